@@ -1,4 +1,9 @@
 {
+  "variables": {
+    "with_x264%": 0,
+    "with_vpx%": 0,
+    "with_jpeg%": 0
+  },
   "targets": [
     {
       "target_name": "screen_recorder",
@@ -7,16 +12,38 @@
       "dependencies": ["<!(node -p \"require('node-addon-api').gyp\")"],
       "cflags!": ["-fno-exceptions"],
       "cflags_cc!": ["-fno-exceptions"],
+      "cflags_cc": ["-std=c++20"],
+      "xcode_settings": {
+        "CLANG_CXX_LANGUAGE_STANDARD": "c++20",
+        "GCC_ENABLE_CPP_EXCEPTIONS": "YES"
+      },
+      "msvs_settings": {
+        "VCCLCompilerTool": {
+          "AdditionalOptions": ["/std:c++20"]
+        }
+      },
       "defines": ["NAPI_DISABLE_CPP_EXCEPTIONS"],
       "conditions": [
         ["OS=='win'", {
-          "libraries": ["-lgdi32"]
+          "libraries": ["-lgdi32", "-lws2_32"]
         }],
         ["OS=='mac'", {
-          "libraries": ["-framework ApplicationServices"]
+          "libraries": ["-framework ApplicationServices", "-lz"]
         }],
         ["OS=='linux'", {
-          "libraries": ["-lX11"]
+          "libraries": ["-lX11", "-lXext", "-lXdamage", "-lz"]
+        }],
+        ["with_x264==1", {
+          "defines": ["SCREEN_RECORDER_HAVE_X264"],
+          "libraries": ["-lx264"]
+        }],
+        ["with_vpx==1", {
+          "defines": ["SCREEN_RECORDER_HAVE_VPX"],
+          "libraries": ["-lvpx"]
+        }],
+        ["with_jpeg==1", {
+          "defines": ["SCREEN_RECORDER_HAVE_JPEG"],
+          "libraries": ["-ljpeg"]
         }]
       ]
     }
@@ -1,3 +1,44 @@
-const screenRecorder= require('bindings')('screen_recorder.node');
+const screenRecorder = require('bindings')('screen_recorder.node');
 
-module.exports = screenRecorder;
\ No newline at end of file
+// Stage descriptors for pipeline(). Stages may be passed called or bare,
+// e.g. pipeline([capture, convert('i420'), sink('out.yuv')]).
+const capture = (options = {}) => ({ type: 'capture', ...options });
+const convert = (format) => ({ type: 'convert', format });
+const scale = (width, height) => ({ type: 'scale', width, height });
+const encode = (codec, options = {}) => ({ type: 'encode', codec, ...options });
+const sink = (path, options = {}) => ({ type: 'sink', path, ...options });
+const replay = (options = {}) => ({ type: 'replay', ...options });
+const timelapse = (options = {}) => ({ type: 'timelapse', ...options });
+
+function pipeline(stages, options = {}) {
+    const descriptors = stages.map((stage) => (typeof stage === 'function' ? stage() : stage));
+    return screenRecorder.createPipeline(descriptors, options);
+}
+
+// A pipeline condensing `interval` seconds of screen time into each frame of
+// an encoded file. "sample" captures once per interval; "blend" and
+// "changed" look at `samples` captures per interval. Without a codec the
+// best one in this build is used.
+function recordTimelapse(path, options = {}) {
+    const { interval = 10, mode = 'changed', samples = 4, outputFps = 30, codec, ...rest } = options;
+    const captureFps = (mode === 'sample' ? 1 : samples) / interval;
+    return pipeline([
+        capture({ fps: captureFps }),
+        timelapse({ interval, mode, outputFps }),
+        encode(codec, { preset: 'archival', fps: outputFps, ...rest }),
+        sink(path),
+    ]);
+}
+
+module.exports = {
+    ...screenRecorder,
+    pipeline,
+    capture,
+    convert,
+    scale,
+    encode,
+    sink,
+    replay,
+    timelapse,
+    recordTimelapse,
+};
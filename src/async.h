@@ -0,0 +1,342 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace screen_recorder {
+
+// Fixed-size pool that resumes coroutines. A pool of one thread acts as a
+// strand: everything scheduled on it runs in order on the same thread, which
+// is what single-threaded resources such as an X connection need.
+class Executor {
+public:
+    explicit Executor(size_t threads) {
+        if (threads == 0) {
+            threads = 1;
+        }
+        for (size_t i = 0; i < threads; i++) {
+            threads_.emplace_back(&Executor::Run, this);
+        }
+    }
+
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    ~Executor() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        ready_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    void Post(std::function<void()> work) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(std::move(work));
+        }
+        ready_.notify_one();
+    }
+
+    void Post(std::coroutine_handle<> handle) {
+        Post([handle] { handle.resume(); });
+    }
+
+    size_t Size() const {
+        return threads_.size();
+    }
+
+    // `co_await executor.Schedule()` continues the current coroutine on the pool.
+    auto Schedule() {
+        struct Awaiter {
+            Executor& executor;
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> handle) { executor.Post(handle); }
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{*this};
+    }
+
+private:
+    void Run() {
+        for (;;) {
+            std::function<void()> work;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                ready_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+                if (queue_.empty()) {
+                    return;
+                }
+                work = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            work();
+        }
+    }
+
+    std::vector<std::thread> threads_;
+    std::deque<std::function<void()>> queue_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    bool stopping_ = false;
+};
+
+// Serializes coroutines on top of a shared Executor without owning a thread.
+// Always held by shared_ptr so a drain in progress keeps the strand alive even
+// if the coroutine it resumes releases the last outside reference.
+class Strand : public std::enable_shared_from_this<Strand> {
+public:
+    explicit Strand(Executor& executor) : executor_(executor) {}
+
+    void Post(std::coroutine_handle<> handle) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(handle);
+            if (draining_) {
+                return;
+            }
+            draining_ = true;
+        }
+        executor_.Post([self = shared_from_this()] { self->Drain(); });
+    }
+
+    auto Schedule() {
+        struct Awaiter {
+            Strand& strand;
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> handle) { strand.Post(handle); }
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{*this};
+    }
+
+private:
+    void Drain() {
+        for (;;) {
+            std::coroutine_handle<> handle;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (queue_.empty()) {
+                    draining_ = false;
+                    return;
+                }
+                handle = queue_.front();
+                queue_.pop_front();
+            }
+            handle.resume();
+        }
+    }
+
+    Executor& executor_;
+    std::deque<std::coroutine_handle<>> queue_;
+    std::mutex mutex_;
+    bool draining_ = false;
+};
+
+template <typename T = void>
+class Task;
+
+namespace detail {
+
+struct FinalAwaiter {
+    bool await_ready() const noexcept { return false; }
+
+    // Symmetric transfer to the awaiter keeps long chains from growing the stack.
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+        std::coroutine_handle<> continuation = handle.promise().continuation;
+        return continuation ? continuation : std::noop_coroutine();
+    }
+
+    void await_resume() const noexcept {}
+};
+
+template <typename T>
+struct TaskPromiseBase {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { error = std::current_exception(); }
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase<T> {
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+    void return_value(T result) { value = std::move(result); }
+
+    T Take() {
+        if (this->error) {
+            std::rethrow_exception(this->error);
+        }
+        return std::move(*value);
+    }
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase<void> {
+    Task<void> get_return_object();
+    void return_void() {}
+
+    void Take() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+}  // namespace detail
+
+// Lazily started coroutine producing a T. Awaiting it starts it and resumes
+// the awaiter, on whatever thread the task finished, once it completes.
+template <typename T>
+class Task {
+public:
+    using promise_type = detail::TaskPromise<T>;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    explicit Task(Handle handle) : handle_(handle) {}
+    Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+        handle_.promise().continuation = awaiter;
+        return handle_;
+    }
+
+    T await_resume() { return handle_.promise().Take(); }
+
+private:
+    Handle handle_;
+};
+
+namespace detail {
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+}  // namespace detail
+
+template <typename T>
+struct Outcome {
+    std::optional<T> value;
+    std::exception_ptr error;
+};
+
+template <>
+struct Outcome<void> {
+    std::exception_ptr error;
+};
+
+// Starts `task` without an awaiter and hands its result or exception to `done`.
+template <typename T, typename Callback>
+detail::DetachedTask Spawn(Task<T> task, Callback done) {
+    Outcome<T> outcome;
+    try {
+        if constexpr (std::is_void_v<T>) {
+            co_await task;
+        } else {
+            outcome.value = co_await task;
+        }
+    } catch (...) {
+        outcome.error = std::current_exception();
+    }
+    done(std::move(outcome));
+}
+
+// Calls `fn(i)` for every i in [0, count) on the calling thread and on
+// whichever pool threads are idle, returning once all calls finished. The
+// caller works through the range itself, so this is safe to use from a pool
+// thread even when every other thread is busy. `fn` must not throw.
+template <typename Fn>
+void ParallelFor(Executor& executor, int count, Fn fn) {
+    struct Shared {
+        std::atomic<int> next{0};
+        int count = 0;
+        int active = 0;
+        std::function<void(int)> fn;
+        std::mutex mutex;
+        std::condition_variable idle;
+    };
+    auto shared = std::make_shared<Shared>();
+    shared->count = count;
+    shared->fn = std::move(fn);
+    // A helper only touches `fn` while registered as active, and the caller
+    // waits for active helpers, so late helpers find the range exhausted.
+    auto work = [](Shared& state) {
+        for (int i = state.next++; i < state.count; i = state.next++) {
+            state.fn(i);
+        }
+    };
+    const int helpers = std::min(static_cast<int>(executor.Size()), count) - 1;
+    for (int i = 0; i < helpers; i++) {
+        executor.Post([shared, work] {
+            {
+                std::lock_guard<std::mutex> lock(shared->mutex);
+                shared->active++;
+            }
+            work(*shared);
+            std::lock_guard<std::mutex> lock(shared->mutex);
+            if (--shared->active == 0) {
+                shared->idle.notify_all();
+            }
+        });
+    }
+    work(*shared);
+    std::unique_lock<std::mutex> lock(shared->mutex);
+    shared->idle.wait(lock, [&] { return shared->active == 0; });
+}
+
+// Runs `fn` on `executor` and resumes the awaiter there with its result.
+template <typename Fn>
+Task<std::invoke_result_t<Fn>> Offload(Executor& executor, Fn fn) {
+    co_await executor.Schedule();
+    co_return fn();
+}
+
+}  // namespace screen_recorder
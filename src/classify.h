@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+namespace screen_recorder {
+
+enum class TileContent : uint8_t {
+    kUniform,
+    // Text, UI and line art: few colours, flat areas and hard edges. Needs a
+    // lossless coding to stay crisp.
+    kSynthetic,
+    // Photos, video and soft gradients: many colours changing in small steps.
+    // Lossy coding is far smaller and the loss is not visible.
+    kNatural,
+};
+
+namespace detail {
+
+// Counts distinct packed colours in a row-major tile, stopping at `limit`.
+inline int CountColours(const uint8_t* data, int stride, int width, int height, int bytes_per_pixel, int limit) {
+    constexpr int kSlots = 512;
+    uint32_t slots[kSlots];
+    bool used[kSlots] = {};
+    int count = 0;
+    for (int y = 0; y < height; y++) {
+        const uint8_t* row = data + static_cast<size_t>(y) * stride;
+        for (int x = 0; x < width; x++) {
+            uint32_t colour = 0;
+            std::memcpy(&colour, row + x * bytes_per_pixel, 3);
+            uint32_t slot = (colour * 0x9E3779B1u) >> 23;
+            while (used[slot] && slots[slot] != colour) {
+                slot = (slot + 1) & (kSlots - 1);
+            }
+            if (!used[slot]) {
+                used[slot] = true;
+                slots[slot] = colour;
+                if (++count >= limit) {
+                    return count;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+}  // namespace detail
+
+// Classifies a tile of at most 16x16 packed 24/32-bit pixels from its colour
+// count and how its neighbouring channel values step: natural content has
+// mostly small non-zero steps, synthetic content mostly none or large ones.
+// The step histogram runs over plain byte arrays so the compiler vectorizes
+// it; the colour count only runs on tiles that pass the cheaper test.
+inline TileContent ClassifyTile(const uint8_t* data, int stride, int width, int height, int bytes_per_pixel) {
+    const int row_bytes = width * bytes_per_pixel;
+    int flat = 0;
+    int small = 0;
+    int large = 0;
+    for (int y = 0; y < height; y++) {
+        const uint8_t* row = data + static_cast<size_t>(y) * stride;
+        for (int i = bytes_per_pixel; i < row_bytes; i++) {
+            const int step = std::abs(row[i] - row[i - bytes_per_pixel]);
+            flat += step == 0;
+            small += step > 0 && step <= 24;
+            large += step > 24;
+        }
+        if (y + 1 < height) {
+            const uint8_t* below = row + stride;
+            for (int i = 0; i < row_bytes; i++) {
+                const int step = std::abs(below[i] - row[i]);
+                flat += step == 0;
+                small += step > 0 && step <= 24;
+                large += step > 24;
+            }
+        }
+    }
+    if (small + large == 0) {
+        return TileContent::kUniform;
+    }
+    if (small <= flat || small <= 2 * large) {
+        return TileContent::kSynthetic;
+    }
+    const int pixels = width * height;
+    const int limit = pixels / 4 > 8 ? pixels / 4 : 8;
+    return detail::CountColours(data, stride, width, height, bytes_per_pixel, limit) >= limit
+        ? TileContent::kNatural : TileContent::kSynthetic;
+}
+
+}  // namespace screen_recorder
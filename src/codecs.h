@@ -0,0 +1,272 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "async.h"
+#include "convert.h"
+#include "cpus.h"
+#include "encoder.h"
+#include "frame.h"
+#include "governor.h"
+#include "pipeline.h"
+#include "tile_codec.h"
+#include "vpx_encoder.h"
+#include "x264_encoder.h"
+
+namespace screen_recorder {
+
+// Encoders other than tiles are optional at build time; see the with_*
+// variables in binding.gyp.
+inline bool IsEncoderAvailable(const std::string& codec) {
+    if (codec == "tiles") {
+        return true;
+    }
+#ifdef SCREEN_RECORDER_HAVE_X264
+    if (codec == "x264" || codec == "h264") {
+        return true;
+    }
+#endif
+#ifdef SCREEN_RECORDER_HAVE_VPX
+    if (codec == "vp8" || codec == "vp9") {
+        return true;
+    }
+#endif
+    return false;
+}
+
+// The codec used when none is named: the first of x264, vp9 and tiles that
+// this build includes.
+inline std::string DefaultEncoder() {
+    for (const char* codec : {"x264", "vp9"}) {
+        if (IsEncoderAvailable(codec)) {
+            return codec;
+        }
+    }
+    return "tiles";
+}
+
+inline std::unique_ptr<VideoEncoder> OpenEncoder(const EncoderOptions& options, int width, int height) {
+    if (options.codec == "tiles") {
+        return std::make_unique<TileEncoder>(options, width, height);
+    }
+#ifdef SCREEN_RECORDER_HAVE_X264
+    if (options.codec == "x264" || options.codec == "h264") {
+        return std::make_unique<X264Encoder>(options, width, height);
+    }
+#endif
+#ifdef SCREEN_RECORDER_HAVE_VPX
+    if (options.codec == "vp8" || options.codec == "vp9") {
+        return std::make_unique<VpxEncoder>(options, width, height);
+    }
+#endif
+    throw std::runtime_error("Encoder '" + options.codec + "' is not available in this build");
+}
+
+// Pipeline stage wrapping an encoder. Converts to I420 on its own if the
+// previous stage did not, and opens the encoder at the first frame's size.
+class EncodeStage : public Stage {
+public:
+    explicit EncodeStage(EncoderOptions options, std::shared_ptr<CpuGovernor> governor = nullptr)
+        : options_(std::move(options)), governor_(std::move(governor)) {}
+
+    std::string Name() const override {
+        return "encode(" + options_.codec + ")";
+    }
+
+    void Process(Frame&& frame, const Emit& emit) override {
+        if (frame.format != PixelFormat::kI420) {
+            Frame converted;
+            ConvertToI420(frame, converted);
+            frame = std::move(converted);
+        }
+        if (encoder_ && (frame.width != width_ || frame.height != height_)) {
+            // The governor resized the capture; raw outputs follow the new size.
+            encoder_->Flush(packets_);
+            Drain(emit);
+            std::lock_guard<std::mutex> lock(mutex_);
+            encoder_.reset();
+        }
+        if (!pinned_) {
+            // Before the encoder starts its threads, so they inherit the mask.
+            if (!PinCurrentThread(options_.cpus)) {
+                throw std::runtime_error("Unable to pin the encoder to the requested CPUs");
+            }
+            pinned_ = true;
+        }
+        if (!encoder_) {
+            auto encoder = OpenEncoder(options_, frame.width, frame.height);
+            std::lock_guard<std::mutex> lock(mutex_);
+            encoder_ = std::move(encoder);
+            width_ = frame.width;
+            height_ = frame.height;
+            speed_ = 0;
+        }
+        const int speed = governor_ ? governor_->Decision().speed : 0;
+        if (speed != speed_) {
+            encoder_->SetSpeed(speed);
+            speed_ = speed;
+        }
+        encoder_->Encode(frame, packets_);
+        Drain(emit);
+    }
+
+    void Flush(const Emit& emit) override {
+        if (encoder_) {
+            encoder_->Flush(packets_);
+            Drain(emit);
+        }
+    }
+
+    void AddMetrics(Metrics& metrics) const override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (encoder_) {
+            encoder_->AddMetrics(metrics);
+        }
+    }
+
+private:
+    void Drain(const Emit& emit) {
+        for (Frame& packet : packets_) {
+            emit(std::move(packet));
+        }
+        packets_.clear();
+    }
+
+    EncoderOptions options_;
+    std::shared_ptr<CpuGovernor> governor_;
+    // Guards swapping encoder_ against the stats thread reading it.
+    mutable std::mutex mutex_;
+    std::unique_ptr<VideoEncoder> encoder_;
+    int width_ = 0;
+    int height_ = 0;
+    int speed_ = 0;
+    bool pinned_ = false;
+    std::vector<Frame> packets_;
+};
+
+// Coroutine front end to an encoder. Each submission takes a ticket when it
+// is made and the encoder runs them in ticket order on a strand of the
+// shared worker pool, while conversion to I420 runs on the pool beforehand,
+// so overlapping submissions convert in parallel but never reach the encoder
+// out of order. Must be owned by a shared_ptr that outlives the submissions.
+class AsyncEncoder {
+public:
+    AsyncEncoder(Executor& workers, EncoderOptions options)
+        : workers_(workers), strand_(std::make_shared<Strand>(workers)), options_(std::move(options)) {}
+
+    // Takes the next place in line; every ticket must reach Submit or Flush.
+    uint64_t Reserve() {
+        return tickets_++;
+    }
+
+    Task<std::vector<Frame>> Submit(Frame frame, uint64_t ticket) {
+        std::exception_ptr error;
+        if (frame.format != PixelFormat::kI420) {
+            co_await workers_.Schedule();
+            try {
+                Frame converted;
+                ConvertToI420(frame, converted);
+                frame = std::move(converted);
+            } catch (...) {
+                error = std::current_exception();
+            }
+        }
+        co_await Turn(ticket);
+        TurnDone done{*this};
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        if (!encoder_) {
+            encoder_ = OpenEncoder(options_, frame.width, frame.height);
+            opened_ = encoder_.get();
+        }
+        std::vector<Frame> packets;
+        encoder_->Encode(frame, packets);
+        co_return packets;
+    }
+
+    // Gives up a ticket whose frame never arrived.
+    Task<void> Skip(uint64_t ticket) {
+        co_await Turn(ticket);
+        TurnDone done{*this};
+    }
+
+    Task<std::vector<Frame>> Flush(uint64_t ticket) {
+        co_await Turn(ticket);
+        TurnDone done{*this};
+        std::vector<Frame> packets;
+        if (encoder_) {
+            encoder_->Flush(packets);
+        }
+        co_return packets;
+    }
+
+    Metrics GetMetrics() const {
+        Metrics metrics;
+        if (const VideoEncoder* encoder = opened_) {
+            encoder->AddMetrics(metrics);
+        }
+        return metrics;
+    }
+
+private:
+    // Resumes on the strand once every earlier ticket is done.
+    struct TurnAwaiter {
+        AsyncEncoder& encoder;
+        uint64_t ticket;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            std::unique_lock<std::mutex> lock(encoder.turn_mutex_);
+            if (ticket != encoder.next_ticket_) {
+                encoder.waiting_.emplace(ticket, handle);
+                return;
+            }
+            lock.unlock();
+            encoder.strand_->Post(handle);
+        }
+        void await_resume() const noexcept {}
+    };
+
+    TurnAwaiter Turn(uint64_t ticket) {
+        return TurnAwaiter{*this, ticket};
+    }
+
+    // Ends the current turn however the submission leaves the strand.
+    struct TurnDone {
+        AsyncEncoder& encoder;
+        ~TurnDone() {
+            std::coroutine_handle<> next;
+            {
+                std::lock_guard<std::mutex> lock(encoder.turn_mutex_);
+                auto it = encoder.waiting_.find(++encoder.next_ticket_);
+                if (it == encoder.waiting_.end()) {
+                    return;
+                }
+                next = it->second;
+                encoder.waiting_.erase(it);
+            }
+            encoder.strand_->Post(next);
+        }
+    };
+
+    Executor& workers_;
+    std::shared_ptr<Strand> strand_;
+    EncoderOptions options_;
+    std::atomic<uint64_t> tickets_{0};
+    std::mutex turn_mutex_;
+    uint64_t next_ticket_ = 0;
+    std::map<uint64_t, std::coroutine_handle<>> waiting_;
+    std::unique_ptr<VideoEncoder> encoder_;
+    std::atomic<const VideoEncoder*> opened_{nullptr};
+};
+
+}  // namespace screen_recorder
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "frame.h"
+
+namespace screen_recorder {
+
+namespace detail {
+
+struct ChannelOrder {
+    int r;
+    int g;
+    int b;
+};
+
+inline ChannelOrder GetChannelOrder(PixelFormat format) {
+    if (format == PixelFormat::kRGB24) {
+        return {0, 1, 2};
+    }
+    return {2, 1, 0};
+}
+
+// BT.601 limited range, 8-bit fixed point.
+inline uint8_t RgbToY(int r, int g, int b) {
+    return static_cast<uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+inline uint8_t RgbToU(int r, int g, int b) {
+    return static_cast<uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+}
+
+inline uint8_t RgbToV(int r, int g, int b) {
+    return static_cast<uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+// Bilinear resample of one interleaved plane using 16.16 fixed point.
+inline void ScalePlane(const uint8_t* src, int src_width, int src_height, int src_stride,
+                       uint8_t* dst, int dst_width, int dst_height, int dst_stride,
+                       int channels) {
+    const int64_t x_step = (static_cast<int64_t>(src_width) << 16) / dst_width;
+    const int64_t y_step = (static_cast<int64_t>(src_height) << 16) / dst_height;
+
+    std::vector<int> x0(dst_width), x1(dst_width), fx(dst_width);
+    for (int dx = 0; dx < dst_width; dx++) {
+        int64_t sx = std::max<int64_t>(0, dx * x_step + x_step / 2 - 0x8000);
+        x0[dx] = std::min(static_cast<int>(sx >> 16), src_width - 1);
+        x1[dx] = std::min(x0[dx] + 1, src_width - 1);
+        fx[dx] = static_cast<int>((sx >> 8) & 0xff);
+    }
+
+    for (int dy = 0; dy < dst_height; dy++) {
+        int64_t sy = std::max<int64_t>(0, dy * y_step + y_step / 2 - 0x8000);
+        int y0 = std::min(static_cast<int>(sy >> 16), src_height - 1);
+        int y1 = std::min(y0 + 1, src_height - 1);
+        int fy = static_cast<int>((sy >> 8) & 0xff);
+        const uint8_t* top = src + static_cast<size_t>(y0) * src_stride;
+        const uint8_t* bottom = src + static_cast<size_t>(y1) * src_stride;
+        uint8_t* out = dst + static_cast<size_t>(dy) * dst_stride;
+        for (int dx = 0; dx < dst_width; dx++) {
+            const int a = x0[dx] * channels;
+            const int b = x1[dx] * channels;
+            for (int c = 0; c < channels; c++) {
+                int t = top[a + c] * (256 - fx[dx]) + top[b + c] * fx[dx];
+                int u = bottom[a + c] * (256 - fx[dx]) + bottom[b + c] * fx[dx];
+                out[dx * channels + c] = static_cast<uint8_t>((t * (256 - fy) + u * fy + 0x8000) >> 16);
+            }
+        }
+    }
+}
+
+}  // namespace detail
+
+// Converts any packed capture format to I420. I420 input is copied as-is.
+inline void ConvertToI420(const Frame& src, Frame& dst) {
+    if (src.format == PixelFormat::kI420) {
+        dst = src;
+        return;
+    }
+
+    const int width = src.width;
+    const int height = src.height;
+    const int bpp = BytesPerPixel(src.format);
+    const detail::ChannelOrder order = detail::GetChannelOrder(src.format);
+
+    dst.format = PixelFormat::kI420;
+    dst.width = width;
+    dst.height = height;
+    dst.stride = width;
+    dst.timestamp_us = src.timestamp_us;
+    dst.sequence = src.sequence;
+    dst.data.resize(I420Size(width, height));
+    I420Planes planes = GetI420Planes(dst.data.data(), width, height);
+
+    for (int y = 0; y < height; y += 2) {
+        const bool has_second_row = y + 1 < height;
+        const uint8_t* row0 = src.data.data() + static_cast<size_t>(y) * src.stride;
+        const uint8_t* row1 = has_second_row ? row0 + src.stride : row0;
+        uint8_t* y0 = planes.y + static_cast<size_t>(y) * planes.y_stride;
+        uint8_t* y1 = y0 + planes.y_stride;
+        uint8_t* u = planes.u + static_cast<size_t>(y / 2) * planes.uv_stride;
+        uint8_t* v = planes.v + static_cast<size_t>(y / 2) * planes.uv_stride;
+
+        for (int x = 0; x < width; x += 2) {
+            const int xs[2] = {x, x + 1 < width ? x + 1 : x};
+            int r_sum = 0, g_sum = 0, b_sum = 0;
+            for (int i = 0; i < 2; i++) {
+                const uint8_t* p0 = row0 + xs[i] * bpp;
+                const uint8_t* p1 = row1 + xs[i] * bpp;
+                r_sum += p0[order.r] + p1[order.r];
+                g_sum += p0[order.g] + p1[order.g];
+                b_sum += p0[order.b] + p1[order.b];
+                if (i == 0 || xs[1] != xs[0]) {
+                    y0[xs[i]] = detail::RgbToY(p0[order.r], p0[order.g], p0[order.b]);
+                    if (has_second_row) {
+                        y1[xs[i]] = detail::RgbToY(p1[order.r], p1[order.g], p1[order.b]);
+                    }
+                }
+            }
+            u[x / 2] = detail::RgbToU((r_sum + 2) >> 2, (g_sum + 2) >> 2, (b_sum + 2) >> 2);
+            v[x / 2] = detail::RgbToV((r_sum + 2) >> 2, (g_sum + 2) >> 2, (b_sum + 2) >> 2);
+        }
+    }
+}
+
+// Repacks any packed capture format as tightly strided RGB24.
+inline void ConvertToRGB24(const Frame& src, Frame& dst) {
+    dst.format = PixelFormat::kRGB24;
+    dst.width = src.width;
+    dst.height = src.height;
+    dst.stride = src.width * 3;
+    dst.timestamp_us = src.timestamp_us;
+    dst.sequence = src.sequence;
+    dst.data.resize(static_cast<size_t>(dst.stride) * src.height);
+
+    const int bpp = BytesPerPixel(src.format);
+    const detail::ChannelOrder order = detail::GetChannelOrder(src.format);
+    for (int y = 0; y < src.height; y++) {
+        const uint8_t* in = src.data.data() + static_cast<size_t>(y) * src.stride;
+        uint8_t* out = dst.data.data() + static_cast<size_t>(y) * dst.stride;
+        if (src.format == PixelFormat::kRGB24) {
+            std::copy(in, in + dst.stride, out);
+            continue;
+        }
+        for (int x = 0; x < src.width; x++, in += bpp, out += 3) {
+            out[0] = in[order.r];
+            out[1] = in[order.g];
+            out[2] = in[order.b];
+        }
+    }
+}
+
+// Copies a rectangle of a packed frame into a tightly strided frame of the
+// same format. The rectangle must lie within the frame.
+inline void CropFrame(const Frame& src, int x, int y, int width, int height, Frame& dst) {
+    const int bpp = BytesPerPixel(src.format);
+    dst.format = src.format;
+    dst.width = width;
+    dst.height = height;
+    dst.stride = width * bpp;
+    dst.timestamp_us = src.timestamp_us;
+    dst.sequence = src.sequence;
+    dst.data.resize(static_cast<size_t>(dst.stride) * height);
+    for (int row = 0; row < height; row++) {
+        const uint8_t* in = src.data.data() + static_cast<size_t>(y + row) * src.stride + static_cast<size_t>(x) * bpp;
+        std::copy(in, in + dst.stride, dst.data.data() + static_cast<size_t>(row) * dst.stride);
+    }
+}
+
+inline void ScaleFrame(const Frame& src, int width, int height, Frame& dst) {
+    dst.format = src.format;
+    dst.width = width;
+    dst.height = height;
+    dst.timestamp_us = src.timestamp_us;
+    dst.sequence = src.sequence;
+
+    if (src.format == PixelFormat::kI420) {
+        dst.stride = width;
+        dst.data.resize(I420Size(width, height));
+        I420Planes in = GetI420Planes(const_cast<uint8_t*>(src.data.data()), src.width, src.height);
+        I420Planes out = GetI420Planes(dst.data.data(), width, height);
+        detail::ScalePlane(in.y, src.width, src.height, in.y_stride,
+                           out.y, width, height, out.y_stride, 1);
+        detail::ScalePlane(in.u, ChromaWidth(src.width), ChromaHeight(src.height), in.uv_stride,
+                           out.u, ChromaWidth(width), ChromaHeight(height), out.uv_stride, 1);
+        detail::ScalePlane(in.v, ChromaWidth(src.width), ChromaHeight(src.height), in.uv_stride,
+                           out.v, ChromaWidth(width), ChromaHeight(height), out.uv_stride, 1);
+        return;
+    }
+
+    const int bpp = BytesPerPixel(src.format);
+    dst.stride = width * bpp;
+    dst.data.resize(static_cast<size_t>(dst.stride) * height);
+    detail::ScalePlane(src.data.data(), src.width, src.height, src.stride,
+                       dst.data.data(), width, height, dst.stride, bpp);
+}
+
+}  // namespace screen_recorder
@@ -0,0 +1,200 @@
+#pragma once
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+// winsock2.h has to come before windows.h, and the RFB server needs it.
+#include <winsock2.h>
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace screen_recorder {
+
+namespace detail {
+
+// Cores a cgroup CPU quota allows, or 0 when unlimited. cgroup v2 limits
+// every level of the hierarchy, so the tightest `cpu.max` from the process's
+// cgroup up to the root applies; v1 only has the one cpu controller file.
+// `self` and `root` stand in for /proc/self/cgroup and /sys/fs/cgroup.
+inline unsigned CgroupCpuLimit(const std::string& self = "/proc/self/cgroup",
+                               const std::string& root = "/sys/fs/cgroup") {
+#ifdef __linux__
+    double limit = 0;
+    auto apply = [&limit](double quota, double period) {
+        if (quota > 0 && period > 0 && (limit == 0 || quota / period < limit)) {
+            limit = quota / period;
+        }
+    };
+
+    std::ifstream cgroups(self);
+    std::string line;
+    while (std::getline(cgroups, line)) {
+        if (line.compare(0, 3, "0::") != 0) {
+            continue;
+        }
+        std::string path = line.substr(3);
+        while (true) {
+            std::ifstream file(root + (path == "/" ? std::string() : path) + "/cpu.max");
+            std::string quota;
+            double period = 0;
+            if (file >> quota >> period && quota != "max") {
+                apply(std::atof(quota.c_str()), period);
+            }
+            if (path.empty() || path == "/") {
+                break;
+            }
+            path = path.substr(0, path.find_last_of('/'));
+        }
+    }
+
+    std::ifstream quota_file(root + "/cpu/cpu.cfs_quota_us");
+    std::ifstream period_file(root + "/cpu/cpu.cfs_period_us");
+    double quota = 0;
+    double period = 0;
+    if (quota_file >> quota && period_file >> period) {
+        apply(quota, period);
+    }
+    return limit > 0 ? std::max(1u, static_cast<unsigned>(std::ceil(limit))) : 0;
+#else
+    return 0;
+#endif
+}
+
+}  // namespace detail
+
+// CPUs this process may actually run on: the affinity mask, further capped
+// by a cgroup CPU quota. Inside a container hardware_concurrency() reports
+// every host core, and pools sized from it oversubscribe the quota.
+inline unsigned AvailableCpus() {
+    static const unsigned cpus = [] {
+        unsigned count = std::max(1u, std::thread::hardware_concurrency());
+#if defined(__linux__)
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            count = std::max(1, CPU_COUNT(&set));
+        }
+#elif defined(_WIN32)
+        DWORD_PTR process = 0;
+        DWORD_PTR system = 0;
+        if (GetProcessAffinityMask(GetCurrentProcess(), &process, &system) && process != 0) {
+            count = 0;
+            for (; process != 0; process &= process - 1) {
+                count++;
+            }
+        }
+#endif
+        unsigned limit = detail::CgroupCpuLimit();
+        return limit > 0 ? std::min(count, limit) : count;
+    }();
+    return cpus;
+}
+
+#if defined(__linux__) || defined(_WIN32)
+constexpr bool kThreadAffinityAvailable = true;
+#else
+// macOS only has affinity hints, not pinning.
+constexpr bool kThreadAffinityAvailable = false;
+#endif
+
+// Restricts the calling thread to `cpus`; threads it starts afterwards
+// inherit the mask on Linux. False when the set is rejected or the platform
+// cannot pin. An empty set leaves the thread alone.
+inline bool PinCurrentThread(const std::vector<int>& cpus) {
+    if (cpus.empty()) {
+        return true;
+    }
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE) {
+            return false;
+        }
+        CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+    DWORD_PTR mask = 0;
+    for (int cpu : cpus) {
+        if (cpu < 0 || cpu >= static_cast<int>(sizeof(mask) * 8)) {
+            return false;
+        }
+        mask |= static_cast<DWORD_PTR>(1) << cpu;
+    }
+    return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+    return false;
+#endif
+}
+
+enum class ThreadPriority {
+    kNormal,
+    // Elevated but still time-shared: a negative nice value on Linux.
+    kHigh,
+    // Real-time policies, which preempt every normal thread.
+    kFifo,
+    kRoundRobin,
+};
+
+// Raises the calling thread's scheduling priority as far as the process is
+// permitted toward `priority`, falling back step by step (real-time, then
+// nice -10, then the nice floor RLIMIT_NICE allows) instead of failing.
+// Returns the policy now in effect: "fifo", "rr", "nice", "timeCritical",
+// "highest", "userInteractive" or "normal". Threads the caller starts later
+// do not inherit a real-time policy.
+inline const char* RaiseCurrentThreadPriority(ThreadPriority priority) {
+    if (priority == ThreadPriority::kNormal) {
+        return "normal";
+    }
+#if defined(__linux__)
+    if (priority == ThreadPriority::kFifo || priority == ThreadPriority::kRoundRobin) {
+        const int policy = priority == ThreadPriority::kFifo ? SCHED_FIFO : SCHED_RR;
+        // A low real-time priority is enough to preempt normal threads and
+        // stays below kernel interrupt threads (50).
+        sched_param param = {};
+        param.sched_priority = std::max(sched_get_priority_min(policy), 10);
+        if (sched_setscheduler(0, policy | SCHED_RESET_ON_FORK, &param) == 0) {
+            return policy == SCHED_FIFO ? "fifo" : "rr";
+        }
+    }
+    const id_t thread = static_cast<id_t>(syscall(SYS_gettid));
+    if (setpriority(PRIO_PROCESS, thread, -10) == 0) {
+        return "nice";
+    }
+    rlimit limit;
+    if (getrlimit(RLIMIT_NICE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur > 20 &&
+        setpriority(PRIO_PROCESS, thread, 20 - static_cast<int>(limit.rlim_cur)) == 0) {
+        return "nice";
+    }
+    return "normal";
+#elif defined(_WIN32)
+    const bool realtime = priority != ThreadPriority::kHigh;
+    if (SetThreadPriority(GetCurrentThread(), realtime ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_HIGHEST)) {
+        return realtime ? "timeCritical" : "highest";
+    }
+    return "normal";
+#elif defined(__APPLE__)
+    return pthread_set_qos_class_self_np(QOS_CLASS_USER_INTERACTIVE, 0) == 0 ? "userInteractive" : "normal";
+#else
+    return "normal";
+#endif
+}
+
+}  // namespace screen_recorder
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "frame.h"
+
+namespace screen_recorder {
+
+struct EncoderOptions {
+    // "tiles" is always built; the others only when enabled in binding.gyp.
+    std::string codec = "tiles";
+    // "lowLatency" for live streaming, "archival" for recordings.
+    std::string preset = "lowLatency";
+    int bitrate_kbps = 0;
+    double fps = 30;
+    int threads = 0;
+    int keyframe_interval = 0;
+    bool intra_refresh = true;
+    // libvpx only: speed/quality trade-off and "realtime", "good" or "best";
+    // both default from the preset.
+    std::optional<int> cpu_used;
+    std::string deadline;
+    // tiles only: content cache budget; 0 picks the codec default.
+    size_t cache_bytes = 0;
+    // tiles only: frames between cache resets, the stream's random access
+    // points; 0 picks the codec default. `keyframe_interval` then spaces
+    // full-picture refreshes that keep the cache.
+    int cache_reset_interval = 0;
+    // CPUs the encoding thread, and the threads the encoder starts, run on;
+    // empty for no pinning.
+    std::vector<int> cpus;
+};
+
+// Turns I420 frames into encoded frames. Encode() may hold frames back
+// (lookahead, reordering); Flush() drains them at the end of a stream.
+class VideoEncoder {
+public:
+    virtual ~VideoEncoder() = default;
+    virtual std::string Name() const = 0;
+    virtual void Encode(const Frame& frame, std::vector<Frame>& packets) = 0;
+    virtual void Flush(std::vector<Frame>& packets) = 0;
+    // May be called from any thread while another one encodes.
+    virtual void AddMetrics(Metrics& metrics) const {}
+    // Trades quality for `steps` steps of speed over the configured preset;
+    // 0 restores it. Called between frames.
+    virtual void SetSpeed(int steps) {}
+};
+
+}  // namespace screen_recorder
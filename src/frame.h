@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "frame_allocator.h"
+
+namespace screen_recorder {
+
+enum class PixelFormat {
+    kRGB24,
+    kBGR24,
+    kBGRA,
+    kI420,
+    // Compressed bitstreams travel through the same queues as pictures.
+    kH264,
+    kVP8,
+    kVP9,
+    kTiles,
+};
+
+// Large buffers are backed by huge pages; see FrameAllocator.
+using FrameBuffer = std::vector<uint8_t, FrameAllocator<uint8_t>>;
+
+// Named counters a stage or encoder reports beyond frame counts and timing.
+using Metrics = std::vector<std::pair<std::string, double>>;
+
+// A single picture moving through the native pipeline. Packed formats use
+// `stride` bytes per row; I420 stores the Y, U and V planes back to back with
+// the luma plane `stride` bytes wide and chroma planes half that (rounded up).
+// Encoded frames hold one access unit, with `timestamp_us` as the presentation
+// time and `decode_timestamp_us` as the decode time. `keyframe` marks frames
+// that decode on their own (IDR frames for H.264), the only safe places to
+// start or cut a stream. `recovery_point` marks intra-refresh frames a decoder
+// may start from, showing a whole picture only once the refresh completes.
+struct Frame {
+    PixelFormat format = PixelFormat::kRGB24;
+    int width = 0;
+    int height = 0;
+    int stride = 0;
+    int64_t timestamp_us = 0;
+    int64_t decode_timestamp_us = 0;
+    uint64_t sequence = 0;
+    bool keyframe = false;
+    bool recovery_point = false;
+    FrameBuffer data;
+};
+
+inline bool IsEncoded(PixelFormat format) {
+    return format == PixelFormat::kH264 || format == PixelFormat::kVP8 || format == PixelFormat::kVP9 ||
+           format == PixelFormat::kTiles;
+}
+
+inline int BytesPerPixel(PixelFormat format) {
+    switch (format) {
+        case PixelFormat::kRGB24:
+        case PixelFormat::kBGR24:
+            return 3;
+        case PixelFormat::kBGRA:
+            return 4;
+        case PixelFormat::kI420:
+            return 1;
+        case PixelFormat::kH264:
+        case PixelFormat::kVP8:
+        case PixelFormat::kVP9:
+        case PixelFormat::kTiles:
+            return 0;
+    }
+    return 0;
+}
+
+inline const char* PixelFormatName(PixelFormat format) {
+    switch (format) {
+        case PixelFormat::kRGB24: return "rgb24";
+        case PixelFormat::kBGR24: return "bgr24";
+        case PixelFormat::kBGRA: return "bgra";
+        case PixelFormat::kI420: return "i420";
+        case PixelFormat::kH264: return "h264";
+        case PixelFormat::kVP8: return "vp8";
+        case PixelFormat::kVP9: return "vp9";
+        case PixelFormat::kTiles: return "tiles";
+    }
+    return "unknown";
+}
+
+inline int ChromaWidth(int width) { return (width + 1) / 2; }
+inline int ChromaHeight(int height) { return (height + 1) / 2; }
+
+inline size_t I420Size(int width, int height) {
+    return static_cast<size_t>(width) * height +
+           2 * static_cast<size_t>(ChromaWidth(width)) * ChromaHeight(height);
+}
+
+struct I420Planes {
+    uint8_t* y;
+    uint8_t* u;
+    uint8_t* v;
+    int y_stride;
+    int uv_stride;
+};
+
+inline I420Planes GetI420Planes(uint8_t* data, int width, int height) {
+    I420Planes planes;
+    planes.y_stride = width;
+    planes.uv_stride = ChromaWidth(width);
+    planes.y = data;
+    planes.u = planes.y + static_cast<size_t>(width) * height;
+    planes.v = planes.u + static_cast<size_t>(planes.uv_stride) * ChromaHeight(height);
+    return planes;
+}
+
+}  // namespace screen_recorder
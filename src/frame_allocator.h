@@ -0,0 +1,196 @@
+#pragma once
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "memory_budget.h"
+
+namespace screen_recorder {
+
+struct HugePageStats {
+    // Mappings served from the hugetlbfs pool (MAP_HUGETLB).
+    uint64_t explicit_mappings = 0;
+    // Mappings advised to transparent huge pages instead.
+    uint64_t transparent_mappings = 0;
+    // Allocations served from a previously freed mapping.
+    uint64_t reused = 0;
+};
+
+namespace detail {
+
+// Recycles large frame buffers as whole 2 MiB-aligned mappings. A 4K BGRA
+// frame spans about 8000 4 KiB pages, so converters streaming through it
+// miss the TLB constantly; on 2 MiB pages it spans 16. Mappings come from
+// MAP_HUGETLB when the administrator reserved huge pages, else they are
+// advised for transparent huge pages. Keeping freed mappings avoids paying
+// the mmap and page-fault cost again for every frame.
+class HugePagePool {
+public:
+    static constexpr size_t kPageSize = 2 << 20;
+    // Idle mappings kept for reuse, oldest dropped first: enough for the
+    // frames a few pipelines keep in flight.
+    static constexpr size_t kMaxIdle = 16;
+    static constexpr size_t kMaxIdleBytes = 256 << 20;
+
+    static HugePagePool& Instance() {
+        // Leaked so buffers freed during static destruction stay valid.
+        static HugePagePool* pool = new HugePagePool();
+        return *pool;
+    }
+
+    void* Allocate(size_t bytes) {
+        const size_t length = Round(bytes);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (size_t i = 0; i < idle_.size(); i++) {
+                if (idle_[i].first == length) {
+                    void* memory = idle_[i].second;
+                    idle_.erase(idle_.begin() + i);
+                    idle_bytes_ -= length;
+                    GlobalMemoryBudget().Release(MemoryPool::kFramePool, length);
+                    reused_++;
+                    return memory;
+                }
+            }
+        }
+#ifdef __linux__
+        void* memory = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (memory != MAP_FAILED) {
+            explicit_++;
+            return memory;
+        }
+        // Over-allocate by a page so the mapping can be trimmed to 2 MiB
+        // alignment, which transparent huge pages need.
+        void* raw = mmap(nullptr, length + kPageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        const uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+        const uintptr_t aligned = (start + kPageSize - 1) & ~(kPageSize - 1);
+        if (aligned > start) {
+            munmap(raw, aligned - start);
+        }
+        if (const size_t tail = start + kPageSize - aligned) {
+            munmap(reinterpret_cast<void*>(aligned + length), tail);
+        }
+        memory = reinterpret_cast<void*>(aligned);
+        madvise(memory, length, MADV_HUGEPAGE);
+        transparent_++;
+        return memory;
+#else
+        return ::operator new(length);
+#endif
+    }
+
+    void Free(void* memory, size_t bytes) {
+        std::vector<std::pair<size_t, void*>> released;
+        const size_t length = Round(bytes);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (length <= kMaxIdleBytes && GlobalMemoryBudget().TryCharge(MemoryPool::kFramePool, length)) {
+                idle_.emplace_back(length, memory);
+                idle_bytes_ += length;
+                while (idle_.size() > kMaxIdle || idle_bytes_ > kMaxIdleBytes) {
+                    released.push_back(idle_.front());
+                    idle_bytes_ -= idle_.front().first;
+                    GlobalMemoryBudget().Release(MemoryPool::kFramePool, idle_.front().first);
+                    idle_.erase(idle_.begin());
+                }
+            } else {
+                released.emplace_back(length, memory);
+            }
+        }
+        for (const auto& [size, mapping] : released) {
+#ifdef __linux__
+            munmap(mapping, size);
+#else
+            ::operator delete(mapping);
+#endif
+        }
+    }
+
+    HugePageStats Stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        HugePageStats stats;
+        stats.explicit_mappings = explicit_;
+        stats.transparent_mappings = transparent_;
+        stats.reused = reused_;
+        return stats;
+    }
+
+private:
+    HugePagePool() = default;
+
+    static size_t Round(size_t bytes) {
+        return (bytes + kPageSize - 1) & ~(kPageSize - 1);
+    }
+
+    mutable std::mutex mutex_;
+    std::vector<std::pair<size_t, void*>> idle_;
+    size_t idle_bytes_ = 0;
+    uint64_t explicit_ = 0;
+    uint64_t transparent_ = 0;
+    uint64_t reused_ = 0;
+};
+
+}  // namespace detail
+
+// Frame buffers of at least kThreshold bytes (1440p RGB and up) come from
+// the huge page pool; smaller ones, and everything off Linux, from the heap.
+// Stateless, so buffers move and swap freely between frames.
+template <typename T>
+struct FrameAllocator {
+    using value_type = T;
+
+    static constexpr size_t kThreshold = 8 << 20;
+
+    FrameAllocator() = default;
+    template <typename U>
+    FrameAllocator(const FrameAllocator<U>&) {}
+
+    T* allocate(size_t count) {
+        const size_t bytes = count * sizeof(T);
+#ifdef __linux__
+        if (bytes >= kThreshold) {
+            return static_cast<T*>(detail::HugePagePool::Instance().Allocate(bytes));
+        }
+#endif
+        return static_cast<T*>(::operator new(bytes));
+    }
+
+    void deallocate(T* pointer, size_t count) {
+        const size_t bytes = count * sizeof(T);
+#ifdef __linux__
+        if (bytes >= kThreshold) {
+            detail::HugePagePool::Instance().Free(pointer, bytes);
+            return;
+        }
+#endif
+        ::operator delete(pointer);
+    }
+
+    template <typename U>
+    bool operator==(const FrameAllocator<U>&) const {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const FrameAllocator<U>&) const {
+        return false;
+    }
+};
+
+inline HugePageStats GetHugePageStats() {
+    return detail::HugePagePool::Instance().Stats();
+}
+
+}  // namespace screen_recorder
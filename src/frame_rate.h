@@ -0,0 +1,72 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "frame.h"
+#include "hash.h"
+
+namespace screen_recorder {
+
+// Variable capture rate driven by screen activity. Each captured frame is
+// compared with the previous one row by row; a frame that changed raises
+// the rate at once, to at least the share of the range matching the damaged
+// share of rows (a quarter of the screen changing reaches the ceiling) and
+// at least double the current rate. While the screen is static the rate
+// halves every `half_life` seconds down to the floor.
+class AdaptiveRate {
+public:
+    AdaptiveRate(double floor_fps, double ceiling_fps, double half_life = 0.5)
+        : floor_(std::min(floor_fps, ceiling_fps)), ceiling_(ceiling_fps), half_life_(half_life), fps_(ceiling_fps) {}
+
+    // Updates the rate from a newly captured frame and returns the delay
+    // until the next capture.
+    std::chrono::steady_clock::duration Update(const Frame& frame) {
+        const double damage = Damage(frame);
+        if (damage > 0) {
+            fps_ = std::min(ceiling_, std::max({fps_ * 2, floor_ + (ceiling_ - floor_) * std::min(1.0, damage * 4)}));
+        } else {
+            fps_ = std::max(floor_, fps_ * std::exp2(-1.0 / (fps_ * half_life_)));
+        }
+        return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(1.0 / fps_));
+    }
+
+    double Fps() const {
+        return fps_;
+    }
+
+private:
+    // Share of rows that differ from the previous frame; 1 after a resize.
+    double Damage(const Frame& frame) {
+        const int rows = IsEncoded(frame.format) ? 0 : frame.height;
+        const size_t row_bytes = frame.format == PixelFormat::kI420
+            ? static_cast<size_t>(frame.width)
+            : static_cast<size_t>(frame.width) * BytesPerPixel(frame.format);
+        bool resized = rows != static_cast<int>(row_hashes_.size()) || frame.width != width_;
+        row_hashes_.resize(rows);
+        width_ = frame.width;
+        int changed = 0;
+        for (int y = 0; y < rows; y++) {
+            const uint64_t hash = HashBytes(frame.data.data() + static_cast<size_t>(y) * frame.stride, row_bytes);
+            changed += hash != row_hashes_[y];
+            row_hashes_[y] = hash;
+        }
+        if (resized) {
+            return 1;
+        }
+        return rows > 0 ? static_cast<double>(changed) / rows : 0;
+    }
+
+    double floor_;
+    double ceiling_;
+    double half_life_;
+    double fps_;
+    int width_ = -1;
+    std::vector<uint64_t> row_hashes_;
+};
+
+}  // namespace screen_recorder
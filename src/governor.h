@@ -0,0 +1,148 @@
+#pragma once
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+// winsock2.h has to come before windows.h, and the RFB server needs it.
+#include <winsock2.h>
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "frame.h"
+
+namespace screen_recorder {
+
+// CPU time consumed so far by the calling thread.
+inline int64_t ThreadCpuTimeNs() {
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+        return 0;
+    }
+    auto ticks = [](const FILETIME& time) {
+        return (static_cast<int64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+    };
+    return (ticks(kernel) + ticks(user)) * 100;
+#else
+    timespec now;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) != 0) {
+        return 0;
+    }
+    return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+#endif
+}
+
+// What the governor currently asks of the pipeline. Capture divides its rate
+// by `fps_scale` and its size by `resolution_scale`; encoders trade quality
+// for `speed` extra steps of speed.
+struct GovernorDecision {
+    double fps_scale = 1;
+    double resolution_scale = 1;
+    int speed = 0;
+};
+
+struct GovernorOptions {
+    // CPU budget in cores, e.g. 0.15 for 15% of one core.
+    double budget = 1;
+    // Resolution steps change the frame size mid-stream, which only raw
+    // outputs can follow.
+    bool allow_resize = false;
+};
+
+// Keeps a pipeline's own CPU use under a budget. Stage threads report the
+// thread CPU time each frame costs; once a second the governor compares
+// the total with the wall time and moves one step along a ladder that first
+// lowers the frame rate, then the resolution, then encoder effort. It steps
+// back once the load has stayed under 60% of the budget for three seconds.
+class CpuGovernor {
+public:
+    explicit CpuGovernor(const GovernorOptions& options) : options_(options) {
+        ladder_.push_back({});
+        for (double fps_scale : {0.75, 0.5, 0.35, 0.25}) {
+            ladder_.push_back({fps_scale, 1, 0});
+        }
+        if (options.allow_resize) {
+            for (double resolution_scale : {0.75, 0.5}) {
+                ladder_.push_back({0.25, resolution_scale, 0});
+            }
+        }
+        for (int speed : {1, 2}) {
+            ladder_.push_back({0.25, ladder_.back().resolution_scale, speed});
+        }
+    }
+
+    void AddCpuTime(int64_t ns) {
+        cpu_ns_ += ns;
+    }
+
+    // Called once per captured frame; re-evaluates when a window has passed.
+    void Tick() {
+        Tick(std::chrono::steady_clock::now());
+    }
+
+    void Tick(std::chrono::steady_clock::time_point now) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (window_start_ == std::chrono::steady_clock::time_point()) {
+            window_start_ = now;
+            cpu_ns_ = 0;
+            return;
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - window_start_).count();
+        if (elapsed < kWindowNs) {
+            return;
+        }
+        load_ = static_cast<double>(cpu_ns_.exchange(0)) / elapsed;
+        window_start_ = now;
+        if (load_ > options_.budget) {
+            calm_windows_ = 0;
+            level_ = std::min(level_ + 1, ladder_.size() - 1);
+        } else if (load_ < options_.budget * 0.6 && level_ > 0) {
+            if (++calm_windows_ >= 3) {
+                calm_windows_ = 0;
+                level_--;
+            }
+        } else {
+            calm_windows_ = 0;
+        }
+    }
+
+    GovernorDecision Decision() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return ladder_[level_];
+    }
+
+    void AddMetrics(Metrics& metrics) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const GovernorDecision& decision = ladder_[level_];
+        metrics.emplace_back("budget", options_.budget);
+        metrics.emplace_back("load", load_);
+        metrics.emplace_back("level", static_cast<double>(level_));
+        metrics.emplace_back("fpsScale", decision.fps_scale);
+        metrics.emplace_back("resolutionScale", decision.resolution_scale);
+        metrics.emplace_back("speed", decision.speed);
+    }
+
+private:
+    static constexpr int64_t kWindowNs = 1000000000;
+
+    GovernorOptions options_;
+    std::vector<GovernorDecision> ladder_;
+    std::atomic<int64_t> cpu_ns_{0};
+    mutable std::mutex mutex_;
+    std::chrono::steady_clock::time_point window_start_;
+    double load_ = 0;
+    size_t level_ = 0;
+    int calm_windows_ = 0;
+};
+
+}  // namespace screen_recorder
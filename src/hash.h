@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace screen_recorder {
+
+// Fast non-cryptographic 64-bit hash for change detection, 8 bytes per step.
+inline uint64_t HashBytes(const uint8_t* data, size_t size, uint64_t seed = 0x9E3779B97F4A7C15ull) {
+    uint64_t hash = seed ^ (size * 0xC2B2AE3D27D4EB4Full);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        word *= 0x87C37B91114253D5ull;
+        word = (word << 31) | (word >> 33);
+        hash ^= word * 0x4CF5AD432745937Full;
+        hash = ((hash << 27) | (hash >> 37)) * 5 + 0x52DCE729;
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, data + i, size - i);
+    hash ^= tail * 0x87C37B91114253D5ull;
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Hash of a rectangle of rows in a packed image, chaining row by row.
+inline uint64_t HashRect(const uint8_t* data, int stride, int x, int y, int width, int height,
+                         int bytes_per_pixel) {
+    uint64_t hash = 0x9E3779B97F4A7C15ull;
+    for (int row = 0; row < height; row++) {
+        hash = HashBytes(data + static_cast<size_t>(y + row) * stride + static_cast<size_t>(x) * bytes_per_pixel,
+                         static_cast<size_t>(width) * bytes_per_pixel, hash);
+    }
+    return hash;
+}
+
+}  // namespace screen_recorder
@@ -0,0 +1,80 @@
+#pragma once
+
+#ifdef SCREEN_RECORDER_HAVE_JPEG
+
+#include <csetjmp>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+extern "C" {
+#include <jpeglib.h>
+}
+
+namespace screen_recorder {
+
+// Baseline JPEG of packed RGB24 rectangles through libjpeg(-turbo), 4:2:0,
+// with one compressor reused across calls.
+class JpegCompressor {
+public:
+    JpegCompressor() {
+        info_.err = jpeg_std_error(&error_.manager);
+        error_.manager.error_exit = [](j_common_ptr info) {
+            std::longjmp(reinterpret_cast<Error*>(info->err)->jump, 1);
+        };
+        jpeg_create_compress(&info_);
+    }
+
+    ~JpegCompressor() {
+        jpeg_destroy_compress(&info_);
+    }
+
+    JpegCompressor(const JpegCompressor&) = delete;
+    JpegCompressor& operator=(const JpegCompressor&) = delete;
+
+    void Compress(const uint8_t* rgb, int stride, int width, int height, int quality, std::vector<uint8_t>& out) {
+        buffer_ = nullptr;
+        size_ = 0;
+        rows_.resize(height);
+        for (int y = 0; y < height; y++) {
+            rows_[y] = const_cast<JSAMPROW>(rgb + static_cast<size_t>(y) * stride);
+        }
+        if (setjmp(error_.jump)) {
+            jpeg_abort_compress(&info_);
+            std::free(buffer_);
+            throw std::runtime_error("libjpeg failed to compress");
+        }
+        jpeg_mem_dest(&info_, &buffer_, &size_);
+        info_.image_width = static_cast<JDIMENSION>(width);
+        info_.image_height = static_cast<JDIMENSION>(height);
+        info_.input_components = 3;
+        info_.in_color_space = JCS_RGB;
+        jpeg_set_defaults(&info_);
+        jpeg_set_quality(&info_, quality, TRUE);
+        info_.dct_method = JDCT_IFAST;
+        jpeg_start_compress(&info_, TRUE);
+        jpeg_write_scanlines(&info_, rows_.data(), static_cast<JDIMENSION>(height));
+        jpeg_finish_compress(&info_);
+        out.assign(buffer_, buffer_ + size_);
+        std::free(buffer_);
+    }
+
+private:
+    struct Error {
+        jpeg_error_mgr manager;
+        std::jmp_buf jump;
+    };
+
+    jpeg_compress_struct info_ = {};
+    Error error_;
+    std::vector<JSAMPROW> rows_;
+    // Members rather than locals so they survive the longjmp.
+    unsigned char* buffer_ = nullptr;
+    unsigned long size_ = 0;
+};
+
+}  // namespace screen_recorder
+
+#endif  // SCREEN_RECORDER_HAVE_JPEG
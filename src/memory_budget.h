@@ -0,0 +1,148 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+namespace screen_recorder {
+
+// Subsystems whose native memory is accounted against the budget.
+enum class MemoryPool {
+    // Frames waiting in pipeline queues.
+    kQueues,
+    kTileCache,
+    // Frames the VNC server shares with its viewers.
+    kVnc,
+    // Freed huge-page frame buffers kept for reuse.
+    kFramePool,
+    // Encoded packets held for instant replay.
+    kReplay,
+    // Frames a captureBurst() call is collecting.
+    kBursts,
+    kCount,
+};
+
+inline const char* MemoryPoolName(MemoryPool pool) {
+    switch (pool) {
+        case MemoryPool::kQueues:
+            return "queues";
+        case MemoryPool::kTileCache:
+            return "tileCache";
+        case MemoryPool::kVnc:
+            return "vnc";
+        case MemoryPool::kFramePool:
+            return "framePool";
+        case MemoryPool::kReplay:
+            return "replay";
+        case MemoryPool::kBursts:
+            return "bursts";
+        case MemoryPool::kCount:
+            break;
+    }
+    return "unknown";
+}
+
+// Process-wide cap on the large native allocations the addon makes. Memory
+// that already exists (frames passed between stages, shared VNC frames) is
+// always charged; optional growth (a newly captured frame entering a full
+// pipeline, a tile entering the cache) asks TryCharge first and is dropped
+// or skipped when the budget is spent. Encoder-internal buffers belong to
+// the codec libraries and are not counted.
+class MemoryBudget {
+public:
+    // 0 removes the limit.
+    void SetLimit(size_t bytes) {
+        limit_ = bytes;
+    }
+
+    size_t Limit() const {
+        return limit_;
+    }
+
+    bool TryCharge(MemoryPool pool, size_t bytes) {
+        const size_t limit = limit_;
+        size_t used = used_.load(std::memory_order_relaxed);
+        do {
+            if (limit != 0 && used + bytes > limit) {
+                rejected_++;
+                return false;
+            }
+        } while (!used_.compare_exchange_weak(used, used + bytes, std::memory_order_relaxed));
+        pools_[static_cast<size_t>(pool)] += bytes;
+        return true;
+    }
+
+    void Charge(MemoryPool pool, size_t bytes) {
+        used_ += bytes;
+        pools_[static_cast<size_t>(pool)] += bytes;
+    }
+
+    void Release(MemoryPool pool, size_t bytes) {
+        used_ -= bytes;
+        pools_[static_cast<size_t>(pool)] -= bytes;
+    }
+
+    size_t Used() const {
+        return used_;
+    }
+
+    size_t Used(MemoryPool pool) const {
+        return pools_[static_cast<size_t>(pool)];
+    }
+
+    // TryCharge calls refused so far.
+    uint64_t Rejected() const {
+        return rejected_;
+    }
+
+private:
+    std::atomic<size_t> limit_{0};
+    std::atomic<size_t> used_{0};
+    std::atomic<size_t> pools_[static_cast<size_t>(MemoryPool::kCount)] = {};
+    std::atomic<uint64_t> rejected_{0};
+};
+
+inline MemoryBudget& GlobalMemoryBudget() {
+    static MemoryBudget budget;
+    return budget;
+}
+
+// Bytes charged to the global budget for as long as the owner lives.
+class MemoryCharge {
+public:
+    MemoryCharge() = default;
+
+    MemoryCharge(MemoryPool pool, size_t bytes) : pool_(pool), bytes_(bytes) {
+        GlobalMemoryBudget().Charge(pool, bytes);
+    }
+
+    MemoryCharge(MemoryCharge&& other) noexcept
+        : pool_(other.pool_), bytes_(std::exchange(other.bytes_, 0)) {}
+
+    MemoryCharge& operator=(MemoryCharge&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            pool_ = other.pool_;
+            bytes_ = std::exchange(other.bytes_, 0);
+        }
+        return *this;
+    }
+
+    ~MemoryCharge() {
+        Reset();
+    }
+
+    void Reset() {
+        if (bytes_ != 0) {
+            GlobalMemoryBudget().Release(pool_, bytes_);
+            bytes_ = 0;
+        }
+    }
+
+private:
+    MemoryPool pool_ = MemoryPool::kQueues;
+    size_t bytes_ = 0;
+};
+
+}  // namespace screen_recorder
@@ -0,0 +1,329 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "frame.h"
+#include "hash.h"
+
+namespace screen_recorder {
+
+// A region of the current frame whose pixels sat at (source_x, source_y) in
+// the previous frame, i.e. a CopyRect from the previous picture.
+struct Move {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+    int source_x = 0;
+    int source_y = 0;
+};
+
+struct MotionOptions {
+    // Strip width across the direction of motion. Static content, such as a
+    // scrollbar or sidebar, costs at most one strip on each side of a move.
+    int band = 16;
+    // Smallest move worth a copy, along and across the direction of motion.
+    int min_length = 24;
+    int min_span = 64;
+    size_t max_moves = 8;
+};
+
+namespace detail {
+
+struct Area {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+};
+
+// Hashes of one frame's lines (rows or columns) inside an area, split into
+// strips across the lines so partially moved lines still match.
+struct LineHashes {
+    int bands = 0;
+    int lines = 0;
+    std::vector<uint64_t> hashes;
+
+    uint64_t At(int band, int line) const {
+        return hashes[static_cast<size_t>(band) * lines + line];
+    }
+};
+
+// A block of bands whose lines moved by `offset` (previous line minus current line).
+struct Shift {
+    int band_begin = 0;
+    int band_end = 0;
+    int line_begin = 0;
+    int line_end = 0;
+    int offset = 0;
+};
+
+// Tightest pixel box containing every difference between two frames.
+inline bool ChangedArea(const Frame& previous, const Frame& current, int bytes_per_pixel, Area& area) {
+    const size_t row_bytes = static_cast<size_t>(current.width) * bytes_per_pixel;
+    int top = -1;
+    int bottom = 0;
+    int left = current.width;
+    int right = 0;
+    for (int y = 0; y < current.height; y++) {
+        const uint8_t* a = previous.data.data() + static_cast<size_t>(y) * previous.stride;
+        const uint8_t* b = current.data.data() + static_cast<size_t>(y) * current.stride;
+        if (std::memcmp(a, b, row_bytes) == 0) {
+            continue;
+        }
+        if (top < 0) {
+            top = y;
+        }
+        bottom = y + 1;
+        int x = 0;
+        while (x < left && std::memcmp(a + x * bytes_per_pixel, b + x * bytes_per_pixel, bytes_per_pixel) == 0) {
+            x++;
+        }
+        left = std::min(left, x);
+        x = current.width - 1;
+        while (x >= right && std::memcmp(a + x * bytes_per_pixel, b + x * bytes_per_pixel, bytes_per_pixel) == 0) {
+            x--;
+        }
+        right = std::max(right, x + 1);
+    }
+    if (top < 0) {
+        return false;
+    }
+    area = {left, top, right - left, bottom - top};
+    return true;
+}
+
+// Row hashes for vertical motion: one hash per row per column strip.
+inline LineHashes HashRows(const Frame& frame, const Area& area, int bytes_per_pixel, int band) {
+    LineHashes result;
+    result.bands = (area.width + band - 1) / band;
+    result.lines = area.height;
+    result.hashes.resize(static_cast<size_t>(result.bands) * result.lines);
+    for (int b = 0; b < result.bands; b++) {
+        const int x = area.x + b * band;
+        const size_t bytes = static_cast<size_t>(std::min(band, area.x + area.width - x)) * bytes_per_pixel;
+        for (int line = 0; line < result.lines; line++) {
+            const uint8_t* row = frame.data.data() + static_cast<size_t>(area.y + line) * frame.stride +
+                                 static_cast<size_t>(x) * bytes_per_pixel;
+            result.hashes[static_cast<size_t>(b) * result.lines + line] = HashBytes(row, bytes);
+        }
+    }
+    return result;
+}
+
+// Column hashes for horizontal motion, accumulated row by row so the frame
+// is read in memory order.
+inline LineHashes HashColumns(const Frame& frame, const Area& area, int bytes_per_pixel, int band) {
+    LineHashes result;
+    result.bands = (area.height + band - 1) / band;
+    result.lines = area.width;
+    result.hashes.assign(static_cast<size_t>(result.bands) * result.lines, 0xCBF29CE484222325ull);
+    for (int y = 0; y < area.height; y++) {
+        uint64_t* hashes = result.hashes.data() + static_cast<size_t>(y / band) * result.lines;
+        const uint8_t* row = frame.data.data() + static_cast<size_t>(area.y + y) * frame.stride +
+                             static_cast<size_t>(area.x) * bytes_per_pixel;
+        for (int x = 0; x < area.width; x++) {
+            uint32_t pixel = 0;
+            std::memcpy(&pixel, row + x * bytes_per_pixel, bytes_per_pixel);
+            uint64_t hash = (hashes[x] ^ pixel) * 0x100000001B3ull;
+            hashes[x] = (hash << 29) | (hash >> 35);
+        }
+    }
+    return result;
+}
+
+// Offsets are voted for by lines whose hash is unique within their strip in
+// the previous frame, so repeated lines (blank space, borders) cannot vote.
+// Each winning offset then claims blocks of strips x lines that match under
+// it, most voted offsets first.
+inline std::vector<Shift> FindShifts(const LineHashes& previous, const LineHashes& current, int min_lines,
+                                     int min_bands, size_t max_shifts) {
+    std::vector<Shift> shifts;
+    if (current.lines < min_lines || current.bands < min_bands) {
+        return shifts;
+    }
+
+    std::unordered_map<int, int> votes;
+    std::unordered_map<uint64_t, int> positions;
+    const int step = std::max(1, current.bands / 8);
+    for (int band = 0; band < current.bands; band += step) {
+        positions.clear();
+        for (int line = 0; line < previous.lines; line++) {
+            auto [it, inserted] = positions.emplace(previous.At(band, line), line);
+            if (!inserted) {
+                it->second = -1;
+            }
+        }
+        for (int line = 0; line < current.lines; line++) {
+            auto it = positions.find(current.At(band, line));
+            if (it != positions.end() && it->second >= 0 && it->second != line) {
+                votes[it->second - line]++;
+            }
+        }
+    }
+    std::vector<std::pair<int, int>> ranked(votes.begin(), votes.end());
+    std::sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+
+    std::vector<uint8_t> claimed(current.hashes.size(), 0);
+    for (const auto& [offset, count] : ranked) {
+        if (shifts.size() >= max_shifts || count < min_lines / 2) {
+            break;
+        }
+        // Runs of matching strips per line, merged with identical runs on the line before.
+        std::vector<Shift> blocks;
+        std::vector<size_t> open;
+        for (int line = std::max(0, -offset); line < std::min(current.lines, previous.lines - offset); line++) {
+            auto matches = [&](int band) {
+                return !claimed[static_cast<size_t>(band) * current.lines + line] &&
+                       current.At(band, line) == previous.At(band, line + offset);
+            };
+            std::vector<size_t> still_open;
+            for (int band = 0; band < current.bands;) {
+                if (!matches(band)) {
+                    band++;
+                    continue;
+                }
+                int end = band + 1;
+                while (end < current.bands && matches(end)) {
+                    end++;
+                }
+                auto above = std::find_if(open.begin(), open.end(), [&](size_t i) {
+                    return blocks[i].band_begin == band && blocks[i].band_end == end;
+                });
+                if (above != open.end()) {
+                    blocks[*above].line_end = line + 1;
+                    still_open.push_back(*above);
+                } else {
+                    still_open.push_back(blocks.size());
+                    blocks.push_back({band, end, line, line + 1, offset});
+                }
+                band = end;
+            }
+            open.swap(still_open);
+        }
+        for (const Shift& block : blocks) {
+            if (block.line_end - block.line_begin < min_lines || block.band_end - block.band_begin < min_bands ||
+                shifts.size() >= max_shifts) {
+                continue;
+            }
+            for (int band = block.band_begin; band < block.band_end; band++) {
+                std::fill_n(claimed.begin() + static_cast<size_t>(band) * current.lines + block.line_begin,
+                            block.line_end - block.line_begin, 1);
+            }
+            shifts.push_back(block);
+        }
+    }
+    return shifts;
+}
+
+// Hashes only nominate moves; a copy is kept once every row of it compares
+// equal byte for byte, so a collision can never paint wrong pixels.
+inline bool MoveMatches(const Frame& previous, const Frame& current, int bytes_per_pixel, const Move& move) {
+    const size_t bytes = static_cast<size_t>(move.width) * bytes_per_pixel;
+    for (int row = 0; row < move.height; row++) {
+        const uint8_t* from = previous.data.data() + static_cast<size_t>(move.source_y + row) * previous.stride +
+                              static_cast<size_t>(move.source_x) * bytes_per_pixel;
+        const uint8_t* to = current.data.data() + static_cast<size_t>(move.y + row) * current.stride +
+                            static_cast<size_t>(move.x) * bytes_per_pixel;
+        if (std::memcmp(from, to, bytes) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool Overlaps(int ax, int ay, int aw, int ah, int bx, int by, int bw, int bh) {
+    return ax < bx + bw && bx < ax + aw && ay < by + bh && by < ay + ah;
+}
+
+// Orders moves so none reads pixels an earlier one has overwritten, dropping
+// the smallest move whenever no order exists.
+inline std::vector<Move> OrderMoves(std::vector<Move> moves) {
+    std::sort(moves.begin(), moves.end(), [](const Move& a, const Move& b) {
+        return static_cast<int64_t>(a.width) * a.height > static_cast<int64_t>(b.width) * b.height;
+    });
+    std::vector<Move> ordered;
+    while (!moves.empty()) {
+        auto safe = std::find_if(moves.begin(), moves.end(), [&](const Move& move) {
+            return std::none_of(moves.begin(), moves.end(), [&](const Move& other) {
+                return &other != &move && Overlaps(move.x, move.y, move.width, move.height, other.source_x,
+                                                   other.source_y, other.width, other.height);
+            });
+        });
+        if (safe == moves.end()) {
+            moves.pop_back();
+            continue;
+        }
+        ordered.push_back(*safe);
+        moves.erase(safe);
+    }
+    return ordered;
+}
+
+}  // namespace detail
+
+// Finds large regions that scrolled or moved between two packed frames of
+// the same size by matching line hashes inside the changed area: rows for
+// vertical motion and, when nothing moved vertically, columns for horizontal
+// motion. Whatever the moves leave uncovered is newly exposed content.
+// Every move is verified against the pixels, and applying the returned moves
+// in order to the previous frame never reads a pixel an earlier move has
+// written.
+inline std::vector<Move> DetectMoves(const Frame& previous, const Frame& current,
+                                     const MotionOptions& options = MotionOptions()) {
+    std::vector<Move> moves;
+    const int bytes_per_pixel = BytesPerPixel(current.format);
+    if (IsEncoded(current.format) || current.format == PixelFormat::kI420 || previous.format != current.format ||
+        previous.width != current.width || previous.height != current.height || current.width <= 0 ||
+        current.height <= 0) {
+        return moves;
+    }
+    detail::Area area;
+    if (!detail::ChangedArea(previous, current, bytes_per_pixel, area)) {
+        return moves;
+    }
+
+    const int band = std::max(1, options.band);
+    const int min_bands = std::max(1, (options.min_span + band - 1) / band);
+    std::vector<detail::Shift> shifts = detail::FindShifts(
+        detail::HashRows(previous, area, bytes_per_pixel, band), detail::HashRows(current, area, bytes_per_pixel, band),
+        options.min_length, min_bands, options.max_moves);
+    for (const detail::Shift& shift : shifts) {
+        Move move;
+        move.x = area.x + shift.band_begin * band;
+        move.width = std::min(area.x + area.width, area.x + shift.band_end * band) - move.x;
+        move.y = area.y + shift.line_begin;
+        move.height = shift.line_end - shift.line_begin;
+        move.source_x = move.x;
+        move.source_y = move.y + shift.offset;
+        moves.push_back(move);
+    }
+    if (moves.empty()) {
+        shifts = detail::FindShifts(detail::HashColumns(previous, area, bytes_per_pixel, band),
+                                    detail::HashColumns(current, area, bytes_per_pixel, band), options.min_length,
+                                    min_bands, options.max_moves);
+        for (const detail::Shift& shift : shifts) {
+            Move move;
+            move.y = area.y + shift.band_begin * band;
+            move.height = std::min(area.y + area.height, area.y + shift.band_end * band) - move.y;
+            move.x = area.x + shift.line_begin;
+            move.width = shift.line_end - shift.line_begin;
+            move.source_x = move.x + shift.offset;
+            move.source_y = move.y;
+            moves.push_back(move);
+        }
+    }
+    moves.erase(std::remove_if(moves.begin(), moves.end(), [&](const Move& move) {
+        return !detail::MoveMatches(previous, current, bytes_per_pixel, move);
+    }), moves.end());
+    return detail::OrderMoves(std::move(moves));
+}
+
+}  // namespace screen_recorder
@@ -0,0 +1,545 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "frame.h"
+#include "pipeline.h"
+
+namespace screen_recorder {
+
+namespace mp4 {
+
+constexpr uint32_t kTimescale = 90000;
+
+inline int64_t ToTimescale(int64_t microseconds) {
+    return microseconds * kTimescale / 1000000;
+}
+
+// Serializes ISO-BMFF boxes into a byte vector, back-patching box sizes.
+class BoxWriter {
+public:
+    void U8(uint8_t value) { data_.push_back(value); }
+    void U16(uint16_t value) { U8(value >> 8); U8(value & 0xff); }
+    void U24(uint32_t value) { U8((value >> 16) & 0xff); U16(value & 0xffff); }
+    void U32(uint32_t value) { U16(value >> 16); U16(value & 0xffff); }
+    void U64(uint64_t value) { U32(static_cast<uint32_t>(value >> 32)); U32(static_cast<uint32_t>(value)); }
+    void Zeros(size_t count) { data_.insert(data_.end(), count, 0); }
+    void Bytes(const uint8_t* bytes, size_t size) { data_.insert(data_.end(), bytes, bytes + size); }
+    void Bytes(const std::vector<uint8_t>& bytes) { Bytes(bytes.data(), bytes.size()); }
+    void FourCC(const char* code) { Bytes(reinterpret_cast<const uint8_t*>(code), 4); }
+
+    size_t Begin(const char* type) {
+        size_t offset = data_.size();
+        U32(0);
+        FourCC(type);
+        return offset;
+    }
+
+    size_t BeginFull(const char* type, uint8_t version, uint32_t flags) {
+        size_t offset = Begin(type);
+        U8(version);
+        U24(flags);
+        return offset;
+    }
+
+    void End(size_t offset) {
+        Patch32(offset, static_cast<uint32_t>(data_.size() - offset));
+    }
+
+    void Patch32(size_t offset, uint32_t value) {
+        data_[offset] = value >> 24;
+        data_[offset + 1] = (value >> 16) & 0xff;
+        data_[offset + 2] = (value >> 8) & 0xff;
+        data_[offset + 3] = value & 0xff;
+    }
+
+    size_t Size() const { return data_.size(); }
+    std::vector<uint8_t>& Data() { return data_; }
+
+private:
+    std::vector<uint8_t> data_;
+};
+
+struct NalUnit {
+    const uint8_t* data;
+    size_t size;
+    int type;
+};
+
+// Splits an Annex B byte stream at its 3- or 4-byte start codes.
+inline std::vector<NalUnit> SplitAnnexB(const uint8_t* data, size_t size) {
+    std::vector<NalUnit> units;
+    size_t i = 0;
+    size_t start = SIZE_MAX;
+    while (i + 3 <= size) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+            if (start != SIZE_MAX) {
+                size_t end = i;
+                while (end > start && data[end - 1] == 0) {
+                    end--;
+                }
+                units.push_back({data + start, end - start, data[start] & 0x1f});
+            }
+            i += 3;
+            start = i;
+        } else {
+            i++;
+        }
+    }
+    if (start != SIZE_MAX && start < size) {
+        units.push_back({data + start, size - start, data[start] & 0x1f});
+    }
+    return units;
+}
+
+struct Track {
+    PixelFormat codec = PixelFormat::kH264;
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> sps;
+    std::vector<uint8_t> pps;
+};
+
+struct Sample {
+    FrameBuffer data;
+    int64_t decode_time = 0;
+    int64_t presentation_time = 0;
+    uint32_t duration = 0;
+    bool keyframe = false;
+};
+
+inline int Vp9Level(const Track& track) {
+    const int64_t pixels = static_cast<int64_t>(track.width) * track.height;
+    return pixels <= 1280 * 720 ? 31 : pixels <= 1920 * 1088 ? 41 : pixels <= 4096 * 2176 ? 51 : 61;
+}
+
+// RFC 6381 codec string for playlists and manifests.
+inline std::string CodecString(const Track& track) {
+    char buffer[32];
+    if (track.codec == PixelFormat::kH264) {
+        std::snprintf(buffer, sizeof(buffer), "avc1.%02x%02x%02x", track.sps[1], track.sps[2], track.sps[3]);
+    } else {
+        std::snprintf(buffer, sizeof(buffer), "vp09.00.%02d.08", Vp9Level(track));
+    }
+    return buffer;
+}
+
+inline void WriteSampleEntry(BoxWriter& w, const Track& track) {
+    size_t entry = w.Begin(track.codec == PixelFormat::kH264 ? "avc1" : "vp09");
+    w.Zeros(6);
+    w.U16(1);  // data_reference_index
+    w.Zeros(16);
+    w.U16(track.width);
+    w.U16(track.height);
+    w.U32(0x00480000);
+    w.U32(0x00480000);
+    w.U32(0);
+    w.U16(1);  // frame_count
+    w.Zeros(32);
+    w.U16(0x0018);
+    w.U16(0xffff);
+
+    if (track.codec == PixelFormat::kH264) {
+        size_t avcc = w.Begin("avcC");
+        w.U8(1);
+        w.U8(track.sps[1]);
+        w.U8(track.sps[2]);
+        w.U8(track.sps[3]);
+        w.U8(0xff);  // 4-byte NAL lengths
+        w.U8(0xe1);
+        w.U16(static_cast<uint16_t>(track.sps.size()));
+        w.Bytes(track.sps);
+        w.U8(1);
+        w.U16(static_cast<uint16_t>(track.pps.size()));
+        w.Bytes(track.pps);
+        const uint8_t profile = track.sps[1];
+        if (profile == 100 || profile == 110 || profile == 122 || profile == 144) {
+            w.U8(0xfc | 1);  // 4:2:0
+            w.U8(0xf8);
+            w.U8(0xf8);
+            w.U8(0);
+        }
+        w.End(avcc);
+    } else {
+        size_t vpcc = w.BeginFull("vpcC", 1, 0);
+        w.U8(0);  // profile 0
+        w.U8(Vp9Level(track));
+        w.U8((8 << 4) | (1 << 1));  // 8-bit, 4:2:0 colocated, limited range
+        w.U8(2);  // colour primaries unspecified
+        w.U8(2);  // transfer unspecified
+        w.U8(6);  // BT.601 matrix, matching ConvertToI420
+        w.U16(0);
+        w.End(vpcc);
+    }
+    w.End(entry);
+}
+
+inline std::vector<uint8_t> BuildInitSegment(const Track& track) {
+    BoxWriter w;
+    size_t ftyp = w.Begin("ftyp");
+    w.FourCC("iso6");
+    w.U32(0);
+    w.FourCC("iso6");
+    w.FourCC("isom");
+    w.FourCC(track.codec == PixelFormat::kH264 ? "avc1" : "vp09");
+    w.FourCC("mp41");
+    w.End(ftyp);
+
+    size_t moov = w.Begin("moov");
+    size_t mvhd = w.BeginFull("mvhd", 0, 0);
+    w.U32(0);
+    w.U32(0);
+    w.U32(1000);
+    w.U32(0);
+    w.U32(0x00010000);  // rate
+    w.U16(0x0100);      // volume
+    w.Zeros(10);
+    const uint32_t matrix[9] = {0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000};
+    for (uint32_t value : matrix) {
+        w.U32(value);
+    }
+    w.Zeros(24);
+    w.U32(2);  // next_track_ID
+    w.End(mvhd);
+
+    size_t trak = w.Begin("trak");
+    size_t tkhd = w.BeginFull("tkhd", 0, 3);
+    w.U32(0);
+    w.U32(0);
+    w.U32(1);  // track_ID
+    w.U32(0);
+    w.U32(0);
+    w.Zeros(8);
+    w.U16(0);
+    w.U16(0);
+    w.U16(0);
+    w.U16(0);
+    for (uint32_t value : matrix) {
+        w.U32(value);
+    }
+    w.U32(static_cast<uint32_t>(track.width) << 16);
+    w.U32(static_cast<uint32_t>(track.height) << 16);
+    w.End(tkhd);
+
+    size_t mdia = w.Begin("mdia");
+    size_t mdhd = w.BeginFull("mdhd", 0, 0);
+    w.U32(0);
+    w.U32(0);
+    w.U32(kTimescale);
+    w.U32(0);
+    w.U16(0x55c4);  // "und"
+    w.U16(0);
+    w.End(mdhd);
+    size_t hdlr = w.BeginFull("hdlr", 0, 0);
+    w.U32(0);
+    w.FourCC("vide");
+    w.Zeros(12);
+    const char name[] = "VideoHandler";
+    w.Bytes(reinterpret_cast<const uint8_t*>(name), sizeof(name));
+    w.End(hdlr);
+
+    size_t minf = w.Begin("minf");
+    size_t vmhd = w.BeginFull("vmhd", 0, 1);
+    w.Zeros(8);
+    w.End(vmhd);
+    size_t dinf = w.Begin("dinf");
+    size_t dref = w.BeginFull("dref", 0, 0);
+    w.U32(1);
+    size_t url = w.BeginFull("url ", 0, 1);
+    w.End(url);
+    w.End(dref);
+    w.End(dinf);
+
+    size_t stbl = w.Begin("stbl");
+    size_t stsd = w.BeginFull("stsd", 0, 0);
+    w.U32(1);
+    WriteSampleEntry(w, track);
+    w.End(stsd);
+    for (const char* type : {"stts", "stsc", "stco"}) {
+        size_t box = w.BeginFull(type, 0, 0);
+        w.U32(0);
+        w.End(box);
+    }
+    size_t stsz = w.BeginFull("stsz", 0, 0);
+    w.U32(0);
+    w.U32(0);
+    w.End(stsz);
+    w.End(stbl);
+    w.End(minf);
+    w.End(mdia);
+    w.End(trak);
+
+    size_t mvex = w.Begin("mvex");
+    size_t trex = w.BeginFull("trex", 0, 0);
+    w.U32(1);
+    w.U32(1);
+    w.U32(0);
+    w.U32(0);
+    w.U32(0);
+    w.End(trex);
+    w.End(mvex);
+    w.End(moov);
+    return std::move(w.Data());
+}
+
+// One moof+mdat pair. Samples must carry their final durations.
+inline std::vector<uint8_t> BuildFragment(uint32_t sequence, const std::vector<Sample>& samples) {
+    BoxWriter w;
+    size_t moof = w.Begin("moof");
+    size_t mfhd = w.BeginFull("mfhd", 0, 0);
+    w.U32(sequence);
+    w.End(mfhd);
+
+    size_t traf = w.Begin("traf");
+    size_t tfhd = w.BeginFull("tfhd", 0, 0x020000);  // default-base-is-moof
+    w.U32(1);
+    w.End(tfhd);
+    size_t tfdt = w.BeginFull("tfdt", 1, 0);
+    w.U64(static_cast<uint64_t>(samples.front().decode_time));
+    w.End(tfdt);
+
+    // data-offset, duration, size, flags and signed composition offset per sample.
+    size_t trun = w.BeginFull("trun", 1, 0x000001 | 0x000100 | 0x000200 | 0x000400 | 0x000800);
+    w.U32(static_cast<uint32_t>(samples.size()));
+    size_t data_offset = w.Size();
+    w.U32(0);
+    for (const Sample& sample : samples) {
+        w.U32(sample.duration);
+        w.U32(static_cast<uint32_t>(sample.data.size()));
+        w.U32(sample.keyframe ? 0x02000000 : 0x01010000);
+        w.U32(static_cast<uint32_t>(static_cast<int32_t>(sample.presentation_time - sample.decode_time)));
+    }
+    w.End(trun);
+    w.End(traf);
+    w.End(moof);
+
+    size_t mdat_size = 8;
+    for (const Sample& sample : samples) {
+        mdat_size += sample.data.size();
+    }
+    w.Patch32(data_offset, static_cast<uint32_t>(w.Size() - moof + 8));
+    w.U32(static_cast<uint32_t>(mdat_size));
+    w.FourCC("mdat");
+    for (const Sample& sample : samples) {
+        w.Bytes(sample.data.data(), sample.data.size());
+    }
+    return std::move(w.Data());
+}
+
+}  // namespace mp4
+
+struct FragmentInfo {
+    int64_t start_us = 0;
+    int64_t duration_us = 0;
+    bool starts_with_keyframe = false;
+};
+
+// Turns encoded frames into an fMP4 stream: an init segment once the codec
+// configuration is known, then a moof+mdat fragment per keyframe interval of
+// at least `fragment_duration_us`. Only the current fragment is held in
+// memory. Timestamps come from the capture clock, rebased so the first
+// decode time is zero.
+class Fmp4Muxer {
+public:
+    using InitCallback = std::function<void(std::vector<uint8_t>&&)>;
+    using FragmentCallback = std::function<void(std::vector<uint8_t>&&, const FragmentInfo&)>;
+
+    Fmp4Muxer(int64_t fragment_duration_us, InitCallback on_init, FragmentCallback on_fragment)
+        : fragment_duration_(mp4::ToTimescale(fragment_duration_us)),
+          on_init_(std::move(on_init)), on_fragment_(std::move(on_fragment)) {}
+
+    // Longest a fragment runs before it is cut without a keyframe, give or
+    // take a frame.
+    int64_t MaxFragmentDurationUs() const {
+        return 4 * std::max<int64_t>(fragment_duration_, mp4::kTimescale / 2) * 1000000 / mp4::kTimescale;
+    }
+
+    void AddPacket(Frame&& packet) {
+        if (packet.format != PixelFormat::kH264 && packet.format != PixelFormat::kVP9) {
+            throw std::runtime_error(std::string("mp4 cannot carry ") + PixelFormatName(packet.format) +
+                                     "; encode to h264 or vp9 first");
+        }
+        const bool sync = IsSyncSample(packet);
+        if (!initialized_) {
+            if (!sync) {
+                return;
+            }
+            Initialize(packet);
+        }
+
+        mp4::Sample sample;
+        sample.decode_time = mp4::ToTimescale(packet.decode_timestamp_us - time_base_us_);
+        sample.presentation_time = mp4::ToTimescale(packet.timestamp_us - time_base_us_);
+        sample.keyframe = sync;
+        sample.data = packet.format == PixelFormat::kH264 ? ToLengthPrefixed(packet.data) : std::move(packet.data);
+
+        if (!pending_.empty()) {
+            mp4::Sample& previous = pending_.back();
+            previous.duration = static_cast<uint32_t>(std::max<int64_t>(1, sample.decode_time - previous.decode_time));
+            // Half a frame of slack keeps capture jitter from pushing a cut
+            // to the following keyframe.
+            const int64_t elapsed = sample.decode_time - pending_.front().decode_time + previous.duration / 2;
+            // x264 with intra refresh sends an IDR frame only at the start of
+            // the stream, so cut anyway once a fragment runs well past its
+            // target; such fragments start on a non-sync sample.
+            if ((sample.keyframe && elapsed >= fragment_duration_) ||
+                elapsed >= mp4::ToTimescale(MaxFragmentDurationUs())) {
+                EmitFragment();
+            }
+        }
+        pending_.push_back(std::move(sample));
+    }
+
+    void Finish() {
+        if (pending_.empty()) {
+            return;
+        }
+        uint32_t last_duration = pending_.size() > 1 ? pending_[pending_.size() - 2].duration : mp4::kTimescale / 30;
+        pending_.back().duration = last_duration;
+        EmitFragment();
+    }
+
+    bool Initialized() const {
+        return initialized_;
+    }
+
+    const mp4::Track& Track() const {
+        return track_;
+    }
+
+private:
+    void Initialize(const Frame& packet) {
+        mp4::Track track;
+        track.codec = packet.format;
+        track.width = packet.width;
+        track.height = packet.height;
+        if (packet.format == PixelFormat::kH264) {
+            for (const mp4::NalUnit& nal : mp4::SplitAnnexB(packet.data.data(), packet.data.size())) {
+                if (nal.type == 7 && track.sps.empty()) {
+                    track.sps.assign(nal.data, nal.data + nal.size);
+                } else if (nal.type == 8 && track.pps.empty()) {
+                    track.pps.assign(nal.data, nal.data + nal.size);
+                }
+            }
+            if (track.sps.size() < 4 || track.pps.empty()) {
+                throw std::runtime_error("First H.264 keyframe carries no SPS/PPS");
+            }
+        }
+        time_base_us_ = std::min(packet.decode_timestamp_us, packet.timestamp_us);
+        initialized_ = true;
+        track_ = track;
+        on_init_(mp4::BuildInitSegment(track));
+    }
+
+    // Only IDR access units are sync samples: an intra-refresh recovery point
+    // still references earlier frames, even when its producer flags it as a
+    // keyframe.
+    static bool IsSyncSample(const Frame& packet) {
+        if (!packet.keyframe) {
+            return false;
+        }
+        if (packet.format != PixelFormat::kH264) {
+            return true;
+        }
+        for (const mp4::NalUnit& nal : mp4::SplitAnnexB(packet.data.data(), packet.data.size())) {
+            if (nal.type == 5) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Parameter sets live in avcC; access unit delimiters are dropped too.
+    static FrameBuffer ToLengthPrefixed(const FrameBuffer& annex_b) {
+        FrameBuffer out;
+        out.reserve(annex_b.size() + 16);
+        for (const mp4::NalUnit& nal : mp4::SplitAnnexB(annex_b.data(), annex_b.size())) {
+            if (nal.type == 7 || nal.type == 8 || nal.type == 9) {
+                continue;
+            }
+            const uint32_t size = static_cast<uint32_t>(nal.size);
+            const uint8_t length[4] = {static_cast<uint8_t>(size >> 24), static_cast<uint8_t>(size >> 16),
+                                       static_cast<uint8_t>(size >> 8), static_cast<uint8_t>(size)};
+            out.insert(out.end(), length, length + 4);
+            out.insert(out.end(), nal.data, nal.data + nal.size);
+        }
+        return out;
+    }
+
+    void EmitFragment() {
+        FragmentInfo info;
+        info.start_us = pending_.front().decode_time * 1000000 / mp4::kTimescale;
+        int64_t duration = 0;
+        for (const mp4::Sample& sample : pending_) {
+            duration += sample.duration;
+        }
+        info.duration_us = duration * 1000000 / mp4::kTimescale;
+        info.starts_with_keyframe = pending_.front().keyframe;
+        on_fragment_(mp4::BuildFragment(++sequence_, pending_), info);
+        pending_.clear();
+    }
+
+    int64_t fragment_duration_;
+    InitCallback on_init_;
+    FragmentCallback on_fragment_;
+    bool initialized_ = false;
+    int64_t time_base_us_ = 0;
+    uint32_t sequence_ = 0;
+    mp4::Track track_;
+    std::vector<mp4::Sample> pending_;
+};
+
+// Pipeline sink writing a fragmented MP4 file. Every fragment is flushed as
+// soon as it is complete, so the file stays playable while being written and
+// only the fragment in progress is lost if the process dies.
+class Mp4SinkStage : public Stage {
+public:
+    Mp4SinkStage(const std::string& path, int64_t fragment_duration_us)
+        : path_(path),
+          muxer_(fragment_duration_us,
+                 [this](std::vector<uint8_t>&& init) { Write(init); },
+                 [this](std::vector<uint8_t>&& fragment, const FragmentInfo&) { Write(fragment); }) {
+        file_ = std::fopen(path.c_str(), "wb");
+        if (!file_) {
+            throw std::runtime_error("Unable to open " + path);
+        }
+    }
+
+    ~Mp4SinkStage() override {
+        if (file_) {
+            std::fclose(file_);
+        }
+    }
+
+    std::string Name() const override {
+        return "sink(" + path_ + ")";
+    }
+
+    void Process(Frame&& frame, const Emit& emit) override {
+        muxer_.AddPacket(std::move(frame));
+    }
+
+    void Flush(const Emit& emit) override {
+        muxer_.Finish();
+    }
+
+private:
+    void Write(const std::vector<uint8_t>& bytes) {
+        if (std::fwrite(bytes.data(), 1, bytes.size(), file_) != bytes.size() || std::fflush(file_) != 0) {
+            throw std::runtime_error("Write to " + path_ + " failed");
+        }
+    }
+
+    std::string path_;
+    FILE* file_ = nullptr;
+    Fmp4Muxer muxer_;
+};
+
+}  // namespace screen_recorder
@@ -0,0 +1,394 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "convert.h"
+#include "frame.h"
+#include "governor.h"
+#include "memory_budget.h"
+#include "spsc_queue.h"
+
+namespace screen_recorder {
+
+// A processing step running on its own thread. Stages may emit zero or more
+// frames per input and may throw std::runtime_error to abort the pipeline.
+class Stage {
+public:
+    using Emit = std::function<void(Frame&&)>;
+
+    virtual ~Stage() = default;
+    virtual std::string Name() const = 0;
+    virtual void Process(Frame&& frame, const Emit& emit) = 0;
+    virtual void Flush(const Emit& emit) {}
+    // Called from the thread reading stats while Process() may be running.
+    virtual void AddMetrics(Metrics& metrics) const {}
+};
+
+// The first stage of a pipeline. Produce() blocks until the next frame is due.
+class SourceStage {
+public:
+    virtual ~SourceStage() = default;
+    virtual std::string Name() const = 0;
+    virtual bool Produce(Frame& frame) = 0;
+    // Called from the thread reading stats while Produce() may be running.
+    virtual void AddMetrics(Metrics& metrics) const {}
+};
+
+class ConvertStage : public Stage {
+public:
+    explicit ConvertStage(PixelFormat format) : format_(format) {}
+
+    std::string Name() const override {
+        return std::string("convert(") + PixelFormatName(format_) + ")";
+    }
+
+    void Process(Frame&& frame, const Emit& emit) override {
+        if (frame.format == format_) {
+            emit(std::move(frame));
+            return;
+        }
+        Frame converted;
+        ConvertToI420(frame, converted);
+        emit(std::move(converted));
+    }
+
+private:
+    PixelFormat format_;
+};
+
+class ScaleStage : public Stage {
+public:
+    ScaleStage(int width, int height) : width_(width), height_(height) {}
+
+    std::string Name() const override {
+        return "scale(" + std::to_string(width_) + "x" + std::to_string(height_) + ")";
+    }
+
+    void Process(Frame&& frame, const Emit& emit) override {
+        if (frame.width == width_ && frame.height == height_) {
+            emit(std::move(frame));
+            return;
+        }
+        Frame scaled;
+        ScaleFrame(frame, width_, height_, scaled);
+        emit(std::move(scaled));
+    }
+
+private:
+    int width_;
+    int height_;
+};
+
+// Appends the raw bytes of every frame to a file.
+class FileSinkStage : public Stage {
+public:
+    explicit FileSinkStage(const std::string& path) : path_(path) {
+        file_ = std::fopen(path.c_str(), "wb");
+        if (!file_) {
+            throw std::runtime_error("Unable to open " + path);
+        }
+    }
+
+    ~FileSinkStage() override {
+        if (file_) {
+            std::fclose(file_);
+        }
+    }
+
+    std::string Name() const override {
+        return "sink(" + path_ + ")";
+    }
+
+    void Process(Frame&& frame, const Emit& emit) override {
+        if (std::fwrite(frame.data.data(), 1, frame.data.size(), file_) != frame.data.size()) {
+            throw std::runtime_error("Write to " + path_ + " failed");
+        }
+    }
+
+    void Flush(const Emit& emit) override {
+        std::fflush(file_);
+    }
+
+private:
+    std::string path_;
+    FILE* file_ = nullptr;
+};
+
+struct StageStats {
+    std::string name;
+    uint64_t frames = 0;
+    double busy_ms = 0;
+    size_t queued = 0;
+    Metrics metrics;
+};
+
+// Runs a source and a chain of stages, one thread each, connected by bounded
+// lock-free queues. Throughput is bound by the slowest stage: when the first
+// queue is full the source drops frames instead of falling behind real time.
+class Pipeline {
+public:
+    Pipeline(std::unique_ptr<SourceStage> source, std::vector<std::unique_ptr<Stage>> stages,
+             size_t queue_size, std::shared_ptr<CpuGovernor> governor = nullptr)
+        : source_(std::move(source)), stages_(std::move(stages)), governor_(std::move(governor)) {
+        for (size_t i = 0; i < stages_.size(); i++) {
+            queues_.push_back(std::make_unique<SpscQueue<Frame>>(queue_size));
+        }
+        counters_ = std::make_unique<Counters[]>(stages_.size() + 1);
+        pushed_ = std::make_unique<Signal[]>(stages_.size());
+        popped_ = std::make_unique<Signal[]>(stages_.size());
+        done_ = std::make_unique<std::atomic<bool>[]>(stages_.size() + 1);
+    }
+
+    ~Pipeline() {
+        Stop();
+        // Frames left behind by an aborted run.
+        Frame frame;
+        for (auto& queue : queues_) {
+            while (queue->TryPop(frame)) {
+                GlobalMemoryBudget().Release(MemoryPool::kQueues, frame.data.capacity());
+            }
+        }
+    }
+
+    void Start() {
+        if (running_.exchange(true)) {
+            return;
+        }
+        aborted_ = false;
+        for (size_t i = 0; i <= stages_.size(); i++) {
+            done_[i] = false;
+        }
+        threads_.emplace_back(&Pipeline::RunSource, this);
+        for (size_t i = 0; i < stages_.size(); i++) {
+            threads_.emplace_back(&Pipeline::RunStage, this, i);
+        }
+    }
+
+    // Stops capturing and waits for queued frames to drain through every stage.
+    void Stop() {
+        running_ = false;
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+        threads_.clear();
+    }
+
+    bool IsRunning() const {
+        return running_;
+    }
+
+    uint64_t DroppedFrames() const {
+        return dropped_;
+    }
+
+    std::string Error() const {
+        std::lock_guard<std::mutex> lock(error_mutex_);
+        return error_;
+    }
+
+    std::vector<StageStats> Stats() const {
+        std::vector<StageStats> stats(stages_.size() + 1);
+        for (size_t i = 0; i <= stages_.size(); i++) {
+            stats[i].name = i == 0 ? source_->Name() : stages_[i - 1]->Name();
+            stats[i].frames = counters_[i].frames;
+            stats[i].busy_ms = counters_[i].busy_ns / 1e6;
+            stats[i].queued = i < queues_.size() ? queues_[i]->Size() : 0;
+            if (i == 0) {
+                source_->AddMetrics(stats[i].metrics);
+            } else {
+                stages_[i - 1]->AddMetrics(stats[i].metrics);
+            }
+        }
+        return stats;
+    }
+
+    Metrics GovernorMetrics() const {
+        Metrics metrics;
+        if (governor_) {
+            governor_->AddMetrics(metrics);
+        }
+        return metrics;
+    }
+
+private:
+    struct Counters {
+        std::atomic<uint64_t> frames{0};
+        std::atomic<uint64_t> busy_ns{0};
+    };
+
+    // Counts pushes or pops on one queue so the other end can sleep on it.
+    // Notifying is cheap while nobody waits.
+    struct Signal {
+        std::atomic<uint32_t> epoch{0};
+
+        uint32_t Read() const {
+            return epoch.load();
+        }
+
+        void Notify() {
+            epoch.fetch_add(1);
+            epoch.notify_all();
+        }
+    };
+
+    // Yields for a while, then parks until `signal` has moved on from `seen`,
+    // which must be read before the attempt that failed.
+    static void Backoff(int& spins, const Signal& signal, uint32_t seen) {
+        if (++spins < 64) {
+            std::this_thread::yield();
+        } else {
+            signal.epoch.wait(seen);
+        }
+    }
+
+    // Marks the producer of queue `index` finished and wakes its consumer.
+    void SetDone(size_t index) {
+        done_[index] = true;
+        if (index < queues_.size()) {
+            pushed_[index].Notify();
+        }
+    }
+
+    void Fail(const std::string& message) {
+        {
+            std::lock_guard<std::mutex> lock(error_mutex_);
+            if (error_.empty()) {
+                error_ = message;
+            }
+        }
+        aborted_ = true;
+        running_ = false;
+        for (size_t i = 0; i < queues_.size(); i++) {
+            pushed_[i].Notify();
+            popped_[i].Notify();
+        }
+    }
+
+    void Account(size_t index, std::chrono::steady_clock::time_point start, int64_t cpu_start) {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        counters_[index].frames++;
+        counters_[index].busy_ns +=
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        if (governor_) {
+            governor_->AddCpuTime(ThreadCpuTimeNs() - cpu_start);
+        }
+    }
+
+    void RunSource() {
+        try {
+            while (running_) {
+                Frame frame;
+                auto start = std::chrono::steady_clock::now();
+                int64_t cpu_start = governor_ ? ThreadCpuTimeNs() : 0;
+                if (!source_->Produce(frame)) {
+                    break;
+                }
+                Account(0, start, cpu_start);
+                if (governor_) {
+                    governor_->Tick();
+                }
+                if (queues_.empty()) {
+                    continue;
+                }
+                // New frames are dropped, like on a full queue, while the
+                // memory budget is spent.
+                const size_t bytes = frame.data.capacity();
+                if (!GlobalMemoryBudget().TryCharge(MemoryPool::kQueues, bytes)) {
+                    dropped_++;
+                } else if (!queues_[0]->TryPush(std::move(frame))) {
+                    GlobalMemoryBudget().Release(MemoryPool::kQueues, bytes);
+                    dropped_++;
+                } else {
+                    pushed_[0].Notify();
+                }
+            }
+        } catch (const std::exception& e) {
+            Fail(source_->Name() + ": " + e.what());
+        }
+        running_ = false;
+        SetDone(0);
+    }
+
+    void RunStage(size_t index) {
+        Stage& stage = *stages_[index];
+        SpscQueue<Frame>& input = *queues_[index];
+        SpscQueue<Frame>* output = index + 1 < queues_.size() ? queues_[index + 1].get() : nullptr;
+
+        Stage::Emit emit = [this, index, output](Frame&& frame) {
+            if (!output) {
+                return;
+            }
+            const size_t bytes = frame.data.capacity();
+            GlobalMemoryBudget().Charge(MemoryPool::kQueues, bytes);
+            int spins = 0;
+            for (;;) {
+                const uint32_t seen = popped_[index + 1].Read();
+                if (output->TryPush(std::move(frame))) {
+                    break;
+                }
+                if (aborted_) {
+                    GlobalMemoryBudget().Release(MemoryPool::kQueues, bytes);
+                    return;
+                }
+                Backoff(spins, popped_[index + 1], seen);
+            }
+            pushed_[index + 1].Notify();
+        };
+
+        try {
+            int spins = 0;
+            Frame frame;
+            while (!aborted_) {
+                const uint32_t seen = pushed_[index].Read();
+                if (input.TryPop(frame)) {
+                    popped_[index].Notify();
+                    GlobalMemoryBudget().Release(MemoryPool::kQueues, frame.data.capacity());
+                    spins = 0;
+                    auto start = std::chrono::steady_clock::now();
+                    int64_t cpu_start = governor_ ? ThreadCpuTimeNs() : 0;
+                    stage.Process(std::move(frame), emit);
+                    Account(index + 1, start, cpu_start);
+                } else if (done_[index]) {
+                    if (input.Size() == 0) {
+                        break;
+                    }
+                } else {
+                    Backoff(spins, pushed_[index], seen);
+                }
+            }
+            if (!aborted_) {
+                stage.Flush(emit);
+            }
+        } catch (const std::exception& e) {
+            Fail(stage.Name() + ": " + e.what());
+        }
+        SetDone(index + 1);
+    }
+
+    std::unique_ptr<SourceStage> source_;
+    std::vector<std::unique_ptr<Stage>> stages_;
+    std::shared_ptr<CpuGovernor> governor_;
+    std::vector<std::unique_ptr<SpscQueue<Frame>>> queues_;
+    std::unique_ptr<Counters[]> counters_;
+    std::unique_ptr<std::atomic<bool>[]> done_;
+    std::unique_ptr<Signal[]> pushed_;
+    std::unique_ptr<Signal[]> popped_;
+    std::vector<std::thread> threads_;
+    std::atomic<bool> running_{false};
+    std::atomic<bool> aborted_{false};
+    std::atomic<uint64_t> dropped_{0};
+    mutable std::mutex error_mutex_;
+    std::string error_;
+};
+
+}  // namespace screen_recorder
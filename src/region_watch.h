@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "frame.h"
+#include "hash.h"
+
+namespace screen_recorder {
+
+struct RegionChange {
+    // Share of the region's tiles that differ from the previous capture.
+    double fraction = 0;
+    // Bounding box of the changed tiles, relative to the region.
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+};
+
+// Compares successive captures of one screen region in 16x16 tiles. A
+// window system reports redraws, not changes: a repainted spinner frame or
+// a blinking caret redrawn identically still counts as damage, so the
+// pixels decide whether anything actually changed.
+class TileDiff {
+public:
+    static constexpr int kTileSize = 16;
+
+    // Hashes a packed frame and compares it with the baseline. True when at
+    // least `threshold` of the tiles changed (any tile for 0), which also
+    // makes this frame the new baseline; smaller changes keep accumulating
+    // against the old one. The first frame, and the first after a size
+    // change, only sets the baseline.
+    bool Update(const Frame& frame, double threshold, RegionChange& change) {
+        const int columns = (frame.width + kTileSize - 1) / kTileSize;
+        const int rows = (frame.height + kTileSize - 1) / kTileSize;
+        const bool baseline = columns != columns_ || rows != rows_;
+        columns_ = columns;
+        rows_ = rows;
+        next_.resize(static_cast<size_t>(columns) * rows);
+        hashes_.resize(next_.size());
+
+        const int bpp = BytesPerPixel(frame.format);
+        int changed = 0;
+        int left = columns;
+        int top = rows;
+        int right = 0;
+        int bottom = 0;
+        for (int row = 0; row < rows; row++) {
+            const int y = row * kTileSize;
+            const int height = std::min(kTileSize, frame.height - y);
+            for (int column = 0; column < columns; column++) {
+                const int x = column * kTileSize;
+                const uint64_t hash = HashRect(frame.data.data(), frame.stride, x, y,
+                                               std::min(kTileSize, frame.width - x), height, bpp);
+                const size_t index = static_cast<size_t>(row) * columns + column;
+                next_[index] = hash;
+                if (hash != hashes_[index]) {
+                    changed++;
+                    left = std::min(left, column);
+                    top = std::min(top, row);
+                    right = std::max(right, column + 1);
+                    bottom = std::max(bottom, row + 1);
+                }
+            }
+        }
+        const double fraction = static_cast<double>(changed) / next_.size();
+        if (baseline || changed == 0 || fraction < threshold) {
+            if (baseline) {
+                hashes_.swap(next_);
+            }
+            return false;
+        }
+        hashes_.swap(next_);
+        change.fraction = fraction;
+        change.x = left * kTileSize;
+        change.y = top * kTileSize;
+        change.width = std::min(right * kTileSize, frame.width) - change.x;
+        change.height = std::min(bottom * kTileSize, frame.height) - change.y;
+        return true;
+    }
+
+private:
+    int columns_ = -1;
+    int rows_ = -1;
+    std::vector<uint64_t> hashes_;
+    std::vector<uint64_t> next_;
+};
+
+}  // namespace screen_recorder
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "frame.h"
+#include "memory_budget.h"
+#include "pipeline.h"
+
+namespace screen_recorder {
+
+struct ReplayOptions {
+    // The buffer always covers at least this much, plus up to one GOP.
+    int64_t duration_us = 60000000;
+    // Oldest GOPs are dropped beyond this, even within `duration_us`.
+    size_t max_bytes = 256 << 20;
+};
+
+// Pre-roll buffer for "save the last minute": a pass-through stage keeping
+// the most recent encoded packets in memory. The buffer is trimmed a whole
+// GOP at a time so it always starts at a keyframe (an IDR frame for H.264,
+// never an intra-refresh recovery point; pipelines with a replay stage encode
+// without intra refresh so IDR frames keep coming), and every packet is
+// charged to the global memory budget; when that is spent the oldest GOPs go
+// first and, if nothing is left to drop, packets are skipped until the next
+// keyframe. Snapshot() is cheap and safe from any thread: packets are shared,
+// never copied, so saving runs beside capture without pausing it.
+class ReplayStage : public Stage {
+public:
+    using Packet = std::shared_ptr<const Frame>;
+
+    explicit ReplayStage(const ReplayOptions& options) : options_(options) {}
+
+    ~ReplayStage() override {
+        GlobalMemoryBudget().Release(MemoryPool::kReplay, bytes_);
+    }
+
+    std::string Name() const override {
+        return "replay";
+    }
+
+    void Process(Frame&& frame, const Emit& emit) override {
+        if (!IsEncoded(frame.format)) {
+            throw std::runtime_error("replay buffers encoded frames; add an encode stage before it");
+        }
+        Store(frame);
+        emit(std::move(frame));
+    }
+
+    std::vector<Packet> Snapshot() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return std::vector<Packet>(packets_.begin(), packets_.end());
+    }
+
+    void AddMetrics(Metrics& metrics) const override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const int64_t span = packets_.empty() ? 0 : packets_.back()->timestamp_us - packets_.front()->timestamp_us;
+        metrics.emplace_back("replayMs", span / 1000.0);
+        metrics.emplace_back("replayFrames", static_cast<double>(packets_.size()));
+        metrics.emplace_back("replayBytes", static_cast<double>(bytes_));
+    }
+
+private:
+    void Store(const Frame& frame) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const bool keyframe = frame.keyframe && !frame.recovery_point;
+        if (keyframe) {
+            waiting_for_keyframe_ = false;
+        }
+        if (waiting_for_keyframe_) {
+            return;
+        }
+        const size_t size = frame.data.size();
+        while (!GlobalMemoryBudget().TryCharge(MemoryPool::kReplay, size)) {
+            if (!DropOldestGop(keyframe)) {
+                // Later deltas would reference this packet.
+                waiting_for_keyframe_ = true;
+                return;
+            }
+        }
+        if (keyframe) {
+            keyframe_times_.push_back(frame.timestamp_us);
+        }
+        packets_.push_back(std::make_shared<const Frame>(frame));
+        bytes_ += size;
+        while (keyframe_times_.size() > 1 &&
+               (frame.timestamp_us - keyframe_times_[1] >= options_.duration_us || bytes_ > options_.max_bytes)) {
+            DropOldestGop(false);
+        }
+    }
+
+    // Drops packets up to the second keyframe; the last GOP is kept unless
+    // `incoming_keyframe` starts a new one.
+    bool DropOldestGop(bool incoming_keyframe) {
+        if (keyframe_times_.size() < (incoming_keyframe ? 1u : 2u)) {
+            return false;
+        }
+        do {
+            bytes_ -= packets_.front()->data.size();
+            GlobalMemoryBudget().Release(MemoryPool::kReplay, packets_.front()->data.size());
+            packets_.pop_front();
+        } while (!packets_.empty() && !(packets_.front()->keyframe && !packets_.front()->recovery_point));
+        keyframe_times_.pop_front();
+        return true;
+    }
+
+    ReplayOptions options_;
+    mutable std::mutex mutex_;
+    std::deque<Packet> packets_;
+    std::deque<int64_t> keyframe_times_;
+    size_t bytes_ = 0;
+    bool waiting_for_keyframe_ = true;
+};
+
+// Feeds a replay snapshot through a sink stage, e.g. a muxer writing a file.
+inline void WriteReplay(const std::vector<ReplayStage::Packet>& packets, Stage& sink) {
+    if (packets.empty()) {
+        throw std::runtime_error("The replay buffer is empty");
+    }
+    Stage::Emit discard = [](Frame&&) {};
+    for (const ReplayStage::Packet& packet : packets) {
+        sink.Process(Frame(*packet), discard);
+    }
+    sink.Flush(discard);
+}
+
+}  // namespace screen_recorder
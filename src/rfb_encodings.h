@@ -0,0 +1,650 @@
+#pragma once
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "jpeg_encoder.h"
+
+namespace screen_recorder {
+
+namespace rfb {
+
+enum Encoding : int32_t {
+    kRaw = 0,
+    kCopyRect = 1,
+    kHextile = 5,
+    kTight = 7,
+    kZrle = 16,
+    // Pseudo-encodings -32..-23 request Tight JPEG at quality level 0..9.
+    kQualityLevel0 = -32,
+    kQualityLevel9 = -23,
+};
+
+#ifdef SCREEN_RECORDER_HAVE_JPEG
+constexpr bool kJpegAvailable = true;
+#else
+constexpr bool kJpegAvailable = false;
+#endif
+
+struct Rect {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+};
+
+// The RFB PIXEL_FORMAT structure as negotiated with a client.
+struct WireFormat {
+    uint8_t bits_per_pixel = 32;
+    uint8_t depth = 24;
+    uint8_t big_endian = 0;
+    uint8_t true_colour = 1;
+    uint16_t red_max = 255;
+    uint16_t green_max = 255;
+    uint16_t blue_max = 255;
+    uint8_t red_shift = 16;
+    uint8_t green_shift = 8;
+    uint8_t blue_shift = 0;
+};
+
+// Packed RGB24 pixels as captured; the server's canonical framebuffer.
+struct Surface {
+    const uint8_t* rgb = nullptr;
+    int stride = 0;
+    int width = 0;
+    int height = 0;
+};
+
+inline void Put16(std::vector<uint8_t>& out, uint16_t value) {
+    out.push_back(value >> 8);
+    out.push_back(value & 0xff);
+}
+
+inline void Put32(std::vector<uint8_t>& out, uint32_t value) {
+    Put16(out, value >> 16);
+    Put16(out, value & 0xffff);
+}
+
+inline void PutRectHeader(std::vector<uint8_t>& out, const Rect& rect, int32_t encoding) {
+    Put16(out, static_cast<uint16_t>(rect.x));
+    Put16(out, static_cast<uint16_t>(rect.y));
+    Put16(out, static_cast<uint16_t>(rect.width));
+    Put16(out, static_cast<uint16_t>(rect.height));
+    Put32(out, static_cast<uint32_t>(encoding));
+}
+
+// Maps RGB24 to a client's true-colour pixel values through per-channel tables.
+class PixelWriter {
+public:
+    explicit PixelWriter(const WireFormat& format) : format_(format) {
+        for (int i = 0; i < 256; i++) {
+            red_[i] = static_cast<uint32_t>((i * format.red_max + 127) / 255) << format.red_shift;
+            green_[i] = static_cast<uint32_t>((i * format.green_max + 127) / 255) << format.green_shift;
+            blue_[i] = static_cast<uint32_t>((i * format.blue_max + 127) / 255) << format.blue_shift;
+        }
+        bytes_ = format.bits_per_pixel / 8;
+
+        // CPIXEL/TPIXEL: 32bpp formats whose colour bits fit in three bytes go as three.
+        const uint32_t mask = (static_cast<uint32_t>(format.red_max) << format.red_shift) |
+                              (static_cast<uint32_t>(format.green_max) << format.green_shift) |
+                              (static_cast<uint32_t>(format.blue_max) << format.blue_shift);
+        compact_bytes_ = bytes_;
+        if (format.bits_per_pixel == 32 && format.depth <= 24) {
+            if ((mask & 0xff000000u) == 0) {
+                compact_bytes_ = 3;
+                compact_skip_high_ = true;
+            } else if ((mask & 0xffu) == 0) {
+                compact_bytes_ = 3;
+                compact_skip_high_ = false;
+            }
+        }
+    }
+
+    uint32_t Pixel(const uint8_t* rgb) const {
+        return red_[rgb[0]] | green_[rgb[1]] | blue_[rgb[2]];
+    }
+
+    int Bytes() const { return bytes_; }
+    int CompactBytes() const { return compact_bytes_; }
+
+    void Write(std::vector<uint8_t>& out, uint32_t pixel) const {
+        WriteBytes(out, pixel, bytes_);
+    }
+
+    void WriteCompact(std::vector<uint8_t>& out, uint32_t pixel) const {
+        if (compact_bytes_ == bytes_) {
+            Write(out, pixel);
+        } else {
+            WriteBytes(out, compact_skip_high_ ? pixel : pixel >> 8, 3);
+        }
+    }
+
+    // Gathers a rectangle into client pixel values.
+    void Gather(const Surface& surface, const Rect& rect, std::vector<uint32_t>& pixels) const {
+        pixels.resize(static_cast<size_t>(rect.width) * rect.height);
+        uint32_t* out = pixels.data();
+        for (int y = 0; y < rect.height; y++) {
+            const uint8_t* in = surface.rgb + static_cast<size_t>(rect.y + y) * surface.stride + rect.x * 3;
+            for (int x = 0; x < rect.width; x++, in += 3) {
+                *out++ = Pixel(in);
+            }
+        }
+    }
+
+private:
+    void WriteBytes(std::vector<uint8_t>& out, uint32_t value, int count) const {
+        if (format_.big_endian) {
+            for (int i = count - 1; i >= 0; i--) {
+                out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+            }
+        } else {
+            for (int i = 0; i < count; i++) {
+                out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+            }
+        }
+    }
+
+    WireFormat format_;
+    uint32_t red_[256];
+    uint32_t green_[256];
+    uint32_t blue_[256];
+    int bytes_ = 4;
+    int compact_bytes_ = 4;
+    bool compact_skip_high_ = true;
+};
+
+// Counts distinct values, giving up past `limit`.
+inline bool CollectPalette(const std::vector<uint32_t>& pixels, size_t limit,
+                           std::vector<uint32_t>& palette, std::unordered_map<uint32_t, uint8_t>& index) {
+    palette.clear();
+    index.clear();
+    uint32_t last = 0;
+    bool has_last = false;
+    for (uint32_t pixel : pixels) {
+        if (has_last && pixel == last) {
+            continue;
+        }
+        last = pixel;
+        has_last = true;
+        if (index.find(pixel) == index.end()) {
+            if (palette.size() == limit) {
+                return false;
+            }
+            index.emplace(pixel, static_cast<uint8_t>(palette.size()));
+            palette.push_back(pixel);
+        }
+    }
+    return true;
+}
+
+inline void EncodeRaw(const Surface& surface, const Rect& rect, const PixelWriter& writer,
+                      std::vector<uint8_t>& out) {
+    PutRectHeader(out, rect, kRaw);
+    std::vector<uint32_t> pixels;
+    writer.Gather(surface, rect, pixels);
+    out.reserve(out.size() + pixels.size() * writer.Bytes());
+    for (uint32_t pixel : pixels) {
+        writer.Write(out, pixel);
+    }
+}
+
+inline void EncodeCopyRect(const Rect& rect, int src_x, int src_y, std::vector<uint8_t>& out) {
+    PutRectHeader(out, rect, kCopyRect);
+    Put16(out, static_cast<uint16_t>(src_x));
+    Put16(out, static_cast<uint16_t>(src_y));
+}
+
+namespace detail {
+
+struct Subrect {
+    uint32_t pixel;
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+// Greedy cover of every pixel that differs from `background` by solid rectangles.
+inline void FindSubrects(const uint32_t* pixels, int width, int height, uint32_t background,
+                         std::vector<Subrect>& subrects) {
+    subrects.clear();
+    bool covered[16 * 16] = {};
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const uint32_t pixel = pixels[y * width + x];
+            if (pixel == background || covered[y * 16 + x]) {
+                continue;
+            }
+            int w = 1;
+            while (x + w < width && pixels[y * width + x + w] == pixel && !covered[y * 16 + x + w]) {
+                w++;
+            }
+            int h = 1;
+            for (; y + h < height; h++) {
+                bool row_matches = true;
+                for (int i = 0; i < w && row_matches; i++) {
+                    row_matches = pixels[(y + h) * width + x + i] == pixel && !covered[(y + h) * 16 + x + i];
+                }
+                if (!row_matches) {
+                    break;
+                }
+            }
+            for (int j = 0; j < h; j++) {
+                for (int i = 0; i < w; i++) {
+                    covered[(y + j) * 16 + x + i] = true;
+                }
+            }
+            subrects.push_back({pixel, x, y, w, h});
+        }
+    }
+}
+
+// Persistent deflate stream; RFB clients keep matching inflate state.
+class Deflater {
+public:
+    explicit Deflater(int level = 6) {
+        stream_ = {};
+        if (deflateInit(&stream_, level) != Z_OK) {
+            throw std::runtime_error("Unable to initialize zlib");
+        }
+    }
+
+    ~Deflater() {
+        deflateEnd(&stream_);
+    }
+
+    Deflater(const Deflater&) = delete;
+    Deflater& operator=(const Deflater&) = delete;
+
+    void Compress(const std::vector<uint8_t>& input, std::vector<uint8_t>& output) {
+        output.clear();
+        stream_.next_in = const_cast<Bytef*>(input.data());
+        stream_.avail_in = static_cast<uInt>(input.size());
+        do {
+            size_t used = output.size();
+            output.resize(used + deflateBound(&stream_, static_cast<uLong>(input.size())) + 64);
+            stream_.next_out = output.data() + used;
+            stream_.avail_out = static_cast<uInt>(output.size() - used);
+            if (deflate(&stream_, Z_SYNC_FLUSH) == Z_STREAM_ERROR) {
+                throw std::runtime_error("zlib deflate failed");
+            }
+            output.resize(output.size() - stream_.avail_out);
+        } while (stream_.avail_out == 0);
+    }
+
+    // Starts a fresh stream with no history, for a decoder that joins here.
+    void Reset() {
+        deflateReset(&stream_);
+    }
+
+private:
+    z_stream stream_;
+};
+
+}  // namespace detail
+
+class HextileEncoder {
+public:
+    void Encode(const Surface& surface, const Rect& rect, const PixelWriter& writer, std::vector<uint8_t>& out) {
+        enum { kRawTile = 1, kBackground = 2, kForeground = 4, kAnySubrects = 8, kColoured = 16 };
+        PutRectHeader(out, rect, kHextile);
+        bool background_valid = false;
+        bool foreground_valid = false;
+        uint32_t background = 0;
+        uint32_t foreground = 0;
+        const int bpp = writer.Bytes();
+
+        for (int ty = 0; ty < rect.height; ty += 16) {
+            for (int tx = 0; tx < rect.width; tx += 16) {
+                Rect tile{rect.x + tx, rect.y + ty, std::min(16, rect.width - tx), std::min(16, rect.height - ty)};
+                writer.Gather(surface, tile, pixels_);
+
+                // Most frequent colour becomes the background.
+                counts_.clear();
+                for (uint32_t pixel : pixels_) {
+                    counts_[pixel]++;
+                }
+                uint32_t tile_background = pixels_[0];
+                int best = 0;
+                for (const auto& entry : counts_) {
+                    if (entry.second > best) {
+                        best = entry.second;
+                        tile_background = entry.first;
+                    }
+                }
+
+                uint8_t flags = 0;
+                if (!background_valid || tile_background != background) {
+                    flags |= kBackground;
+                }
+                if (counts_.size() == 1) {
+                    out.push_back(flags);
+                    if (flags & kBackground) {
+                        writer.Write(out, tile_background);
+                    }
+                    background = tile_background;
+                    background_valid = true;
+                    continue;
+                }
+
+                detail::FindSubrects(pixels_.data(), tile.width, tile.height, tile_background, subrects_);
+                const bool coloured = counts_.size() > 2;
+                const uint32_t tile_foreground = coloured ? 0 : subrects_[0].pixel;
+                size_t size = 1 + ((flags & kBackground) ? bpp : 0) + 1 +
+                              subrects_.size() * (coloured ? bpp + 2 : 2);
+                if (!coloured && (!foreground_valid || tile_foreground != foreground)) {
+                    flags |= kForeground;
+                    size += bpp;
+                }
+
+                if (size >= 1 + pixels_.size() * bpp || subrects_.size() > 255) {
+                    out.push_back(kRawTile);
+                    for (uint32_t pixel : pixels_) {
+                        writer.Write(out, pixel);
+                    }
+                    background_valid = false;
+                    foreground_valid = false;
+                    continue;
+                }
+
+                flags |= kAnySubrects | (coloured ? kColoured : 0);
+                out.push_back(flags);
+                if (flags & kBackground) {
+                    writer.Write(out, tile_background);
+                }
+                if (flags & kForeground) {
+                    writer.Write(out, tile_foreground);
+                }
+                out.push_back(static_cast<uint8_t>(subrects_.size()));
+                for (const detail::Subrect& subrect : subrects_) {
+                    if (coloured) {
+                        writer.Write(out, subrect.pixel);
+                    }
+                    out.push_back(static_cast<uint8_t>((subrect.x << 4) | subrect.y));
+                    out.push_back(static_cast<uint8_t>(((subrect.width - 1) << 4) | (subrect.height - 1)));
+                }
+                background = tile_background;
+                background_valid = true;
+                foreground = tile_foreground;
+                foreground_valid = !coloured;
+            }
+        }
+    }
+
+private:
+    std::vector<uint32_t> pixels_;
+    std::unordered_map<uint32_t, int> counts_;
+    std::vector<detail::Subrect> subrects_;
+};
+
+class ZrleEncoder {
+public:
+    void Encode(const Surface& surface, const Rect& rect, const PixelWriter& writer, std::vector<uint8_t>& out) {
+        PutRectHeader(out, rect, kZrle);
+        tiles_.clear();
+        for (int ty = 0; ty < rect.height; ty += 64) {
+            for (int tx = 0; tx < rect.width; tx += 64) {
+                Rect tile{rect.x + tx, rect.y + ty, std::min(64, rect.width - tx), std::min(64, rect.height - ty)};
+                writer.Gather(surface, tile, pixels_);
+                EncodeTile(tile, writer);
+            }
+        }
+        deflater_.Compress(tiles_, compressed_);
+        Put32(out, static_cast<uint32_t>(compressed_.size()));
+        out.insert(out.end(), compressed_.begin(), compressed_.end());
+    }
+
+private:
+    static void PutRunLength(std::vector<uint8_t>& out, size_t length) {
+        length--;
+        while (length >= 255) {
+            out.push_back(255);
+            length -= 255;
+        }
+        out.push_back(static_cast<uint8_t>(length));
+    }
+
+    void EncodeTile(const Rect& tile, const PixelWriter& writer) {
+        const size_t cpixel = writer.CompactBytes();
+        const bool small_palette = CollectPalette(pixels_, 127, palette_, index_);
+
+        if (small_palette && palette_.size() == 1) {
+            tiles_.push_back(1);
+            writer.WriteCompact(tiles_, palette_[0]);
+            return;
+        }
+
+        size_t runs = 0;
+        size_t run_bytes = 0;
+        for (size_t i = 0; i < pixels_.size();) {
+            size_t j = i + 1;
+            while (j < pixels_.size() && pixels_[j] == pixels_[i]) {
+                j++;
+            }
+            runs++;
+            run_bytes += (j - i - 1) / 255 + 1;
+            i = j;
+        }
+
+        const size_t raw_size = pixels_.size() * cpixel;
+        const size_t plain_rle_size = runs * cpixel + run_bytes;
+        size_t packed_size = SIZE_MAX;
+        size_t palette_rle_size = SIZE_MAX;
+        int bits = 0;
+        if (small_palette) {
+            bits = palette_.size() <= 2 ? 1 : palette_.size() <= 4 ? 2 : palette_.size() <= 16 ? 4 : 0;
+            if (bits) {
+                packed_size = palette_.size() * cpixel + tile.height * ((tile.width * bits + 7) / 8);
+            }
+            palette_rle_size = palette_.size() * cpixel + runs + run_bytes;
+        }
+
+        const size_t best = std::min({raw_size, plain_rle_size, packed_size, palette_rle_size});
+        if (best == packed_size) {
+            tiles_.push_back(static_cast<uint8_t>(palette_.size()));
+            for (uint32_t pixel : palette_) {
+                writer.WriteCompact(tiles_, pixel);
+            }
+            for (int y = 0; y < tile.height; y++) {
+                uint8_t byte = 0;
+                int used = 0;
+                for (int x = 0; x < tile.width; x++) {
+                    byte = static_cast<uint8_t>((byte << bits) | index_[pixels_[y * tile.width + x]]);
+                    used += bits;
+                    if (used == 8) {
+                        tiles_.push_back(byte);
+                        byte = 0;
+                        used = 0;
+                    }
+                }
+                if (used) {
+                    tiles_.push_back(static_cast<uint8_t>(byte << (8 - used)));
+                }
+            }
+        } else if (best == palette_rle_size) {
+            tiles_.push_back(static_cast<uint8_t>(128 + palette_.size()));
+            for (uint32_t pixel : palette_) {
+                writer.WriteCompact(tiles_, pixel);
+            }
+            for (size_t i = 0; i < pixels_.size();) {
+                size_t j = i + 1;
+                while (j < pixels_.size() && pixels_[j] == pixels_[i]) {
+                    j++;
+                }
+                const uint8_t index = index_[pixels_[i]];
+                if (j - i == 1) {
+                    tiles_.push_back(index);
+                } else {
+                    tiles_.push_back(index | 128);
+                    PutRunLength(tiles_, j - i);
+                }
+                i = j;
+            }
+        } else if (best == plain_rle_size) {
+            tiles_.push_back(128);
+            for (size_t i = 0; i < pixels_.size();) {
+                size_t j = i + 1;
+                while (j < pixels_.size() && pixels_[j] == pixels_[i]) {
+                    j++;
+                }
+                writer.WriteCompact(tiles_, pixels_[i]);
+                PutRunLength(tiles_, j - i);
+                i = j;
+            }
+        } else {
+            tiles_.push_back(0);
+            for (uint32_t pixel : pixels_) {
+                writer.WriteCompact(tiles_, pixel);
+            }
+        }
+    }
+
+    detail::Deflater deflater_;
+    std::vector<uint32_t> pixels_;
+    std::vector<uint32_t> palette_;
+    std::unordered_map<uint32_t, uint8_t> index_;
+    std::vector<uint8_t> tiles_;
+    std::vector<uint8_t> compressed_;
+};
+
+// Tight with fill, palette and copy filters over persistent zlib streams
+// 0 (full colour), 1 (two colours) and 2 (indexed), plus JPEG when built
+// with libjpeg. Rectangles are split into blocks small enough for every
+// client's decoder limits.
+class TightEncoder {
+public:
+    static constexpr int kBlockSize = 128;
+    static constexpr size_t kMaxPalette = 64;
+
+    // Returns the number of rectangles written.
+    int Encode(const Surface& surface, const Rect& rect, const PixelWriter& writer, std::vector<uint8_t>& out) {
+        int count = 0;
+        for (int by = 0; by < rect.height; by += kBlockSize) {
+            for (int bx = 0; bx < rect.width; bx += kBlockSize) {
+                Rect block{rect.x + bx, rect.y + by, std::min(kBlockSize, rect.width - bx),
+                           std::min(kBlockSize, rect.height - by)};
+                PutRectHeader(out, block, kTight);
+                writer.Gather(surface, block, pixels_);
+                EncodeBlock(block, writer, out);
+                count++;
+            }
+        }
+        return count;
+    }
+
+    static constexpr int kJpegBlockSize = 2048;
+
+#ifdef SCREEN_RECORDER_HAVE_JPEG
+    // Tight JPEG for natural-image content, at a client quality level 0..9
+    // mapped to libjpeg qualities as TigerVNC and TurboVNC do. Returns the
+    // number of rectangles written.
+    int EncodeJpeg(const Surface& surface, const Rect& rect, int quality_level, std::vector<uint8_t>& out) {
+        static constexpr int kQualities[10] = {15, 29, 41, 42, 62, 77, 79, 86, 92, 100};
+        int count = 0;
+        for (int by = 0; by < rect.height; by += kJpegBlockSize) {
+            for (int bx = 0; bx < rect.width; bx += kJpegBlockSize) {
+                Rect block{rect.x + bx, rect.y + by, std::min(kJpegBlockSize, rect.width - bx),
+                           std::min(kJpegBlockSize, rect.height - by)};
+                jpeg_.Compress(surface.rgb + static_cast<size_t>(block.y) * surface.stride + block.x * 3,
+                               surface.stride, block.width, block.height, kQualities[quality_level], compressed_);
+                PutRectHeader(out, block, kTight);
+                out.push_back(0x90);
+                PutCompactLength(out, compressed_.size());
+                out.insert(out.end(), compressed_.begin(), compressed_.end());
+                count++;
+            }
+        }
+        return count;
+    }
+#endif
+
+protected:
+    void EncodeBlock(const Rect& block, const PixelWriter& writer, std::vector<uint8_t>& out) {
+        const bool has_palette = CollectPalette(pixels_, kMaxPalette, palette_, index_);
+        if (has_palette && palette_.size() == 1) {
+            out.push_back(0x80);
+            writer.WriteCompact(out, palette_[0]);
+            return;
+        }
+
+        data_.clear();
+        if (has_palette) {
+            const int stream = palette_.size() == 2 ? 1 : 2;
+            out.push_back(static_cast<uint8_t>((stream << 4) | 0x40));
+            out.push_back(1);  // palette filter
+            out.push_back(static_cast<uint8_t>(palette_.size() - 1));
+            for (uint32_t pixel : palette_) {
+                writer.WriteCompact(out, pixel);
+            }
+            if (palette_.size() == 2) {
+                for (int y = 0; y < block.height; y++) {
+                    uint8_t byte = 0;
+                    int used = 0;
+                    for (int x = 0; x < block.width; x++) {
+                        byte = static_cast<uint8_t>((byte << 1) | index_[pixels_[y * block.width + x]]);
+                        if (++used == 8) {
+                            data_.push_back(byte);
+                            byte = 0;
+                            used = 0;
+                        }
+                    }
+                    if (used) {
+                        data_.push_back(static_cast<uint8_t>(byte << (8 - used)));
+                    }
+                }
+            } else {
+                for (uint32_t pixel : pixels_) {
+                    data_.push_back(index_[pixel]);
+                }
+            }
+            PutData(stream, out);
+            return;
+        }
+
+        out.push_back(0x00);  // stream 0, copy filter
+        for (uint32_t pixel : pixels_) {
+            writer.WriteCompact(data_, pixel);
+        }
+        PutData(0, out);
+    }
+
+    // Payloads under 12 bytes go uncompressed, as the protocol requires.
+    void PutData(int stream, std::vector<uint8_t>& out) {
+        if (data_.size() < 12) {
+            out.insert(out.end(), data_.begin(), data_.end());
+            return;
+        }
+        streams_[stream].Compress(data_, compressed_);
+        PutCompactLength(out, compressed_.size());
+        out.insert(out.end(), compressed_.begin(), compressed_.end());
+    }
+
+    static void PutCompactLength(std::vector<uint8_t>& out, size_t length) {
+        out.push_back(static_cast<uint8_t>((length & 0x7f) | (length > 0x7f ? 0x80 : 0)));
+        if (length > 0x7f) {
+            out.push_back(static_cast<uint8_t>(((length >> 7) & 0x7f) | (length > 0x3fff ? 0x80 : 0)));
+            if (length > 0x3fff) {
+                out.push_back(static_cast<uint8_t>(length >> 14));
+            }
+        }
+    }
+
+    detail::Deflater streams_[3];
+#ifdef SCREEN_RECORDER_HAVE_JPEG
+    JpegCompressor jpeg_;
+#endif
+    std::vector<uint32_t> pixels_;
+    std::vector<uint32_t> palette_;
+    std::unordered_map<uint32_t, uint8_t> index_;
+    std::vector<uint8_t> data_;
+    std::vector<uint8_t> compressed_;
+};
+
+}  // namespace rfb
+
+}  // namespace screen_recorder
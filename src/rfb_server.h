@@ -0,0 +1,1116 @@
+#pragma once
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "classify.h"
+#include "convert.h"
+#include "frame.h"
+#include "hash.h"
+#include "memory_budget.h"
+#include "motion.h"
+#include "pipeline.h"
+#include "rfb_encodings.h"
+
+namespace screen_recorder {
+
+namespace rfb {
+
+#ifdef _WIN32
+using Socket = SOCKET;
+constexpr Socket kInvalidSocket = INVALID_SOCKET;
+
+inline void CloseSocket(Socket socket) {
+    closesocket(socket);
+}
+
+inline void InitSockets() {
+    static const bool initialized = [] {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+    if (!initialized) {
+        throw std::runtime_error("Unable to initialize Winsock");
+    }
+}
+#else
+using Socket = int;
+constexpr Socket kInvalidSocket = -1;
+
+inline void CloseSocket(Socket socket) {
+    close(socket);
+}
+
+inline void InitSockets() {}
+#endif
+
+#ifdef MSG_NOSIGNAL
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+
+constexpr int32_t kDesktopSize = -223;
+constexpr int kTileSize = 16;
+
+inline bool SendAll(Socket socket, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        int chunk = static_cast<int>(std::min<size_t>(size, 1 << 20));
+        int sent = send(socket, reinterpret_cast<const char*>(data), chunk, kSendFlags);
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+inline bool ReadExact(Socket socket, uint8_t* data, size_t size) {
+    while (size > 0) {
+        int received = recv(socket, reinterpret_cast<char*>(data), static_cast<int>(size), 0);
+        if (received <= 0) {
+            return false;
+        }
+        data += received;
+        size -= received;
+    }
+    return true;
+}
+
+inline uint16_t Get16(const uint8_t* data) {
+    return static_cast<uint16_t>((data[0] << 8) | data[1]);
+}
+
+inline uint32_t Get32(const uint8_t* data) {
+    return (static_cast<uint32_t>(Get16(data)) << 16) | Get16(data + 2);
+}
+
+// A captured frame as RGB24 with a hash per 16x16 tile, and which tiles hold
+// natural-image content when JPEG is available. Published once and
+// shared read-only by every client. `moves` are the scrolled regions since the
+// previously published frame, whose tile hashes are kept so a client can tell
+// whether it shows that frame where the moves read from.
+struct SharedFrame {
+    Frame frame;
+    int columns = 0;
+    int rows = 0;
+    std::vector<uint64_t> tile_hashes;
+    std::vector<uint8_t> tile_uniform;
+    std::vector<uint8_t> tile_natural;
+    std::vector<Move> moves;
+    std::vector<uint64_t> previous_tile_hashes;
+    uint64_t version = 0;
+    MemoryCharge memory;
+
+    Rect TileRect(int column, int row) const {
+        int x = column * kTileSize;
+        int y = row * kTileSize;
+        return {x, y, std::min(kTileSize, frame.width - x), std::min(kTileSize, frame.height - y)};
+    }
+};
+
+// Tiles whose hash matches `previous` keep its classification, so only
+// changed tiles are classified.
+inline void HashTiles(SharedFrame& shared, const SharedFrame* previous) {
+    const Frame& frame = shared.frame;
+    shared.columns = (frame.width + kTileSize - 1) / kTileSize;
+    shared.rows = (frame.height + kTileSize - 1) / kTileSize;
+    shared.tile_hashes.resize(static_cast<size_t>(shared.columns) * shared.rows);
+    shared.tile_uniform.resize(shared.tile_hashes.size());
+    shared.tile_natural.assign(kJpegAvailable ? shared.tile_hashes.size() : 0, 0);
+    if (previous && (previous->frame.width != frame.width || previous->frame.height != frame.height)) {
+        previous = nullptr;
+    }
+    for (int row = 0; row < shared.rows; row++) {
+        for (int column = 0; column < shared.columns; column++) {
+            Rect tile = shared.TileRect(column, row);
+            size_t index = static_cast<size_t>(row) * shared.columns + column;
+            shared.tile_hashes[index] = HashRect(frame.data.data(), frame.stride, tile.x, tile.y,
+                                                 tile.width, tile.height, 3);
+            const uint8_t* first = frame.data.data() + static_cast<size_t>(tile.y) * frame.stride + tile.x * 3;
+            bool uniform = true;
+            for (int x = 1; x < tile.width && uniform; x++) {
+                uniform = std::memcmp(first, first + x * 3, 3) == 0;
+            }
+            for (int y = 1; y < tile.height && uniform; y++) {
+                uniform = std::memcmp(first, first + static_cast<size_t>(y) * frame.stride, tile.width * 3) == 0;
+            }
+            shared.tile_uniform[index] = uniform;
+            if (kJpegAvailable && !uniform) {
+                shared.tile_natural[index] = previous && previous->tile_hashes[index] == shared.tile_hashes[index]
+                    ? previous->tile_natural[index]
+                    : ClassifyTile(first, frame.stride, tile.width, tile.height, 3) == TileContent::kNatural;
+            }
+        }
+    }
+}
+
+// Runs of masked tiles per row, merged with identical runs directly above.
+inline std::vector<Rect> MergeDamage(const SharedFrame& shared, const std::vector<uint8_t>& mask, int first_column,
+                                     int last_column, int first_row, int last_row) {
+    std::vector<Rect> damage;
+    std::vector<size_t> open;
+    for (int row = first_row; row <= last_row; row++) {
+        std::vector<size_t> still_open;
+        for (int column = first_column; column <= last_column;) {
+            size_t index = static_cast<size_t>(row) * shared.columns + column;
+            if (!mask[index]) {
+                column++;
+                continue;
+            }
+            int end = column;
+            while (end + 1 <= last_column && mask[index + (end + 1 - column)]) {
+                end++;
+            }
+            Rect rect{column * kTileSize, row * kTileSize, (end - column + 1) * kTileSize, kTileSize};
+            auto above = std::find_if(open.begin(), open.end(), [&](size_t i) {
+                return damage[i].x == rect.x && damage[i].width == rect.width &&
+                       damage[i].y + damage[i].height == rect.y;
+            });
+            if (above != open.end()) {
+                damage[*above].height += kTileSize;
+                still_open.push_back(*above);
+            } else {
+                still_open.push_back(damage.size());
+                damage.push_back(rect);
+            }
+            column = end + 1;
+        }
+        open.swap(still_open);
+    }
+    if (damage.size() > 4096) {
+        damage.assign(1, {first_column * kTileSize, first_row * kTileSize,
+                          (last_column - first_column + 1) * kTileSize, (last_row - first_row + 1) * kTileSize});
+    }
+    return damage;
+}
+
+// The rectangle count of a FramebufferUpdate is 16 bits.
+constexpr size_t kMaxUpdateRects = 65535;
+
+// A damaged rectangle and how it is sent: JPEG, or lossless in `encoding`.
+struct DamageRect {
+    Rect rect;
+    int32_t encoding = kRaw;
+    bool jpeg = false;
+};
+
+// Rectangles written for `damage` once Tight has split it into blocks.
+inline size_t UpdateRects(const DamageRect& damage) {
+    if (damage.encoding != kTight) {
+        return 1;
+    }
+    const int block = damage.jpeg ? TightEncoder::kJpegBlockSize : TightEncoder::kBlockSize;
+    return static_cast<size_t>((damage.rect.width + block - 1) / block) * ((damage.rect.height + block - 1) / block);
+}
+
+// Keeps `damage` within `budget` rectangles, at least one: past it the damage
+// is sent as one lossless bounding rectangle, and as Raw if Tight would still
+// split that into too many blocks.
+inline void FitDamage(std::vector<DamageRect>& damage, size_t budget) {
+    size_t rects = 0;
+    for (const DamageRect& rect : damage) {
+        rects += UpdateRects(rect);
+    }
+    if (rects <= budget) {
+        return;
+    }
+    int left = damage.front().rect.x;
+    int top = damage.front().rect.y;
+    int right = left;
+    int bottom = top;
+    for (const DamageRect& rect : damage) {
+        left = std::min(left, rect.rect.x);
+        top = std::min(top, rect.rect.y);
+        right = std::max(right, rect.rect.x + rect.rect.width);
+        bottom = std::max(bottom, rect.rect.y + rect.rect.height);
+    }
+    // JPEG goes only to Tight viewers, so every rectangle has one encoding.
+    DamageRect bounds{{left, top, right - left, bottom - top}, damage.front().encoding, false};
+    if (UpdateRects(bounds) > budget) {
+        bounds.encoding = kRaw;
+    }
+    damage.assign(1, bounds);
+}
+
+struct ServerOptions {
+    std::string host = "127.0.0.1";
+    int port = 5900;
+    std::string name = "screen-recorder";
+};
+
+struct ServerStats {
+    size_t clients = 0;
+    uint64_t frames_captured = 0;
+    uint64_t updates_sent = 0;
+    uint64_t rects_sent = 0;
+    uint64_t copy_rects_sent = 0;
+    uint64_t bytes_sent = 0;
+    int port = 0;
+    // Name of the running capture source, e.g. "capture(fifo)".
+    std::string capture;
+    std::string error;
+};
+
+// An RFB 3.8 server (also accepting 3.3 and 3.7 viewers) with no
+// authentication. One capture source is shared by every connected client and
+// only runs while at least one is connected. Each client tracks the tile
+// hashes of what it was last sent, so updates carry only damaged tiles, and
+// tiles that reappear elsewhere on screen go as CopyRect.
+class Server {
+public:
+    using SourceFactory = std::function<std::unique_ptr<SourceStage>()>;
+
+    Server(ServerOptions options, SourceFactory factory)
+        : options_(std::move(options)), factory_(std::move(factory)) {}
+
+    ~Server() {
+        Stop();
+    }
+
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    void Start() {
+        if (running_) {
+            return;
+        }
+        InitSockets();
+        Socket listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (listener == kInvalidSocket) {
+            throw std::runtime_error("Unable to create a listening socket");
+        }
+        int reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast<uint16_t>(options_.port));
+        if (inet_pton(AF_INET, options_.host.c_str(), &address.sin_addr) != 1) {
+            CloseSocket(listener);
+            throw std::runtime_error("Invalid listen address '" + options_.host + "'");
+        }
+        if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(listener, 8) != 0) {
+            CloseSocket(listener);
+            throw std::runtime_error("Unable to listen on " + options_.host + ":" + std::to_string(options_.port));
+        }
+        socklen_t length = sizeof(address);
+        getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length);
+        port_ = ntohs(address.sin_port);
+
+        listener_ = listener;
+        running_ = true;
+        accept_thread_ = std::thread(&Server::AcceptLoop, this);
+        capture_thread_ = std::thread(&Server::CaptureLoop, this);
+    }
+
+    void Stop() {
+        if (!running_.exchange(false)) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto& client : clients_) {
+                client->closed = true;
+                shutdown(client->socket, 2);
+            }
+        }
+        cv_.notify_all();
+        accept_thread_.join();
+        capture_thread_.join();
+        for (auto& client : clients_) {
+            client->thread.join();
+            CloseSocket(client->socket);
+        }
+        clients_.clear();
+        CloseSocket(listener_);
+        current_.reset();
+    }
+
+    bool IsRunning() const {
+        return running_;
+    }
+
+    ServerStats Stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ServerStats stats;
+        stats.clients = active_clients_;
+        stats.frames_captured = frames_captured_;
+        stats.updates_sent = updates_sent_;
+        stats.rects_sent = rects_sent_;
+        stats.copy_rects_sent = copy_rects_sent_;
+        stats.bytes_sent = bytes_sent_;
+        stats.port = port_;
+        stats.capture = capture_name_;
+        stats.error = error_;
+        return stats;
+    }
+
+private:
+    struct Request {
+        bool incremental = false;
+        Rect area;
+    };
+
+    struct Client {
+        Socket socket = kInvalidSocket;
+        std::thread thread;
+        std::atomic<bool> finished{false};
+
+        // Guarded by Server::mutex_.
+        bool closed = false;
+        WireFormat format;
+        std::vector<int32_t> encodings;
+        std::optional<Request> request;
+        uint64_t version = 0;
+        int width = 0;
+        int height = 0;
+        bool resize_pending = false;
+
+        // Writer state: tile hashes of what the viewer currently shows.
+        std::vector<uint64_t> shown;
+        std::vector<uint8_t> shown_valid;
+        std::unique_ptr<HextileEncoder> hextile;
+        std::unique_ptr<ZrleEncoder> zrle;
+        std::unique_ptr<TightEncoder> tight;
+    };
+
+    void AcceptLoop() {
+        while (running_) {
+            fd_set readable;
+            FD_ZERO(&readable);
+            FD_SET(listener_, &readable);
+            timeval timeout = {0, 200000};
+            int ready = select(static_cast<int>(listener_) + 1, &readable, nullptr, nullptr, &timeout);
+            ReapClients();
+            if (ready <= 0) {
+                continue;
+            }
+            Socket socket = accept(listener_, nullptr, nullptr);
+            if (socket == kInvalidSocket) {
+                continue;
+            }
+            int nodelay = 1;
+            setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&nodelay), sizeof(nodelay));
+#ifdef SO_NOSIGPIPE
+            int nosigpipe = 1;
+            setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &nosigpipe, sizeof(nosigpipe));
+#endif
+            auto client = std::make_shared<Client>();
+            client->socket = socket;
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!running_) {
+                CloseSocket(socket);
+                break;
+            }
+            clients_.push_back(client);
+            client->thread = std::thread(&Server::Serve, this, client);
+        }
+    }
+
+    void ReapClients() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = clients_.begin(); it != clients_.end();) {
+            if ((*it)->finished) {
+                (*it)->thread.join();
+                CloseSocket((*it)->socket);
+                it = clients_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // Runs the source while anyone is watching and publishes each changed frame.
+    void CaptureLoop() {
+        std::unique_ptr<SourceStage> source;
+        std::shared_ptr<const SharedFrame> previous;
+        uint64_t version = 0;
+        Frame captured;
+        while (running_) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                if (active_clients_ == 0) {
+                    source.reset();
+                    previous.reset();
+                    current_.reset();
+                    cv_.wait_for(lock, std::chrono::milliseconds(200));
+                    continue;
+                }
+            }
+            try {
+                const bool fresh = !source;
+                if (fresh) {
+                    source = factory_();
+                }
+                if (!source->Produce(captured)) {
+                    source.reset();
+                    continue;
+                }
+                if (fresh) {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    capture_name_ = source->Name();
+                }
+                auto shared = std::make_shared<SharedFrame>();
+                ConvertToRGB24(captured, shared->frame);
+                shared->memory = MemoryCharge(MemoryPool::kVnc, shared->frame.data.capacity());
+                HashTiles(*shared, previous.get());
+                bool resized = !previous || previous->frame.width != shared->frame.width ||
+                               previous->frame.height != shared->frame.height;
+                bool changed = resized || previous->tile_hashes != shared->tile_hashes;
+                if (changed && !resized) {
+                    shared->moves = DetectMoves(previous->frame, shared->frame);
+                    if (!shared->moves.empty()) {
+                        shared->previous_tile_hashes = previous->tile_hashes;
+                    }
+                }
+                std::lock_guard<std::mutex> lock(mutex_);
+                frames_captured_++;
+                if (changed) {
+                    shared->version = ++version;
+                    previous = shared;
+                    current_ = std::move(shared);
+                    cv_.notify_all();
+                }
+            } catch (const std::exception& e) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    error_ = e.what();
+                }
+                source.reset();
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+            }
+        }
+    }
+
+    // A failure while serving one viewer (an allocation, an encoder error)
+    // closes that viewer only; escaping the thread would end the process.
+    void Serve(std::shared_ptr<Client> client) {
+        bool counted = false;
+        std::thread writer;
+        try {
+            if (Handshake(*client)) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    active_clients_++;
+                    counted = true;
+                }
+                cv_.notify_all();
+                if (SendServerInit(*client)) {
+                    writer = std::thread(&Server::WriteLoop, this, client);
+                    ReadLoop(*client);
+                }
+            }
+        } catch (const std::exception& e) {
+            RecordClientError(e);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            client->closed = true;
+            if (counted) {
+                active_clients_--;
+            }
+        }
+        cv_.notify_all();
+        shutdown(client->socket, 2);
+        if (writer.joinable()) {
+            writer.join();
+        }
+        client->finished = true;
+    }
+
+    bool Handshake(Client& client) {
+        const char* version = "RFB 003.008\n";
+        uint8_t reply[12];
+        if (!SendAll(client.socket, reinterpret_cast<const uint8_t*>(version), 12) ||
+            !ReadExact(client.socket, reply, 12) || std::memcmp(reply, "RFB 003.", 8) != 0) {
+            return false;
+        }
+        int minor = (reply[8] - '0') * 100 + (reply[9] - '0') * 10 + (reply[10] - '0');
+        if (minor < 7) {
+            uint8_t security[4] = {0, 0, 0, 1};
+            if (!SendAll(client.socket, security, 4)) {
+                return false;
+            }
+        } else {
+            uint8_t types[2] = {1, 1};
+            uint8_t chosen = 0;
+            if (!SendAll(client.socket, types, 2) || !ReadExact(client.socket, &chosen, 1) || chosen != 1) {
+                return false;
+            }
+            if (minor >= 8) {
+                uint8_t result[4] = {0, 0, 0, 0};
+                if (!SendAll(client.socket, result, 4)) {
+                    return false;
+                }
+            }
+        }
+        uint8_t shared_flag = 0;
+        return ReadExact(client.socket, &shared_flag, 1);
+    }
+
+    // ServerInit needs the framebuffer size, so it waits for the first frame.
+    bool SendServerInit(Client& client) {
+        std::shared_ptr<const SharedFrame> frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait_for(lock, std::chrono::seconds(10), [&] { return current_ || client.closed || !running_; });
+            frame = current_;
+            if (!frame) {
+                return false;
+            }
+            client.width = frame->frame.width;
+            client.height = frame->frame.height;
+        }
+        std::vector<uint8_t> init;
+        Put16(init, static_cast<uint16_t>(client.width));
+        Put16(init, static_cast<uint16_t>(client.height));
+        const WireFormat& format = client.format;
+        init.push_back(format.bits_per_pixel);
+        init.push_back(format.depth);
+        init.push_back(format.big_endian);
+        init.push_back(format.true_colour);
+        Put16(init, format.red_max);
+        Put16(init, format.green_max);
+        Put16(init, format.blue_max);
+        init.push_back(format.red_shift);
+        init.push_back(format.green_shift);
+        init.push_back(format.blue_shift);
+        init.insert(init.end(), 3, 0);
+        Put32(init, static_cast<uint32_t>(options_.name.size()));
+        init.insert(init.end(), options_.name.begin(), options_.name.end());
+        return SendAll(client.socket, init.data(), init.size());
+    }
+
+    void ReadLoop(Client& client) {
+        uint8_t buffer[20];
+        while (running_) {
+            uint8_t type = 0;
+            if (!ReadExact(client.socket, &type, 1)) {
+                return;
+            }
+            if (type == 0) {  // SetPixelFormat
+                if (!ReadExact(client.socket, buffer, 19)) {
+                    return;
+                }
+                const uint8_t* p = buffer + 3;
+                WireFormat format;
+                format.bits_per_pixel = p[0];
+                format.depth = p[1];
+                format.big_endian = p[2];
+                format.true_colour = p[3];
+                format.red_max = Get16(p + 4);
+                format.green_max = Get16(p + 6);
+                format.blue_max = Get16(p + 8);
+                format.red_shift = p[10];
+                format.green_shift = p[11];
+                format.blue_shift = p[12];
+                if (!format.true_colour ||
+                    (format.bits_per_pixel != 8 && format.bits_per_pixel != 16 && format.bits_per_pixel != 32)) {
+                    return;
+                }
+                std::lock_guard<std::mutex> lock(mutex_);
+                client.format = format;
+            } else if (type == 2) {  // SetEncodings
+                if (!ReadExact(client.socket, buffer, 3)) {
+                    return;
+                }
+                std::vector<uint8_t> data(static_cast<size_t>(Get16(buffer + 1)) * 4);
+                if (!ReadExact(client.socket, data.data(), data.size())) {
+                    return;
+                }
+                std::vector<int32_t> encodings;
+                for (size_t i = 0; i < data.size(); i += 4) {
+                    encodings.push_back(static_cast<int32_t>(Get32(data.data() + i)));
+                }
+                std::lock_guard<std::mutex> lock(mutex_);
+                client.encodings = std::move(encodings);
+            } else if (type == 3) {  // FramebufferUpdateRequest
+                if (!ReadExact(client.socket, buffer, 9)) {
+                    return;
+                }
+                Request request;
+                request.incremental = buffer[0] != 0;
+                request.area = {Get16(buffer + 1), Get16(buffer + 3), Get16(buffer + 5), Get16(buffer + 7)};
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (client.request && !client.request->incremental) {
+                        request.incremental = false;
+                    }
+                    client.request = request;
+                }
+                cv_.notify_all();
+            } else if (type == 4) {  // KeyEvent, ignored
+                if (!ReadExact(client.socket, buffer, 7)) {
+                    return;
+                }
+            } else if (type == 5) {  // PointerEvent, ignored
+                if (!ReadExact(client.socket, buffer, 5)) {
+                    return;
+                }
+            } else if (type == 6) {  // ClientCutText, ignored
+                if (!ReadExact(client.socket, buffer, 7)) {
+                    return;
+                }
+                // The length comes from an unauthenticated peer; skip the
+                // text a buffer at a time rather than allocating it.
+                uint8_t discard[4096];
+                uint32_t remaining = Get32(buffer + 3);
+                while (remaining > 0) {
+                    const uint32_t chunk = std::min<uint32_t>(remaining, sizeof(discard));
+                    if (!ReadExact(client.socket, discard, chunk)) {
+                        return;
+                    }
+                    remaining -= chunk;
+                }
+            } else {
+                return;
+            }
+        }
+    }
+
+    void WriteLoop(std::shared_ptr<Client> client) {
+        try {
+            WriteUpdates(client);
+        } catch (const std::exception& e) {
+            RecordClientError(e);
+        }
+        // Wakes the reader so Serve() can finish with this viewer.
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            client->closed = true;
+        }
+        cv_.notify_all();
+        shutdown(client->socket, 2);
+    }
+
+    void RecordClientError(const std::exception& e) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        error_ = std::string("viewer: ") + e.what();
+    }
+
+    void WriteUpdates(const std::shared_ptr<Client>& client) {
+        std::vector<uint8_t> message;
+        while (true) {
+            Request request;
+            std::shared_ptr<const SharedFrame> frame;
+            WireFormat format;
+            std::vector<int32_t> encodings;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [&] {
+                    return client->closed || (client->request && current_ &&
+                                              (!client->request->incremental || current_->version != client->version));
+                });
+                if (client->closed) {
+                    return;
+                }
+                request = *client->request;
+                client->request.reset();
+                frame = current_;
+                format = client->format;
+                encodings = client->encodings;
+            }
+
+            bool desktop_size = std::find(encodings.begin(), encodings.end(), kDesktopSize) != encodings.end();
+            if (frame->frame.width != client->width || frame->frame.height != client->height) {
+                if (!desktop_size) {
+                    // The viewer cannot follow a resolution change; hold the request.
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    client->version = frame->version;
+                    if (!client->request) {
+                        client->request = request;
+                    }
+                    continue;
+                }
+                client->width = frame->frame.width;
+                client->height = frame->frame.height;
+                client->shown.clear();
+                message.clear();
+                message.push_back(0);
+                message.push_back(0);
+                Put16(message, 1);
+                PutRectHeader(message, {0, 0, client->width, client->height}, kDesktopSize);
+                if (!SendAll(client->socket, message.data(), message.size())) {
+                    return;
+                }
+                std::lock_guard<std::mutex> lock(mutex_);
+                client->version = 0;
+                bytes_sent_ += message.size();
+                updates_sent_++;
+                continue;
+            }
+
+            size_t copies = 0;
+            size_t rects = BuildUpdate(*client, *frame, request, format, encodings, message, copies);
+            if (rects == 0 && request.incremental) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                client->version = frame->version;
+                if (!client->request) {
+                    client->request = request;
+                }
+                continue;
+            }
+            if (!SendAll(client->socket, message.data(), message.size())) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            client->version = frame->version;
+            updates_sent_++;
+            rects_sent_ += rects;
+            copy_rects_sent_ += copies;
+            bytes_sent_ += message.size();
+        }
+    }
+
+    // Encodes the damaged part of `request` into a FramebufferUpdate message
+    // and returns its rectangle count.
+    size_t BuildUpdate(Client& client, const SharedFrame& shared, const Request& request, const WireFormat& format,
+                       const std::vector<int32_t>& encodings, std::vector<uint8_t>& message, size_t& copies) {
+        const Frame& frame = shared.frame;
+        Rect area = request.area;
+        area.width = std::max(0, std::min(area.x + area.width, frame.width) - area.x);
+        area.height = std::max(0, std::min(area.y + area.height, frame.height) - area.y);
+        message.assign(4, 0);
+        if (area.width == 0 || area.height == 0) {
+            return 0;
+        }
+
+        const size_t tiles = shared.tile_hashes.size();
+        if (client.shown.size() != tiles) {
+            client.shown.assign(tiles, 0);
+            client.shown_valid.assign(tiles, 0);
+        }
+
+        int32_t encoding = kRaw;
+        bool copy_rect = false;
+        int quality_level = -1;
+        for (int32_t candidate : encodings) {
+            if (candidate == kCopyRect) {
+                copy_rect = request.incremental;
+            } else if (encoding == kRaw &&
+                       (candidate == kTight || candidate == kZrle || candidate == kHextile)) {
+                encoding = candidate;
+            } else if (quality_level < 0 && candidate >= kQualityLevel0 && candidate <= kQualityLevel9) {
+                quality_level = candidate - kQualityLevel0;
+            }
+        }
+        // Natural-image tiles go lossy only to Tight viewers that asked for
+        // JPEG; text and UI always stay lossless.
+        const bool jpeg = kJpegAvailable && encoding == kTight && quality_level >= 0 &&
+                          format.bits_per_pixel == 32;
+
+        // Tiles touching the request that the viewer does not already show.
+        const int first_column = area.x / kTileSize;
+        const int last_column = (area.x + area.width - 1) / kTileSize;
+        const int first_row = area.y / kTileSize;
+        const int last_row = (area.y + area.height - 1) / kTileSize;
+        std::vector<uint8_t> dirty(tiles, 0);
+        bool any_dirty = false;
+        for (int row = first_row; row <= last_row; row++) {
+            for (int column = first_column; column <= last_column; column++) {
+                size_t index = static_cast<size_t>(row) * shared.columns + column;
+                if (!request.incremental || !client.shown_valid[index] ||
+                    client.shown[index] != shared.tile_hashes[index]) {
+                    dirty[index] = 1;
+                    any_dirty = true;
+                }
+            }
+        }
+        if (!any_dirty) {
+            return 0;
+        }
+
+        // Copies leave room for at least one damage rectangle.
+        constexpr size_t kMaxCopyRects = kMaxUpdateRects - 1;
+        size_t count = 0;
+
+        // Scrolled regions go first, copied at pixel precision from where the
+        // previous frame had them, provided the viewer shows that frame there.
+        // The tile copies below then only see what the moves left damaged.
+        if (copy_rect) {
+            for (const Move& move : shared.moves) {
+                Rect destination{move.x, move.y, move.width, move.height};
+                if (count == kMaxCopyRects || !Contains(area, destination) ||
+                    !ShowsTiles(client, shared, {move.source_x, move.source_y, move.width, move.height},
+                                shared.previous_tile_hashes)) {
+                    continue;
+                }
+                EncodeCopyRect(destination, move.source_x, move.source_y, message);
+                ForEachTile(shared, destination, [&](size_t index, const Rect& tile) {
+                    if (Contains(destination, tile)) {
+                        dirty[index] = 0;
+                        client.shown[index] = shared.tile_hashes[index];
+                        client.shown_valid[index] = 1;
+                    } else if (client.shown[index] != shared.tile_hashes[index]) {
+                        client.shown_valid[index] = 0;
+                    }
+                });
+                count++;
+                copies++;
+            }
+        }
+
+        // Damaged tiles whose content the viewer already shows elsewhere are
+        // copied from there. Scrolling needs the copies ordered against the
+        // direction of motion, so both row orders are planned and the one
+        // that copies more tiles wins.
+        if (copy_rect) {
+            std::unordered_map<uint64_t, size_t> sources;
+            for (int row = 0; row < shared.rows; row++) {
+                for (int column = 0; column < shared.columns; column++) {
+                    size_t index = static_cast<size_t>(row) * shared.columns + column;
+                    Rect tile = shared.TileRect(column, row);
+                    if (client.shown_valid[index] && tile.width == kTileSize && tile.height == kTileSize) {
+                        sources.emplace(client.shown[index], index);
+                    }
+                }
+            }
+            std::vector<Copy> plan;
+            if (!sources.empty()) {
+                std::vector<Copy> top_down = PlanCopies(client, shared, area, dirty, sources, false);
+                std::vector<Copy> bottom_up = PlanCopies(client, shared, area, dirty, sources, true);
+                plan = CopiedTiles(bottom_up) > CopiedTiles(top_down) ? std::move(bottom_up) : std::move(top_down);
+            }
+            // Tiles left out stay dirty and go with the damage below. No copy
+            // reads what a later one writes, so the plan can be cut anywhere.
+            plan.resize(std::min(plan.size(), kMaxCopyRects - count));
+            for (const Copy& copy : plan) {
+                Rect tile = shared.TileRect(static_cast<int>(copy.destination % shared.columns),
+                                            static_cast<int>(copy.destination / shared.columns));
+                EncodeCopyRect({tile.x, tile.y, copy.run * kTileSize, kTileSize},
+                               static_cast<int>(copy.source % shared.columns) * kTileSize,
+                               static_cast<int>(copy.source / shared.columns) * kTileSize, message);
+                for (int i = 0; i < copy.run; i++) {
+                    dirty[copy.destination + i] = 0;
+                    client.shown[copy.destination + i] = shared.tile_hashes[copy.destination + i];
+                    client.shown_valid[copy.destination + i] = 1;
+                }
+                count++;
+                copies++;
+            }
+        }
+
+        // Natural-image tiles are split off for JPEG; the rest stays lossless.
+        std::vector<uint8_t> lossless = dirty;
+        std::vector<uint8_t> natural;
+        if (jpeg) {
+            natural.assign(tiles, 0);
+            for (size_t index = 0; index < tiles; index++) {
+                if (dirty[index] && shared.tile_natural[index]) {
+                    natural[index] = 1;
+                    lossless[index] = 0;
+                }
+            }
+        }
+
+        std::vector<DamageRect> damage;
+        if (jpeg) {
+            for (const Rect& rect : MergeDamage(shared, natural, first_column, last_column, first_row, last_row)) {
+                damage.push_back({Intersect(rect, area), kTight, true});
+            }
+        }
+        for (const Rect& rect : MergeDamage(shared, lossless, first_column, last_column, first_row, last_row)) {
+            damage.push_back({Intersect(rect, area), encoding, false});
+        }
+        damage.erase(std::remove_if(damage.begin(), damage.end(),
+                                    [](const DamageRect& rect) { return rect.rect.width == 0 || rect.rect.height == 0; }),
+                     damage.end());
+        if (!damage.empty()) {
+            FitDamage(damage, kMaxUpdateRects - count);
+        }
+
+        const Surface surface{frame.data.data(), frame.stride, frame.width, frame.height};
+        const PixelWriter writer(format);
+        for (const DamageRect& rect : damage) {
+            if (rect.encoding == kTight) {
+                if (!client.tight) {
+                    client.tight = std::make_unique<TightEncoder>();
+                }
+#ifdef SCREEN_RECORDER_HAVE_JPEG
+                if (rect.jpeg) {
+                    count += client.tight->EncodeJpeg(surface, rect.rect, quality_level, message);
+                    continue;
+                }
+#endif
+                count += client.tight->Encode(surface, rect.rect, writer, message);
+            } else if (rect.encoding == kZrle) {
+                if (!client.zrle) {
+                    client.zrle = std::make_unique<ZrleEncoder>();
+                }
+                client.zrle->Encode(surface, rect.rect, writer, message);
+                count++;
+            } else if (rect.encoding == kHextile) {
+                if (!client.hextile) {
+                    client.hextile = std::make_unique<HextileEncoder>();
+                }
+                client.hextile->Encode(surface, rect.rect, writer, message);
+                count++;
+            } else {
+                EncodeRaw(surface, rect.rect, writer, message);
+                count++;
+            }
+        }
+
+        // Tiles sent whole are now known to the viewer; clipped ones are not.
+        for (int row = first_row; row <= last_row; row++) {
+            for (int column = first_column; column <= last_column; column++) {
+                size_t index = static_cast<size_t>(row) * shared.columns + column;
+                if (dirty[index]) {
+                    bool whole = Contains(area, shared.TileRect(column, row));
+                    client.shown[index] = shared.tile_hashes[index];
+                    client.shown_valid[index] = whole;
+                }
+            }
+        }
+
+        message[0] = 0;
+        message[1] = 0;
+        message[2] = static_cast<uint8_t>(count >> 8);
+        message[3] = static_cast<uint8_t>(count & 0xff);
+        return count;
+    }
+
+    struct Copy {
+        size_t destination;
+        size_t source;
+        int run;
+    };
+
+    static size_t CopiedTiles(const std::vector<Copy>& plan) {
+        size_t tiles = 0;
+        for (const Copy& copy : plan) {
+            tiles += copy.run;
+        }
+        return tiles;
+    }
+
+    // Horizontal runs of dirty tiles that moved by one offset, each copied
+    // from viewer tiles no earlier copy in the plan has overwritten.
+    static std::vector<Copy> PlanCopies(const Client& client, const SharedFrame& shared, const Rect& area,
+                                        const std::vector<uint8_t>& dirty,
+                                        const std::unordered_map<uint64_t, size_t>& sources, bool bottom_up) {
+        std::vector<Copy> plan;
+        std::vector<uint8_t> written(dirty.size(), 0);
+        auto copyable = [&](int column, int row) {
+            size_t index = static_cast<size_t>(row) * shared.columns + column;
+            Rect tile = shared.TileRect(column, row);
+            return dirty[index] && !shared.tile_uniform[index] && tile.width == kTileSize &&
+                   tile.height == kTileSize && Contains(area, tile);
+        };
+        const int first_row = area.y / kTileSize;
+        const int last_row = (area.y + area.height - 1) / kTileSize;
+        for (int step = 0; step <= last_row - first_row; step++) {
+            const int row = bottom_up ? last_row - step : first_row + step;
+            for (int column = area.x / kTileSize; column < shared.columns;) {
+                size_t index = static_cast<size_t>(row) * shared.columns + column;
+                auto source = copyable(column, row) ? sources.find(shared.tile_hashes[index]) : sources.end();
+                if (source == sources.end() || source->second == index || written[source->second]) {
+                    column++;
+                    continue;
+                }
+                const int source_column = static_cast<int>(source->second % shared.columns);
+                int run = 1;
+                while (source_column + run < shared.columns && column + run < shared.columns &&
+                       copyable(column + run, row)) {
+                    size_t next_source = source->second + run;
+                    if (written[next_source] || !client.shown_valid[next_source] ||
+                        client.shown[next_source] != shared.tile_hashes[index + run]) {
+                        break;
+                    }
+                    run++;
+                }
+                plan.push_back({index, source->second, run});
+                std::fill(written.begin() + index, written.begin() + index + run, 1);
+                column += run;
+            }
+        }
+        return plan;
+    }
+
+    template <typename Visit>
+    static void ForEachTile(const SharedFrame& shared, const Rect& rect, Visit visit) {
+        for (int row = rect.y / kTileSize; row <= (rect.y + rect.height - 1) / kTileSize; row++) {
+            for (int column = rect.x / kTileSize; column <= (rect.x + rect.width - 1) / kTileSize; column++) {
+                visit(static_cast<size_t>(row) * shared.columns + column, shared.TileRect(column, row));
+            }
+        }
+    }
+
+    // Whether every tile under `rect` is known to show the given hashes.
+    static bool ShowsTiles(const Client& client, const SharedFrame& shared, const Rect& rect,
+                           const std::vector<uint64_t>& hashes) {
+        bool shows = hashes.size() == client.shown.size();
+        if (shows) {
+            ForEachTile(shared, rect, [&](size_t index, const Rect&) {
+                shows = shows && client.shown_valid[index] && client.shown[index] == hashes[index];
+            });
+        }
+        return shows;
+    }
+
+    static bool Contains(const Rect& outer, const Rect& inner) {
+        return inner.x >= outer.x && inner.y >= outer.y && inner.x + inner.width <= outer.x + outer.width &&
+               inner.y + inner.height <= outer.y + outer.height;
+    }
+
+    static Rect Intersect(const Rect& a, const Rect& b) {
+        int x = std::max(a.x, b.x);
+        int y = std::max(a.y, b.y);
+        int right = std::min(a.x + a.width, b.x + b.width);
+        int bottom = std::min(a.y + a.height, b.y + b.height);
+        return {x, y, std::max(0, right - x), std::max(0, bottom - y)};
+    }
+
+    ServerOptions options_;
+    SourceFactory factory_;
+    Socket listener_ = kInvalidSocket;
+    int port_ = 0;
+    std::atomic<bool> running_{false};
+    std::thread accept_thread_;
+    std::thread capture_thread_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::list<std::shared_ptr<Client>> clients_;
+    size_t active_clients_ = 0;
+    std::shared_ptr<const SharedFrame> current_;
+    uint64_t frames_captured_ = 0;
+    uint64_t updates_sent_ = 0;
+    uint64_t rects_sent_ = 0;
+    uint64_t copy_rects_sent_ = 0;
+    uint64_t bytes_sent_ = 0;
+    std::string capture_name_;
+    std::string error_;
+};
+
+}  // namespace rfb
+
+}  // namespace screen_recorder
@@ -1,6 +1,31 @@
 #include <napi.h>
 #include <vector>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "async.h"
+#include "codecs.h"
+#include "convert.h"
+#include "cpus.h"
+#include "frame.h"
+#include "frame_rate.h"
+#include "memory_budget.h"
+#include "mp4_muxer.h"
+#include "pipeline.h"
+#include "region_watch.h"
+#include "replay.h"
+#include "rfb_server.h"
+#include "segmenter.h"
+#include "template_match.h"
+#include "timelapse.h"
+#include "webm_muxer.h"
 
 #ifdef _WIN32
 #include <windows.h>
@@ -9,6 +34,13 @@
 #else
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/Xdamage.h>
+#include <poll.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <unistd.h>
+#include <cerrno>
 #endif
 
 namespace screen_recorder {
@@ -18,13 +50,85 @@ struct ScreenDimensions {
     int height;
 };
 
+struct ScreenRect {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+};
+
 class Recorder {
 public:
     Recorder() : frames_count_(0) {}
 
-    std::vector<uint8_t> CaptureFrame() {
+    Recorder(const Recorder&) = delete;
+    Recorder& operator=(const Recorder&) = delete;
+
+    ~Recorder() {
+#if !defined(_WIN32) && !defined(__APPLE__)
+        if (display_) {
+            ReleaseShm();
+            XCloseDisplay(display_);
+        }
+#endif
+    }
+
+    FrameBuffer CaptureFrame() {
         ScreenDimensions dimensions = GetScreenDimensions();
-        return CaptureScreenFrame(dimensions);
+        FrameBuffer frame_data;
+        CaptureScreenFrame(dimensions, frame_data);
+        return frame_data;
+    }
+
+    // Captures into a pipeline frame, tagging it with the platform's native
+    // layout. Reuses the frame's buffer when it is large enough.
+    void CaptureFrame(Frame& frame) {
+        ScreenDimensions dimensions = GetScreenDimensions();
+        CaptureScreenFrame(dimensions, frame.data);
+        frame.width = dimensions.width;
+        frame.height = dimensions.height;
+#ifdef _WIN32
+        frame.format = PixelFormat::kBGR24;
+        frame.stride = ((dimensions.width * 24 + 31) / 32) * 4;
+#elif defined(__APPLE__)
+        frame.format = PixelFormat::kBGRA;
+        frame.stride = dimensions.height > 0 ? static_cast<int>(frame.data.size() / dimensions.height) : 0;
+#else
+        frame.format = PixelFormat::kRGB24;
+        frame.stride = dimensions.width * 3;
+#endif
+    }
+
+    // Captures one on-screen area in a single request to the window system,
+    // in the same native layout as CaptureFrame. On macOS the result may be
+    // larger than asked for on HiDPI displays.
+    void CaptureArea(int x, int y, int width, int height, Frame& frame) {
+#ifdef __APPLE__
+        CGImageRef image = CGDisplayCreateImageForRect(CGMainDisplayID(), CGRectMake(x, y, width, height));
+        if (!image) {
+            throw std::runtime_error("Unable to capture the screen area");
+        }
+        CFDataRef dataRef = CGDataProviderCopyData(CGImageGetDataProvider(image));
+        const uint8_t* bytes = CFDataGetBytePtr(dataRef);
+        frame.data.assign(bytes, bytes + CFDataGetLength(dataRef));
+        frame.width = static_cast<int>(CGImageGetWidth(image));
+        frame.height = static_cast<int>(CGImageGetHeight(image));
+        frame.stride = static_cast<int>(CGImageGetBytesPerRow(image));
+        frame.format = PixelFormat::kBGRA;
+        CFRelease(dataRef);
+        CGImageRelease(image);
+#else
+        CaptureScreenArea(x, y, width, height, frame.data);
+        frame.width = width;
+        frame.height = height;
+#ifdef _WIN32
+        frame.format = PixelFormat::kBGR24;
+        frame.stride = ((width * 24 + 31) / 32) * 4;
+#else
+        frame.format = PixelFormat::kRGB24;
+        frame.stride = width * 3;
+#endif
+#endif
     }
 
     int GetFramesCount() const {
@@ -46,31 +150,52 @@ public:
         dimensions.width = CGRectGetWidth(mainMonitor);
         dimensions.height = CGRectGetHeight(mainMonitor);
 #else
-        Display* display = XOpenDisplay(NULL);
-        Screen* screen = DefaultScreenOfDisplay(display);
+        Screen* screen = DefaultScreenOfDisplay(GetDisplay());
         dimensions.width = screen->width;
         dimensions.height = screen->height;
-        XCloseDisplay(display);
 #endif
         
         return dimensions;
     }
 
 private:
-    std::vector<uint8_t> CaptureScreenFrame(const ScreenDimensions& dimensions) {
-        std::vector<uint8_t> frame_data;
-        
+#if !defined(_WIN32) && !defined(__APPLE__)
+    // Each Recorder keeps one connection open for its lifetime; Xlib calls on it
+    // must stay on a single thread, so threads needing capture own a Recorder.
+    Display* GetDisplay() {
+        if (!display_) {
+            display_ = XOpenDisplay(NULL);
+        }
+        return display_;
+    }
+#endif
+
+    void CaptureScreenFrame(const ScreenDimensions& dimensions, FrameBuffer& frame_data) {
+#ifdef __APPLE__
+        CGImageRef image = CGDisplayCreateImage(CGMainDisplayID());
+        CFDataRef dataRef = CGDataProviderCopyData(CGImageGetDataProvider(image));
+        size_t length = CFDataGetLength(dataRef);
+        frame_data.resize(length);
+        memcpy(frame_data.data(), CFDataGetBytePtr(dataRef), length);
+        CFRelease(dataRef);
+        CGImageRelease(image);
+#else
+        CaptureScreenArea(0, 0, dimensions.width, dimensions.height, frame_data);
+#endif
+    }
+
 #ifdef _WIN32
+    void CaptureScreenArea(int x, int y, int width, int height, FrameBuffer& frame_data) {
         HDC hScreenDC = GetDC(NULL);
         HDC hMemoryDC = CreateCompatibleDC(hScreenDC);
-        HBITMAP hBitmap = CreateCompatibleBitmap(hScreenDC, dimensions.width, dimensions.height);
+        HBITMAP hBitmap = CreateCompatibleBitmap(hScreenDC, width, height);
         HBITMAP hOldBitmap = (HBITMAP)SelectObject(hMemoryDC, hBitmap);
-        BitBlt(hMemoryDC, 0, 0, dimensions.width, dimensions.height, hScreenDC, 0, 0, SRCCOPY);
+        BitBlt(hMemoryDC, 0, 0, width, height, hScreenDC, x, y, SRCCOPY);
         
         BITMAPINFOHEADER bi;
         bi.biSize = sizeof(BITMAPINFOHEADER);
-        bi.biWidth = dimensions.width;
-        bi.biHeight = -dimensions.height;
+        bi.biWidth = width;
+        bi.biHeight = -height;
         bi.biPlanes = 1;
         bi.biBitCount = 24;
         bi.biCompression = BI_RGB;
@@ -80,51 +205,1163 @@ private:
         bi.biClrUsed = 0;
         bi.biClrImportant = 0;
         
-        DWORD dwBmpSize = ((dimensions.width * bi.biBitCount + 31) / 32) * 4 * dimensions.height;
+        DWORD dwBmpSize = ((width * bi.biBitCount + 31) / 32) * 4 * height;
         frame_data.resize(dwBmpSize);
         
-        GetDIBits(hMemoryDC, hBitmap, 0, dimensions.height, frame_data.data(), 
+        GetDIBits(hMemoryDC, hBitmap, 0, height, frame_data.data(), 
                  (BITMAPINFO*)&bi, DIB_RGB_COLORS);
         
         SelectObject(hMemoryDC, hOldBitmap);
         DeleteObject(hBitmap);
         DeleteDC(hMemoryDC);
         ReleaseDC(NULL, hScreenDC);
-#elif defined(__APPLE__)
-        CGImageRef image = CGDisplayCreateImage(CGMainDisplayID());
-        CFDataRef dataRef = CGDataProviderCopyData(CGImageGetDataProvider(image));
-        size_t length = CFDataGetLength(dataRef);
-        frame_data.resize(length);
-        memcpy(frame_data.data(), CFDataGetBytePtr(dataRef), length);
-        CFRelease(dataRef);
-        CGImageRelease(image);
-#else
-        Display* display = XOpenDisplay(NULL);
+    }
+#elif !defined(__APPLE__)
+    // One request for the whole area: through MIT-SHM when the X server
+    // shares memory with us, else a plain XGetImage over the socket.
+    void CaptureScreenArea(int x, int y, int width, int height, FrameBuffer& frame_data) {
+        Display* display = GetDisplay();
         Window root = DefaultRootWindow(display);
-        XWindowAttributes attributes;
-        XGetWindowAttributes(display, root, &attributes);
-        XImage* ximage = XGetImage(display, root, 0, 0, dimensions.width, dimensions.height, AllPlanes, ZPixmap);
-        int bytesPerPixel = ximage->bits_per_pixel / 8;
-        frame_data.resize(dimensions.width * dimensions.height * 3);
-        for (int y = 0; y < dimensions.height; y++) {
-            for (int x = 0; x < dimensions.width; x++) {
-                unsigned long pixel = XGetPixel(ximage, x, y);
-                int index = (y * dimensions.width + x) * 3;
-                frame_data[index] = (pixel & ximage->red_mask) >> 16;
-                frame_data[index+1] = (pixel & ximage->green_mask) >> 8;
-                frame_data[index+2] = pixel & ximage->blue_mask;
+        if (XImage* shared = ShmImage(width, height)) {
+            const bool fetched = XShmGetImage(display, root, shared, x, y, AllPlanes);
+            if (fetched) {
+                CopyXImage(shared, width, height, frame_data);
+            }
+            XDestroyImage(shared);
+            if (fetched) {
+                return;
             }
         }
+        XImage* ximage = XGetImage(display, root, x, y, width, height, AllPlanes, ZPixmap);
+        if (!ximage) {
+            throw std::runtime_error("XGetImage failed");
+        }
+        CopyXImage(ximage, width, height, frame_data);
         XDestroyImage(ximage);
-        XCloseDisplay(display);
-#endif
-        
-        return frame_data;
     }
 
+    // Packs an XImage as RGB24. The common 32-bit layout is read directly;
+    // anything else goes through XGetPixel.
+    static void CopyXImage(XImage* ximage, int width, int height, FrameBuffer& frame_data) {
+        frame_data.resize(static_cast<size_t>(width) * height * 3);
+        const bool direct = ximage->bits_per_pixel == 32 && ximage->byte_order == LSBFirst &&
+                            ximage->red_mask == 0xff0000 && ximage->green_mask == 0xff00 && ximage->blue_mask == 0xff;
+        for (int y = 0; y < height; y++) {
+            uint8_t* row = frame_data.data() + static_cast<size_t>(y) * width * 3;
+            if (direct) {
+                const uint8_t* source = reinterpret_cast<const uint8_t*>(ximage->data) +
+                                        static_cast<size_t>(y) * ximage->bytes_per_line;
+                for (int x = 0; x < width; x++) {
+                    row[x * 3] = source[x * 4 + 2];
+                    row[x * 3 + 1] = source[x * 4 + 1];
+                    row[x * 3 + 2] = source[x * 4];
+                }
+                continue;
+            }
+            for (int x = 0; x < width; x++) {
+                unsigned long pixel = XGetPixel(ximage, x, y);
+                row[x * 3] = (pixel & ximage->red_mask) >> 16;
+                row[x * 3 + 1] = (pixel & ximage->green_mask) >> 8;
+                row[x * 3 + 2] = pixel & ximage->blue_mask;
+            }
+        }
+    }
+
+    // Wraps the shared segment in an image of this size, growing the segment
+    // when it is too small. Null once the server has refused shared memory,
+    // e.g. over ssh -X. The image is only a header; XDestroyImage on it
+    // leaves the segment alone.
+    XImage* ShmImage(int width, int height) {
+        Display* display = GetDisplay();
+        if (!shm_usable_ || !XShmQueryExtension(display)) {
+            shm_usable_ = false;
+            return nullptr;
+        }
+        const int screen = DefaultScreen(display);
+        XImage* image = XShmCreateImage(display, DefaultVisual(display, screen), DefaultDepth(display, screen),
+                                        ZPixmap, nullptr, &shm_info_, width, height);
+        if (!image) {
+            return nullptr;
+        }
+        const size_t bytes = static_cast<size_t>(image->bytes_per_line) * image->height;
+        if (bytes > shm_size_ && !AttachShm(bytes)) {
+            XDestroyImage(image);
+            return nullptr;
+        }
+        image->data = shm_info_.shmaddr;
+        return image;
+    }
+
+    bool AttachShm(size_t bytes) {
+        ReleaseShm();
+        Display* display = GetDisplay();
+        shm_info_.shmid = shmget(IPC_PRIVATE, bytes, IPC_CREAT | 0600);
+        if (shm_info_.shmid < 0) {
+            shm_usable_ = false;
+            return false;
+        }
+        void* address = shmat(shm_info_.shmid, nullptr, 0);
+        bool attached = false;
+        if (address != reinterpret_cast<void*>(-1)) {
+            shm_info_.shmaddr = static_cast<char*>(address);
+            shm_info_.readOnly = False;
+            // A refused attach arrives as an X error, which by default exits
+            // the process; trap it instead.
+            static bool attach_failed;
+            attach_failed = false;
+            XErrorHandler previous = XSetErrorHandler([](Display*, XErrorEvent*) {
+                attach_failed = true;
+                return 0;
+            });
+            attached = XShmAttach(display, &shm_info_) && (XSync(display, False), !attach_failed);
+            XSetErrorHandler(previous);
+        }
+        // Freed once both sides detach.
+        shmctl(shm_info_.shmid, IPC_RMID, nullptr);
+        if (!attached) {
+            if (address != reinterpret_cast<void*>(-1)) {
+                shmdt(address);
+            }
+            shm_usable_ = false;
+            return false;
+        }
+        shm_size_ = bytes;
+        return true;
+    }
+
+    void ReleaseShm() {
+        if (shm_size_ == 0) {
+            return;
+        }
+        XShmDetach(display_, &shm_info_);
+        XSync(display_, False);
+        shmdt(shm_info_.shmaddr);
+        shm_size_ = 0;
+    }
+#endif
+
     std::atomic<int> frames_count_;
+#if !defined(_WIN32) && !defined(__APPLE__)
+    Display* display_ = nullptr;
+    XShmSegmentInfo shm_info_ = {};
+    size_t shm_size_ = 0;
+    bool shm_usable_ = true;
+#endif
+};
+
+double GetNumberOption(const Napi::Object& options, const char* key, double fallback) {
+    Napi::Value value = options.Get(key);
+    return value.IsNumber() ? value.As<Napi::Number>().DoubleValue() : fallback;
+}
+
+std::string GetStringOption(const Napi::Object& options, const char* key, const std::string& fallback) {
+    Napi::Value value = options.Get(key);
+    return value.IsString() ? value.As<Napi::String>().Utf8Value() : fallback;
+}
+
+bool GetBoolOption(const Napi::Object& options, const char* key, bool fallback) {
+    Napi::Value value = options.Get(key);
+    return value.IsBoolean() ? value.As<Napi::Boolean>().Value() : fallback;
+}
+
+// `cpus: [0, 1]` pins a thread; absent or empty leaves it unpinned.
+std::vector<int> GetCpuListOption(const Napi::Object& options, const char* key) {
+    std::vector<int> cpus;
+    Napi::Value value = options.Get(key);
+    if (value.IsUndefined()) {
+        return cpus;
+    }
+    if (!value.IsArray()) {
+        throw std::runtime_error(std::string(key) + " must be an array of CPU numbers");
+    }
+    Napi::Array array = value.As<Napi::Array>();
+    for (uint32_t i = 0; i < array.Length(); i++) {
+        Napi::Value cpu = array.Get(i);
+        if (!cpu.IsNumber() || cpu.As<Napi::Number>().DoubleValue() < 0) {
+            throw std::runtime_error(std::string(key) + " must be an array of CPU numbers");
+        }
+        cpus.push_back(cpu.As<Napi::Number>().Int32Value());
+    }
+    if (!cpus.empty() && !kThreadAffinityAvailable) {
+        throw std::runtime_error(std::string(key) + " is not supported on this platform");
+    }
+    return cpus;
+}
+
+EncoderOptions ParseEncoderOptions(const Napi::Object& options) {
+    EncoderOptions result;
+    result.codec = GetStringOption(options, "codec", DefaultEncoder());
+    result.preset = GetStringOption(options, "preset", result.preset);
+    result.bitrate_kbps = static_cast<int>(GetNumberOption(options, "bitrate", result.bitrate_kbps));
+    result.fps = GetNumberOption(options, "fps", result.fps);
+    result.threads = static_cast<int>(GetNumberOption(options, "threads", result.threads));
+    result.keyframe_interval = static_cast<int>(GetNumberOption(options, "keyframeInterval", result.keyframe_interval));
+    result.intra_refresh = GetBoolOption(options, "intraRefresh", result.intra_refresh);
+    if (options.Get("cpuUsed").IsNumber()) {
+        result.cpu_used = static_cast<int>(GetNumberOption(options, "cpuUsed", 0));
+    }
+    result.deadline = GetStringOption(options, "deadline", result.deadline);
+    result.cache_bytes = static_cast<size_t>(std::max(0.0, GetNumberOption(options, "cacheSize", 0)));
+    result.cache_reset_interval = static_cast<int>(GetNumberOption(options, "cacheResetInterval", 0));
+    result.cpus = GetCpuListOption(options, "cpus");
+    if (result.preset != "lowLatency" && result.preset != "archival") {
+        throw std::runtime_error("Unknown encoder preset '" + result.preset + "'");
+    }
+    if (!IsEncoderAvailable(result.codec)) {
+        throw std::runtime_error("Encoder '" + result.codec + "' is not available in this build");
+    }
+    return result;
+}
+
+// "normal", "high" (nice), "fifo" or "rr" (real-time).
+ThreadPriority GetPriorityOption(const Napi::Object& options, const char* key) {
+    std::string priority = GetStringOption(options, key, "normal");
+    if (priority == "normal") {
+        return ThreadPriority::kNormal;
+    }
+    if (priority == "high") {
+        return ThreadPriority::kHigh;
+    }
+    if (priority == "fifo") {
+        return ThreadPriority::kFifo;
+    }
+    if (priority == "rr") {
+        return ThreadPriority::kRoundRobin;
+    }
+    throw std::runtime_error("Unknown " + std::string(key) + " '" + priority + "'");
+}
+
+struct CaptureOptions {
+    double fps = 30;
+    // Below fps, the rate follows screen activity down to this floor.
+    double min_fps = 0;
+    std::vector<int> cpus;
+    ThreadPriority priority = ThreadPriority::kNormal;
+};
+
+// Pipeline source pacing captures on a dedicated Recorder, at a fixed rate or,
+// given a lower `min_fps`, at a rate that follows screen activity. A CPU
+// governor may further lower the rate and the captured size. The capturing
+// thread is pinned and prioritized as asked; its name reports the scheduling
+// policy it got, e.g. "capture(fifo)".
+class CaptureStage : public SourceStage {
+public:
+    explicit CaptureStage(CaptureOptions options, std::shared_ptr<CpuGovernor> governor = nullptr)
+        : options_(std::move(options)),
+          interval_(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+              std::chrono::duration<double>(1.0 / options_.fps))),
+          governor_(std::move(governor)) {
+        if (options_.min_fps > 0 && options_.min_fps < options_.fps) {
+            adaptive_ = std::make_unique<AdaptiveRate>(options_.min_fps, options_.fps);
+        }
+    }
+
+    std::string Name() const override {
+        const std::string policy = policy_.load();
+        return policy == "normal" ? "capture" : "capture(" + policy + ")";
+    }
+
+    bool Produce(Frame& frame) override {
+        auto now = std::chrono::steady_clock::now();
+        if (sequence_ == 0) {
+            if (!PinCurrentThread(options_.cpus)) {
+                throw std::runtime_error("Unable to pin capture to the requested CPUs");
+            }
+            policy_ = RaiseCurrentThreadPriority(options_.priority);
+            start_ = now;
+            next_ = now;
+        }
+        if (next_ > now) {
+            std::this_thread::sleep_until(next_);
+        }
+
+        recorder_.CaptureFrame(frame);
+        recorder_.IncrementFrameCount();
+        frame.sequence = sequence_++;
+        frame.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start_).count();
+
+        GovernorDecision decision = governor_ ? governor_->Decision() : GovernorDecision();
+        if (decision.resolution_scale < 1) {
+            Frame scaled;
+            ScaleFrame(frame, std::max(2, static_cast<int>(frame.width * decision.resolution_scale) & ~1),
+                       std::max(2, static_cast<int>(frame.height * decision.resolution_scale) & ~1), scaled);
+            frame = std::move(scaled);
+        }
+
+        std::chrono::steady_clock::duration delay = adaptive_ ? adaptive_->Update(frame) : interval_;
+        if (adaptive_) {
+            fps_ = adaptive_->Fps();
+        }
+        next_ += std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay / decision.fps_scale);
+        if (next_ < std::chrono::steady_clock::now()) {
+            next_ = std::chrono::steady_clock::now();
+        }
+        return true;
+    }
+
+    void AddMetrics(Metrics& metrics) const override {
+        if (adaptive_) {
+            metrics.emplace_back("fps", fps_.load());
+        }
+    }
+
+private:
+    CaptureOptions options_;
+    Recorder recorder_;
+    std::chrono::steady_clock::duration interval_;
+    std::unique_ptr<AdaptiveRate> adaptive_;
+    std::atomic<double> fps_{0};
+    std::shared_ptr<CpuGovernor> governor_;
+    // A string literal from RaiseCurrentThreadPriority, read by Name().
+    std::atomic<const char*> policy_{"normal"};
+    std::chrono::steady_clock::time_point start_;
+    std::chrono::steady_clock::time_point next_;
+    uint64_t sequence_ = 0;
+};
+
+// Tells V8 how much native memory the addon's budgeted pools hold, so heavy
+// native use makes the GC run sooner. Buffers handed to JS are reported
+// separately, by FrameToObject and their finalizers. Only called on the JS
+// thread.
+void ReportExternalMemory(Napi::Env env) {
+    static int64_t reported = 0;
+    const int64_t used = static_cast<int64_t>(GlobalMemoryBudget().Used());
+    if (used != reported) {
+        Napi::MemoryManagement::AdjustExternalMemory(env, used - reported);
+        reported = used;
+    }
+}
+
+Napi::Object MetricsToObject(Napi::Env env, const Metrics& metrics) {
+    Napi::Object result = Napi::Object::New(env);
+    for (const auto& [name, value] : metrics) {
+        result.Set(name, Napi::Number::New(env, value));
+    }
+    return result;
+}
+
+bool HasExtension(const std::string& path, const std::string& extension) {
+    return path.size() >= extension.size() &&
+        path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+// The container comes from the `container` option or the file extension;
+// anything unrecognized is written as raw frame data.
+std::string SinkContainer(const Napi::Object& descriptor) {
+    std::string path = GetStringOption(descriptor, "path", "");
+    return GetStringOption(descriptor, "container",
+        HasExtension(path, ".mp4") || HasExtension(path, ".m4v") ? "mp4" :
+        HasExtension(path, ".webm") || HasExtension(path, ".mkv") ? "webm" :
+        HasExtension(path, ".m3u8") ? "hls" :
+        HasExtension(path, ".mpd") ? "dash" : "raw");
+}
+
+std::unique_ptr<Stage> CreateSink(const Napi::Object& descriptor) {
+    std::string path = GetStringOption(descriptor, "path", "");
+    if (path.empty()) {
+        throw std::runtime_error("sink requires a file path");
+    }
+    std::string container = SinkContainer(descriptor);
+    if (container == "mp4") {
+        int64_t fragment_ms = static_cast<int64_t>(GetNumberOption(descriptor, "fragmentDuration", 1000));
+        return std::make_unique<Mp4SinkStage>(path, fragment_ms * 1000);
+    }
+    if (container == "hls" || container == "dash") {
+        SegmenterOptions options;
+        options.format = container == "hls" ? ManifestFormat::kHls : ManifestFormat::kDash;
+        options.segment_duration_us = static_cast<int64_t>(GetNumberOption(descriptor, "segmentDuration", 2000)) * 1000;
+        options.playlist_size = static_cast<size_t>(std::max(1.0, GetNumberOption(descriptor, "playlistSize", 6)));
+        return std::make_unique<SegmenterStage>(path, options);
+    }
+    if (container == "webm") {
+        return std::make_unique<WebmSinkStage>(path);
+    }
+    if (container == "raw") {
+        return std::make_unique<FileSinkStage>(path);
+    }
+    throw std::runtime_error("Unknown container '" + container + "'");
+}
+
+class PipelineWrap : public Napi::ObjectWrap<PipelineWrap> {
+public:
+    static Napi::FunctionReference constructor;
+
+    static void Init(Napi::Env env) {
+        Napi::Function func = DefineClass(env, "Pipeline", {
+            InstanceMethod("start", &PipelineWrap::Start),
+            InstanceMethod("stop", &PipelineWrap::Stop),
+            InstanceMethod("stats", &PipelineWrap::Stats),
+            InstanceMethod("saveReplay", &PipelineWrap::SaveReplay),
+        });
+        constructor = Napi::Persistent(func);
+        constructor.SuppressDestruct();
+    }
+
+    PipelineWrap(const Napi::CallbackInfo& info) : Napi::ObjectWrap<PipelineWrap>(info) {
+        Napi::Env env = info.Env();
+        if (info.Length() < 1 || !info[0].IsArray()) {
+            Napi::TypeError::New(env, "Expected an array of pipeline stages").ThrowAsJavaScriptException();
+            return;
+        }
+        Napi::Array descriptors = info[0].As<Napi::Array>();
+        size_t queue_size = 4;
+        double cpu_budget = 0;
+        if (info.Length() > 1 && info[1].IsObject()) {
+            Napi::Object options = info[1].As<Napi::Object>();
+            if (options.Get("queueSize").IsNumber()) {
+                queue_size = std::max(1u, options.Get("queueSize").As<Napi::Number>().Uint32Value());
+            }
+            cpu_budget = GetNumberOption(options, "cpuBudget", 0);
+        }
+
+        // cpuBudget is in cores, e.g. 0.15 for 15% of one core. Containers
+        // declare a fixed frame size, so only all-raw pipelines may be resized.
+        std::shared_ptr<CpuGovernor> governor;
+        if (cpu_budget > 0) {
+            GovernorOptions governor_options;
+            governor_options.budget = cpu_budget;
+            governor_options.allow_resize = true;
+            for (uint32_t i = 0; i < descriptors.Length(); i++) {
+                Napi::Value value = descriptors.Get(i);
+                if (value.IsObject() && GetStringOption(value.As<Napi::Object>(), "type", "") == "sink" &&
+                    SinkContainer(value.As<Napi::Object>()) != "raw") {
+                    governor_options.allow_resize = false;
+                }
+            }
+            governor = std::make_shared<CpuGovernor>(governor_options);
+        }
+
+        // A replay buffer is trimmed at IDR frames, which intra refresh only
+        // sends at the start of the stream.
+        bool has_replay = false;
+        for (uint32_t i = 0; i < descriptors.Length(); i++) {
+            Napi::Value value = descriptors.Get(i);
+            if (value.IsObject() && value.As<Napi::Object>().Get("type").IsString() &&
+                value.As<Napi::Object>().Get("type").As<Napi::String>().Utf8Value() == "replay") {
+                has_replay = true;
+            }
+        }
+
+        std::unique_ptr<SourceStage> source;
+        std::vector<std::unique_ptr<Stage>> stages;
+        try {
+            for (uint32_t i = 0; i < descriptors.Length(); i++) {
+                Napi::Value value = descriptors.Get(i);
+                if (!value.IsObject() || !value.As<Napi::Object>().Get("type").IsString()) {
+                    throw std::runtime_error("Stage " + std::to_string(i) + " is not a stage descriptor");
+                }
+                Napi::Object descriptor = value.As<Napi::Object>();
+                std::string type = descriptor.Get("type").As<Napi::String>().Utf8Value();
+                if ((type == "capture") != (i == 0)) {
+                    throw std::runtime_error("A pipeline must start with exactly one capture stage");
+                }
+                if (type == "capture") {
+                    CaptureOptions capture;
+                    capture.fps = GetNumberOption(descriptor, "fps", capture.fps);
+                    capture.min_fps = GetNumberOption(descriptor, "minFps", capture.min_fps);
+                    if (capture.fps <= 0 || capture.min_fps < 0) {
+                        throw std::runtime_error("capture fps must be positive and minFps non-negative");
+                    }
+                    capture.cpus = GetCpuListOption(descriptor, "cpus");
+                    capture.priority = GetPriorityOption(descriptor, "priority");
+                    source = std::make_unique<CaptureStage>(std::move(capture), governor);
+                } else if (type == "convert") {
+                    std::string format = GetStringOption(descriptor, "format", "");
+                    if (format != "i420") {
+                        throw std::runtime_error("Unsupported convert format '" + format + "'");
+                    }
+                    stages.push_back(std::make_unique<ConvertStage>(PixelFormat::kI420));
+                } else if (type == "scale") {
+                    int width = static_cast<int>(GetNumberOption(descriptor, "width", 0));
+                    int height = static_cast<int>(GetNumberOption(descriptor, "height", 0));
+                    if (width <= 0 || height <= 0) {
+                        throw std::runtime_error("scale requires a positive width and height");
+                    }
+                    stages.push_back(std::make_unique<ScaleStage>(width, height));
+                } else if (type == "encode") {
+                    EncoderOptions encoder = ParseEncoderOptions(descriptor);
+                    if (has_replay) {
+                        if (GetBoolOption(descriptor, "intraRefresh", false)) {
+                            throw std::runtime_error("intraRefresh cannot be used with a replay stage, "
+                                                     "whose clips must start at IDR frames");
+                        }
+                        encoder.intra_refresh = false;
+                    }
+                    stages.push_back(std::make_unique<EncodeStage>(encoder, governor));
+                } else if (type == "timelapse") {
+                    TimelapseOptions timelapse;
+                    timelapse.interval_us = static_cast<int64_t>(GetNumberOption(descriptor, "interval", 10) * 1e6);
+                    timelapse.output_fps = GetNumberOption(descriptor, "outputFps", timelapse.output_fps);
+                    std::string mode = GetStringOption(descriptor, "mode", "sample");
+                    if (mode == "blend") {
+                        timelapse.mode = TimelapseMode::kBlend;
+                    } else if (mode == "changed") {
+                        timelapse.mode = TimelapseMode::kChanged;
+                    } else if (mode != "sample") {
+                        throw std::runtime_error("Unknown timelapse mode '" + mode + "'");
+                    }
+                    if (timelapse.interval_us <= 0 || timelapse.output_fps <= 0) {
+                        throw std::runtime_error("timelapse interval and outputFps must be positive");
+                    }
+                    stages.push_back(std::make_unique<TimelapseStage>(timelapse));
+                } else if (type == "replay") {
+                    ReplayOptions replay;
+                    replay.duration_us = static_cast<int64_t>(GetNumberOption(descriptor, "duration", 60) * 1e6);
+                    replay.max_bytes = static_cast<size_t>(
+                        std::max(0.0, GetNumberOption(descriptor, "maxBytes", static_cast<double>(replay.max_bytes))));
+                    if (replay.duration_us <= 0 || replay_) {
+                        throw std::runtime_error("A pipeline takes one replay stage with a positive duration");
+                    }
+                    auto stage = std::make_unique<ReplayStage>(replay);
+                    replay_ = stage.get();
+                    stages.push_back(std::move(stage));
+                } else if (type == "sink") {
+                    stages.push_back(CreateSink(descriptor));
+                } else {
+                    throw std::runtime_error("Unknown pipeline stage '" + type + "'");
+                }
+            }
+            if (!source) {
+                throw std::runtime_error("A pipeline must start with exactly one capture stage");
+            }
+        } catch (const std::exception& e) {
+            Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+            return;
+        }
+
+        pipeline_ = std::make_unique<Pipeline>(std::move(source), std::move(stages), queue_size, governor);
+    }
+
+private:
+    Napi::Value Start(const Napi::CallbackInfo& info) {
+        if (pipeline_) {
+            pipeline_->Start();
+        }
+        return info.This();
+    }
+
+    Napi::Value Stop(const Napi::CallbackInfo& info) {
+        if (pipeline_) {
+            pipeline_->Stop();
+        }
+        return info.This();
+    }
+
+    Napi::Value Stats(const Napi::CallbackInfo& info) {
+        Napi::Env env = info.Env();
+        ReportExternalMemory(env);
+        Napi::Object result = Napi::Object::New(env);
+        if (!pipeline_) {
+            return result;
+        }
+        Napi::Array stages = Napi::Array::New(env);
+        auto stats = pipeline_->Stats();
+        for (size_t i = 0; i < stats.size(); i++) {
+            Napi::Object stage = Napi::Object::New(env);
+            stage.Set("name", Napi::String::New(env, stats[i].name));
+            stage.Set("frames", Napi::Number::New(env, static_cast<double>(stats[i].frames)));
+            stage.Set("busyMs", Napi::Number::New(env, stats[i].busy_ms));
+            stage.Set("queued", Napi::Number::New(env, static_cast<double>(stats[i].queued)));
+            if (!stats[i].metrics.empty()) {
+                stage.Set("metrics", MetricsToObject(env, stats[i].metrics));
+            }
+            stages.Set(static_cast<uint32_t>(i), stage);
+        }
+        result.Set("running", Napi::Boolean::New(env, pipeline_->IsRunning()));
+        result.Set("dropped", Napi::Number::New(env, static_cast<double>(pipeline_->DroppedFrames())));
+        result.Set("stages", stages);
+        Metrics governor = pipeline_->GovernorMetrics();
+        if (!governor.empty()) {
+            result.Set("governor", MetricsToObject(env, governor));
+        }
+        std::string error = pipeline_->Error();
+        if (!error.empty()) {
+            result.Set("error", Napi::String::New(env, error));
+        }
+        return result;
+    }
+
+    Napi::Value SaveReplay(const Napi::CallbackInfo& info);
+
+    std::unique_ptr<Pipeline> pipeline_;
+    // Owned by pipeline_.
+    ReplayStage* replay_ = nullptr;
+};
+
+Napi::FunctionReference PipelineWrap::constructor;
+
+// createVncServer({port, host, fps, minFps, name, captureCpus, capturePriority}):
+// an RFB server sharing one capture between all viewers. Binds to localhost by default
+// since there is no authentication.
+class VncServerWrap : public Napi::ObjectWrap<VncServerWrap> {
+public:
+    static Napi::FunctionReference constructor;
+
+    static void Init(Napi::Env env) {
+        Napi::Function func = DefineClass(env, "VncServer", {
+            InstanceMethod("start", &VncServerWrap::Start),
+            InstanceMethod("stop", &VncServerWrap::Stop),
+            InstanceMethod("stats", &VncServerWrap::Stats),
+        });
+        constructor = Napi::Persistent(func);
+        constructor.SuppressDestruct();
+    }
+
+    VncServerWrap(const Napi::CallbackInfo& info) : Napi::ObjectWrap<VncServerWrap>(info) {
+        Napi::Env env = info.Env();
+        Napi::Object options = info.Length() > 0 && info[0].IsObject() ? info[0].As<Napi::Object>()
+                                                                        : Napi::Object::New(env);
+        rfb::ServerOptions server_options;
+        server_options.host = GetStringOption(options, "host", server_options.host);
+        server_options.name = GetStringOption(options, "name", server_options.name);
+        double port = GetNumberOption(options, "port", server_options.port);
+        CaptureOptions capture;
+        capture.fps = GetNumberOption(options, "fps", capture.fps);
+        capture.min_fps = GetNumberOption(options, "minFps", capture.min_fps);
+        if (port < 0 || port > 65535) {
+            Napi::RangeError::New(env, "port must be between 0 and 65535").ThrowAsJavaScriptException();
+            return;
+        }
+        if (capture.fps <= 0 || capture.min_fps < 0) {
+            Napi::RangeError::New(env, "fps must be positive and minFps non-negative").ThrowAsJavaScriptException();
+            return;
+        }
+        try {
+            capture.cpus = GetCpuListOption(options, "captureCpus");
+            capture.priority = GetPriorityOption(options, "capturePriority");
+        } catch (const std::exception& e) {
+            Napi::TypeError::New(env, e.what()).ThrowAsJavaScriptException();
+            return;
+        }
+        server_options.port = static_cast<int>(port);
+        server_ = std::make_unique<rfb::Server>(server_options, [capture] {
+            return std::make_unique<CaptureStage>(capture);
+        });
+    }
+
+private:
+    Napi::Value Start(const Napi::CallbackInfo& info) {
+        Napi::Env env = info.Env();
+        try {
+            server_->Start();
+        } catch (const std::exception& e) {
+            Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+            return env.Null();
+        }
+        return info.This();
+    }
+
+    Napi::Value Stop(const Napi::CallbackInfo& info) {
+        server_->Stop();
+        return info.This();
+    }
+
+    Napi::Value Stats(const Napi::CallbackInfo& info) {
+        Napi::Env env = info.Env();
+        ReportExternalMemory(env);
+        rfb::ServerStats stats = server_->Stats();
+        Napi::Object result = Napi::Object::New(env);
+        result.Set("running", Napi::Boolean::New(env, server_->IsRunning()));
+        result.Set("port", Napi::Number::New(env, stats.port));
+        result.Set("clients", Napi::Number::New(env, static_cast<double>(stats.clients)));
+        result.Set("framesCaptured", Napi::Number::New(env, static_cast<double>(stats.frames_captured)));
+        result.Set("updatesSent", Napi::Number::New(env, static_cast<double>(stats.updates_sent)));
+        result.Set("rectsSent", Napi::Number::New(env, static_cast<double>(stats.rects_sent)));
+        result.Set("copyRectsSent", Napi::Number::New(env, static_cast<double>(stats.copy_rects_sent)));
+        result.Set("bytesSent", Napi::Number::New(env, static_cast<double>(stats.bytes_sent)));
+        if (!stats.capture.empty()) {
+            result.Set("capture", Napi::String::New(env, stats.capture));
+        }
+        if (!stats.error.empty()) {
+            result.Set("error", Napi::String::New(env, stats.error));
+        }
+        return result;
+    }
+
+    std::unique_ptr<rfb::Server> server_;
+};
+
+Napi::FunctionReference VncServerWrap::constructor;
+
+struct RegionWatchOptions {
+    ScreenRect rect;
+    // Share of the region's tiles that must change before a callback.
+    double threshold = 0;
+    // Capture period when the window system cannot report damage, and the
+    // shortest gap between checks when it can.
+    std::chrono::milliseconds interval{250};
+    // When set, the watch ends once the region has gone this long without
+    // a change, or when `timeout` (if set) passes first.
+    std::chrono::milliseconds quiet{0};
+    std::chrono::milliseconds timeout{0};
+};
+
+// Reports pixel changes inside one screen rect from a thread of its own. On
+// X11 the thread sleeps in poll() until the DAMAGE extension reports drawing
+// that touches the rect, so a static screen costs no CPU at all; reports are
+// then confirmed, at most once per `interval`, by capturing the rect and
+// comparing tile hashes. Without DAMAGE, and on Windows and macOS, the rect
+// is captured every `interval`.
+class RegionWatcher {
+public:
+    using Callback = std::function<void(Frame&&, const RegionChange&)>;
+    // Told whether the region settled (true) or the timeout passed first.
+    using Settled = std::function<void(bool)>;
+
+    RegionWatcher(const RegionWatchOptions& options, Callback callback)
+        : options_(options), callback_(std::move(callback)) {}
+
+    RegionWatcher(const RegionWatcher&) = delete;
+    RegionWatcher& operator=(const RegionWatcher&) = delete;
+
+    ~RegionWatcher() {
+        Stop();
+    }
+
+    // `on_settled` runs once, on the watch thread, when a watch with a quiet
+    // period ends, including when it fails.
+    void Start(Settled on_settled = nullptr) {
+        on_settled_ = std::move(on_settled);
+#if !defined(_WIN32) && !defined(__APPLE__)
+        if (pipe(wake_) != 0) {
+            throw std::runtime_error("Unable to create the region watch wake pipe");
+        }
+#endif
+        running_ = true;
+        start_ = std::chrono::steady_clock::now();
+        last_change_ = start_;
+        thread_ = std::thread([this] { Run(); });
+    }
+
+    void Stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_ = false;
+        }
+        cv_.notify_all();
+#if !defined(_WIN32) && !defined(__APPLE__)
+        if (wake_[1] >= 0) {
+            const char byte = 0;
+            (void)!write(wake_[1], &byte, 1);
+        }
+#endif
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+#if !defined(_WIN32) && !defined(__APPLE__)
+        for (int& fd : wake_) {
+            if (fd >= 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+#endif
+    }
+
+    bool IsRunning() const {
+        return running_;
+    }
+
+    // "damage" or "poll" once the thread has started.
+    std::string Mode() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return mode_;
+    }
+
+    std::string Error() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return error_;
+    }
+
+    uint64_t Checks() const {
+        return checks_;
+    }
+
+    uint64_t Changes() const {
+        return changes_;
+    }
+
+private:
+    void Run() {
+        try {
+            Recorder recorder;
+            TileDiff diff;
+            auto check = [&] {
+                const ScreenRect& rect = options_.rect;
+                Frame frame;
+                recorder.CaptureArea(rect.x, rect.y, rect.width, rect.height, frame);
+                frame.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start_).count();
+                frame.sequence = checks_++;
+                RegionChange change;
+                if (diff.Update(frame, options_.threshold, change)) {
+                    changes_++;
+                    last_change_ = std::chrono::steady_clock::now();
+                    if (callback_) {
+                        callback_(std::move(frame), change);
+                    }
+                }
+            };
+#if !defined(_WIN32) && !defined(__APPLE__)
+            if (WatchDamage(check)) {
+                return;
+            }
+#endif
+            check();
+            std::unique_lock<std::mutex> lock(mutex_);
+            mode_ = "poll";
+            while (running_ && !Settle()) {
+                auto wait = options_.interval;
+                if (options_.quiet.count() > 0) {
+                    wait = std::min(wait, std::chrono::milliseconds(MsUntilDeadline()));
+                }
+                if (cv_.wait_for(lock, wait, [this] { return !running_; })) {
+                    break;
+                }
+                lock.unlock();
+                check();
+                lock.lock();
+            }
+        } catch (const std::exception& e) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                error_ = e.what();
+            }
+            running_ = false;
+            if (on_settled_) {
+                on_settled_(false);
+            }
+        }
+    }
+
+    // Milliseconds, rounded up, until the quiet period or the timeout ends.
+    int MsUntilDeadline() const {
+        const auto now = std::chrono::steady_clock::now();
+        auto deadline = last_change_ + options_.quiet;
+        if (options_.timeout.count() > 0) {
+            deadline = std::min(deadline, start_ + options_.timeout);
+        }
+        if (deadline <= now) {
+            return 0;
+        }
+        return static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(deadline - now).count());
+    }
+
+    // Ends a watch with a quiet period once it settled or timed out.
+    bool Settle() {
+        if (options_.quiet.count() == 0) {
+            return false;
+        }
+        const auto now = std::chrono::steady_clock::now();
+        const bool stable = now - last_change_ >= options_.quiet;
+        if (!stable && (options_.timeout.count() == 0 || now - start_ < options_.timeout)) {
+            return false;
+        }
+        running_ = false;
+        on_settled_(stable);
+        return true;
+    }
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+    // Runs `check` whenever damage touches the rect until stopped. False,
+    // having done nothing, when the server lacks the DAMAGE extension. Uses
+    // a connection of its own so the event queue holds only damage.
+    // Throws, having released both, when waiting fails or `check` throws.
+    bool WatchDamage(const std::function<void()>& check) {
+        struct DisplayCloser {
+            void operator()(Display* display) const {
+                XCloseDisplay(display);
+            }
+        };
+        std::unique_ptr<Display, DisplayCloser> connection(XOpenDisplay(nullptr));
+        Display* display = connection.get();
+        int event_base = 0;
+        int error_base = 0;
+        if (!display || !XDamageQueryExtension(display, &event_base, &error_base)) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            mode_ = "damage";
+        }
+        // Raw rectangles keep arriving while the rect is being redrawn,
+        // without having to subtract the accumulated damage each time.
+        struct DamageGuard {
+            Display* display;
+            Damage damage;
+            ~DamageGuard() {
+                XDamageDestroy(display, damage);
+            }
+        } damage{display, XDamageCreate(display, DefaultRootWindow(display), XDamageReportRawRectangles)};
+        XSync(display, False);
+        // The baseline is taken once damage is being tracked, so nothing
+        // drawn in between goes unnoticed.
+        check();
+        auto last_check = std::chrono::steady_clock::now();
+        // Damage seen but not yet checked; the region cannot be called
+        // settled until it is.
+        bool pending = false;
+        const ScreenRect& rect = options_.rect;
+        pollfd fds[2] = {{ConnectionNumber(display), POLLIN, 0}, {wake_[0], POLLIN, 0}};
+        while (running_ && (pending || !Settle())) {
+            while (XPending(display) > 0) {
+                XEvent event;
+                XNextEvent(display, &event);
+                if (event.type != event_base + XDamageNotify) {
+                    continue;
+                }
+                const XRectangle& area = reinterpret_cast<XDamageNotifyEvent*>(&event)->area;
+                pending |= area.x < rect.x + rect.width && rect.x < area.x + area.width &&
+                           area.y < rect.y + rect.height && rect.y < area.y + area.height;
+            }
+            const auto now = std::chrono::steady_clock::now();
+            if (pending && now - last_check >= options_.interval) {
+                // Drawing that lands during the capture is drained before
+                // sleeping again.
+                check();
+                last_check = now;
+                pending = false;
+                continue;
+            }
+            int timeout = options_.quiet.count() > 0 && !pending ? MsUntilDeadline() : -1;
+            if (pending) {
+                timeout = static_cast<int>(
+                    std::chrono::ceil<std::chrono::milliseconds>(last_check + options_.interval - now).count());
+            }
+            if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+                throw std::runtime_error(std::string("Waiting for damage failed: ") + std::strerror(errno));
+            }
+        }
+        return true;
+    }
+
+    int wake_[2] = {-1, -1};
+#endif
+
+    RegionWatchOptions options_;
+    Callback callback_;
+    Settled on_settled_;
+    std::thread thread_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::atomic<bool> running_{false};
+    std::string mode_;
+    std::string error_;
+    std::chrono::steady_clock::time_point start_;
+    std::chrono::steady_clock::time_point last_change_;
+    std::atomic<uint64_t> checks_{0};
+    std::atomic<uint64_t> changes_{0};
+};
+
+// Coroutine front end to a Recorder. Captures are serialized on a private
+// strand that owns the X connection, while conversion hops to the shared
+// worker pool, so the next capture's round-trip overlaps this one's conversion.
+class AsyncRecorder {
+public:
+    explicit AsyncRecorder(Executor& workers)
+        : workers_(workers), capture_strand_(1), start_(std::chrono::steady_clock::now()) {}
+
+    Task<Frame> NextFrame() {
+        co_await capture_strand_.Schedule();
+        Frame frame;
+        recorder_.CaptureFrame(frame);
+        frame.sequence = sequence_++;
+        frame.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start_).count();
+        co_return frame;
+    }
+
+    Task<Frame> NextFrame(PixelFormat format) {
+        Frame frame = co_await NextFrame();
+        if (format != PixelFormat::kI420) {
+            co_return frame;
+        }
+        co_await workers_.Schedule();
+        Frame converted;
+        ConvertToI420(frame, converted);
+        co_return converted;
+    }
+
+    // Captures `count` frames back to back, `interval` apart (or as fast as
+    // possible), then converts them. Buffers are reserved up front so the
+    // capture loop itself never allocates; they are charged to the memory
+    // budget first, and the burst fails when it cannot hold them. Every
+    // other capture waits on the strand until the burst is done.
+    Task<std::vector<Frame>> Burst(size_t count, std::chrono::microseconds interval, PixelFormat format) {
+        co_await capture_strand_.Schedule();
+        ScreenDimensions dimensions = recorder_.GetScreenDimensions();
+        const size_t bytes = static_cast<size_t>(dimensions.width) * dimensions.height * 4;
+        struct Charge {
+            size_t bytes;
+            ~Charge() {
+                GlobalMemoryBudget().Release(MemoryPool::kBursts, bytes);
+            }
+        };
+        if (!GlobalMemoryBudget().TryCharge(MemoryPool::kBursts, count * bytes)) {
+            throw std::runtime_error("A burst of " + std::to_string(count) + " frames needs " +
+                                     std::to_string(count * bytes >> 20) + " MiB, more than the memory budget has left");
+        }
+        Charge charge{count * bytes};
+        std::vector<Frame> frames(count);
+        for (Frame& frame : frames) {
+            frame.data.reserve(bytes);
+        }
+        auto next = std::chrono::steady_clock::now();
+        for (Frame& frame : frames) {
+            if (interval.count() > 0) {
+                std::this_thread::sleep_until(next);
+                next += interval;
+            }
+            recorder_.CaptureFrame(frame);
+            frame.sequence = sequence_++;
+            frame.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start_).count();
+        }
+        if (format == PixelFormat::kI420) {
+            co_await workers_.Schedule();
+            for (Frame& frame : frames) {
+                Frame converted;
+                ConvertToI420(frame, converted);
+                frame = std::move(converted);
+            }
+        }
+        co_return frames;
+    }
+
+    // Captures the bounding box of `rects` in one request and slices each
+    // rect out of it. Rects must lie on screen.
+    Task<std::vector<Frame>> Regions(std::vector<ScreenRect> rects) {
+        co_await capture_strand_.Schedule();
+        ScreenDimensions screen = recorder_.GetScreenDimensions();
+        int left = screen.width;
+        int top = screen.height;
+        int right = 0;
+        int bottom = 0;
+        for (const ScreenRect& rect : rects) {
+            if (rect.x < 0 || rect.y < 0 || rect.width <= 0 || rect.height <= 0 ||
+                rect.x + rect.width > screen.width || rect.y + rect.height > screen.height) {
+                throw std::runtime_error("Region " + std::to_string(rect.x) + "," + std::to_string(rect.y) + " " +
+                                         std::to_string(rect.width) + "x" + std::to_string(rect.height) +
+                                         " is not on the " + std::to_string(screen.width) + "x" +
+                                         std::to_string(screen.height) + " screen");
+            }
+            left = std::min(left, rect.x);
+            top = std::min(top, rect.y);
+            right = std::max(right, rect.x + rect.width);
+            bottom = std::max(bottom, rect.y + rect.height);
+        }
+        Frame area;
+        recorder_.CaptureArea(left, top, right - left, bottom - top, area);
+        area.sequence = sequence_++;
+        area.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start_).count();
+
+        // HiDPI captures come back larger than the area in screen points.
+        const double scale_x = static_cast<double>(area.width) / (right - left);
+        const double scale_y = static_cast<double>(area.height) / (bottom - top);
+        std::vector<Frame> frames(rects.size());
+        for (size_t i = 0; i < rects.size(); i++) {
+            const int x = static_cast<int>((rects[i].x - left) * scale_x);
+            const int y = static_cast<int>((rects[i].y - top) * scale_y);
+            CropFrame(area, x, y, std::min(area.width - x, static_cast<int>(rects[i].width * scale_x)),
+                      std::min(area.height - y, static_cast<int>(rects[i].height * scale_y)), frames[i]);
+        }
+        co_return frames;
+    }
+
+    Executor& Workers() {
+        return workers_;
+    }
+
+private:
+    Executor& workers_;
+    Executor capture_strand_;
+    Recorder recorder_;
+    std::chrono::steady_clock::time_point start_;
+    uint64_t sequence_ = 0;
 };
 
+Executor g_workers(AvailableCpus());
+AsyncRecorder g_async_recorder(g_workers);
+
+// Hands the frame's pixels to JS without copying; V8 frees them with the
+// buffer. The allocation counts as external memory until then, so frames
+// that JS drops get collected at the pace they arrive.
+Napi::Object FrameToObject(Napi::Env env, Frame&& frame) {
+    auto* data = new FrameBuffer(std::move(frame.data));
+    const int64_t bytes = static_cast<int64_t>(data->capacity());
+    Napi::ArrayBuffer buffer = Napi::ArrayBuffer::New(env, data->data(), data->size(),
+        [bytes](Napi::Env env, void*, FrameBuffer* hint) {
+            delete hint;
+            Napi::MemoryManagement::AdjustExternalMemory(env, -bytes);
+        }, data);
+    Napi::MemoryManagement::AdjustExternalMemory(env, bytes);
+
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("data", Napi::Uint8Array::New(env, data->size(), buffer, 0));
+    result.Set("width", Napi::Number::New(env, frame.width));
+    result.Set("height", Napi::Number::New(env, frame.height));
+    result.Set("stride", Napi::Number::New(env, frame.stride));
+    result.Set("format", Napi::String::New(env, PixelFormatName(frame.format)));
+    result.Set("timestamp", Napi::Number::New(env, frame.timestamp_us / 1000.0));
+    result.Set("sequence", Napi::Number::New(env, static_cast<double>(frame.sequence)));
+    if (IsEncoded(frame.format)) {
+        result.Set("decodeTimestamp", Napi::Number::New(env, frame.decode_timestamp_us / 1000.0));
+        result.Set("keyframe", Napi::Boolean::New(env, frame.keyframe));
+        result.Set("recoveryPoint", Napi::Boolean::New(env, frame.recovery_point));
+    }
+    return result;
+}
+
+Napi::Array FramesToArray(Napi::Env env, std::vector<Frame>&& frames) {
+    Napi::Array result = Napi::Array::New(env, frames.size());
+    for (size_t i = 0; i < frames.size(); i++) {
+        result.Set(static_cast<uint32_t>(i), FrameToObject(env, std::move(frames[i])));
+    }
+    return result;
+}
+
+// Runs a task on the native executors and settles a JS promise with its result.
+// `to_js` is invoked on the JS thread to build the resolution value.
+template <typename T, typename ToJs>
+Napi::Value ToPromise(Napi::Env env, Task<T> task, ToJs to_js) {
+    struct Completion {
+        Napi::Promise::Deferred deferred;
+        ToJs to_js;
+        Outcome<T> outcome;
+    };
+
+    auto* completion = new Completion{Napi::Promise::Deferred::New(env), std::move(to_js), {}};
+    Napi::Promise promise = completion->deferred.Promise();
+    Napi::ThreadSafeFunction tsfn = Napi::ThreadSafeFunction::New(
+        env, Napi::Function::New(env, [](const Napi::CallbackInfo&) {}), "screen_recorder.promise", 0, 1);
+
+    Spawn(std::move(task), [tsfn, completion](Outcome<T>&& outcome) {
+        completion->outcome = std::move(outcome);
+        tsfn.BlockingCall(completion, [](Napi::Env env, Napi::Function, Completion* done) {
+            if (done->outcome.error) {
+                std::string message = "Native task failed";
+                try {
+                    std::rethrow_exception(done->outcome.error);
+                } catch (const std::exception& e) {
+                    message = e.what();
+                } catch (...) {
+                }
+                done->deferred.Reject(Napi::Error::New(env, message).Value());
+            } else if constexpr (std::is_void_v<T>) {
+                done->deferred.Resolve(done->to_js(env));
+            } else {
+                done->deferred.Resolve(done->to_js(env, std::move(*done->outcome.value)));
+            }
+            delete done;
+            ReportExternalMemory(env);
+        });
+        tsfn.Release();
+    });
+    return promise;
+}
+
 // Global recorder instance
 Recorder g_recorder;
 
@@ -162,10 +1399,690 @@ Napi::Value GetScreenDimensions(const Napi::CallbackInfo& info) {
     return result;
 }
 
+// Tickets are taken when the call is made: tasks start synchronously and
+// captures run first come first served, so call order is capture order.
+Task<std::vector<Frame>> CaptureAndEncode(std::shared_ptr<AsyncEncoder> encoder, uint64_t ticket) {
+    Frame frame;
+    std::exception_ptr error;
+    try {
+        frame = co_await g_async_recorder.NextFrame();
+    } catch (...) {
+        error = std::current_exception();
+    }
+    if (error) {
+        // Give up the turn so later frames are not held up.
+        co_await encoder->Skip(ticket);
+        std::rethrow_exception(error);
+    }
+    co_return co_await encoder->Submit(std::move(frame), ticket);
+}
+
+Task<std::vector<Frame>> FlushEncoder(std::shared_ptr<AsyncEncoder> encoder, uint64_t ticket) {
+    co_return co_await encoder->Flush(ticket);
+}
+
+class EncoderWrap : public Napi::ObjectWrap<EncoderWrap> {
+public:
+    static Napi::FunctionReference constructor;
+
+    static void Init(Napi::Env env) {
+        Napi::Function func = DefineClass(env, "Encoder", {
+            InstanceMethod("encodeNextFrame", &EncoderWrap::EncodeNextFrame),
+            InstanceMethod("flush", &EncoderWrap::Flush),
+            InstanceMethod("stats", &EncoderWrap::Stats),
+        });
+        constructor = Napi::Persistent(func);
+        constructor.SuppressDestruct();
+    }
+
+    EncoderWrap(const Napi::CallbackInfo& info) : Napi::ObjectWrap<EncoderWrap>(info) {
+        Napi::Env env = info.Env();
+        Napi::Object options = info.Length() > 0 && info[0].IsObject()
+            ? info[0].As<Napi::Object>() : Napi::Object::New(env);
+        try {
+            EncoderOptions encoder_options = ParseEncoderOptions(options);
+            if (!encoder_options.cpus.empty()) {
+                // Encodes run on the shared worker pool, whose threads must not be pinned.
+                throw std::runtime_error("cpus is only supported by pipeline encode stages");
+            }
+            encoder_ = std::make_shared<AsyncEncoder>(g_workers, std::move(encoder_options));
+        } catch (const std::exception& e) {
+            Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+        }
+    }
+
+private:
+    // Captures, converts and encodes natively; resolves with the packets that
+    // became ready, which may be none while the encoder fills its lookahead.
+    Napi::Value EncodeNextFrame(const Napi::CallbackInfo& info) {
+        g_recorder.IncrementFrameCount();
+        return ToPromise(info.Env(), CaptureAndEncode(encoder_, encoder_->Reserve()), FramesToArray);
+    }
+
+    Napi::Value Flush(const Napi::CallbackInfo& info) {
+        return ToPromise(info.Env(), FlushEncoder(encoder_, encoder_->Reserve()), FramesToArray);
+    }
+
+    Napi::Value Stats(const Napi::CallbackInfo& info) {
+        return MetricsToObject(info.Env(), encoder_ ? encoder_->GetMetrics() : Metrics());
+    }
+
+    std::shared_ptr<AsyncEncoder> encoder_;
+};
+
+Napi::FunctionReference EncoderWrap::constructor;
+
+Napi::Value CreateEncoder(const Napi::CallbackInfo& info) {
+    return EncoderWrap::constructor.New({info[0]});
+}
+
+Napi::Value GetNextFrameAsync(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    PixelFormat format = PixelFormat::kRGB24;
+    if (info.Length() > 0 && info[0].IsObject()) {
+        Napi::Value requested = info[0].As<Napi::Object>().Get("format");
+        if (requested.IsString()) {
+            std::string name = requested.As<Napi::String>().Utf8Value();
+            if (name != "i420") {
+                Napi::TypeError::New(env, "Unsupported frame format '" + name + "'").ThrowAsJavaScriptException();
+                return env.Null();
+            }
+            format = PixelFormat::kI420;
+        }
+    }
+
+    return ToPromise(env, g_async_recorder.NextFrame(format), [](Napi::Env env, Frame&& frame) {
+        g_recorder.IncrementFrameCount();
+        return FrameToObject(env, std::move(frame));
+    });
+}
+
+// setMemoryBudget(bytes): caps the addon's accounted native memory; 0 lifts
+// the cap.
+Napi::Value SetMemoryBudget(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsNumber() || info[0].As<Napi::Number>().DoubleValue() < 0) {
+        Napi::TypeError::New(env, "Expected a non-negative byte count").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    GlobalMemoryBudget().SetLimit(static_cast<size_t>(info[0].As<Napi::Number>().DoubleValue()));
+    return env.Undefined();
+}
+
+Napi::Value GetMemoryStats(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    ReportExternalMemory(env);
+    const MemoryBudget& budget = GlobalMemoryBudget();
+    Napi::Object pools = Napi::Object::New(env);
+    for (size_t i = 0; i < static_cast<size_t>(MemoryPool::kCount); i++) {
+        MemoryPool pool = static_cast<MemoryPool>(i);
+        pools.Set(MemoryPoolName(pool), Napi::Number::New(env, static_cast<double>(budget.Used(pool))));
+    }
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("budget", Napi::Number::New(env, static_cast<double>(budget.Limit())));
+    result.Set("used", Napi::Number::New(env, static_cast<double>(budget.Used())));
+    result.Set("rejected", Napi::Number::New(env, static_cast<double>(budget.Rejected())));
+    result.Set("pools", pools);
+    HugePageStats huge_pages = GetHugePageStats();
+    Napi::Object huge = Napi::Object::New(env);
+    huge.Set("explicit", Napi::Number::New(env, static_cast<double>(huge_pages.explicit_mappings)));
+    huge.Set("transparent", Napi::Number::New(env, static_cast<double>(huge_pages.transparent_mappings)));
+    huge.Set("reused", Napi::Number::New(env, static_cast<double>(huge_pages.reused)));
+    result.Set("hugePages", huge);
+    return result;
+}
+
+Task<void> WriteReplayTask(std::vector<ReplayStage::Packet> packets, std::unique_ptr<Stage> sink) {
+    co_await g_workers.Schedule();
+    WriteReplay(packets, *sink);
+}
+
+// saveReplay(path | {path, container, ...}): writes what the replay stage
+// holds through a sink built like a `sink` stage. Resolves once the file is
+// complete; capture and the live pipeline keep running meanwhile.
+Napi::Value PipelineWrap::SaveReplay(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (!pipeline_ || !replay_) {
+        Napi::Error::New(env, "This pipeline has no replay stage").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    Napi::Object descriptor = Napi::Object::New(env);
+    if (info.Length() > 0 && info[0].IsString()) {
+        descriptor.Set("path", info[0]);
+    } else if (info.Length() > 0 && info[0].IsObject()) {
+        descriptor = info[0].As<Napi::Object>();
+    }
+    std::unique_ptr<Stage> sink;
+    try {
+        sink = CreateSink(descriptor);
+    } catch (const std::exception& e) {
+        Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    return ToPromise(env, WriteReplayTask(replay_->Snapshot(), std::move(sink)),
+                     [](Napi::Env env) { return env.Undefined(); });
+}
+
+// captureBurst(n, {intervalMs, format}): resolves with n frames captured
+// back to back, each with its own timestamp. Every other capture waits while
+// a burst runs, so n is capped at kMaxBurstFrames and n * intervalMs at
+// kMaxBurstMs.
+constexpr double kMaxBurstFrames = 1000;
+constexpr double kMaxBurstMs = 10000;
+
+Napi::Value CaptureBurst(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsNumber() || info[0].As<Napi::Number>().DoubleValue() < 1) {
+        Napi::TypeError::New(env, "Expected a positive frame count").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    const double frames = info[0].As<Napi::Number>().DoubleValue();
+    Napi::Object options = info.Length() > 1 && info[1].IsObject() ? info[1].As<Napi::Object>() : Napi::Object::New(env);
+    const double interval_ms = GetNumberOption(options, "intervalMs", 0);
+    if (interval_ms < 0) {
+        Napi::TypeError::New(env, "intervalMs must be non-negative").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    if (frames > kMaxBurstFrames || frames * interval_ms > kMaxBurstMs) {
+        Napi::RangeError::New(env, "A burst is limited to " + std::to_string(static_cast<int>(kMaxBurstFrames)) +
+                                       " frames and " + std::to_string(static_cast<int>(kMaxBurstMs / 1000)) + " seconds")
+            .ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    const size_t count = static_cast<size_t>(frames);
+    // Frames keep the platform's capture layout unless i420 is requested.
+    PixelFormat format = PixelFormat::kRGB24;
+    std::string name = GetStringOption(options, "format", "");
+    if (name == "i420") {
+        format = PixelFormat::kI420;
+    } else if (!name.empty()) {
+        Napi::TypeError::New(env, "Unsupported frame format '" + name + "'").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    auto interval = std::chrono::microseconds(static_cast<int64_t>(interval_ms * 1000));
+    return ToPromise(env, g_async_recorder.Burst(count, interval, format),
+                     [](Napi::Env env, std::vector<Frame>&& frames) {
+                         for (size_t i = 0; i < frames.size(); i++) {
+                             g_recorder.IncrementFrameCount();
+                         }
+                         return FramesToArray(env, std::move(frames));
+                     });
+}
+
+// captureRegions([{x, y, width, height}, ...]): resolves with one frame per
+// rect, all sliced from a single capture of their bounding box.
+Napi::Value CaptureRegions(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsArray() || info[0].As<Napi::Array>().Length() == 0) {
+        Napi::TypeError::New(env, "Expected a non-empty array of rects").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    Napi::Array array = info[0].As<Napi::Array>();
+    std::vector<ScreenRect> rects;
+    for (uint32_t i = 0; i < array.Length(); i++) {
+        Napi::Value value = array.Get(i);
+        if (!value.IsObject()) {
+            Napi::TypeError::New(env, "Region " + std::to_string(i) + " is not a rect").ThrowAsJavaScriptException();
+            return env.Null();
+        }
+        Napi::Object object = value.As<Napi::Object>();
+        ScreenRect rect;
+        rect.x = static_cast<int>(GetNumberOption(object, "x", 0));
+        rect.y = static_cast<int>(GetNumberOption(object, "y", 0));
+        rect.width = static_cast<int>(GetNumberOption(object, "width", 0));
+        rect.height = static_cast<int>(GetNumberOption(object, "height", 0));
+        rects.push_back(rect);
+    }
+    return ToPromise(env, g_async_recorder.Regions(std::move(rects)), [](Napi::Env env, std::vector<Frame>&& frames) {
+        g_recorder.IncrementFrameCount();
+        return FramesToArray(env, std::move(frames));
+    });
+}
+
+ScreenRect GetRectOption(const Napi::Object& rect) {
+    ScreenRect result;
+    result.x = static_cast<int>(GetNumberOption(rect, "x", 0));
+    result.y = static_cast<int>(GetNumberOption(rect, "y", 0));
+    result.width = static_cast<int>(GetNumberOption(rect, "width", 0));
+    result.height = static_cast<int>(GetNumberOption(rect, "height", 0));
+    return result;
+}
+
+bool RectOnScreen(const ScreenRect& rect) {
+    ScreenDimensions screen = g_recorder.GetScreenDimensions();
+    return rect.x >= 0 && rect.y >= 0 && rect.width > 0 && rect.height > 0 &&
+           rect.x + rect.width <= screen.width && rect.y + rect.height <= screen.height;
+}
+
+// getPixel(x, y): {r, g, b} of one screen pixel. Only that pixel is fetched,
+// over the recorder's persistent connection, instead of the whole screen.
+Napi::Value GetPixel(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 2 || !info[0].IsNumber() || !info[1].IsNumber()) {
+        Napi::TypeError::New(env, "Expected x and y").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    ScreenRect rect;
+    rect.x = info[0].As<Napi::Number>().Int32Value();
+    rect.y = info[1].As<Napi::Number>().Int32Value();
+    rect.width = 1;
+    rect.height = 1;
+    if (!RectOnScreen(rect)) {
+        Napi::RangeError::New(env, "The pixel must lie on the screen").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    Frame area;
+    Frame rgb;
+    try {
+        g_recorder.CaptureArea(rect.x, rect.y, rect.width, rect.height, area);
+    } catch (const std::exception& e) {
+        Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    // HiDPI captures return a block of pixels; the first is the one asked for.
+    ConvertToRGB24(area, rgb);
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("r", Napi::Number::New(env, rgb.data[0]));
+    result.Set("g", Napi::Number::New(env, rgb.data[1]));
+    result.Set("b", Napi::Number::New(env, rgb.data[2]));
+    return result;
+}
+
+// sampleRect({x, y, width, height}): an rgb24 frame of just that area,
+// fetched in one request like getPixel.
+Napi::Value SampleRect(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsObject()) {
+        Napi::TypeError::New(env, "Expected a rect").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    ScreenRect rect = GetRectOption(info[0].As<Napi::Object>());
+    if (!RectOnScreen(rect)) {
+        Napi::RangeError::New(env, "The rect must lie on the screen").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    Frame area;
+    Frame rgb;
+    try {
+        g_recorder.CaptureArea(rect.x, rect.y, rect.width, rect.height, area);
+    } catch (const std::exception& e) {
+        Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    ConvertToRGB24(area, rgb);
+    return FrameToObject(env, std::move(rgb));
+}
+
+// watchRegion({x, y, width, height}, callback, {threshold, intervalMs}):
+// calls back with {x, y, width, height, changed, timestamp, frame} each time
+// at least `threshold` of the region's 16x16 tiles changed since the last
+// callback. The returned watcher keeps running until stop().
+class RegionWatchWrap : public Napi::ObjectWrap<RegionWatchWrap> {
+public:
+    static Napi::FunctionReference constructor;
+
+    static void Init(Napi::Env env) {
+        Napi::Function func = DefineClass(env, "RegionWatcher", {
+            InstanceMethod("stop", &RegionWatchWrap::Stop),
+            InstanceMethod("stats", &RegionWatchWrap::Stats),
+        });
+        constructor = Napi::Persistent(func);
+        constructor.SuppressDestruct();
+    }
+
+    RegionWatchWrap(const Napi::CallbackInfo& info) : Napi::ObjectWrap<RegionWatchWrap>(info) {
+        Napi::Env env = info.Env();
+        if (info.Length() < 2 || !info[0].IsObject() || !info[1].IsFunction()) {
+            Napi::TypeError::New(env, "Expected a rect and a callback").ThrowAsJavaScriptException();
+            return;
+        }
+        Napi::Object rect = info[0].As<Napi::Object>();
+        Napi::Object options = info.Length() > 2 && info[2].IsObject() ? info[2].As<Napi::Object>()
+                                                                        : Napi::Object::New(env);
+        RegionWatchOptions watch;
+        watch.rect = GetRectOption(rect);
+        watch.threshold = GetNumberOption(options, "threshold", 0);
+        const double interval_ms = GetNumberOption(options, "intervalMs", 250);
+        if (!RectOnScreen(watch.rect)) {
+            Napi::RangeError::New(env, "The region must lie on the screen").ThrowAsJavaScriptException();
+            return;
+        }
+        if (watch.threshold < 0 || watch.threshold > 1 || interval_ms < 1) {
+            Napi::RangeError::New(env, "threshold must be between 0 and 1 and intervalMs at least 1")
+                .ThrowAsJavaScriptException();
+            return;
+        }
+        watch.interval = std::chrono::milliseconds(static_cast<int64_t>(interval_ms));
+
+        // At most one call is queued: changes found while it waits for the
+        // JS thread are merged into it, keeping only the newest frame.
+        tsfn_ = Napi::ThreadSafeFunction::New(env, info[1].As<Napi::Function>(), "screen_recorder.watchRegion", 1, 1);
+        pending_ = std::make_shared<PendingChange>();
+        const ScreenRect origin = watch.rect;
+        Napi::ThreadSafeFunction tsfn = tsfn_;
+        std::shared_ptr<PendingChange> pending = pending_;
+        watcher_ = std::make_unique<RegionWatcher>(watch, [tsfn, origin, pending](Frame&& frame, const RegionChange& change) {
+            {
+                std::lock_guard<std::mutex> lock(pending->mutex);
+                if (pending->queued) {
+                    RegionChange& merged = pending->change;
+                    const int right = std::max(merged.x + merged.width, change.x + change.width);
+                    const int bottom = std::max(merged.y + merged.height, change.y + change.height);
+                    merged.x = std::min(merged.x, change.x);
+                    merged.y = std::min(merged.y, change.y);
+                    merged.width = right - merged.x;
+                    merged.height = bottom - merged.y;
+                    merged.fraction = std::max(merged.fraction, change.fraction);
+                    pending->frame = std::move(frame);
+                    pending->merged++;
+                    return;
+                }
+                pending->queued = true;
+                pending->frame = std::move(frame);
+                pending->change = change;
+            }
+            napi_status status = tsfn.NonBlockingCall(pending.get(), [origin, pending](
+                Napi::Env env, Napi::Function callback, PendingChange*) {
+                Frame frame;
+                RegionChange change;
+                {
+                    std::lock_guard<std::mutex> lock(pending->mutex);
+                    frame = std::move(pending->frame);
+                    change = pending->change;
+                    pending->queued = false;
+                }
+                // HiDPI captures are larger than the rect; report screen points.
+                const double scale_x = static_cast<double>(origin.width) / frame.width;
+                const double scale_y = static_cast<double>(origin.height) / frame.height;
+                Napi::Object result = Napi::Object::New(env);
+                result.Set("x", Napi::Number::New(env, origin.x + change.x * scale_x));
+                result.Set("y", Napi::Number::New(env, origin.y + change.y * scale_y));
+                result.Set("width", Napi::Number::New(env, change.width * scale_x));
+                result.Set("height", Napi::Number::New(env, change.height * scale_y));
+                result.Set("changed", Napi::Number::New(env, change.fraction));
+                result.Set("timestamp", Napi::Number::New(env, frame.timestamp_us / 1000.0));
+                result.Set("frame", FrameToObject(env, std::move(frame)));
+                callback.Call({result});
+            });
+            if (status != napi_ok) {
+                std::lock_guard<std::mutex> lock(pending->mutex);
+                pending->queued = false;
+                pending->frame = Frame();
+            }
+        });
+        try {
+            watcher_->Start();
+        } catch (const std::exception& e) {
+            tsfn_.Release();
+            watcher_.reset();
+            Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+        }
+    }
+
+    ~RegionWatchWrap() {
+        Shutdown();
+    }
+
+private:
+    Napi::Value Stop(const Napi::CallbackInfo& info) {
+        Shutdown();
+        return info.This();
+    }
+
+    Napi::Value Stats(const Napi::CallbackInfo& info) {
+        Napi::Env env = info.Env();
+        Napi::Object result = Napi::Object::New(env);
+        if (!watcher_) {
+            result.Set("running", Napi::Boolean::New(env, false));
+            return result;
+        }
+        result.Set("running", Napi::Boolean::New(env, watcher_->IsRunning()));
+        result.Set("mode", Napi::String::New(env, watcher_->Mode()));
+        result.Set("checks", Napi::Number::New(env, static_cast<double>(watcher_->Checks())));
+        result.Set("changes", Napi::Number::New(env, static_cast<double>(watcher_->Changes())));
+        result.Set("merged", Napi::Number::New(env, static_cast<double>(pending_->merged)));
+        std::string error = watcher_->Error();
+        if (!error.empty()) {
+            result.Set("error", Napi::String::New(env, error));
+        }
+        return result;
+    }
+
+    // Joins the watch thread before releasing the callback, so no call is
+    // queued after the release.
+    void Shutdown() {
+        if (!watcher_ || stopped_) {
+            return;
+        }
+        stopped_ = true;
+        watcher_->Stop();
+        tsfn_.Release();
+    }
+
+    // The change waiting for the JS thread, shared with the queued call.
+    struct PendingChange {
+        std::mutex mutex;
+        bool queued = false;
+        Frame frame;
+        RegionChange change;
+        std::atomic<uint64_t> merged{0};
+    };
+
+    std::unique_ptr<RegionWatcher> watcher_;
+    Napi::ThreadSafeFunction tsfn_;
+    std::shared_ptr<PendingChange> pending_;
+    bool stopped_ = false;
+};
+
+Napi::FunctionReference RegionWatchWrap::constructor;
+
+Napi::Value WatchRegion(const Napi::CallbackInfo& info) {
+    return RegionWatchWrap::constructor.New({info[0], info[1], info[2]});
+}
+
+struct StableResult {
+    bool stable = false;
+    double elapsed_ms = 0;
+    uint64_t changes = 0;
+};
+
+// Watches the region without a change callback until it settles; the
+// coroutine sleeps meanwhile and resumes on the worker pool.
+Task<StableResult> WaitForStableTask(RegionWatchOptions options) {
+    const auto start = std::chrono::steady_clock::now();
+    RegionWatcher watcher(options, nullptr);
+    struct Awaiter {
+        RegionWatcher& watcher;
+        bool stable = false;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            watcher.Start([this, handle](bool settled) {
+                stable = settled;
+                g_workers.Post(handle);
+            });
+        }
+        bool await_resume() const noexcept { return stable; }
+    };
+    StableResult result;
+    result.stable = co_await Awaiter{watcher};
+    watcher.Stop();
+    std::string error = watcher.Error();
+    if (!error.empty()) {
+        throw std::runtime_error(error);
+    }
+    result.elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    result.changes = watcher.Changes();
+    co_return result;
+}
+
+// waitForStable({region, quietMs, timeoutMs, threshold}): resolves with
+// {stable, elapsed, changes} once the region (the whole screen by default)
+// has gone quietMs without a pixel change, or with stable false after
+// timeoutMs. Frames stay native; nothing is copied to JS.
+Napi::Value WaitForStable(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::Object options = info.Length() > 0 && info[0].IsObject() ? info[0].As<Napi::Object>() : Napi::Object::New(env);
+    RegionWatchOptions watch;
+    if (options.Get("region").IsObject()) {
+        watch.rect = GetRectOption(options.Get("region").As<Napi::Object>());
+    } else {
+        ScreenDimensions screen = g_recorder.GetScreenDimensions();
+        watch.rect.width = screen.width;
+        watch.rect.height = screen.height;
+    }
+    const double quiet_ms = GetNumberOption(options, "quietMs", 500);
+    const double timeout_ms = GetNumberOption(options, "timeoutMs", 10000);
+    watch.threshold = GetNumberOption(options, "threshold", 0);
+    // Polling has to sample a few times per quiet period to notice motion.
+    const double interval_ms = GetNumberOption(options, "intervalMs", std::clamp(quiet_ms / 4, 1.0, 250.0));
+    if (!RectOnScreen(watch.rect)) {
+        Napi::RangeError::New(env, "The region must lie on the screen").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    if (quiet_ms < 1 || timeout_ms < 0 || interval_ms < 1 || watch.threshold < 0 || watch.threshold > 1) {
+        Napi::RangeError::New(env, "quietMs and intervalMs must be at least 1, timeoutMs non-negative and "
+                                   "threshold between 0 and 1").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    watch.quiet = std::chrono::milliseconds(static_cast<int64_t>(quiet_ms));
+    watch.timeout = std::chrono::milliseconds(static_cast<int64_t>(timeout_ms));
+    watch.interval = std::chrono::milliseconds(static_cast<int64_t>(interval_ms));
+    return ToPromise(env, WaitForStableTask(watch), [](Napi::Env env, StableResult&& stable) {
+        Napi::Object result = Napi::Object::New(env);
+        result.Set("stable", Napi::Boolean::New(env, stable.stable));
+        result.Set("elapsed", Napi::Number::New(env, stable.elapsed_ms));
+        result.Set("changes", Napi::Number::New(env, static_cast<double>(stable.changes)));
+        return result;
+    });
+}
+
+Task<std::vector<TemplateMatch>> FindImageTask(ScreenRect rect, Frame needle, TemplateMatchOptions options) {
+    std::vector<ScreenRect> rects(1, rect);
+    std::vector<Frame> frames = co_await g_async_recorder.Regions(std::move(rects));
+    co_await g_workers.Schedule();
+    std::vector<TemplateMatch> matches = FindTemplate(frames[0], needle, options, g_workers);
+    // HiDPI captures are larger than the region; report screen points.
+    const double scale_x = static_cast<double>(rect.width) / frames[0].width;
+    const double scale_y = static_cast<double>(rect.height) / frames[0].height;
+    for (TemplateMatch& match : matches) {
+        match.x = rect.x + static_cast<int>(match.x * scale_x);
+        match.y = rect.y + static_cast<int>(match.y * scale_y);
+    }
+    co_return matches;
+}
+
+// findImage({data, width, height, format, stride}, {region, tolerance,
+// maxResults}): captures the region (the whole screen by default) and
+// resolves with [{x, y, width, height, score}] wherever the image appears,
+// best first. Frames from getNextFrameAsync or captureRegions can be used
+// as templates directly; tolerance is the largest mean luma difference
+// accepted, as a share of 255.
+Napi::Value FindImage(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsObject() || !info[0].As<Napi::Object>().Get("data").IsTypedArray()) {
+        Napi::TypeError::New(env, "Expected an image with data, width and height").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    Napi::Object image = info[0].As<Napi::Object>();
+    Napi::Object options = info.Length() > 1 && info[1].IsObject() ? info[1].As<Napi::Object>() : Napi::Object::New(env);
+
+    Frame needle;
+    needle.width = static_cast<int>(GetNumberOption(image, "width", 0));
+    needle.height = static_cast<int>(GetNumberOption(image, "height", 0));
+    const std::string format = GetStringOption(image, "format", "rgb24");
+    if (format == "rgb24") {
+        needle.format = PixelFormat::kRGB24;
+    } else if (format == "bgr24") {
+        needle.format = PixelFormat::kBGR24;
+    } else if (format == "bgra") {
+        needle.format = PixelFormat::kBGRA;
+    } else if (format == "i420") {
+        needle.format = PixelFormat::kI420;
+    } else {
+        Napi::TypeError::New(env, "Unsupported image format '" + format + "'").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    const int row_bytes = needle.format == PixelFormat::kI420 ? needle.width : needle.width * BytesPerPixel(needle.format);
+    needle.stride = static_cast<int>(GetNumberOption(image, "stride", row_bytes));
+    Napi::Uint8Array data = image.Get("data").As<Napi::Uint8Array>();
+    const size_t needed = needle.format == PixelFormat::kI420 ? I420Size(needle.width, needle.height)
+                                                              : static_cast<size_t>(needle.stride) * needle.height;
+    if (needle.width <= 0 || needle.height <= 0 || needle.stride < row_bytes || data.ByteLength() < needed) {
+        Napi::RangeError::New(env, "The image data does not match its width, height and stride")
+            .ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    needle.data.assign(data.Data(), data.Data() + needed);
+
+    ScreenRect rect;
+    if (options.Get("region").IsObject()) {
+        rect = GetRectOption(options.Get("region").As<Napi::Object>());
+    } else {
+        ScreenDimensions screen = g_recorder.GetScreenDimensions();
+        rect.width = screen.width;
+        rect.height = screen.height;
+    }
+    TemplateMatchOptions match_options;
+    match_options.tolerance = GetNumberOption(options, "tolerance", match_options.tolerance);
+    const double max_results = GetNumberOption(options, "maxResults", static_cast<double>(match_options.max_results));
+    if (!RectOnScreen(rect)) {
+        Napi::RangeError::New(env, "The region must lie on the screen").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    if (match_options.tolerance < 0 || match_options.tolerance > 1 || max_results < 1) {
+        Napi::RangeError::New(env, "tolerance must be between 0 and 1 and maxResults at least 1")
+            .ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    match_options.max_results = static_cast<size_t>(max_results);
+    const int width = needle.width;
+    const int height = needle.height;
+    return ToPromise(env, FindImageTask(rect, std::move(needle), match_options),
+                     [width, height](Napi::Env env, std::vector<TemplateMatch>&& matches) {
+                         Napi::Array result = Napi::Array::New(env, matches.size());
+                         for (size_t i = 0; i < matches.size(); i++) {
+                             Napi::Object match = Napi::Object::New(env);
+                             match.Set("x", Napi::Number::New(env, matches[i].x));
+                             match.Set("y", Napi::Number::New(env, matches[i].y));
+                             match.Set("width", Napi::Number::New(env, width));
+                             match.Set("height", Napi::Number::New(env, height));
+                             match.Set("score", Napi::Number::New(env, matches[i].score));
+                             result.Set(static_cast<uint32_t>(i), match);
+                         }
+                         return result;
+                     });
+}
+
+Napi::Value CreatePipeline(const Napi::CallbackInfo& info) {
+    return PipelineWrap::constructor.New({info[0], info[1]});
+}
+
+Napi::Value CreateVncServer(const Napi::CallbackInfo& info) {
+    return VncServerWrap::constructor.New({info[0]});
+}
+
 Napi::Object Initialize(Napi::Env env, Napi::Object exports) {
+    PipelineWrap::Init(env);
+    EncoderWrap::Init(env);
+    VncServerWrap::Init(env);
+    RegionWatchWrap::Init(env);
+
     exports.Set("getNextFrame", Napi::Function::New(env, GetNextFrame));
     exports.Set("getFramesCount", Napi::Function::New(env, GetFramesCount));
     exports.Set("getScreenDimensions", Napi::Function::New(env, GetScreenDimensions));
+    exports.Set("getNextFrameAsync", Napi::Function::New(env, GetNextFrameAsync));
+    exports.Set("captureBurst", Napi::Function::New(env, CaptureBurst));
+    exports.Set("captureRegions", Napi::Function::New(env, CaptureRegions));
+    exports.Set("getPixel", Napi::Function::New(env, GetPixel));
+    exports.Set("sampleRect", Napi::Function::New(env, SampleRect));
+    exports.Set("watchRegion", Napi::Function::New(env, WatchRegion));
+    exports.Set("waitForStable", Napi::Function::New(env, WaitForStable));
+    exports.Set("findImage", Napi::Function::New(env, FindImage));
+    exports.Set("createPipeline", Napi::Function::New(env, CreatePipeline));
+    exports.Set("createEncoder", Napi::Function::New(env, CreateEncoder));
+    exports.Set("createVncServer", Napi::Function::New(env, CreateVncServer));
+    exports.Set("setMemoryBudget", Napi::Function::New(env, SetMemoryBudget));
+    exports.Set("getMemoryStats", Napi::Function::New(env, GetMemoryStats));
     return exports;
 }
 
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <deque>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "frame.h"
+#include "mp4_muxer.h"
+#include "pipeline.h"
+
+namespace screen_recorder {
+
+// Writes `bytes` next to `path` and renames it into place, so readers only
+// ever observe complete files.
+inline void WriteFileAtomically(const std::filesystem::path& path, const std::vector<uint8_t>& bytes) {
+    std::filesystem::path temporary = path;
+    temporary += ".tmp";
+    FILE* file = std::fopen(temporary.string().c_str(), "wb");
+    if (!file) {
+        throw std::runtime_error("Unable to open " + temporary.string());
+    }
+    bool written = std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    written = std::fclose(file) == 0 && written;
+    if (!written) {
+        throw std::runtime_error("Write to " + temporary.string() + " failed");
+    }
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+        throw std::runtime_error("Unable to rename " + temporary.string() + ": " + error.message());
+    }
+}
+
+inline void WriteFileAtomically(const std::filesystem::path& path, const std::string& text) {
+    WriteFileAtomically(path, std::vector<uint8_t>(text.begin(), text.end()));
+}
+
+enum class ManifestFormat {
+    kHls,
+    kDash,
+};
+
+struct SegmenterOptions {
+    ManifestFormat format = ManifestFormat::kHls;
+    int64_t segment_duration_us = 2000000;
+    size_t playlist_size = 6;
+};
+
+// Cuts the encoded stream into fMP4 media segments on keyframes at the target
+// duration and maintains a rolling HLS playlist or DASH manifest beside them.
+// Segments that fall out of the window are deleted (after a short grace
+// period for clients still fetching them), so disk usage stays bounded.
+class SegmenterStage : public Stage {
+public:
+    SegmenterStage(const std::string& manifest_path, SegmenterOptions options)
+        : manifest_path_(manifest_path), directory_(manifest_path_.parent_path()), options_(options),
+          muxer_(options.segment_duration_us,
+                 [this](std::vector<uint8_t>&& init) { WriteFileAtomically(directory_ / "init.mp4", init); },
+                 [this](std::vector<uint8_t>&& fragment, const FragmentInfo& info) { AddSegment(fragment, info); }) {
+        if (directory_.empty()) {
+            directory_ = ".";
+        }
+        std::error_code error;
+        std::filesystem::create_directories(directory_, error);
+        if (error) {
+            throw std::runtime_error("Unable to create " + directory_.string() + ": " + error.message());
+        }
+    }
+
+    std::string Name() const override {
+        return "sink(" + manifest_path_.string() + ")";
+    }
+
+    void Process(Frame&& frame, const Emit& emit) override {
+        muxer_.AddPacket(std::move(frame));
+    }
+
+    void Flush(const Emit& emit) override {
+        muxer_.Finish();
+        ended_ = true;
+        if (!segments_.empty()) {
+            WriteManifest();
+        }
+    }
+
+private:
+    struct Segment {
+        uint64_t number;
+        int64_t start_us;
+        int64_t duration_us;
+        size_t bytes;
+        // False for segments cut without a keyframe, where playback cannot
+        // start.
+        bool starts_with_keyframe;
+    };
+
+    static constexpr size_t kGraceSegments = 2;
+
+    static std::string SegmentName(uint64_t number) {
+        return "segment_" + std::to_string(number) + ".m4s";
+    }
+
+    void AddSegment(const std::vector<uint8_t>& fragment, const FragmentInfo& info) {
+        const uint64_t number = next_number_++;
+        WriteFileAtomically(directory_ / SegmentName(number), fragment);
+        if (number == 0) {
+            // Media time zero, placed so the first segment becomes
+            // available as it is written.
+            availability_start_ = std::chrono::system_clock::now() -
+                                  std::chrono::microseconds(info.start_us + info.duration_us);
+        }
+        segments_.push_back({number, info.start_us, info.duration_us, fragment.size(), info.starts_with_keyframe});
+
+        while (segments_.size() > options_.playlist_size) {
+            expired_.push_back(segments_.front().number);
+            segments_.pop_front();
+        }
+        WriteManifest();
+        while (expired_.size() > kGraceSegments) {
+            std::error_code error;
+            std::filesystem::remove(directory_ / SegmentName(expired_.front()), error);
+            expired_.pop_front();
+        }
+    }
+
+    void WriteManifest() {
+        if (options_.format == ManifestFormat::kHls) {
+            WriteFileAtomically(manifest_path_, BuildPlaylist());
+        } else {
+            WriteFileAtomically(manifest_path_, BuildMpd());
+        }
+    }
+
+    std::string BuildPlaylist() const {
+        // The target may not change during a stream, so it covers the
+        // longest segment the muxer can cut rather than the longest so far.
+        const int64_t target = muxer_.MaxFragmentDurationUs();
+        std::string playlist = "#EXTM3U\n#EXT-X-VERSION:7\n";
+        playlist += "#EXT-X-TARGETDURATION:" + std::to_string((target + 999999) / 1000000) + "\n";
+        playlist += "#EXT-X-MEDIA-SEQUENCE:" + std::to_string(segments_.front().number) + "\n";
+        playlist += "#EXT-X-MAP:URI=\"init.mp4\"\n";
+        char duration[32];
+        for (const Segment& segment : segments_) {
+            std::snprintf(duration, sizeof(duration), "%.3f", segment.duration_us / 1e6);
+            playlist += "#EXTINF:" + std::string(duration) + ",\n" + SegmentName(segment.number) + "\n";
+        }
+        if (ended_) {
+            playlist += "#EXT-X-ENDLIST\n";
+        }
+        return playlist;
+    }
+
+    static std::string Iso8601(std::chrono::system_clock::time_point time) {
+        std::time_t seconds = std::chrono::system_clock::to_time_t(time);
+        std::tm utc;
+#ifdef _WIN32
+        gmtime_s(&utc, &seconds);
+#else
+        gmtime_r(&seconds, &utc);
+#endif
+        char buffer[32];
+        std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ", &utc);
+        return buffer;
+    }
+
+    static std::string Duration(int64_t microseconds) {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "PT%.3fS", microseconds / 1e6);
+        return buffer;
+    }
+
+    std::string BuildMpd() const {
+        const mp4::Track& track = muxer_.Track();
+        int64_t window_us = 0;
+        size_t window_bytes = 0;
+        for (const Segment& segment : segments_) {
+            window_us += segment.duration_us;
+            window_bytes += segment.bytes;
+        }
+        const uint64_t bandwidth = window_us > 0 ? window_bytes * 8000000ull / window_us : 0;
+        const bool independent = std::all_of(segments_.begin(), segments_.end(), [](const Segment& segment) {
+            return segment.starts_with_keyframe;
+        });
+
+        std::string mpd = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+        mpd += "<MPD xmlns=\"urn:mpeg:dash:schema:mpd:2011\" profiles=\"urn:mpeg:dash:profile:isoff-live:2011\"";
+        if (ended_) {
+            mpd += " type=\"static\" mediaPresentationDuration=\"" +
+                   Duration(segments_.back().start_us + segments_.back().duration_us) + "\"";
+        } else {
+            mpd += " type=\"dynamic\" availabilityStartTime=\"" + Iso8601(availability_start_) +
+                   "\" publishTime=\"" + Iso8601(std::chrono::system_clock::now()) +
+                   "\" minimumUpdatePeriod=\"" + Duration(options_.segment_duration_us) +
+                   "\" timeShiftBufferDepth=\"" + Duration(window_us) + "\"";
+        }
+        mpd += " minBufferTime=\"" + Duration(options_.segment_duration_us) + "\">\n";
+        mpd += "  <Period id=\"0\" start=\"PT0S\">\n";
+        mpd += "    <AdaptationSet mimeType=\"video/mp4\" segmentAlignment=\"true\"";
+        mpd += independent ? " startWithSAP=\"1\">\n" : ">\n";
+        mpd += "      <Representation id=\"video\" codecs=\"" + mp4::CodecString(track) + "\" width=\"" +
+               std::to_string(track.width) + "\" height=\"" + std::to_string(track.height) +
+               "\" bandwidth=\"" + std::to_string(bandwidth) + "\">\n";
+        mpd += "        <SegmentTemplate timescale=\"" + std::to_string(mp4::kTimescale) +
+               "\" initialization=\"init.mp4\" media=\"segment_$Number$.m4s\" startNumber=\"" +
+               std::to_string(segments_.front().number) + "\">\n";
+        mpd += "          <SegmentTimeline>\n";
+        for (const Segment& segment : segments_) {
+            mpd += "            <S t=\"" + std::to_string(mp4::ToTimescale(segment.start_us)) + "\" d=\"" +
+                   std::to_string(mp4::ToTimescale(segment.duration_us)) + "\"/>\n";
+        }
+        mpd += "          </SegmentTimeline>\n        </SegmentTemplate>\n      </Representation>\n";
+        mpd += "    </AdaptationSet>\n  </Period>\n</MPD>\n";
+        return mpd;
+    }
+
+    std::filesystem::path manifest_path_;
+    std::filesystem::path directory_;
+    SegmenterOptions options_;
+    Fmp4Muxer muxer_;
+    std::chrono::system_clock::time_point availability_start_;
+    std::deque<Segment> segments_;
+    std::deque<uint64_t> expired_;
+    uint64_t next_number_ = 0;
+    bool ended_ = false;
+};
+
+}  // namespace screen_recorder
@@ -0,0 +1,282 @@
+#pragma once
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCREEN_RECORDER_SAD_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define SCREEN_RECORDER_SAD_NEON
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "async.h"
+#include "convert.h"
+#include "frame.h"
+
+namespace screen_recorder {
+
+struct TemplateMatch {
+    // Top-left corner in haystack pixels.
+    int x = 0;
+    int y = 0;
+    // 1 minus the mean absolute luma difference as a share of 255; 1 is an
+    // exact match.
+    double score = 0;
+};
+
+struct TemplateMatchOptions {
+    // Largest mean absolute luma difference accepted, as a share of 255.
+    double tolerance = 0.05;
+    size_t max_results = 10;
+};
+
+namespace detail {
+
+struct GrayImage {
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> data;
+
+    const uint8_t* Row(int y) const {
+        return data.data() + static_cast<size_t>(y) * width;
+    }
+};
+
+// Luma of a packed or I420 frame, tightly strided.
+inline void ToGray(const Frame& frame, GrayImage& gray) {
+    gray.width = frame.width;
+    gray.height = frame.height;
+    gray.data.resize(static_cast<size_t>(frame.width) * frame.height);
+    const int bpp = BytesPerPixel(frame.format);
+    const ChannelOrder order = GetChannelOrder(frame.format);
+    for (int y = 0; y < frame.height; y++) {
+        const uint8_t* in = frame.data.data() + static_cast<size_t>(y) * frame.stride;
+        uint8_t* out = gray.data.data() + static_cast<size_t>(y) * gray.width;
+        if (frame.format == PixelFormat::kI420) {
+            std::copy(in, in + frame.width, out);
+            continue;
+        }
+        for (int x = 0; x < frame.width; x++, in += bpp) {
+            out[x] = RgbToY(in[order.r], in[order.g], in[order.b]);
+        }
+    }
+}
+
+// Rounded mean of the `size` x `size` block starting at every pixel, so the
+// result is `size - 1` smaller in each direction. Sliding sums keep the cost
+// independent of the block size; blocks of up to 16 fit 16-bit sums.
+inline void BoxMeans(const GrayImage& src, int size, GrayImage& dst) {
+    dst.width = src.width - size + 1;
+    dst.height = src.height - size + 1;
+    dst.data.resize(static_cast<size_t>(dst.width) * dst.height);
+    std::vector<uint16_t> rows(static_cast<size_t>(dst.width) * src.height);
+    for (int y = 0; y < src.height; y++) {
+        const uint8_t* in = src.Row(y);
+        uint16_t* out = rows.data() + static_cast<size_t>(y) * dst.width;
+        uint16_t sum = 0;
+        for (int x = 0; x < size; x++) {
+            sum += in[x];
+        }
+        out[0] = sum;
+        for (int x = 1; x < dst.width; x++) {
+            sum = static_cast<uint16_t>(sum + in[x + size - 1] - in[x - 1]);
+            out[x] = sum;
+        }
+    }
+    const int area = size * size;
+    std::vector<uint16_t> sums(rows.begin(), rows.begin() + dst.width);
+    for (int y = 1; y < size; y++) {
+        for (int x = 0; x < dst.width; x++) {
+            sums[x] += rows[static_cast<size_t>(y) * dst.width + x];
+        }
+    }
+    for (int y = 0; y < dst.height; y++) {
+        uint8_t* out = dst.data.data() + static_cast<size_t>(y) * dst.width;
+        for (int x = 0; x < dst.width; x++) {
+            out[x] = static_cast<uint8_t>((sums[x] + area / 2) / area);
+        }
+        if (y + 1 == dst.height) {
+            break;
+        }
+        const uint16_t* leaving = rows.data() + static_cast<size_t>(y) * dst.width;
+        const uint16_t* entering = rows.data() + static_cast<size_t>(y + size) * dst.width;
+        for (int x = 0; x < dst.width; x++) {
+            sums[x] = static_cast<uint16_t>(sums[x] + entering[x] - leaving[x]);
+        }
+    }
+}
+
+// Every `step`th pixel of `src` starting at (x, y).
+inline void Subsample(const GrayImage& src, int x, int y, int step, GrayImage& dst) {
+    dst.width = (src.width - x + step - 1) / step;
+    dst.height = (src.height - y + step - 1) / step;
+    dst.data.resize(static_cast<size_t>(dst.width) * dst.height);
+    for (int row = 0; row < dst.height; row++) {
+        const uint8_t* in = src.Row(y + row * step) + x;
+        uint8_t* out = dst.data.data() + static_cast<size_t>(row) * dst.width;
+        for (int column = 0; column < dst.width; column++) {
+            out[column] = in[column * step];
+        }
+    }
+}
+
+// Sum of absolute differences of two byte rows, 16 bytes per step where
+// the target has SSE2 (psadbw) or NEON.
+inline uint32_t RowSad(const uint8_t* a, const uint8_t* b, int count) {
+    uint32_t sum = 0;
+    int i = 0;
+#if defined(SCREEN_RECORDER_SAD_SSE2)
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16) {
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+                                              _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i))));
+    }
+    for (; i + 8 <= count; i += 8) {
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(a + i)),
+                                              _mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + i))));
+    }
+    sum = static_cast<uint32_t>(_mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+#elif defined(SCREEN_RECORDER_SAD_NEON)
+    uint32x4_t acc = vdupq_n_u32(0);
+    for (; i + 16 <= count; i += 16) {
+        acc = vpadalq_u16(acc, vpaddlq_u8(vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i))));
+    }
+    sum = vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) + vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+#endif
+    for (; i < count; i++) {
+        sum += static_cast<uint32_t>(std::abs(a[i] - b[i]));
+    }
+    return sum;
+}
+
+// SAD of `patch` placed at (x, y) in `image`. Gives up, returning something
+// above `limit`, as soon as the rows summed so far exceed it.
+inline uint64_t PatchSad(const GrayImage& image, int x, int y, const GrayImage& patch, uint64_t limit) {
+    uint64_t sum = 0;
+    for (int row = 0; row < patch.height && sum <= limit; row++) {
+        sum += RowSad(image.Row(y + row) + x, patch.Row(row), patch.width);
+    }
+    return sum;
+}
+
+struct Candidate {
+    uint64_t sad;
+    int x;
+    int y;
+};
+
+// Sorts by SAD and drops candidates overlapping a better one by more than
+// half the template in both directions.
+inline void SuppressOverlaps(std::vector<Candidate>& candidates, int width, int height, size_t limit) {
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        return a.sad < b.sad;
+    });
+    std::vector<Candidate> kept;
+    for (const Candidate& candidate : candidates) {
+        if (kept.size() == limit) {
+            break;
+        }
+        bool overlaps = false;
+        for (const Candidate& better : kept) {
+            if (std::abs(candidate.x - better.x) < width / 2 + 1 && std::abs(candidate.y - better.y) < height / 2 + 1) {
+                overlaps = true;
+                break;
+            }
+        }
+        if (!overlaps) {
+            kept.push_back(candidate);
+        }
+    }
+    candidates.swap(kept);
+}
+
+}  // namespace detail
+
+// Finds where `needle` appears in `haystack` by luma SAD, coarse to fine.
+// The needle is reduced by a factor of up to 8 (while its short side stays
+// at least 4 pixels) and each candidate position is first compared at that
+// scale: the haystack's block means are kept for every pixel offset, split
+// into one subsampled image per phase, so the coarse comparison is exact for
+// every position rather than only those on the block grid. A mean over
+// blocks never differs more than the pixels inside it, so the coarse test
+// rejects no position the full-size test would accept; survivors are then
+// checked at full size. Rows are spread over `executor`, and each comparison
+// stops as soon as it passes the tolerance. Returns up to `max_results`
+// matches, best first, none overlapping a better one by more than half.
+inline std::vector<TemplateMatch> FindTemplate(const Frame& haystack, const Frame& needle,
+                                               const TemplateMatchOptions& options, Executor& executor) {
+    constexpr int kMaxScale = 8;
+    constexpr int kMinSide = 4;
+
+    detail::GrayImage hay;
+    detail::GrayImage pin;
+    detail::ToGray(haystack, hay);
+    detail::ToGray(needle, pin);
+    if (pin.width == 0 || pin.height == 0 || pin.width > hay.width || pin.height > hay.height) {
+        return {};
+    }
+    int scale = 1;
+    while (scale < kMaxScale && std::min(pin.width, pin.height) / (scale * 2) >= kMinSide) {
+        scale *= 2;
+    }
+
+    // Block means of the needle on its own grid; partial edge blocks are
+    // left out of the coarse test.
+    detail::GrayImage pin_means;
+    detail::GrayImage coarse_pin;
+    std::vector<detail::GrayImage> phases;
+    if (scale > 1) {
+        detail::BoxMeans(pin, scale, pin_means);
+        detail::Subsample(pin_means, 0, 0, scale, coarse_pin);
+
+        detail::GrayImage hay_means;
+        detail::BoxMeans(hay, scale, hay_means);
+        phases.resize(static_cast<size_t>(scale) * scale);
+        for (int y = 0; y < scale; y++) {
+            for (int x = 0; x < scale; x++) {
+                detail::Subsample(hay_means, x, y, scale, phases[static_cast<size_t>(y) * scale + x]);
+            }
+        }
+    }
+
+    const uint64_t fine_limit = static_cast<uint64_t>(options.tolerance * 255 * pin.width * pin.height);
+    // Rounding the means costs up to one level per coarse pixel.
+    const uint64_t coarse_limit =
+        fine_limit / (static_cast<uint64_t>(scale) * scale) + static_cast<uint64_t>(coarse_pin.width) * coarse_pin.height;
+    const int rows = hay.height - pin.height + 1;
+    const int columns = hay.width - pin.width + 1;
+    std::vector<std::vector<detail::Candidate>> found(rows);
+    ParallelFor(executor, rows, [&](int y) {
+        for (int phase_x = 0; phase_x < scale && phase_x < columns; phase_x++) {
+            const detail::GrayImage* coarse =
+                scale > 1 ? &phases[static_cast<size_t>(y % scale) * scale + phase_x] : nullptr;
+            for (int x = phase_x; x < columns; x += scale) {
+                if (coarse && detail::PatchSad(*coarse, x / scale, y / scale, coarse_pin, coarse_limit) > coarse_limit) {
+                    continue;
+                }
+                const uint64_t sad = detail::PatchSad(hay, x, y, pin, fine_limit);
+                if (sad <= fine_limit) {
+                    found[y].push_back({sad, x, y});
+                }
+            }
+        }
+    });
+
+    std::vector<detail::Candidate> candidates;
+    for (const auto& row : found) {
+        candidates.insert(candidates.end(), row.begin(), row.end());
+    }
+    detail::SuppressOverlaps(candidates, pin.width, pin.height, options.max_results);
+    const double full = 255.0 * pin.width * pin.height;
+    std::vector<TemplateMatch> matches;
+    for (const detail::Candidate& candidate : candidates) {
+        matches.push_back({candidate.x, candidate.y, 1 - candidate.sad / full});
+    }
+    return matches;
+}
+
+}  // namespace screen_recorder
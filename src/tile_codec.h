@@ -0,0 +1,332 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <list>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "encoder.h"
+#include "frame.h"
+#include "hash.h"
+#include "memory_budget.h"
+#include "rfb_encodings.h"
+
+namespace screen_recorder {
+
+struct TileCacheStats {
+    uint64_t hits = 0;
+    // Hits on tiles cached before the latest refresh; a cache cleared on
+    // every refresh would have missed them.
+    uint64_t old_hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+};
+
+// Bounded LRU of tile hash -> tile pixels. Every tile costs its pixel size
+// against the budget, so a decoder replaying the same Find/Insert sequence
+// with the same budget evicts exactly the same tiles. Cached pixels are also
+// charged to the global memory budget.
+class TileCache {
+public:
+    explicit TileCache(size_t budget_bytes) : budget_(budget_bytes) {}
+
+    ~TileCache() {
+        Clear();
+    }
+
+    TileCache(const TileCache&) = delete;
+    TileCache& operator=(const TileCache&) = delete;
+
+    // Marks the tile most recently used; false when it is not cached.
+    // `epoch` is the caller's refresh count, used only for statistics.
+    bool Find(uint64_t hash, uint64_t epoch = 0) {
+        auto it = index_.find(hash);
+        if (it == index_.end()) {
+            misses_++;
+            return false;
+        }
+        entries_.splice(entries_.begin(), entries_, it->second);
+        hits_++;
+        if (it->second->epoch < epoch) {
+            old_hits_++;
+        }
+        return true;
+    }
+
+    // Evicts per the cache budget, then caches the tile unless the global
+    // memory budget refuses it; returns whether it was cached. Decoders,
+    // which only insert what the encoder cached, can pass `global` false.
+    bool Insert(uint64_t hash, const uint8_t* pixels, size_t size, bool global = true, uint64_t epoch = 0) {
+        if (size > budget_ || index_.count(hash)) {
+            return false;
+        }
+        if (global && !GlobalMemoryBudget().TryCharge(MemoryPool::kTileCache, size)) {
+            return false;
+        }
+        while (bytes_ + size > budget_) {
+            const size_t evicted = entries_.back().pixels.size();
+            bytes_ -= evicted;
+            if (entries_.back().charged) {
+                GlobalMemoryBudget().Release(MemoryPool::kTileCache, evicted);
+            }
+            index_.erase(entries_.back().hash);
+            entries_.pop_back();
+            evictions_++;
+        }
+        entries_.push_front({hash, std::vector<uint8_t>(pixels, pixels + size), global, epoch});
+        index_[hash] = entries_.begin();
+        bytes_ += size;
+        return true;
+    }
+
+    void Clear() {
+        for (const Entry& entry : entries_) {
+            if (entry.charged) {
+                GlobalMemoryBudget().Release(MemoryPool::kTileCache, entry.pixels.size());
+            }
+        }
+        entries_.clear();
+        index_.clear();
+        bytes_ = 0;
+    }
+
+    // Safe to call from any thread while another one encodes.
+    TileCacheStats Stats() const {
+        TileCacheStats stats;
+        stats.hits = hits_;
+        stats.old_hits = old_hits_;
+        stats.misses = misses_;
+        stats.evictions = evictions_;
+        stats.entries = entry_count_;
+        stats.bytes = bytes_;
+        return stats;
+    }
+
+    void Publish() {
+        entry_count_ = index_.size();
+    }
+
+private:
+    struct Entry {
+        uint64_t hash;
+        std::vector<uint8_t> pixels;
+        bool charged;
+        uint64_t epoch;
+    };
+
+    size_t budget_;
+    std::list<Entry> entries_;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index_;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> old_hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> evictions_{0};
+    std::atomic<size_t> entry_count_{0};
+    std::atomic<size_t> bytes_{0};
+};
+
+// Lossless I420 tile-delta codec for screen content. Each frame is cut into
+// 16x16 luma tiles (8x8 chroma); a tile identical to the one at the same
+// place in the previous frame is skipped, a tile found in the content cache
+// is sent as its 64-bit hash, and anything else is sent as pixels and cached.
+// Switching back to a window or tab seen recently therefore costs 9 bytes
+// per tile instead of 384.
+//
+// Every packet is self-delimiting, so a raw sink yields a playable stream:
+//   u32 LE  size of everything after this field
+//   u8      flags, bit 0 set on keyframes, bit 1 on refreshes
+//   u16 LE  width, u16 LE height
+//   ...     zlib data (one stream, sync-flushed per packet, reset on keyframes)
+// The inflated data lists tiles in raster order as ops:
+//   0x00 varint n  skip n unchanged tiles
+//   0x01 pixels    literal tile: Y rows, then U rows, then V rows, cropped at
+//                  the frame edges; the decoder caches it
+//   0x02 u64 LE    cached tile with this hash; the decoder marks it used
+//   0x03 pixels    literal tile the decoder must not cache, sent when the
+//                  addon's memory budget is spent
+// Keyframes clear the cache and skip nothing; they are the stream's random
+// access points and come every `cacheResetInterval` frames (a minute by
+// default, five for archival). Refreshes, every `keyframeInterval` frames,
+// also skip nothing but keep the cache, so content from minutes ago still
+// hits. Decoders keep a TileCache with the encoder's budget (the `cacheSize`
+// option) to stay in sync.
+class TileEncoder : public VideoEncoder {
+public:
+    static constexpr int kTileSize = 16;
+    static constexpr size_t kDefaultCacheBytes = 64 << 20;
+
+    TileEncoder(const EncoderOptions& options, int width, int height)
+        : width_(width),
+          height_(height),
+          keyframe_interval_(options.keyframe_interval > 0
+              ? options.keyframe_interval
+              : static_cast<int>(std::lround((options.fps > 0 ? options.fps : 30) *
+                                             (options.preset != "archival" ? 2 : 10)))),
+          cache_reset_interval_(options.cache_reset_interval > 0
+              ? options.cache_reset_interval
+              : static_cast<int>(std::lround((options.fps > 0 ? options.fps : 30) *
+                                             (options.preset != "archival" ? 60 : 300)))),
+          cache_(options.cache_bytes > 0 ? options.cache_bytes : kDefaultCacheBytes),
+          deflater_(options.preset != "archival" ? 1 : 6) {
+        if (width <= 0 || height <= 0 || width > 0xffff || height > 0xffff) {
+            throw std::runtime_error("tiles cannot encode a " + std::to_string(width) + "x" +
+                                     std::to_string(height) + " frame");
+        }
+        columns_ = (width + kTileSize - 1) / kTileSize;
+        rows_ = (height + kTileSize - 1) / kTileSize;
+    }
+
+    std::string Name() const override {
+        return "tiles";
+    }
+
+    void Encode(const Frame& frame, std::vector<Frame>& packets) override {
+        if (frame.format != PixelFormat::kI420 || frame.width != width_ || frame.height != height_) {
+            throw std::runtime_error("tiles input must be I420 at the size the encoder was opened with");
+        }
+        const bool keyframe = frames_since_reset_ == 0;
+        const bool refresh = !keyframe && frames_since_keyframe_ == 0;
+        if (keyframe) {
+            cache_.Clear();
+            deflater_.Reset();
+            resets_++;
+        }
+        if (keyframe || refresh) {
+            previous_.assign(static_cast<size_t>(columns_) * rows_, 0);
+            epoch_++;
+        }
+        frames_since_reset_ = (frames_since_reset_ + 1) % cache_reset_interval_;
+        frames_since_keyframe_ = frames_since_reset_ == 0 ? 0 : (frames_since_keyframe_ + 1) % keyframe_interval_;
+
+        const I420Planes planes = GetI420Planes(const_cast<uint8_t*>(frame.data.data()), width_, height_);
+        ops_.clear();
+        uint64_t skipped = 0;
+        for (int row = 0; row < rows_; row++) {
+            for (int column = 0; column < columns_; column++) {
+                CopyTile(planes, column, row);
+                const uint64_t hash = HashBytes(tile_.data(), tile_.size());
+                uint64_t& previous = previous_[static_cast<size_t>(row) * columns_ + column];
+                if (!keyframe && !refresh && previous == hash) {
+                    skipped++;
+                    continue;
+                }
+                previous = hash;
+                if (skipped > 0) {
+                    ops_.push_back(0x00);
+                    PutVarint(skipped);
+                    skipped = 0;
+                }
+                if (cache_.Find(hash, epoch_)) {
+                    ops_.push_back(0x02);
+                    for (int i = 0; i < 8; i++) {
+                        ops_.push_back(static_cast<uint8_t>(hash >> (8 * i)));
+                    }
+                } else {
+                    ops_.push_back(cache_.Insert(hash, tile_.data(), tile_.size(), true, epoch_) ? 0x01 : 0x03);
+                    ops_.insert(ops_.end(), tile_.begin(), tile_.end());
+                }
+            }
+        }
+        if (skipped > 0) {
+            ops_.push_back(0x00);
+            PutVarint(skipped);
+        }
+        cache_.Publish();
+        deflater_.Compress(ops_, compressed_);
+
+        Frame packet;
+        packet.format = PixelFormat::kTiles;
+        packet.width = width_;
+        packet.height = height_;
+        packet.timestamp_us = frame.timestamp_us;
+        packet.decode_timestamp_us = frame.timestamp_us;
+        packet.keyframe = keyframe;
+        packet.sequence = packet_count_++;
+        const uint32_t size = static_cast<uint32_t>(5 + compressed_.size());
+        packet.data.reserve(4 + size);
+        for (int i = 0; i < 4; i++) {
+            packet.data.push_back(static_cast<uint8_t>(size >> (8 * i)));
+        }
+        packet.data.push_back(static_cast<uint8_t>((keyframe ? 1 : 0) | (refresh ? 2 : 0)));
+        packet.data.push_back(static_cast<uint8_t>(width_ & 0xff));
+        packet.data.push_back(static_cast<uint8_t>(width_ >> 8));
+        packet.data.push_back(static_cast<uint8_t>(height_ & 0xff));
+        packet.data.push_back(static_cast<uint8_t>(height_ >> 8));
+        packet.data.insert(packet.data.end(), compressed_.begin(), compressed_.end());
+        packets.push_back(std::move(packet));
+    }
+
+    void Flush(std::vector<Frame>&) override {}
+
+    void AddMetrics(Metrics& metrics) const override {
+        TileCacheStats stats = cache_.Stats();
+        const uint64_t lookups = stats.hits + stats.misses;
+        metrics.emplace_back("cacheHits", static_cast<double>(stats.hits));
+        metrics.emplace_back("cacheMisses", static_cast<double>(stats.misses));
+        metrics.emplace_back("cacheHitRate", lookups > 0 ? static_cast<double>(stats.hits) / lookups : 0.0);
+        metrics.emplace_back("cacheHitsAcrossRefresh", static_cast<double>(stats.old_hits));
+        metrics.emplace_back("cacheResets", static_cast<double>(resets_));
+        metrics.emplace_back("cacheEvictions", static_cast<double>(stats.evictions));
+        metrics.emplace_back("cacheEntries", static_cast<double>(stats.entries));
+        metrics.emplace_back("cacheBytes", static_cast<double>(stats.bytes));
+    }
+
+private:
+    // Gathers one tile's Y, U and V rows into tile_.
+    void CopyTile(const I420Planes& planes, int column, int row) {
+        tile_.clear();
+        const int x = column * kTileSize;
+        const int y = row * kTileSize;
+        const int width = std::min(kTileSize, width_ - x);
+        const int height = std::min(kTileSize, height_ - y);
+        for (int line = 0; line < height; line++) {
+            const uint8_t* source = planes.y + static_cast<size_t>(y + line) * planes.y_stride + x;
+            tile_.insert(tile_.end(), source, source + width);
+        }
+        const int chroma_x = x / 2;
+        const int chroma_y = y / 2;
+        const int chroma_width = std::min(kTileSize / 2, ChromaWidth(width_) - chroma_x);
+        const int chroma_height = std::min(kTileSize / 2, ChromaHeight(height_) - chroma_y);
+        for (const uint8_t* plane : {planes.u, planes.v}) {
+            for (int line = 0; line < chroma_height; line++) {
+                const uint8_t* source = plane + static_cast<size_t>(chroma_y + line) * planes.uv_stride + chroma_x;
+                tile_.insert(tile_.end(), source, source + chroma_width);
+            }
+        }
+    }
+
+    void PutVarint(uint64_t value) {
+        while (value >= 0x80) {
+            ops_.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        ops_.push_back(static_cast<uint8_t>(value));
+    }
+
+    int width_;
+    int height_;
+    int columns_ = 0;
+    int rows_ = 0;
+    int keyframe_interval_;
+    int cache_reset_interval_;
+    int frames_since_keyframe_ = 0;
+    int frames_since_reset_ = 0;
+    uint64_t epoch_ = 0;
+    std::atomic<uint64_t> resets_{0};
+    TileCache cache_;
+    rfb::detail::Deflater deflater_;
+    std::vector<uint64_t> previous_;
+    std::vector<uint8_t> tile_;
+    std::vector<uint8_t> ops_;
+    std::vector<uint8_t> compressed_;
+    uint64_t packet_count_ = 0;
+};
+
+}  // namespace screen_recorder
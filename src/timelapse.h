@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "frame.h"
+#include "hash.h"
+#include "pipeline.h"
+
+namespace screen_recorder {
+
+enum class TimelapseMode {
+    // The first frame of each interval.
+    kSample,
+    // The average of every frame in the interval; motion shows as trails.
+    kBlend,
+    // The frame that differs most from the last one emitted, so short-lived
+    // activity within an interval still makes it into the video.
+    kChanged,
+};
+
+struct TimelapseOptions {
+    // Wall time condensed into one output frame.
+    int64_t interval_us = 10000000;
+    // Playback rate the output timestamps are spaced for.
+    double output_fps = 30;
+    TimelapseMode mode = TimelapseMode::kSample;
+};
+
+// Condenses captured pictures into one frame per interval of capture time
+// and retimes the result for playback at `output_fps`, so an encoder after
+// it only ever sees the frames that end up in the file.
+class TimelapseStage : public Stage {
+public:
+    explicit TimelapseStage(const TimelapseOptions& options) : options_(options) {}
+
+    std::string Name() const override {
+        return "timelapse";
+    }
+
+    void Process(Frame&& frame, const Emit& emit) override {
+        if (IsEncoded(frame.format)) {
+            throw std::runtime_error("timelapse needs pictures; place it before the encode stage");
+        }
+        const int64_t interval = frame.timestamp_us / options_.interval_us;
+        if (pending_ && (interval != interval_ || frame.format != best_.format || frame.width != best_.width ||
+                         frame.height != best_.height)) {
+            Finish(emit);
+        }
+        if (!pending_) {
+            interval_ = interval;
+        }
+        switch (options_.mode) {
+            case TimelapseMode::kSample:
+                if (!pending_) {
+                    best_ = std::move(frame);
+                }
+                break;
+            case TimelapseMode::kBlend:
+                Accumulate(frame);
+                break;
+            case TimelapseMode::kChanged: {
+                HashRows(frame, hashes_);
+                int changed = 0;
+                for (size_t y = 0; y < hashes_.size(); y++) {
+                    changed += y >= emitted_hashes_.size() || hashes_[y] != emitted_hashes_[y];
+                }
+                if (!pending_ || changed > best_changed_) {
+                    best_changed_ = changed;
+                    best_hashes_.swap(hashes_);
+                    best_ = std::move(frame);
+                }
+                break;
+            }
+        }
+        pending_ = true;
+    }
+
+    void Flush(const Emit& emit) override {
+        if (pending_) {
+            Finish(emit);
+        }
+    }
+
+    void AddMetrics(Metrics& metrics) const override {
+        metrics.emplace_back("emitted", static_cast<double>(emitted_));
+    }
+
+private:
+    static int RowBytes(const Frame& frame) {
+        return frame.format == PixelFormat::kI420 ? frame.width : frame.width * BytesPerPixel(frame.format);
+    }
+
+    static void HashRows(const Frame& frame, std::vector<uint64_t>& hashes) {
+        hashes.resize(frame.height);
+        const size_t row_bytes = static_cast<size_t>(RowBytes(frame));
+        for (int y = 0; y < frame.height; y++) {
+            hashes[y] = HashBytes(frame.data.data() + static_cast<size_t>(y) * frame.stride, row_bytes);
+        }
+    }
+
+    // 16-bit sums hold up to 257 frames of 255; later frames in the same
+    // interval are left out of the blend.
+    void Accumulate(const Frame& frame) {
+        if (pending_ && blended_ == 257) {
+            return;
+        }
+        if (!pending_) {
+            sums_.assign(frame.data.size(), 0);
+            blended_ = 0;
+            best_.format = frame.format;
+            best_.width = frame.width;
+            best_.height = frame.height;
+            best_.stride = frame.stride;
+        }
+        const size_t size = std::min(sums_.size(), frame.data.size());
+        const uint8_t* data = frame.data.data();
+        uint16_t* sums = sums_.data();
+        for (size_t i = 0; i < size; i++) {
+            sums[i] = static_cast<uint16_t>(sums[i] + data[i]);
+        }
+        blended_++;
+    }
+
+    void Finish(const Emit& emit) {
+        if (options_.mode == TimelapseMode::kBlend) {
+            best_.data.resize(sums_.size());
+            const uint32_t count = blended_;
+            for (size_t i = 0; i < sums_.size(); i++) {
+                best_.data[i] = static_cast<uint8_t>((sums_[i] + count / 2) / count);
+            }
+        }
+        if (options_.mode == TimelapseMode::kChanged) {
+            emitted_hashes_.swap(best_hashes_);
+        }
+        Frame out = std::move(best_);
+        out.timestamp_us = static_cast<int64_t>(emitted_.load() * 1e6 / options_.output_fps);
+        out.sequence = emitted_;
+        emitted_++;
+        pending_ = false;
+        emit(std::move(out));
+    }
+
+    TimelapseOptions options_;
+    bool pending_ = false;
+    int64_t interval_ = 0;
+    Frame best_;
+    int best_changed_ = 0;
+    std::vector<uint64_t> hashes_;
+    std::vector<uint64_t> best_hashes_;
+    std::vector<uint64_t> emitted_hashes_;
+    std::vector<uint16_t> sums_;
+    uint32_t blended_ = 0;
+    std::atomic<uint64_t> emitted_{0};
+};
+
+}  // namespace screen_recorder
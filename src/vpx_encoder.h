@@ -0,0 +1,216 @@
+#pragma once
+
+#ifdef SCREEN_RECORDER_HAVE_VPX
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <vpx/vp8cx.h>
+#include <vpx/vpx_encoder.h>
+}
+
+#include "cpus.h"
+#include "encoder.h"
+#include "frame.h"
+
+namespace screen_recorder {
+
+// In-process VP8/VP9 via libvpx, tuned for screen content.
+//
+// lowLatency: realtime deadline, CBR, no lag or alt-ref, error resilient.
+// archival: good-quality deadline, VBR (or constant quality without a
+// bitrate) with a 25-frame lag for alt-ref frames.
+// VP9 always enables row-based multithreading and as many tile columns as
+// the thread count and frame width allow.
+class VpxEncoder : public VideoEncoder {
+public:
+    VpxEncoder(const EncoderOptions& options, int width, int height)
+        : vp9_(options.codec == "vp9"), width_(width), height_(height) {
+        const bool low_latency = options.preset != "archival";
+        std::string deadline = options.deadline.empty()
+            ? (low_latency ? "realtime" : "good") : options.deadline;
+        if (deadline == "realtime") {
+            deadline_ = VPX_DL_REALTIME;
+        } else if (deadline == "good") {
+            deadline_ = VPX_DL_GOOD_QUALITY;
+        } else if (deadline == "best") {
+            deadline_ = VPX_DL_BEST_QUALITY;
+        } else {
+            throw std::runtime_error("Unknown vpx deadline '" + deadline + "'");
+        }
+
+        vpx_codec_iface_t* iface = vp9_ ? vpx_codec_vp9_cx() : vpx_codec_vp8_cx();
+        vpx_codec_enc_cfg_t config;
+        if (vpx_codec_enc_config_default(iface, &config, 0) != VPX_CODEC_OK) {
+            throw std::runtime_error("libvpx has no default configuration");
+        }
+
+        const double fps = options.fps > 0 ? options.fps : 30;
+        frame_duration_ = std::max(1L, std::lround(1e6 / fps));
+        const unsigned threads = options.threads > 0
+            ? static_cast<unsigned>(options.threads)
+            : AvailableCpus();
+        config.g_w = width;
+        config.g_h = height;
+        config.g_timebase.num = 1;
+        config.g_timebase.den = 1000000;
+        config.g_threads = threads;
+        config.g_pass = VPX_RC_ONE_PASS;
+        config.g_lag_in_frames = low_latency ? 0 : 25;
+        config.g_error_resilient = low_latency ? 1 : 0;
+        config.kf_mode = VPX_KF_AUTO;
+        config.kf_max_dist = options.keyframe_interval > 0
+            ? options.keyframe_interval
+            : static_cast<unsigned>(fps * (low_latency ? 2 : 10));
+
+        if (options.bitrate_kbps > 0) {
+            config.rc_end_usage = low_latency ? VPX_CBR : VPX_VBR;
+            config.rc_target_bitrate = options.bitrate_kbps;
+        } else if (low_latency) {
+            config.rc_end_usage = VPX_CBR;
+            config.rc_target_bitrate = 2000;
+        } else {
+            config.rc_end_usage = VPX_Q;
+        }
+        if (low_latency) {
+            config.rc_buf_sz = 1000;
+            config.rc_buf_initial_sz = 500;
+            config.rc_buf_optimal_sz = 600;
+        }
+
+        if (vpx_codec_enc_init(&codec_, iface, &config, 0) != VPX_CODEC_OK) {
+            throw std::runtime_error(std::string("Unable to open libvpx encoder: ") + vpx_codec_error(&codec_));
+        }
+        open_ = true;
+
+        cpu_used_ = options.cpu_used ? *options.cpu_used : (low_latency ? 8 : 2);
+        vpx_codec_control(&codec_, VP8E_SET_CPUUSED, cpu_used_);
+        if (config.rc_end_usage == VPX_Q) {
+            vpx_codec_control(&codec_, VP8E_SET_CQ_LEVEL, 32);
+        }
+        if (!low_latency) {
+            vpx_codec_control(&codec_, VP8E_SET_ENABLEAUTOALTREF, 1);
+        }
+
+        if (vp9_) {
+            // Tiles must be at least 256 pixels wide.
+            int tile_columns = 0;
+            while ((2u << tile_columns) <= threads && (width >> (tile_columns + 1)) >= 256 && tile_columns < 6) {
+                tile_columns++;
+            }
+            vpx_codec_control(&codec_, VP9E_SET_ROW_MT, 1);
+            vpx_codec_control(&codec_, VP9E_SET_TILE_COLUMNS, tile_columns);
+            vpx_codec_control(&codec_, VP9E_SET_TUNE_CONTENT, VP9E_CONTENT_SCREEN);
+            if (low_latency) {
+                vpx_codec_control(&codec_, VP9E_SET_AQ_MODE, 3);
+            }
+        } else {
+            int partitions = 0;
+            while ((2u << partitions) <= threads && partitions < 3) {
+                partitions++;
+            }
+            vpx_codec_control(&codec_, VP8E_SET_TOKEN_PARTITIONS, partitions);
+            vpx_codec_control(&codec_, VP8E_SET_SCREEN_CONTENT_MODE, 1);
+        }
+    }
+
+    ~VpxEncoder() override {
+        if (open_) {
+            vpx_codec_destroy(&codec_);
+        }
+    }
+
+    VpxEncoder(const VpxEncoder&) = delete;
+    VpxEncoder& operator=(const VpxEncoder&) = delete;
+
+    std::string Name() const override {
+        return vp9_ ? "vp9" : "vp8";
+    }
+
+    void Encode(const Frame& frame, std::vector<Frame>& packets) override {
+        if (frame.format != PixelFormat::kI420 || frame.width != width_ || frame.height != height_) {
+            throw std::runtime_error("libvpx input must be I420 at the size the encoder was opened with");
+        }
+
+        I420Planes planes = GetI420Planes(const_cast<uint8_t*>(frame.data.data()), width_, height_);
+        vpx_image_t image;
+        vpx_img_wrap(&image, VPX_IMG_FMT_I420, width_, height_, 1, planes.y);
+        image.planes[VPX_PLANE_Y] = planes.y;
+        image.planes[VPX_PLANE_U] = planes.u;
+        image.planes[VPX_PLANE_V] = planes.v;
+        image.stride[VPX_PLANE_Y] = planes.y_stride;
+        image.stride[VPX_PLANE_U] = planes.uv_stride;
+        image.stride[VPX_PLANE_V] = planes.uv_stride;
+
+        // A frame's duration is how long it stays up, which is not known
+        // until the next one arrives; the gap since the previous frame is
+        // the best estimate, and the nominal rate stands in for the first.
+        const int64_t pts = std::max(frame.timestamp_us, last_pts_ + 1);
+        const unsigned long duration = last_pts_ >= 0 ? static_cast<unsigned long>(pts - last_pts_) : frame_duration_;
+        last_pts_ = pts;
+        if (vpx_codec_encode(&codec_, &image, pts, duration, 0, deadline_) != VPX_CODEC_OK) {
+            throw std::runtime_error(std::string("libvpx failed to encode frame: ") + vpx_codec_error(&codec_));
+        }
+        CollectPackets(packets);
+    }
+
+    void Flush(std::vector<Frame>& packets) override {
+        for (;;) {
+            if (vpx_codec_encode(&codec_, nullptr, -1, frame_duration_, 0, deadline_) != VPX_CODEC_OK) {
+                break;
+            }
+            if (!CollectPackets(packets)) {
+                break;
+            }
+        }
+    }
+
+    void SetSpeed(int steps) override {
+        vpx_codec_control(&codec_, VP8E_SET_CPUUSED, std::min(vp9_ ? 9 : 16, cpu_used_ + 2 * steps));
+    }
+
+private:
+    bool CollectPackets(std::vector<Frame>& packets) {
+        bool got_packet = false;
+        vpx_codec_iter_t iter = nullptr;
+        while (const vpx_codec_cx_pkt_t* packet = vpx_codec_get_cx_data(&codec_, &iter)) {
+            if (packet->kind != VPX_CODEC_CX_FRAME_PKT) {
+                continue;
+            }
+            const uint8_t* data = static_cast<const uint8_t*>(packet->data.frame.buf);
+            Frame encoded;
+            encoded.format = vp9_ ? PixelFormat::kVP9 : PixelFormat::kVP8;
+            encoded.width = width_;
+            encoded.height = height_;
+            encoded.timestamp_us = packet->data.frame.pts;
+            encoded.decode_timestamp_us = packet->data.frame.pts;
+            encoded.keyframe = (packet->data.frame.flags & VPX_FRAME_IS_KEY) != 0;
+            encoded.sequence = packet_count_++;
+            encoded.data.assign(data, data + packet->data.frame.sz);
+            packets.push_back(std::move(encoded));
+            got_packet = true;
+        }
+        return got_packet;
+    }
+
+    vpx_codec_ctx_t codec_;
+    bool open_ = false;
+    bool vp9_;
+    int width_;
+    int height_;
+    int cpu_used_ = 0;
+    unsigned long deadline_ = VPX_DL_REALTIME;
+    unsigned long frame_duration_ = 1;
+    int64_t last_pts_ = -1;
+    uint64_t packet_count_ = 0;
+};
+
+}  // namespace screen_recorder
+
+#endif  // SCREEN_RECORDER_HAVE_VPX
@@ -0,0 +1,391 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "frame.h"
+#include "pipeline.h"
+
+namespace screen_recorder {
+
+namespace ebml {
+
+constexpr uint32_t kEbml = 0x1A45DFA3;
+constexpr uint32_t kSegment = 0x18538067;
+constexpr uint32_t kSeekHead = 0x114D9B74;
+constexpr uint32_t kSeek = 0x4DBB;
+constexpr uint32_t kSeekId = 0x53AB;
+constexpr uint32_t kSeekPosition = 0x53AC;
+constexpr uint32_t kInfo = 0x1549A966;
+constexpr uint32_t kTimecodeScale = 0x2AD7B1;
+constexpr uint32_t kDuration = 0x4489;
+constexpr uint32_t kMuxingApp = 0x4D80;
+constexpr uint32_t kWritingApp = 0x5741;
+constexpr uint32_t kTracks = 0x1654AE6B;
+constexpr uint32_t kTrackEntry = 0xAE;
+constexpr uint32_t kTrackNumber = 0xD7;
+constexpr uint32_t kTrackUid = 0x73C5;
+constexpr uint32_t kTrackType = 0x83;
+constexpr uint32_t kFlagLacing = 0x9C;
+constexpr uint32_t kCodecId = 0x86;
+constexpr uint32_t kVideo = 0xE0;
+constexpr uint32_t kPixelWidth = 0xB0;
+constexpr uint32_t kPixelHeight = 0xBA;
+constexpr uint32_t kCluster = 0x1F43B675;
+constexpr uint32_t kTimecode = 0xE7;
+constexpr uint32_t kSimpleBlock = 0xA3;
+constexpr uint32_t kCues = 0x1C53BB6B;
+constexpr uint32_t kCuePoint = 0xBB;
+constexpr uint32_t kCueTime = 0xB3;
+constexpr uint32_t kCueTrackPositions = 0xB7;
+constexpr uint32_t kCueTrack = 0xF7;
+constexpr uint32_t kCueClusterPosition = 0xF1;
+constexpr uint32_t kVoid = 0xEC;
+
+constexpr uint64_t kUnknownSize = 0x01FFFFFFFFFFFFFFull;
+
+class Writer {
+public:
+    void Id(uint32_t id) {
+        int bytes = id > 0xFFFFFF ? 4 : id > 0xFFFF ? 3 : id > 0xFF ? 2 : 1;
+        for (int i = bytes - 1; i >= 0; i--) {
+            data_.push_back(static_cast<uint8_t>(id >> (8 * i)));
+        }
+    }
+
+    // Variable-length size; `length` forces a width so it can be patched later.
+    void Size(uint64_t size, int length = 0) {
+        if (length == 0) {
+            length = 1;
+            while (length < 8 && size >= (1ull << (7 * length)) - 1) {
+                length++;
+            }
+        }
+        uint64_t value = size | (1ull << (7 * length));
+        for (int i = length - 1; i >= 0; i--) {
+            data_.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    void Uint(uint32_t id, uint64_t value, int length = 0) {
+        if (length == 0) {
+            length = 1;
+            while (length < 8 && (value >> (8 * length)) != 0) {
+                length++;
+            }
+        }
+        Id(id);
+        Size(length);
+        for (int i = length - 1; i >= 0; i--) {
+            data_.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    void Float(uint32_t id, double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        Id(id);
+        Size(8);
+        for (int i = 7; i >= 0; i--) {
+            data_.push_back(static_cast<uint8_t>(bits >> (8 * i)));
+        }
+    }
+
+    void String(uint32_t id, const std::string& value) {
+        Id(id);
+        Size(value.size());
+        data_.insert(data_.end(), value.begin(), value.end());
+    }
+
+    void Raw(const uint8_t* bytes, size_t size) {
+        data_.insert(data_.end(), bytes, bytes + size);
+    }
+
+    // Master elements get an 8-byte size that End() fills in.
+    size_t Begin(uint32_t id) {
+        Id(id);
+        size_t offset = data_.size();
+        Size(0, 8);
+        return offset;
+    }
+
+    void End(size_t offset) {
+        uint64_t size = data_.size() - offset - 8;
+        uint64_t value = size | (1ull << 56);
+        for (int i = 0; i < 8; i++) {
+            data_[offset + i] = static_cast<uint8_t>(value >> (8 * (7 - i)));
+        }
+    }
+
+    // Padding of exactly `total_size` bytes including its header. A 1-byte
+    // size holds at most 126, so larger padding takes a fixed 8-byte size.
+    void Void(size_t total_size) {
+        if (total_size < 2) {
+            throw std::logic_error("An EBML Void element needs at least 2 bytes");
+        }
+        const int length = total_size - 2 <= 126 ? 1 : 8;
+        Id(kVoid);
+        Size(total_size - 1 - length, length);
+        data_.insert(data_.end(), total_size - 1 - length, 0);
+    }
+
+    size_t Size() const { return data_.size(); }
+    const std::vector<uint8_t>& Data() const { return data_; }
+    void Clear() { data_.clear(); }
+
+private:
+    std::vector<uint8_t> data_;
+};
+
+}  // namespace ebml
+
+// Streams VP8/VP9 into a WebM file. Clusters start on keyframes (or every 30
+// seconds, the limit of a block's 16-bit relative time), each written whole
+// once complete. A Void element reserved right after the segment header takes
+// the SeekHead at Finish(), which appends Cues and patches the segment size
+// and duration in place; until then the file reads as a live stream.
+class WebmMuxer {
+public:
+    explicit WebmMuxer(const std::string& path) : path_(path) {
+        file_ = std::fopen(path.c_str(), "wb");
+        if (!file_) {
+            throw std::runtime_error("Unable to open " + path);
+        }
+    }
+
+    ~WebmMuxer() {
+        if (file_) {
+            std::fclose(file_);
+        }
+    }
+
+    WebmMuxer(const WebmMuxer&) = delete;
+    WebmMuxer& operator=(const WebmMuxer&) = delete;
+
+    void AddPacket(Frame&& packet) {
+        if (packet.format != PixelFormat::kVP8 && packet.format != PixelFormat::kVP9) {
+            throw std::runtime_error(std::string("webm cannot carry ") + PixelFormatName(packet.format) +
+                                     "; encode to vp8 or vp9 first");
+        }
+        if (!started_) {
+            if (!packet.keyframe) {
+                return;
+            }
+            WriteHeader(packet);
+            time_base_us_ = packet.timestamp_us;
+        }
+
+        const int64_t time_ms = (packet.timestamp_us - time_base_us_) / 1000;
+        if (cluster_open_ && (packet.keyframe || time_ms - cluster_time_ms_ > 30000)) {
+            CloseCluster();
+        }
+        if (!cluster_open_) {
+            cluster_open_ = true;
+            cluster_time_ms_ = time_ms;
+            cluster_keyframe_ = packet.keyframe;
+            cluster_.Clear();
+            cluster_.Uint(ebml::kTimecode, static_cast<uint64_t>(time_ms));
+        }
+
+        const int16_t relative = static_cast<int16_t>(time_ms - cluster_time_ms_);
+        cluster_.Id(ebml::kSimpleBlock);
+        cluster_.Size(packet.data.size() + 4);
+        const uint8_t header[4] = {0x81, static_cast<uint8_t>(static_cast<uint16_t>(relative) >> 8),
+                                   static_cast<uint8_t>(relative & 0xff),
+                                   static_cast<uint8_t>(packet.keyframe ? 0x80 : 0x00)};
+        cluster_.Raw(header, sizeof(header));
+        cluster_.Raw(packet.data.data(), packet.data.size());
+        if (last_time_ms_ >= 0) {
+            last_interval_ms_ = time_ms - last_time_ms_;
+        }
+        last_time_ms_ = time_ms;
+    }
+
+    void Finish() {
+        if (!started_ || finished_) {
+            return;
+        }
+        finished_ = true;
+        if (cluster_open_) {
+            CloseCluster();
+        }
+
+        ebml::Writer cues;
+        size_t cues_master = cues.Begin(ebml::kCues);
+        for (const CuePoint& cue : cue_points_) {
+            size_t point = cues.Begin(ebml::kCuePoint);
+            cues.Uint(ebml::kCueTime, static_cast<uint64_t>(cue.time_ms));
+            size_t positions = cues.Begin(ebml::kCueTrackPositions);
+            cues.Uint(ebml::kCueTrack, 1);
+            cues.Uint(ebml::kCueClusterPosition, cue.position);
+            cues.End(positions);
+            cues.End(point);
+        }
+        cues.End(cues_master);
+        const uint64_t cues_position = position_ - segment_data_start_;
+        Write(cues.Data());
+
+        ebml::Writer seek_head;
+        size_t head = seek_head.Begin(ebml::kSeekHead);
+        const std::pair<uint32_t, uint64_t> entries[] = {
+            {ebml::kInfo, info_position_}, {ebml::kTracks, tracks_position_}, {ebml::kCues, cues_position}};
+        for (const auto& entry : entries) {
+            size_t seek = seek_head.Begin(ebml::kSeek);
+            seek_head.Id(ebml::kSeekId);
+            seek_head.Size(4);
+            seek_head.Id(entry.first);
+            seek_head.Uint(ebml::kSeekPosition, entry.second, 8);
+            seek_head.End(seek);
+        }
+        seek_head.End(head);
+        if (seek_head.Size() + 2 > kSeekHeadReserve) {
+            throw std::logic_error("The SeekHead outgrew its reserved space");
+        }
+        seek_head.Void(kSeekHeadReserve - seek_head.Size());
+        WriteAt(seek_head_offset_, seek_head.Data());
+
+        ebml::Writer duration;
+        duration.Float(ebml::kDuration, static_cast<double>(last_time_ms_ + last_interval_ms_));
+        WriteAt(duration_offset_, duration.Data());
+
+        ebml::Writer segment_size;
+        segment_size.Size(position_ - segment_data_start_, 8);
+        WriteAt(segment_data_start_ - 8, segment_size.Data());
+        std::fflush(file_);
+    }
+
+private:
+    struct CuePoint {
+        int64_t time_ms;
+        uint64_t position;
+    };
+
+    // Room for a SeekHead with three entries plus the trailing Void.
+    static constexpr size_t kSeekHeadReserve = 160;
+
+    void WriteHeader(const Frame& packet) {
+        started_ = true;
+        ebml::Writer w;
+        size_t header = w.Begin(ebml::kEbml);
+        w.Uint(0x4286, 1);
+        w.Uint(0x42F7, 1);
+        w.Uint(0x42F2, 4);
+        w.Uint(0x42F3, 8);
+        w.String(0x4282, "webm");
+        w.Uint(0x4287, 4);
+        w.Uint(0x4285, 2);
+        w.End(header);
+
+        w.Id(ebml::kSegment);
+        w.Size(ebml::kUnknownSize, 8);
+        segment_data_start_ = w.Size();
+        seek_head_offset_ = w.Size();
+        w.Void(kSeekHeadReserve);
+
+        info_position_ = w.Size() - segment_data_start_;
+        size_t info = w.Begin(ebml::kInfo);
+        w.Uint(ebml::kTimecodeScale, 1000000);
+        duration_offset_ = w.Size();
+        w.Float(ebml::kDuration, 0);
+        w.String(ebml::kMuxingApp, "screen-recorder");
+        w.String(ebml::kWritingApp, "screen-recorder");
+        w.End(info);
+
+        tracks_position_ = w.Size() - segment_data_start_;
+        size_t tracks = w.Begin(ebml::kTracks);
+        size_t entry = w.Begin(ebml::kTrackEntry);
+        w.Uint(ebml::kTrackNumber, 1);
+        w.Uint(ebml::kTrackUid, 1);
+        w.Uint(ebml::kTrackType, 1);
+        w.Uint(ebml::kFlagLacing, 0);
+        w.String(ebml::kCodecId, packet.format == PixelFormat::kVP9 ? "V_VP9" : "V_VP8");
+        size_t video = w.Begin(ebml::kVideo);
+        w.Uint(ebml::kPixelWidth, static_cast<uint64_t>(packet.width));
+        w.Uint(ebml::kPixelHeight, static_cast<uint64_t>(packet.height));
+        w.End(video);
+        w.End(entry);
+        w.End(tracks);
+        Write(w.Data());
+    }
+
+    void CloseCluster() {
+        const uint64_t cluster_position = position_ - segment_data_start_;
+        if (cluster_keyframe_) {
+            cue_points_.push_back({cluster_time_ms_, cluster_position});
+        }
+        ebml::Writer header;
+        header.Id(ebml::kCluster);
+        header.Size(cluster_.Size(), 8);
+        Write(header.Data());
+        Write(cluster_.Data());
+        std::fflush(file_);
+        cluster_open_ = false;
+    }
+
+    void Write(const std::vector<uint8_t>& bytes) {
+        if (std::fwrite(bytes.data(), 1, bytes.size(), file_) != bytes.size()) {
+            throw std::runtime_error("Write to " + path_ + " failed");
+        }
+        position_ += bytes.size();
+    }
+
+    void WriteAt(uint64_t offset, const std::vector<uint8_t>& bytes) {
+#ifdef _WIN32
+        int result = _fseeki64(file_, static_cast<int64_t>(offset), SEEK_SET);
+#else
+        int result = fseeko(file_, static_cast<off_t>(offset), SEEK_SET);
+#endif
+        if (result != 0 || std::fwrite(bytes.data(), 1, bytes.size(), file_) != bytes.size()) {
+            throw std::runtime_error("Write to " + path_ + " failed");
+        }
+        std::fseek(file_, 0, SEEK_END);
+    }
+
+    std::string path_;
+    FILE* file_ = nullptr;
+    bool started_ = false;
+    bool finished_ = false;
+    uint64_t position_ = 0;
+    uint64_t segment_data_start_ = 0;
+    uint64_t seek_head_offset_ = 0;
+    uint64_t duration_offset_ = 0;
+    uint64_t info_position_ = 0;
+    uint64_t tracks_position_ = 0;
+    int64_t time_base_us_ = 0;
+    int64_t last_time_ms_ = -1;
+    int64_t last_interval_ms_ = 0;
+    ebml::Writer cluster_;
+    bool cluster_open_ = false;
+    bool cluster_keyframe_ = false;
+    int64_t cluster_time_ms_ = 0;
+    std::vector<CuePoint> cue_points_;
+};
+
+class WebmSinkStage : public Stage {
+public:
+    explicit WebmSinkStage(const std::string& path) : path_(path), muxer_(path) {}
+
+    std::string Name() const override {
+        return "sink(" + path_ + ")";
+    }
+
+    void Process(Frame&& frame, const Emit& emit) override {
+        muxer_.AddPacket(std::move(frame));
+    }
+
+    void Flush(const Emit& emit) override {
+        muxer_.Finish();
+    }
+
+private:
+    std::string path_;
+    WebmMuxer muxer_;
+};
+
+}  // namespace screen_recorder
@@ -0,0 +1,191 @@
+#pragma once
+
+#ifdef SCREEN_RECORDER_HAVE_X264
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <x264.h>
+}
+
+#include "cpus.h"
+#include "encoder.h"
+#include "frame.h"
+
+namespace screen_recorder {
+
+// In-process H.264 via libx264, emitting Annex B access units with in-band
+// SPS/PPS on every keyframe so any slice of the stream is decodable.
+//
+// lowLatency: zerolatency tune, no B-frames or lookahead, sliced threads and
+// periodic intra refresh instead of IDR spikes, single-frame VBV.
+// archival: frame threads, 40-frame lookahead with MB-tree, B-frames, CRF.
+class X264Encoder : public VideoEncoder {
+public:
+    X264Encoder(const EncoderOptions& options, int width, int height)
+        : width_(width), height_(height) {
+        if (width % 2 != 0 || height % 2 != 0) {
+            throw std::runtime_error("x264 needs even frame dimensions; add a scale stage");
+        }
+
+        const bool low_latency = options.preset != "archival";
+        const double fps = options.fps > 0 ? options.fps : 30;
+        x264_param_t param;
+        if (x264_param_default_preset(&param, low_latency ? "veryfast" : "medium",
+                                      low_latency ? "zerolatency" : nullptr) < 0) {
+            throw std::runtime_error("x264 rejected preset");
+        }
+
+        param.i_log_level = X264_LOG_WARNING;
+        param.i_csp = X264_CSP_I420;
+        param.i_width = width;
+        param.i_height = height;
+        // x264's own auto sizing (1.5 threads per core with frame threads)
+        // counts host cores, not the cgroup quota.
+        const int cpus = static_cast<int>(AvailableCpus());
+        param.i_threads = options.threads > 0 ? options.threads : low_latency ? cpus : cpus * 3 / 2;
+        param.i_fps_num = static_cast<uint32_t>(std::lround(fps * 1000));
+        param.i_fps_den = 1000;
+        param.i_timebase_num = 1;
+        param.i_timebase_den = 1000000;
+        param.b_vfr_input = 1;
+        param.b_repeat_headers = 1;
+        param.b_annexb = 1;
+        param.i_keyint_max = options.keyframe_interval > 0
+            ? options.keyframe_interval
+            : static_cast<int>(std::lround(fps * (low_latency ? 2 : 10)));
+
+        if (low_latency) {
+            param.b_sliced_threads = 1;
+            param.b_intra_refresh = options.intra_refresh ? 1 : 0;
+            param.i_bframe = 0;
+            param.rc.i_lookahead = 0;
+        } else {
+            param.b_sliced_threads = 0;
+            param.rc.i_lookahead = 40;
+            param.rc.b_mb_tree = 1;
+        }
+
+        if (options.bitrate_kbps > 0) {
+            param.rc.i_rc_method = X264_RC_ABR;
+            param.rc.i_bitrate = options.bitrate_kbps;
+            param.rc.i_vbv_max_bitrate = options.bitrate_kbps;
+            param.rc.i_vbv_buffer_size = low_latency
+                ? std::max(1, static_cast<int>(options.bitrate_kbps / fps))
+                : options.bitrate_kbps * 2;
+        } else {
+            param.rc.i_rc_method = X264_RC_CRF;
+            param.rc.f_rf_constant = low_latency ? 23 : 20;
+        }
+
+        if (x264_param_apply_profile(&param, "high") < 0) {
+            throw std::runtime_error("x264 rejected profile");
+        }
+        encoder_ = x264_encoder_open(&param);
+        if (!encoder_) {
+            throw std::runtime_error("Unable to open x264 encoder");
+        }
+        x264_encoder_parameters(encoder_, &base_);
+    }
+
+    ~X264Encoder() override {
+        if (encoder_) {
+            x264_encoder_close(encoder_);
+        }
+    }
+
+    X264Encoder(const X264Encoder&) = delete;
+    X264Encoder& operator=(const X264Encoder&) = delete;
+
+    std::string Name() const override {
+        return "x264";
+    }
+
+    void Encode(const Frame& frame, std::vector<Frame>& packets) override {
+        if (frame.format != PixelFormat::kI420 || frame.width != width_ || frame.height != height_) {
+            throw std::runtime_error("x264 input must be I420 at the size the encoder was opened with");
+        }
+
+        I420Planes planes = GetI420Planes(const_cast<uint8_t*>(frame.data.data()), width_, height_);
+        x264_picture_t input;
+        x264_picture_init(&input);
+        input.img.i_csp = X264_CSP_I420;
+        input.img.i_plane = 3;
+        input.img.plane[0] = planes.y;
+        input.img.plane[1] = planes.u;
+        input.img.plane[2] = planes.v;
+        input.img.i_stride[0] = planes.y_stride;
+        input.img.i_stride[1] = planes.uv_stride;
+        input.img.i_stride[2] = planes.uv_stride;
+        // x264 needs strictly increasing timestamps in VFR mode.
+        input.i_pts = std::max(frame.timestamp_us, last_pts_ + 1);
+        last_pts_ = input.i_pts;
+
+        EncodePicture(&input, packets);
+    }
+
+    void Flush(std::vector<Frame>& packets) override {
+        while (x264_encoder_delayed_frames(encoder_) > 0) {
+            if (!EncodePicture(nullptr, packets)) {
+                break;
+            }
+        }
+    }
+
+    void SetSpeed(int steps) override {
+        x264_param_t param;
+        x264_encoder_parameters(encoder_, &param);
+        param.analyse.i_subpel_refine = std::max(1, base_.analyse.i_subpel_refine - 2 * steps);
+        param.analyse.i_me_method = steps > 0 ? X264_ME_DIA : base_.analyse.i_me_method;
+        param.analyse.i_trellis = steps > 0 ? 0 : base_.analyse.i_trellis;
+        param.analyse.inter = steps > 1 ? 0 : base_.analyse.inter;
+        x264_encoder_reconfig(encoder_, &param);
+    }
+
+private:
+    bool EncodePicture(x264_picture_t* input, std::vector<Frame>& packets) {
+        x264_nal_t* nals = nullptr;
+        int nal_count = 0;
+        x264_picture_t output;
+        int size = x264_encoder_encode(encoder_, &nals, &nal_count, input, &output);
+        if (size < 0) {
+            throw std::runtime_error("x264 failed to encode frame");
+        }
+        if (size == 0) {
+            return input != nullptr;
+        }
+
+        // NAL payloads of one access unit are contiguous in memory.
+        Frame packet;
+        packet.format = PixelFormat::kH264;
+        packet.width = width_;
+        packet.height = height_;
+        packet.timestamp_us = output.i_pts;
+        packet.decode_timestamp_us = output.i_dts;
+        // With intra refresh x264 also flags the recovery points as keyframes;
+        // only IDR frames reset the references.
+        packet.keyframe = output.i_type == X264_TYPE_IDR;
+        packet.recovery_point = output.b_keyframe != 0 && !packet.keyframe;
+        packet.sequence = packet_count_++;
+        packet.data.assign(nals[0].p_payload, nals[0].p_payload + size);
+        packets.push_back(std::move(packet));
+        return true;
+    }
+
+    x264_t* encoder_ = nullptr;
+    // Parameters as opened, which SetSpeed(0) returns to.
+    x264_param_t base_;
+    int width_;
+    int height_;
+    int64_t last_pts_ = -1;
+    uint64_t packet_count_ = 0;
+};
+
+}  // namespace screen_recorder
+
+#endif  // SCREEN_RECORDER_HAVE_X264
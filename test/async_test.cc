@@ -0,0 +1,112 @@
+#include <atomic>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "async.h"
+#include "check.h"
+
+using namespace screen_recorder;
+
+namespace {
+
+template <typename T>
+Outcome<T> RunSync(Task<T> task) {
+    std::promise<Outcome<T>> done;
+    auto future = done.get_future();
+    Spawn(std::move(task), [&done](Outcome<T>&& outcome) { done.set_value(std::move(outcome)); });
+    return future.get();
+}
+
+Task<int> Double(Executor& executor, int value) {
+    co_await executor.Schedule();
+    co_return value * 2;
+}
+
+Task<int> Chain(Executor& executor) {
+    const int a = co_await Double(executor, 3);
+    const int b = co_await Double(executor, a);
+    co_return a + b;
+}
+
+Task<int> Fails(Executor& executor) {
+    co_await executor.Schedule();
+    throw std::runtime_error("task failed");
+}
+
+Task<void> Record(std::shared_ptr<Strand> strand, int index, std::vector<int>& order, std::atomic<int>& inside,
+                  std::atomic<bool>& overlapped) {
+    co_await strand->Schedule();
+    if (inside.fetch_add(1) != 0) {
+        overlapped = true;
+    }
+    std::this_thread::yield();
+    order.push_back(index);
+    inside--;
+}
+
+}  // namespace
+
+TEST(TasksChainResultsAcrossThreads) {
+    Executor executor(2);
+    Outcome<int> outcome = RunSync(Chain(executor));
+    CHECK(!outcome.error);
+    CHECK(outcome.value.has_value());
+    CHECK_EQ(*outcome.value, 18);
+}
+
+TEST(ExceptionsReachTheSpawnCallback) {
+    Executor executor(1);
+    Outcome<int> outcome = RunSync(Fails(executor));
+    CHECK(!outcome.value.has_value());
+    CHECK(outcome.error != nullptr);
+}
+
+TEST(StrandRunsOneAtATimeInPostingOrder) {
+    Executor executor(4);
+    auto strand = std::make_shared<Strand>(executor);
+    std::vector<int> order;
+    std::atomic<int> inside{0};
+    std::atomic<bool> overlapped{false};
+    std::atomic<int> finished{0};
+    for (int i = 0; i < 50; i++) {
+        Spawn(Record(strand, i, order, inside, overlapped), [&finished](Outcome<void>&&) { finished++; });
+    }
+    while (finished < 50) {
+        std::this_thread::yield();
+    }
+    CHECK(!overlapped);
+    CHECK_EQ(order.size(), 50u);
+    for (int i = 0; i < static_cast<int>(order.size()); i++) {
+        CHECK_EQ(order[i], i);
+    }
+}
+
+TEST(OffloadRunsOnTheExecutor) {
+    Executor executor(1);
+    const std::thread::id caller = std::this_thread::get_id();
+    Outcome<std::thread::id> outcome =
+        RunSync(Offload(executor, [] { return std::this_thread::get_id(); }));
+    CHECK(outcome.value.has_value());
+    CHECK(*outcome.value != caller);
+}
+
+TEST(ParallelForVisitsEveryIndexOnce) {
+    Executor executor(3);
+    std::vector<std::atomic<int>> visits(1000);
+    ParallelFor(executor, static_cast<int>(visits.size()), [&](int i) { visits[i]++; });
+    int wrong = 0;
+    for (const auto& count : visits) {
+        wrong += count != 1;
+    }
+    CHECK_EQ(wrong, 0);
+
+    // An empty range returns without calling anything.
+    ParallelFor(executor, 0, [&](int) { wrong++; });
+    CHECK_EQ(wrong, 0);
+}
+
+int main() {
+    return check::RunTests();
+}
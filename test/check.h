@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Just enough of a test harness for the native tests: TEST registers a case,
+// CHECK records a failure and carries on, and RunTests reports and returns
+// the exit code.
+namespace check {
+
+struct Case {
+    const char* name;
+    std::function<void()> body;
+};
+
+inline std::vector<Case>& Cases() {
+    static std::vector<Case> cases;
+    return cases;
+}
+
+inline int& Failures() {
+    static int failures = 0;
+    return failures;
+}
+
+struct Register {
+    Register(const char* name, std::function<void()> body) {
+        Cases().push_back({name, std::move(body)});
+    }
+};
+
+inline void Fail(const char* file, int line, const std::string& what) {
+    std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what.c_str());
+    Failures()++;
+}
+
+inline int RunTests() {
+    for (const Case& test : Cases()) {
+        const int before = Failures();
+        try {
+            test.body();
+        } catch (const std::exception& e) {
+            std::fprintf(stderr, "%s threw: %s\n", test.name, e.what());
+            Failures()++;
+        }
+        std::printf("%s %s\n", Failures() == before ? "ok  " : "FAIL", test.name);
+    }
+    return Failures() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+}  // namespace check
+
+#define CHECK_CONCAT_(a, b) a##b
+#define CHECK_CONCAT(a, b) CHECK_CONCAT_(a, b)
+
+#define TEST(name)                                                              \
+    static void name();                                                         \
+    static check::Register CHECK_CONCAT(register_, name)(#name, name);          \
+    static void name()
+
+#define CHECK(condition)                                                        \
+    do {                                                                        \
+        if (!(condition)) {                                                     \
+            check::Fail(__FILE__, __LINE__, #condition);                        \
+        }                                                                       \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                              \
+    do {                                                                        \
+        const auto& check_actual_ = (actual);                                   \
+        const auto& check_expected_ = (expected);                               \
+        if (!(check_actual_ == check_expected_)) {                              \
+            check::Fail(__FILE__, __LINE__, #actual " == " #expected " (got " + \
+                        std::to_string(check_actual_) + ")");                   \
+        }                                                                       \
+    } while (0)
+
+#define CHECK_THROWS(statement)                                                 \
+    do {                                                                        \
+        bool check_threw_ = false;                                              \
+        try {                                                                   \
+            statement;                                                          \
+        } catch (const std::exception&) {                                       \
+            check_threw_ = true;                                                \
+        }                                                                       \
+        if (!check_threw_) {                                                    \
+            check::Fail(__FILE__, __LINE__, #statement " did not throw");       \
+        }                                                                       \
+    } while (0)
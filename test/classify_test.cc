@@ -0,0 +1,120 @@
+#include <random>
+#include <vector>
+
+#include "check.h"
+#include "classify.h"
+
+using namespace screen_recorder;
+
+namespace {
+
+constexpr int kSize = 16;
+
+struct Tile {
+    int bytes_per_pixel;
+    std::vector<uint8_t> data;
+
+    explicit Tile(int bytes) : bytes_per_pixel(bytes), data(static_cast<size_t>(kSize) * kSize * bytes) {}
+
+    void Set(int x, int y, uint8_t r, uint8_t g, uint8_t b) {
+        uint8_t* pixel = &data[(static_cast<size_t>(y) * kSize + x) * bytes_per_pixel];
+        pixel[0] = b;
+        pixel[1] = g;
+        pixel[2] = r;
+    }
+
+    TileContent Classify(int width = kSize, int height = kSize) const {
+        return ClassifyTile(data.data(), kSize * bytes_per_pixel, width, height, bytes_per_pixel);
+    }
+};
+
+// Dark strokes on a light background, like rendered text.
+Tile Text(int bytes) {
+    Tile tile(bytes);
+    for (int y = 0; y < kSize; y++) {
+        for (int x = 0; x < kSize; x++) {
+            const bool ink = (x % 5 == 1 && y > 2 && y < 13) || (y == 7 && x > 1 && x < 14);
+            tile.Set(x, y, ink ? 30 : 250, ink ? 30 : 250, ink ? 40 : 245);
+        }
+    }
+    return tile;
+}
+
+// A soft gradient with sensor-like noise, like a photo.
+Tile Photo(int bytes) {
+    Tile tile(bytes);
+    std::mt19937 random(3);
+    for (int y = 0; y < kSize; y++) {
+        for (int x = 0; x < kSize; x++) {
+            const int noise = static_cast<int>(random() % 7);
+            tile.Set(x, y, static_cast<uint8_t>(60 + 4 * x + noise), static_cast<uint8_t>(90 + 3 * y + noise),
+                     static_cast<uint8_t>(120 + 2 * (x + y) - noise));
+        }
+    }
+    return tile;
+}
+
+}  // namespace
+
+TEST(FlatTilesAreUniform) {
+    Tile tile(4);
+    for (int y = 0; y < kSize; y++) {
+        for (int x = 0; x < kSize; x++) {
+            tile.Set(x, y, 12, 34, 56);
+        }
+    }
+    CHECK(tile.Classify() == TileContent::kUniform);
+}
+
+TEST(TextIsSynthetic) {
+    CHECK(Text(4).Classify() == TileContent::kSynthetic);
+    CHECK(Text(3).Classify() == TileContent::kSynthetic);
+}
+
+TEST(PhotosAreNatural) {
+    CHECK(Photo(4).Classify() == TileContent::kNatural);
+    CHECK(Photo(3).Classify() == TileContent::kNatural);
+}
+
+TEST(SmallStepsWithFewColoursStaySynthetic) {
+    // Small steps everywhere, but only two colours in a checkerboard: the
+    // colour count keeps it lossless.
+    Tile tile(4);
+    for (int y = 0; y < kSize; y++) {
+        for (int x = 0; x < kSize; x++) {
+            const uint8_t value = (x + y) % 2 ? 100 : 110;
+            tile.Set(x, y, value, value, value);
+        }
+    }
+    CHECK(tile.Classify() == TileContent::kSynthetic);
+}
+
+TEST(EdgeTilesClassifyTheirVisiblePart) {
+    // A photo whose visible part at the frame edge is 5x3 pixels of it.
+    CHECK(Photo(4).Classify(5, 3) == TileContent::kNatural);
+    Tile tile = Text(4);
+    CHECK(tile.Classify(1, 1) == TileContent::kUniform);
+}
+
+TEST(CountColoursStopsAtTheLimit) {
+    const Tile photo = Photo(4);
+    const int all = detail::CountColours(photo.data.data(), kSize * 4, kSize, kSize, 4, 1000);
+    CHECK(all > 100);
+    CHECK_EQ(detail::CountColours(photo.data.data(), kSize * 4, kSize, kSize, 4, 10), 10);
+    const Tile text = Text(3);
+    CHECK_EQ(detail::CountColours(text.data.data(), kSize * 3, kSize, kSize, 3, 1000), 2);
+}
+
+TEST(CountColoursIgnoresThePaddingByte) {
+    Tile tile(4);
+    for (int y = 0; y < kSize; y++) {
+        for (int x = 0; x < kSize; x++) {
+            tile.data[(static_cast<size_t>(y) * kSize + x) * 4 + 3] = static_cast<uint8_t>(x * 16 + y);
+        }
+    }
+    CHECK_EQ(detail::CountColours(tile.data.data(), kSize * 4, kSize, kSize, 4, 1000), 1);
+}
+
+int main() {
+    return check::RunTests();
+}
@@ -0,0 +1,121 @@
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "check.h"
+#include "codecs.h"
+
+using namespace screen_recorder;
+
+namespace {
+
+Frame SolidFrame(uint8_t value) {
+    Frame frame;
+    frame.format = PixelFormat::kBGRA;
+    frame.width = 64;
+    frame.height = 32;
+    frame.stride = frame.width * 4;
+    frame.data.assign(static_cast<size_t>(frame.stride) * frame.height, value);
+    return frame;
+}
+
+#ifdef SCREEN_RECORDER_HAVE_X264
+// Whether an Annex B access unit holds an IDR slice (NAL type 5).
+bool HasIdrSlice(const FrameBuffer& data) {
+    for (size_t i = 0; i + 3 < data.size(); i++) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1 && (data[i + 3] & 0x1f) == 5) {
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
+}  // namespace
+
+TEST(DefaultEncoderIsBuiltIn) {
+    CHECK(IsEncoderAvailable(DefaultEncoder()));
+    CHECK(IsEncoderAvailable("tiles"));
+    CHECK(!IsEncoderAvailable("mpeg2"));
+    CHECK(EncoderOptions().codec == "tiles");
+}
+
+TEST(SubmissionsEncodeInTicketOrder) {
+    Executor workers(3);
+    EncoderOptions options;
+    options.codec = "tiles";
+    auto encoder = std::make_shared<AsyncEncoder>(workers, options);
+
+    constexpr int kFrames = 8;
+    std::vector<uint64_t> tickets;
+    for (int i = 0; i < kFrames; i++) {
+        tickets.push_back(encoder->Reserve());
+    }
+    // Submitted back to front; each conversion may finish in any order.
+    std::vector<std::promise<Outcome<std::vector<Frame>>>> done(kFrames);
+    for (int i = kFrames - 1; i >= 0; i--) {
+        Frame frame = SolidFrame(static_cast<uint8_t>(i * 16));
+        frame.timestamp_us = i * 33333;
+        Spawn(encoder->Submit(std::move(frame), tickets[i]),
+              [&done, i](Outcome<std::vector<Frame>>&& outcome) { done[i].set_value(std::move(outcome)); });
+    }
+    for (int i = 0; i < kFrames; i++) {
+        Outcome<std::vector<Frame>> outcome = done[i].get_future().get();
+        CHECK(!outcome.error);
+        CHECK_EQ(outcome.value->size(), 1u);
+        // Packet sequence numbers count calls into the encoder.
+        CHECK_EQ((*outcome.value)[0].sequence, static_cast<uint64_t>(i));
+        CHECK_EQ((*outcome.value)[0].keyframe, i == 0);
+    }
+}
+
+TEST(SkippedTicketsDoNotStallLaterOnes) {
+    Executor workers(2);
+    EncoderOptions options;
+    options.codec = "tiles";
+    auto encoder = std::make_shared<AsyncEncoder>(workers, options);
+    const uint64_t lost = encoder->Reserve();
+    const uint64_t kept = encoder->Reserve();
+
+    std::promise<bool> encoded;
+    Spawn(encoder->Submit(SolidFrame(1), kept),
+          [&encoded](Outcome<std::vector<Frame>>&& outcome) { encoded.set_value(!outcome.error); });
+    std::promise<void> skipped;
+    Spawn(encoder->Skip(lost), [&skipped](Outcome<void>&&) { skipped.set_value(); });
+    skipped.get_future().get();
+    CHECK(encoded.get_future().get());
+}
+
+#ifdef SCREEN_RECORDER_HAVE_X264
+TEST(IntraRefreshReportsRecoveryPointsNotKeyframes) {
+    EncoderOptions options;
+    options.codec = "x264";
+    options.keyframe_interval = 15;
+    options.intra_refresh = true;
+    std::unique_ptr<VideoEncoder> encoder = OpenEncoder(options, 64, 32);
+    std::vector<Frame> packets;
+    for (int i = 0; i < 60; i++) {
+        Frame frame;
+        ConvertToI420(SolidFrame(static_cast<uint8_t>(i * 4)), frame);
+        frame.timestamp_us = i * 33333;
+        encoder->Encode(frame, packets);
+    }
+    encoder->Flush(packets);
+
+    int keyframes = 0;
+    int recovery_points = 0;
+    for (const Frame& packet : packets) {
+        CHECK_EQ(packet.keyframe, HasIdrSlice(packet.data));
+        CHECK(!(packet.keyframe && packet.recovery_point));
+        keyframes += packet.keyframe;
+        recovery_points += packet.recovery_point;
+    }
+    // Only the first frame is an IDR; the refresh cycles are recovery points.
+    CHECK_EQ(keyframes, 1);
+    CHECK(recovery_points > 0);
+}
+#endif
+
+int main() {
+    return check::RunTests();
+}
@@ -0,0 +1,101 @@
+#include <unistd.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "check.h"
+#include "cpus.h"
+
+using namespace screen_recorder;
+
+namespace {
+
+// A scratch cgroup filesystem: a /proc/self/cgroup file and a hierarchy.
+struct Cgroups {
+    std::filesystem::path root;
+
+    Cgroups() {
+        static int serial = 0;
+        root = std::filesystem::temp_directory_path() /
+               ("cpus_test_" + std::to_string(getpid()) + "_" + std::to_string(serial++));
+        std::filesystem::create_directories(root / "fs");
+    }
+
+    ~Cgroups() {
+        std::filesystem::remove_all(root);
+    }
+
+    void Write(const std::string& path, const std::string& contents) {
+        const std::filesystem::path file = root / path;
+        std::filesystem::create_directories(file.parent_path());
+        std::ofstream(file) << contents;
+    }
+
+    unsigned Limit() const {
+        return detail::CgroupCpuLimit((root / "self").string(), (root / "fs").string());
+    }
+};
+
+}  // namespace
+
+TEST(NoQuotaIsUnlimited) {
+    Cgroups cgroups;
+    CHECK_EQ(cgroups.Limit(), 0u);
+    cgroups.Write("self", "0::/app\n");
+    cgroups.Write("fs/cpu.max", "max 100000\n");
+    cgroups.Write("fs/app/cpu.max", "max 100000\n");
+    CHECK_EQ(cgroups.Limit(), 0u);
+}
+
+TEST(FractionalQuotasRoundUp) {
+    Cgroups cgroups;
+    cgroups.Write("self", "0::/app\n");
+    cgroups.Write("fs/app/cpu.max", "150000 100000\n");
+    CHECK_EQ(cgroups.Limit(), 2u);
+    // Less than a core still leaves one.
+    cgroups.Write("fs/app/cpu.max", "20000 100000\n");
+    CHECK_EQ(cgroups.Limit(), 1u);
+}
+
+TEST(TightestLevelUpToTheRootApplies) {
+    Cgroups cgroups;
+    cgroups.Write("self", "12:cpu,cpuacct:/ignored\n0::/a/b/c\n");
+    cgroups.Write("fs/cpu.max", "max 100000\n");
+    cgroups.Write("fs/a/cpu.max", "250000 100000\n");
+    cgroups.Write("fs/a/b/cpu.max", "max 100000\n");
+    cgroups.Write("fs/a/b/c/cpu.max", "800000 100000\n");
+    CHECK_EQ(cgroups.Limit(), 3u);
+    // A nested quota tighter than its parent's wins.
+    cgroups.Write("fs/a/b/c/cpu.max", "120000 100000\n");
+    CHECK_EQ(cgroups.Limit(), 2u);
+    // So does the root's.
+    cgroups.Write("fs/cpu.max", "50000 100000\n");
+    CHECK_EQ(cgroups.Limit(), 1u);
+}
+
+TEST(ProcessInTheRootCgroup) {
+    Cgroups cgroups;
+    cgroups.Write("self", "0::/\n");
+    cgroups.Write("fs/cpu.max", "400000 100000\n");
+    CHECK_EQ(cgroups.Limit(), 4u);
+}
+
+TEST(CgroupV1Quota) {
+    Cgroups cgroups;
+    cgroups.Write("self", "4:cpu,cpuacct:/docker/abc\n");
+    cgroups.Write("fs/cpu/cpu.cfs_quota_us", "350000\n");
+    cgroups.Write("fs/cpu/cpu.cfs_period_us", "100000\n");
+    CHECK_EQ(cgroups.Limit(), 4u);
+    // -1 is unlimited.
+    cgroups.Write("fs/cpu/cpu.cfs_quota_us", "-1\n");
+    CHECK_EQ(cgroups.Limit(), 0u);
+}
+
+TEST(AvailableCpusIsAtLeastOne) {
+    CHECK(AvailableCpus() >= 1);
+}
+
+int main() {
+    return check::RunTests();
+}
@@ -0,0 +1,131 @@
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "frame_allocator.h"
+
+using namespace screen_recorder;
+
+namespace {
+
+constexpr size_t kMiB = 1 << 20;
+constexpr size_t kPage = detail::HugePagePool::kPageSize;
+
+FrameAllocator<uint8_t> allocator;
+
+size_t Idle() {
+    return GlobalMemoryBudget().Used(MemoryPool::kFramePool);
+}
+
+// The extent of the mapping holding `address`, from /proc/self/maps.
+bool FindMapping(const void* address, uintptr_t& start, uintptr_t& end) {
+    std::ifstream maps("/proc/self/maps");
+    std::string line;
+    while (std::getline(maps, line)) {
+        std::istringstream range(line);
+        char dash;
+        range >> std::hex >> start >> dash >> end;
+        if (reinterpret_cast<uintptr_t>(address) >= start && reinterpret_cast<uintptr_t>(address) < end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // namespace
+
+TEST(SmallBuffersStayOnTheHeap) {
+    const HugePageStats before = GetHugePageStats();
+    uint8_t* small = allocator.allocate(FrameAllocator<uint8_t>::kThreshold - 1);
+    allocator.deallocate(small, FrameAllocator<uint8_t>::kThreshold - 1);
+    const HugePageStats after = GetHugePageStats();
+    CHECK_EQ(after.explicit_mappings + after.transparent_mappings,
+             before.explicit_mappings + before.transparent_mappings);
+}
+
+TEST(LargeBuffersAreWholeHugePages) {
+    const HugePageStats before = GetHugePageStats();
+    const size_t bytes = 9 * kMiB + 5;
+    uint8_t* buffer = allocator.allocate(bytes);
+    const HugePageStats after = GetHugePageStats();
+    CHECK_EQ(after.explicit_mappings + after.transparent_mappings,
+             before.explicit_mappings + before.transparent_mappings + 1);
+    CHECK_EQ(reinterpret_cast<uintptr_t>(buffer) % kPage, 0u);
+    // The transparent path over-maps by a page and trims both ends, leaving
+    // nothing but 2 MiB pages around the buffer.
+    uintptr_t start = 0;
+    uintptr_t end = 0;
+    CHECK(FindMapping(buffer, start, end));
+    CHECK_EQ(start % kPage, 0u);
+    CHECK_EQ(end % kPage, 0u);
+    CHECK(end >= reinterpret_cast<uintptr_t>(buffer) + 10 * kMiB);
+    buffer[0] = 1;
+    buffer[bytes - 1] = 1;
+    allocator.deallocate(buffer, bytes);
+}
+
+TEST(FreedBuffersAreKeptChargedAndReused) {
+    const size_t bytes = 13 * kMiB;
+    uint8_t* buffer = allocator.allocate(bytes);
+    const size_t idle = Idle();
+    allocator.deallocate(buffer, bytes);
+    // Idle mappings are charged at their rounded size.
+    CHECK_EQ(Idle(), idle + 14 * kMiB);
+
+    const uint64_t reused = GetHugePageStats().reused;
+    // Any size rounding to the same pages takes the mapping back.
+    uint8_t* again = allocator.allocate(bytes + kMiB - 1);
+    CHECK(again == buffer);
+    CHECK_EQ(GetHugePageStats().reused, reused + 1);
+    CHECK_EQ(Idle(), idle);
+    allocator.deallocate(again, bytes + kMiB - 1);
+}
+
+TEST(IdleMappingsAreCappedByCount) {
+    std::vector<uint8_t*> buffers;
+    for (size_t i = 0; i <= detail::HugePagePool::kMaxIdle; i++) {
+        buffers.push_back(allocator.allocate(10 * kMiB));
+    }
+    for (uint8_t* buffer : buffers) {
+        allocator.deallocate(buffer, 10 * kMiB);
+    }
+    // The oldest mappings, earlier tests' included, were dropped.
+    CHECK_EQ(Idle(), detail::HugePagePool::kMaxIdle * 10 * kMiB);
+}
+
+TEST(IdleMappingsAreCappedByBytes) {
+    std::vector<uint8_t*> buffers;
+    for (int i = 0; i < 6; i++) {
+        buffers.push_back(allocator.allocate(50 * kMiB));
+    }
+    for (uint8_t* buffer : buffers) {
+        allocator.deallocate(buffer, 50 * kMiB);
+    }
+    CHECK_EQ(Idle(), 5 * 50 * kMiB);
+
+    // A buffer over the whole allowance is unmapped at once.
+    uint8_t* huge = allocator.allocate(300 * kMiB);
+    allocator.deallocate(huge, 300 * kMiB);
+    CHECK_EQ(Idle(), 5 * 50 * kMiB);
+}
+
+TEST(SpentBudgetUnmapsFreedBuffers) {
+    MemoryBudget& budget = GlobalMemoryBudget();
+    uint8_t* buffer = allocator.allocate(20 * kMiB);
+    const size_t idle = Idle();
+    budget.SetLimit(budget.Used() + 10 * kMiB);
+    allocator.deallocate(buffer, 20 * kMiB);
+    CHECK_EQ(Idle(), idle);
+    budget.SetLimit(0);
+
+    const uint64_t reused = GetHugePageStats().reused;
+    allocator.deallocate(allocator.allocate(20 * kMiB), 20 * kMiB);
+    CHECK_EQ(GetHugePageStats().reused, reused);
+}
+
+int main() {
+    return check::RunTests();
+}
@@ -0,0 +1,133 @@
+#include <chrono>
+#include <cmath>
+
+#include "check.h"
+#include "frame_rate.h"
+
+using namespace screen_recorder;
+
+namespace {
+
+constexpr int kRows = 100;
+
+Frame Screen() {
+    Frame frame;
+    frame.format = PixelFormat::kBGRA;
+    frame.width = 16;
+    frame.height = kRows;
+    frame.stride = frame.width * 4;
+    frame.data.assign(static_cast<size_t>(frame.stride) * kRows, 0);
+    return frame;
+}
+
+void Change(Frame& frame, int rows) {
+    for (int y = 0; y < rows; y++) {
+        frame.data[static_cast<size_t>(y) * frame.stride] ^= 0xff;
+    }
+}
+
+double Seconds(std::chrono::steady_clock::duration delay) {
+    return std::chrono::duration<double>(delay).count();
+}
+
+// Delays are whole clock ticks.
+bool Near(double a, double b) {
+    return std::abs(a - b) < 1e-6 * b;
+}
+
+// Settles `rate` at its floor on a static screen.
+void Settle(AdaptiveRate& rate, const Frame& frame) {
+    for (int i = 0; i < 1000; i++) {
+        rate.Update(frame);
+    }
+}
+
+}  // namespace
+
+TEST(FirstFrameRunsAtTheCeiling) {
+    AdaptiveRate rate(1, 60);
+    CHECK(Near(Seconds(rate.Update(Screen())), 1.0 / 60));
+    CHECK(rate.Fps() == 60);
+}
+
+TEST(StaticScreenHalvesEveryHalfLife) {
+    AdaptiveRate rate(1, 60, 0.5);
+    const Frame frame = Screen();
+    double elapsed = Seconds(rate.Update(frame));
+    while (elapsed < 1) {
+        const double fps = rate.Fps();
+        elapsed += Seconds(rate.Update(frame));
+        CHECK(rate.Fps() < fps);
+    }
+    // Each capture decays the rate over the delay that preceded it, so the
+    // rate after the last capture reflects all but its own delay.
+    const double decayed = elapsed - 1 / rate.Fps();
+    CHECK(Near(rate.Fps(), 60 * std::exp2(-decayed / 0.5)));
+    CHECK(rate.Fps() > 15 && rate.Fps() < 16);
+}
+
+TEST(StaticScreenSettlesAtTheFloor) {
+    AdaptiveRate rate(2, 30);
+    const Frame frame = Screen();
+    Settle(rate, frame);
+    CHECK(rate.Fps() == 2);
+    CHECK(Near(Seconds(rate.Update(frame)), 0.5));
+}
+
+TEST(DamageRampsTheRate) {
+    AdaptiveRate rate(1, 60);
+    Frame frame = Screen();
+    Settle(rate, frame);
+
+    // A quarter of the rows reaches the ceiling at once.
+    Change(frame, kRows / 4);
+    rate.Update(frame);
+    CHECK(rate.Fps() == 60);
+
+    // An eighth reaches half the range.
+    Settle(rate, frame);
+    Change(frame, kRows / 8 + 1);
+    rate.Update(frame);
+    CHECK(Near(rate.Fps(), 1 + 59 * 0.52));
+
+    // A single row still at least doubles the rate.
+    Settle(rate, frame);
+    Change(frame, 1);
+    rate.Update(frame);
+    CHECK(Near(rate.Fps(), 1 + 59 * 0.04));
+    Settle(rate, frame);
+    for (int i = 0; i < 3; i++) {
+        const double fps = rate.Fps();
+        Change(frame, 1);
+        rate.Update(frame);
+        CHECK(rate.Fps() >= 2 * fps);
+    }
+}
+
+TEST(RateStaysWithinFloorAndCeiling) {
+    AdaptiveRate rate(5, 20);
+    Frame frame = Screen();
+    for (int i = 0; i < 50; i++) {
+        Change(frame, kRows);
+        rate.Update(frame);
+        CHECK(rate.Fps() == 20);
+    }
+    // A floor above the ceiling is lowered to it.
+    AdaptiveRate inverted(30, 10);
+    inverted.Update(frame);
+    Settle(inverted, frame);
+    CHECK(inverted.Fps() == 10);
+}
+
+TEST(ResizeCountsAsFullDamage) {
+    AdaptiveRate rate(1, 60);
+    Frame frame = Screen();
+    Settle(rate, frame);
+    frame.width = 8;
+    rate.Update(frame);
+    CHECK(rate.Fps() == 60);
+}
+
+int main() {
+    return check::RunTests();
+}
@@ -0,0 +1,112 @@
+#include <chrono>
+#include <vector>
+
+#include "check.h"
+#include "governor.h"
+
+using namespace screen_recorder;
+
+namespace {
+
+constexpr int64_t kSecondNs = 1000000000;
+
+// Drives a governor through one-second windows of synthetic CPU time.
+struct Clock {
+    CpuGovernor& governor;
+    std::chrono::steady_clock::time_point now{std::chrono::seconds(1)};
+
+    explicit Clock(CpuGovernor& governor) : governor(governor) {
+        governor.Tick(now);
+    }
+
+    // A window at `load` cores.
+    GovernorDecision Window(double load) {
+        governor.AddCpuTime(static_cast<int64_t>(load * kSecondNs));
+        now += std::chrono::seconds(1);
+        governor.Tick(now);
+        return governor.Decision();
+    }
+};
+
+GovernorOptions Budget(double budget, bool allow_resize = false) {
+    GovernorOptions options;
+    options.budget = budget;
+    options.allow_resize = allow_resize;
+    return options;
+}
+
+void CheckLadder(bool allow_resize, const std::vector<GovernorDecision>& expected) {
+    CpuGovernor governor(Budget(0.2, allow_resize));
+    Clock clock(governor);
+    CHECK(governor.Decision().fps_scale == 1);
+    for (const GovernorDecision& step : expected) {
+        const GovernorDecision decision = clock.Window(0.5);
+        CHECK(decision.fps_scale == step.fps_scale);
+        CHECK(decision.resolution_scale == step.resolution_scale);
+        CHECK_EQ(decision.speed, step.speed);
+    }
+    // The last step is as far as it goes.
+    CHECK_EQ(clock.Window(0.5).speed, 2);
+}
+
+}  // namespace
+
+TEST(LadderLowersFpsThenSpeed) {
+    CheckLadder(false, {{0.75, 1, 0}, {0.5, 1, 0}, {0.35, 1, 0}, {0.25, 1, 0}, {0.25, 1, 1}, {0.25, 1, 2}});
+}
+
+TEST(ResolutionStepsOnlyWhenAllowed) {
+    CheckLadder(true, {{0.75, 1, 0},
+                       {0.5, 1, 0},
+                       {0.35, 1, 0},
+                       {0.25, 1, 0},
+                       {0.25, 0.75, 0},
+                       {0.25, 0.5, 0},
+                       {0.25, 0.5, 1},
+                       {0.25, 0.5, 2}});
+}
+
+TEST(OnlyWholeOverBudgetWindowsStepUp) {
+    CpuGovernor governor(Budget(0.2));
+    Clock clock(governor);
+    CHECK(clock.Window(0.2).fps_scale == 1);
+    // Half a second at 0.3 cores is not a window yet.
+    governor.AddCpuTime(kSecondNs * 3 / 10);
+    governor.Tick(clock.now + std::chrono::milliseconds(500));
+    CHECK(governor.Decision().fps_scale == 1);
+    // Averaged over the full second it is 0.3 + 0.05 = 0.35 cores.
+    CHECK(clock.Window(0.05).fps_scale == 0.75);
+
+    Metrics metrics;
+    governor.AddMetrics(metrics);
+    CHECK(metrics[1].second > 0.34 && metrics[1].second < 0.36);
+    CHECK(metrics[2].second == 1);
+}
+
+TEST(StepsBackAfterThreeCalmWindows) {
+    CpuGovernor governor(Budget(0.2));
+    Clock clock(governor);
+    clock.Window(0.5);
+    clock.Window(0.5);
+    CHECK(governor.Decision().fps_scale == 0.5);
+
+    CHECK(clock.Window(0.1).fps_scale == 0.5);
+    CHECK(clock.Window(0.1).fps_scale == 0.5);
+    CHECK(clock.Window(0.1).fps_scale == 0.75);
+
+    // Load between 60% and 100% of the budget restarts the count.
+    clock.Window(0.1);
+    clock.Window(0.1);
+    clock.Window(0.15);
+    CHECK(clock.Window(0.1).fps_scale == 0.75);
+    CHECK(clock.Window(0.1).fps_scale == 0.75);
+    CHECK(clock.Window(0.1).fps_scale == 1);
+    // There is no step above the top.
+    for (int i = 0; i < 5; i++) {
+        CHECK(clock.Window(0).fps_scale == 1);
+    }
+}
+
+int main() {
+    return check::RunTests();
+}
@@ -0,0 +1,100 @@
+#include <string>
+#include <utility>
+
+#include "check.h"
+#include "memory_budget.h"
+
+using namespace screen_recorder;
+
+TEST(TryChargeRefusesPastTheLimit) {
+    MemoryBudget budget;
+    budget.SetLimit(1000);
+    CHECK_EQ(budget.Limit(), 1000u);
+    CHECK(budget.TryCharge(MemoryPool::kQueues, 600));
+    CHECK(budget.TryCharge(MemoryPool::kTileCache, 400));
+    CHECK_EQ(budget.Rejected(), 0u);
+    CHECK(!budget.TryCharge(MemoryPool::kQueues, 1));
+    CHECK(!budget.TryCharge(MemoryPool::kReplay, 500));
+    CHECK_EQ(budget.Rejected(), 2u);
+    // Refused charges are not counted.
+    CHECK_EQ(budget.Used(), 1000u);
+    CHECK_EQ(budget.Used(MemoryPool::kReplay), 0u);
+
+    budget.Release(MemoryPool::kQueues, 100);
+    CHECK(budget.TryCharge(MemoryPool::kReplay, 100));
+    CHECK(!budget.TryCharge(MemoryPool::kReplay, 1));
+    CHECK_EQ(budget.Rejected(), 3u);
+}
+
+TEST(ChargeIgnoresTheLimit) {
+    MemoryBudget budget;
+    budget.SetLimit(100);
+    budget.Charge(MemoryPool::kVnc, 500);
+    CHECK_EQ(budget.Used(), 500u);
+    CHECK(!budget.TryCharge(MemoryPool::kQueues, 1));
+    budget.Release(MemoryPool::kVnc, 500);
+    CHECK(budget.TryCharge(MemoryPool::kQueues, 100));
+}
+
+TEST(PoolsAreCountedSeparately) {
+    MemoryBudget budget;
+    budget.Charge(MemoryPool::kQueues, 10);
+    budget.Charge(MemoryPool::kFramePool, 20);
+    CHECK(budget.TryCharge(MemoryPool::kBursts, 30));
+    CHECK_EQ(budget.Used(MemoryPool::kQueues), 10u);
+    CHECK_EQ(budget.Used(MemoryPool::kFramePool), 20u);
+    CHECK_EQ(budget.Used(MemoryPool::kBursts), 30u);
+    CHECK_EQ(budget.Used(MemoryPool::kVnc), 0u);
+    CHECK_EQ(budget.Used(), 60u);
+    budget.Release(MemoryPool::kFramePool, 20);
+    CHECK_EQ(budget.Used(MemoryPool::kFramePool), 0u);
+    CHECK_EQ(budget.Used(), 40u);
+    CHECK(std::string(MemoryPoolName(MemoryPool::kFramePool)) == "framePool");
+}
+
+TEST(ZeroLimitIsUnlimited) {
+    MemoryBudget budget;
+    CHECK_EQ(budget.Limit(), 0u);
+    CHECK(budget.TryCharge(MemoryPool::kQueues, size_t(1) << 40));
+    budget.SetLimit(1);
+    CHECK(!budget.TryCharge(MemoryPool::kQueues, 1));
+    budget.SetLimit(0);
+    CHECK(budget.TryCharge(MemoryPool::kQueues, size_t(1) << 40));
+    CHECK_EQ(budget.Rejected(), 1u);
+}
+
+TEST(ChargesReleaseExactlyOnce) {
+    MemoryBudget& budget = GlobalMemoryBudget();
+    const size_t before = budget.Used(MemoryPool::kTileCache);
+    {
+        MemoryCharge charge(MemoryPool::kTileCache, 100);
+        CHECK_EQ(budget.Used(MemoryPool::kTileCache), before + 100);
+
+        // Moving transfers the charge; the moved-from one releases nothing.
+        MemoryCharge moved(std::move(charge));
+        CHECK_EQ(budget.Used(MemoryPool::kTileCache), before + 100);
+        charge.Reset();
+        CHECK_EQ(budget.Used(MemoryPool::kTileCache), before + 100);
+
+        // Assignment releases what the target held.
+        MemoryCharge other(MemoryPool::kTileCache, 50);
+        CHECK_EQ(budget.Used(MemoryPool::kTileCache), before + 150);
+        other = std::move(moved);
+        CHECK_EQ(budget.Used(MemoryPool::kTileCache), before + 100);
+        other = std::move(other);
+        CHECK_EQ(budget.Used(MemoryPool::kTileCache), before + 100);
+
+        other.Reset();
+        CHECK_EQ(budget.Used(MemoryPool::kTileCache), before);
+        other.Reset();
+        CHECK_EQ(budget.Used(MemoryPool::kTileCache), before);
+
+        MemoryCharge last(MemoryPool::kTileCache, 25);
+        charge = std::move(last);
+    }
+    CHECK_EQ(budget.Used(MemoryPool::kTileCache), before);
+}
+
+int main() {
+    return check::RunTests();
+}
@@ -0,0 +1,164 @@
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "check.h"
+#include "motion.h"
+
+using namespace screen_recorder;
+
+namespace {
+
+constexpr int kWidth = 200;
+constexpr int kHeight = 160;
+
+// Noise, so every row and column is distinct.
+Frame NoiseFrame(unsigned seed) {
+    Frame frame;
+    frame.format = PixelFormat::kBGRA;
+    frame.width = kWidth;
+    frame.height = kHeight;
+    frame.stride = kWidth * 4;
+    frame.data.resize(static_cast<size_t>(frame.stride) * kHeight);
+    std::mt19937 random(seed);
+    for (uint8_t& byte : frame.data) {
+        byte = static_cast<uint8_t>(random());
+    }
+    return frame;
+}
+
+uint8_t* PixelAt(Frame& frame, int x, int y) {
+    return frame.data.data() + static_cast<size_t>(y) * frame.stride + static_cast<size_t>(x) * 4;
+}
+
+const uint8_t* PixelAt(const Frame& frame, int x, int y) {
+    return frame.data.data() + static_cast<size_t>(y) * frame.stride + static_cast<size_t>(x) * 4;
+}
+
+// Applies the moves to a copy of `previous` the way a client would, in order
+// and in place, and checks every copied pixel against `current`.
+bool MovesReproduce(const Frame& previous, const Frame& current, const std::vector<Move>& moves) {
+    Frame canvas = previous;
+    for (const Move& move : moves) {
+        std::vector<uint8_t> block(static_cast<size_t>(move.width) * move.height * 4);
+        for (int row = 0; row < move.height; row++) {
+            std::memcpy(&block[static_cast<size_t>(row) * move.width * 4],
+                        PixelAt(canvas, move.source_x, move.source_y + row), static_cast<size_t>(move.width) * 4);
+        }
+        for (int row = 0; row < move.height; row++) {
+            std::memcpy(PixelAt(canvas, move.x, move.y + row), &block[static_cast<size_t>(row) * move.width * 4],
+                        static_cast<size_t>(move.width) * 4);
+        }
+    }
+    for (const Move& move : moves) {
+        for (int row = 0; row < move.height; row++) {
+            if (std::memcmp(PixelAt(canvas, move.x, move.y + row), PixelAt(current, move.x, move.y + row),
+                            static_cast<size_t>(move.width) * 4) != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+TEST(IdenticalFramesHaveNoMoves) {
+    const Frame frame = NoiseFrame(1);
+    CHECK(DetectMoves(frame, frame).empty());
+}
+
+TEST(VerticalScrollBecomesOneCopy) {
+    const Frame previous = NoiseFrame(2);
+    Frame current = NoiseFrame(3);
+    // Content scrolled up by 10 rows; the bottom rows are new.
+    for (int y = 0; y + 10 < kHeight; y++) {
+        std::memcpy(PixelAt(current, 0, y), PixelAt(previous, 0, y + 10), previous.stride);
+    }
+    const std::vector<Move> moves = DetectMoves(previous, current);
+    CHECK_EQ(moves.size(), 1u);
+    CHECK_EQ(moves[0].x, 0);
+    CHECK_EQ(moves[0].width, kWidth);
+    CHECK_EQ(moves[0].y, 0);
+    CHECK_EQ(moves[0].height, kHeight - 10);
+    CHECK_EQ(moves[0].source_y - moves[0].y, 10);
+    CHECK(MovesReproduce(previous, current, moves));
+}
+
+TEST(ScrollBesideStaticSidebarKeepsTheSidebar) {
+    const Frame previous = NoiseFrame(4);
+    Frame current = previous;
+    // Only the area right of a 40 pixel sidebar scrolls, down by 7 rows.
+    for (int y = kHeight - 1; y >= 7; y--) {
+        std::memcpy(PixelAt(current, 40, y), PixelAt(previous, 40, y - 7), (kWidth - 40) * 4);
+    }
+    const std::vector<Move> moves = DetectMoves(previous, current);
+    CHECK(!moves.empty());
+    for (const Move& move : moves) {
+        CHECK(move.x >= 40);
+        CHECK_EQ(move.y - move.source_y, 7);
+    }
+    CHECK(MovesReproduce(previous, current, moves));
+}
+
+TEST(HorizontalMoveIsFoundByColumns) {
+    const Frame previous = NoiseFrame(5);
+    Frame current = previous;
+    // Everything shifted left by 12 columns.
+    for (int y = 0; y < kHeight; y++) {
+        std::memmove(PixelAt(current, 0, y), PixelAt(previous, 12, y), (kWidth - 12) * 4);
+    }
+    const std::vector<Move> moves = DetectMoves(previous, current);
+    CHECK(!moves.empty());
+    for (const Move& move : moves) {
+        CHECK_EQ(move.source_x - move.x, 12);
+        CHECK_EQ(move.source_y, move.y);
+    }
+    CHECK(MovesReproduce(previous, current, moves));
+}
+
+TEST(UnrelatedContentHasNoMoves) {
+    CHECK(DetectMoves(NoiseFrame(6), NoiseFrame(7)).empty());
+}
+
+TEST(MismatchedFramesHaveNoMoves) {
+    const Frame previous = NoiseFrame(8);
+    Frame current = previous;
+    current.format = PixelFormat::kH264;
+    CHECK(DetectMoves(previous, current).empty());
+}
+
+TEST(MoveMatchesComparesEveryByte) {
+    const Frame previous = NoiseFrame(9);
+    Frame current = previous;
+    const Move move{0, 0, 50, 30, 0, 0};
+    CHECK(detail::MoveMatches(previous, current, 4, move));
+    // One differing byte in the last row rejects the move, as a hash
+    // collision would.
+    PixelAt(current, 49, 29)[3] ^= 1;
+    CHECK(!detail::MoveMatches(previous, current, 4, move));
+}
+
+TEST(OrderMovesReadsBeforeWriting) {
+    // `first` reads rows 10..19, which `second` writes, so `first` goes first
+    // even though it is smaller.
+    const Move first{0, 0, 10, 10, 0, 10};
+    const Move second{0, 10, 20, 10, 0, 20};
+    const std::vector<Move> ordered = detail::OrderMoves({second, first});
+    CHECK_EQ(ordered.size(), 2u);
+    CHECK_EQ(ordered[0].width, 10);
+    CHECK_EQ(ordered[1].width, 20);
+}
+
+TEST(OrderMovesDropsTheSmallestOfACycle) {
+    // Two regions swapping places have no safe order.
+    const Move big{0, 0, 20, 10, 0, 10};
+    const Move small{0, 10, 10, 10, 0, 0};
+    const std::vector<Move> ordered = detail::OrderMoves({small, big});
+    CHECK_EQ(ordered.size(), 1u);
+    CHECK_EQ(ordered[0].width, 20);
+}
+
+int main() {
+    return check::RunTests();
+}
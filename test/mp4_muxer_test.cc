@@ -0,0 +1,181 @@
+#include <cstring>
+#include <vector>
+
+#include "check.h"
+#include "mp4_muxer.h"
+
+using namespace screen_recorder;
+
+namespace {
+
+uint32_t ReadU32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) << 24 | static_cast<uint32_t>(p[1]) << 16 |
+           static_cast<uint32_t>(p[2]) << 8 | p[3];
+}
+
+// Offset of the first box of `type` at any depth, found by its fourcc.
+size_t FindBox(const std::vector<uint8_t>& data, const char* type) {
+    for (size_t i = 4; i + 4 <= data.size(); i++) {
+        if (std::memcmp(data.data() + i, type, 4) == 0) {
+            return i - 4;
+        }
+    }
+    return SIZE_MAX;
+}
+
+Frame H264Packet(int64_t timestamp_us, bool keyframe) {
+    static const uint8_t kSps[] = {0, 0, 0, 1, 0x67, 0x64, 0x00, 0x1f, 0xac};
+    static const uint8_t kPps[] = {0, 0, 0, 1, 0x68, 0xee, 0x3c, 0x80};
+    static const uint8_t kIdr[] = {0, 0, 1, 0x65, 0x88, 0x84};
+    static const uint8_t kSlice[] = {0, 0, 1, 0x41, 0x9a, 0x02};
+    Frame packet;
+    packet.format = PixelFormat::kH264;
+    packet.width = 320;
+    packet.height = 240;
+    packet.timestamp_us = timestamp_us;
+    packet.decode_timestamp_us = timestamp_us;
+    packet.keyframe = keyframe;
+    if (keyframe) {
+        packet.data.insert(packet.data.end(), std::begin(kSps), std::end(kSps));
+        packet.data.insert(packet.data.end(), std::begin(kPps), std::end(kPps));
+        packet.data.insert(packet.data.end(), std::begin(kIdr), std::end(kIdr));
+    } else {
+        packet.data.insert(packet.data.end(), std::begin(kSlice), std::end(kSlice));
+    }
+    return packet;
+}
+
+struct Output {
+    std::vector<std::vector<uint8_t>> inits;
+    std::vector<std::vector<uint8_t>> fragments;
+    std::vector<FragmentInfo> infos;
+};
+
+Fmp4Muxer MakeMuxer(Output& output, int64_t fragment_duration_us) {
+    return Fmp4Muxer(
+        fragment_duration_us, [&output](std::vector<uint8_t>&& init) { output.inits.push_back(std::move(init)); },
+        [&output](std::vector<uint8_t>&& fragment, const FragmentInfo& info) {
+            output.fragments.push_back(std::move(fragment));
+            output.infos.push_back(info);
+        });
+}
+
+}  // namespace
+
+TEST(SplitAnnexBFindsThreeAndFourByteStartCodes) {
+    const uint8_t stream[] = {0, 0, 0, 1, 0x67, 0xaa, 0, 0, 1, 0x68, 0xbb, 0, 0, 0, 1, 0x65, 0xcc, 0xdd};
+    std::vector<mp4::NalUnit> units = mp4::SplitAnnexB(stream, sizeof(stream));
+    CHECK_EQ(units.size(), 3u);
+    CHECK_EQ(units[0].type, 7);
+    CHECK_EQ(units[0].size, 2u);
+    // The zero leading the next four-byte start code is not part of the unit.
+    CHECK_EQ(units[1].type, 8);
+    CHECK_EQ(units[1].size, 2u);
+    CHECK_EQ(units[2].type, 5);
+    CHECK_EQ(units[2].size, 3u);
+}
+
+TEST(PacketsBeforeTheFirstKeyframeAreDropped) {
+    Output output;
+    Fmp4Muxer muxer = MakeMuxer(output, 1000000);
+    muxer.AddPacket(H264Packet(0, false));
+    CHECK(!muxer.Initialized());
+    muxer.AddPacket(H264Packet(33333, true));
+    CHECK(muxer.Initialized());
+    CHECK_EQ(output.inits.size(), 1u);
+    CHECK(FindBox(output.inits[0], "avcC") != SIZE_MAX);
+    CHECK(mp4::CodecString(muxer.Track()) == "avc1.64001f");
+}
+
+TEST(KeyframeWithoutParameterSetsIsRejected) {
+    Output output;
+    Fmp4Muxer muxer = MakeMuxer(output, 1000000);
+    static const uint8_t kIdr[] = {0, 0, 1, 0x65, 0x88, 0x84};
+    Frame packet = H264Packet(0, true);
+    packet.data.assign(std::begin(kIdr), std::end(kIdr));
+    CHECK_THROWS(muxer.AddPacket(std::move(packet)));
+}
+
+TEST(RecoveryPointsAreNotSyncSamples) {
+    Output output;
+    Fmp4Muxer muxer = MakeMuxer(output, 1000000);
+    // A recovery point, flagged as a keyframe the way x264 reports it, can
+    // neither start the stream nor a fragment.
+    auto recovery = [](int index) {
+        Frame packet = H264Packet(index * 33333, false);
+        packet.keyframe = true;
+        packet.recovery_point = true;
+        return packet;
+    };
+    muxer.AddPacket(recovery(0));
+    CHECK(!muxer.Initialized());
+    for (int i = 1; i < 60; i++) {
+        muxer.AddPacket(i == 30 ? recovery(i) : H264Packet(i * 33333, i == 1));
+    }
+    muxer.Finish();
+    CHECK_EQ(output.fragments.size(), 1u);
+
+    // Per sample: duration, size, flags and composition offset after the
+    // trun header, sample count and data offset.
+    const std::vector<uint8_t>& fragment = output.fragments[0];
+    const size_t trun = FindBox(fragment, "trun");
+    CHECK_EQ(ReadU32(fragment.data() + trun + 12), 59u);
+    auto flags = [&](int sample) { return ReadU32(fragment.data() + trun + 20 + sample * 16 + 8); };
+    CHECK_EQ(flags(0), 0x02000000u);
+    CHECK_EQ(flags(1), 0x01010000u);
+    CHECK_EQ(flags(29), 0x01010000u);
+}
+
+TEST(RawFramesAreRejected) {
+    Output output;
+    Fmp4Muxer muxer = MakeMuxer(output, 1000000);
+    Frame frame;
+    frame.format = PixelFormat::kBGRA;
+    CHECK_THROWS(muxer.AddPacket(std::move(frame)));
+}
+
+TEST(FragmentsStartOnKeyframesPastTheTarget) {
+    Output output;
+    Fmp4Muxer muxer = MakeMuxer(output, 1000000);
+    // 30 fps with a keyframe every 45 frames: cuts at 1.5 s and 3 s.
+    for (int i = 0; i < 100; i++) {
+        muxer.AddPacket(H264Packet(i * 33333, i % 45 == 0));
+    }
+    muxer.Finish();
+    CHECK_EQ(output.fragments.size(), 3u);
+    CHECK_EQ(output.infos[0].start_us, 0);
+    CHECK(output.infos[1].start_us > 1490000 && output.infos[1].start_us < 1510000);
+    for (const FragmentInfo& info : output.infos) {
+        CHECK(info.starts_with_keyframe);
+    }
+
+    // trun counts the samples; parameter sets moved to avcC and the slice
+    // data became length prefixed.
+    const std::vector<uint8_t>& first = output.fragments[0];
+    const size_t trun = FindBox(first, "trun");
+    CHECK(trun != SIZE_MAX);
+    CHECK_EQ(ReadU32(first.data() + trun + 12), 45u);
+    const size_t mdat = FindBox(first, "mdat");
+    CHECK_EQ(ReadU32(first.data() + mdat + 8), 3u);
+    CHECK_EQ(first[mdat + 12], 0x65);
+}
+
+TEST(StreamsWithoutKeyframesAreCutAtFourTimesTheTarget) {
+    Output output;
+    Fmp4Muxer muxer = MakeMuxer(output, 1000000);
+    CHECK_EQ(muxer.MaxFragmentDurationUs(), 4000000);
+    for (int i = 0; i < 300; i++) {
+        muxer.AddPacket(H264Packet(i * 33333, i == 0));
+    }
+    muxer.Finish();
+    CHECK(output.fragments.size() >= 2u);
+    CHECK(output.infos[0].starts_with_keyframe);
+    CHECK(!output.infos[1].starts_with_keyframe);
+    for (const FragmentInfo& info : output.infos) {
+        CHECK(info.duration_us <= muxer.MaxFragmentDurationUs() + 33333);
+    }
+}
+
+int main() {
+    return check::RunTests();
+}
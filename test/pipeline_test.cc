@@ -0,0 +1,166 @@
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "pipeline.h"
+
+using namespace screen_recorder;
+
+namespace {
+
+// Produces `count` small frames, pausing every `pause_every` so consumers
+// run dry and have to wait for the next one.
+class CountingSource : public SourceStage {
+public:
+    CountingSource(int count, int pause_every = 0) : count_(count), pause_every_(pause_every) {}
+
+    std::string Name() const override {
+        return "source";
+    }
+
+    bool Produce(Frame& frame) override {
+        if (produced_ == count_) {
+            return false;
+        }
+        if (pause_every_ > 0 && produced_ % pause_every_ == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        frame.data.assign(64, static_cast<uint8_t>(produced_));
+        frame.sequence = produced_++;
+        return true;
+    }
+
+private:
+    int count_;
+    int pause_every_;
+    int produced_ = 0;
+};
+
+class Forward : public Stage {
+public:
+    std::string Name() const override {
+        return "forward";
+    }
+
+    void Process(Frame&& frame, const Emit& emit) override {
+        emit(std::move(frame));
+    }
+};
+
+class Collect : public Stage {
+public:
+    explicit Collect(std::vector<uint64_t>& sequences, int& flushes, std::chrono::microseconds delay = {})
+        : sequences_(sequences), flushes_(flushes), delay_(delay) {}
+
+    std::string Name() const override {
+        return "collect";
+    }
+
+    void Process(Frame&& frame, const Emit& emit) override {
+        std::this_thread::sleep_for(delay_);
+        sequences_.push_back(frame.sequence);
+    }
+
+    void Flush(const Emit& emit) override {
+        flushes_++;
+    }
+
+private:
+    std::vector<uint64_t>& sequences_;
+    int& flushes_;
+    std::chrono::microseconds delay_;
+};
+
+class Explode : public Stage {
+public:
+    std::string Name() const override {
+        return "explode";
+    }
+
+    void Process(Frame&& frame, const Emit& emit) override {
+        if (frame.sequence == 3) {
+            throw std::runtime_error("boom");
+        }
+        emit(std::move(frame));
+    }
+};
+
+void RunToEnd(Pipeline& pipeline) {
+    pipeline.Start();
+    while (pipeline.IsRunning()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    pipeline.Stop();
+}
+
+}  // namespace
+
+TEST(SpscQueueHoldsExactlyItsCapacity) {
+    SpscQueue<int> queue(3);
+    for (int i = 0; i < 3; i++) {
+        int item = i;
+        CHECK(queue.TryPush(std::move(item)));
+    }
+    int extra = 3;
+    CHECK(!queue.TryPush(std::move(extra)));
+    CHECK_EQ(queue.Size(), 3u);
+    int item = -1;
+    CHECK(queue.TryPop(item));
+    CHECK_EQ(item, 0);
+}
+
+TEST(FramesPassEveryStageInOrderAndStagesFlushOnce) {
+    std::vector<uint64_t> sequences;
+    int flushes = 0;
+    std::vector<std::unique_ptr<Stage>> stages;
+    stages.push_back(std::make_unique<Forward>());
+    stages.push_back(std::make_unique<Collect>(sequences, flushes));
+    // Pauses leave the stages idle, so they must wake up again for the rest.
+    Pipeline pipeline(std::make_unique<CountingSource>(100, 25), std::move(stages), 256);
+    RunToEnd(pipeline);
+
+    CHECK(pipeline.Error().empty());
+    CHECK_EQ(pipeline.DroppedFrames(), 0u);
+    CHECK_EQ(sequences.size(), 100u);
+    for (size_t i = 0; i < sequences.size(); i++) {
+        CHECK_EQ(sequences[i], i);
+    }
+    CHECK_EQ(flushes, 1);
+}
+
+TEST(FullFirstQueueDropsNewFrames) {
+    std::vector<uint64_t> sequences;
+    int flushes = 0;
+    std::vector<std::unique_ptr<Stage>> stages;
+    stages.push_back(std::make_unique<Collect>(sequences, flushes, std::chrono::milliseconds(2)));
+    Pipeline pipeline(std::make_unique<CountingSource>(200), std::move(stages), 2);
+    RunToEnd(pipeline);
+
+    CHECK(pipeline.DroppedFrames() > 0);
+    CHECK_EQ(sequences.size() + pipeline.DroppedFrames(), 200u);
+    for (size_t i = 1; i < sequences.size(); i++) {
+        CHECK(sequences[i] > sequences[i - 1]);
+    }
+}
+
+TEST(ThrowingStageAbortsWithItsName) {
+    std::vector<uint64_t> sequences;
+    int flushes = 0;
+    std::vector<std::unique_ptr<Stage>> stages;
+    stages.push_back(std::make_unique<Explode>());
+    stages.push_back(std::make_unique<Collect>(sequences, flushes));
+    Pipeline pipeline(std::make_unique<CountingSource>(1000, 10), std::move(stages), 16);
+    RunToEnd(pipeline);
+
+    CHECK(pipeline.Error() == "explode: boom");
+    CHECK(sequences.size() <= 3u);
+    CHECK_EQ(flushes, 0);
+}
+
+int main() {
+    return check::RunTests();
+}
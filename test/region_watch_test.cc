@@ -0,0 +1,97 @@
+#include <vector>
+
+#include "check.h"
+#include "region_watch.h"
+
+using namespace screen_recorder;
+
+namespace {
+
+// 50x40 is 4x3 tiles, the last column 2 pixels wide and the last row 8 high.
+Frame Region(int width = 50, int height = 40) {
+    Frame frame;
+    frame.format = PixelFormat::kBGRA;
+    frame.width = width;
+    frame.height = height;
+    frame.stride = width * 4;
+    frame.data.assign(static_cast<size_t>(frame.stride) * height, 200);
+    return frame;
+}
+
+void Touch(Frame& frame, int x, int y) {
+    frame.data[static_cast<size_t>(y) * frame.stride + x * 4] ^= 0xff;
+}
+
+}  // namespace
+
+TEST(FirstFrameOnlySetsTheBaseline) {
+    TileDiff diff;
+    RegionChange change;
+    CHECK(!diff.Update(Region(), 0, change));
+    // An identical repaint is damage but not a change.
+    CHECK(!diff.Update(Region(), 0, change));
+}
+
+TEST(ChangeIsBoundedByItsTilesAndClipped) {
+    TileDiff diff;
+    RegionChange change;
+    Frame frame = Region();
+    diff.Update(frame, 0, change);
+    Touch(frame, 49, 39);
+    CHECK(diff.Update(frame, 0, change));
+    CHECK_EQ(change.x, 48);
+    CHECK_EQ(change.y, 32);
+    CHECK_EQ(change.width, 2);
+    CHECK_EQ(change.height, 8);
+    CHECK(change.fraction == 1.0 / 12);
+    // The changed frame became the baseline.
+    CHECK(!diff.Update(frame, 0, change));
+}
+
+TEST(SmallChangesAccumulateUntilTheThreshold) {
+    TileDiff diff;
+    RegionChange change;
+    Frame frame = Region();
+    diff.Update(frame, 0.25, change);
+    Touch(frame, 1, 1);
+    CHECK(!diff.Update(frame, 0.25, change));
+    Touch(frame, 20, 1);
+    CHECK(!diff.Update(frame, 0.25, change));
+    Touch(frame, 20, 20);
+    CHECK(diff.Update(frame, 0.25, change));
+    CHECK(change.fraction == 0.25);
+    CHECK_EQ(change.x, 0);
+    CHECK_EQ(change.y, 0);
+    CHECK_EQ(change.width, 32);
+    CHECK_EQ(change.height, 32);
+}
+
+TEST(ChangesUndoneBeforeTheThresholdDoNotCount) {
+    TileDiff diff;
+    RegionChange change;
+    Frame frame = Region();
+    diff.Update(frame, 0.25, change);
+    Touch(frame, 1, 1);
+    Touch(frame, 20, 1);
+    CHECK(!diff.Update(frame, 0.25, change));
+    Touch(frame, 1, 1);
+    Touch(frame, 20, 1);
+    Touch(frame, 40, 20);
+    CHECK(!diff.Update(frame, 0.25, change));
+}
+
+TEST(SizeChangeResetsTheBaseline) {
+    TileDiff diff;
+    RegionChange change;
+    diff.Update(Region(), 0, change);
+    Frame larger = Region(80, 40);
+    CHECK(!diff.Update(larger, 0, change));
+    Touch(larger, 70, 5);
+    CHECK(diff.Update(larger, 0, change));
+    CHECK_EQ(change.x, 64);
+    CHECK_EQ(change.width, 16);
+}
+
+int main() {
+    return check::RunTests();
+}
@@ -0,0 +1,184 @@
+#include <vector>
+
+#include "check.h"
+#include "replay.h"
+
+using namespace screen_recorder;
+
+namespace {
+
+constexpr int64_t kFrameUs = 33333;
+
+Frame Packet(int index, bool keyframe) {
+    Frame packet;
+    packet.format = PixelFormat::kH264;
+    packet.width = 320;
+    packet.height = 240;
+    packet.timestamp_us = index * kFrameUs;
+    packet.keyframe = keyframe;
+    packet.data.assign(keyframe ? 2000 : 100, static_cast<uint8_t>(index));
+    return packet;
+}
+
+// Feeds `count` frames from `first` with a keyframe every `gop` frames.
+void Feed(ReplayStage& stage, int first, int count, int gop) {
+    const Stage::Emit emit = [](Frame&&) {};
+    for (int i = first; i < first + count; i++) {
+        stage.Process(Packet(i, i % gop == 0), emit);
+    }
+}
+
+size_t Bytes(const std::vector<ReplayStage::Packet>& packets) {
+    size_t bytes = 0;
+    for (const ReplayStage::Packet& packet : packets) {
+        bytes += packet->data.size();
+    }
+    return bytes;
+}
+
+class CollectStage : public Stage {
+public:
+    std::string Name() const override {
+        return "collect";
+    }
+
+    void Process(Frame&& frame, const Emit&) override {
+        timestamps.push_back(frame.timestamp_us);
+    }
+
+    void Flush(const Emit&) override {
+        flushed = true;
+    }
+
+    std::vector<int64_t> timestamps;
+    bool flushed = false;
+};
+
+}  // namespace
+
+TEST(PassesPacketsThroughAndRejectsRawFrames) {
+    ReplayStage stage(ReplayOptions{});
+    int emitted = 0;
+    const Stage::Emit emit = [&emitted](Frame&&) { emitted++; };
+    stage.Process(Packet(0, true), emit);
+    CHECK_EQ(emitted, 1);
+    Frame raw;
+    raw.format = PixelFormat::kBGRA;
+    CHECK_THROWS(stage.Process(std::move(raw), emit));
+}
+
+TEST(KeepsTheDurationPlusAtMostOneGop) {
+    ReplayOptions options;
+    options.duration_us = 2000000;
+    ReplayStage stage(options);
+    // Deltas before the first keyframe cannot be decoded and are not kept.
+    Feed(stage, 1, 299, 30);
+    const std::vector<ReplayStage::Packet> packets = stage.Snapshot();
+    CHECK(packets.front()->keyframe);
+    const int64_t span = packets.back()->timestamp_us - packets.front()->timestamp_us;
+    CHECK(span >= options.duration_us - kFrameUs);
+    CHECK(span < options.duration_us + 30 * kFrameUs);
+}
+
+TEST(ByteCapDropsWholeGops) {
+    ReplayOptions options;
+    options.max_bytes = 2 * (2000 + 29 * 100);
+    ReplayStage stage(options);
+    Feed(stage, 0, 200, 30);
+    const std::vector<ReplayStage::Packet> packets = stage.Snapshot();
+    CHECK(packets.front()->keyframe);
+    CHECK(Bytes(packets) <= options.max_bytes);
+    // The latest frame is always kept.
+    CHECK_EQ(packets.back()->timestamp_us, 199 * kFrameUs);
+}
+
+TEST(SnapshotsOutliveTrimming) {
+    ReplayOptions options;
+    options.duration_us = 1000000;
+    ReplayStage stage(options);
+    Feed(stage, 0, 60, 30);
+    const std::vector<ReplayStage::Packet> saved = stage.Snapshot();
+    Feed(stage, 60, 120, 30);
+    CHECK_EQ(saved.front()->timestamp_us, 0);
+    CHECK(stage.Snapshot().front()->timestamp_us > 0);
+}
+
+TEST(GlobalBudgetIsChargedAndReleased) {
+    MemoryBudget& budget = GlobalMemoryBudget();
+    const size_t before = budget.Used(MemoryPool::kReplay);
+    {
+        ReplayStage stage(ReplayOptions{});
+        Feed(stage, 0, 90, 30);
+        CHECK_EQ(budget.Used(MemoryPool::kReplay) - before, Bytes(stage.Snapshot()));
+    }
+    CHECK_EQ(budget.Used(MemoryPool::kReplay), before);
+}
+
+TEST(SpentBudgetDropsOldGopsThenWaitsForAKeyframe) {
+    MemoryBudget& budget = GlobalMemoryBudget();
+    const size_t gop_bytes = 2000 + 29 * 100;
+    budget.SetLimit(budget.Used() + gop_bytes + gop_bytes / 2);
+    {
+        ReplayStage stage(ReplayOptions{});
+        Feed(stage, 0, 90, 30);
+        std::vector<ReplayStage::Packet> packets = stage.Snapshot();
+        CHECK(packets.front()->keyframe);
+        CHECK_EQ(packets.front()->timestamp_us, 60 * kFrameUs);
+        CHECK_EQ(packets.back()->timestamp_us, 89 * kFrameUs);
+
+        // Room for a keyframe and ten deltas: once nothing is left to drop the
+        // rest of the GOP is skipped, since later deltas would reference it.
+        budget.SetLimit(budget.Used() - budget.Used(MemoryPool::kReplay) + 3000);
+        Feed(stage, 90, 25, 30);
+        packets = stage.Snapshot();
+        CHECK_EQ(packets.front()->timestamp_us, 90 * kFrameUs);
+        CHECK_EQ(packets.back()->timestamp_us, 100 * kFrameUs);
+
+        // Recording resumes at the next keyframe, in place of the cut GOP.
+        Feed(stage, 115, 15, 30);
+        packets = stage.Snapshot();
+        CHECK_EQ(packets.front()->timestamp_us, 120 * kFrameUs);
+        CHECK_EQ(packets.back()->timestamp_us, 129 * kFrameUs);
+    }
+    budget.SetLimit(0);
+}
+
+TEST(RecoveryPointsAreNotTrimPoints) {
+    ReplayOptions options;
+    options.duration_us = 1000000;
+    ReplayStage stage(options);
+    const Stage::Emit emit = [](Frame&&) {};
+    // An IDR frame every 90 frames with intra-refresh recovery points
+    // between them, flagged as keyframes the way x264 used to.
+    for (int i = 0; i < 200; i++) {
+        Frame packet = Packet(i, i % 30 == 0);
+        packet.recovery_point = i % 30 == 0 && i % 90 != 0;
+        stage.Process(std::move(packet), emit);
+    }
+    const std::vector<ReplayStage::Packet> packets = stage.Snapshot();
+    // The recovery points at 120 and 150 would have allowed a shorter clip.
+    CHECK(!packets.front()->recovery_point);
+    CHECK_EQ(packets.front()->timestamp_us, 90 * kFrameUs);
+    CHECK_EQ(packets.back()->timestamp_us, 199 * kFrameUs);
+
+    // A stream opening on a recovery point is not kept until its first IDR.
+    ReplayStage late(ReplayOptions{});
+    Frame packet = Packet(0, true);
+    packet.recovery_point = true;
+    late.Process(std::move(packet), emit);
+    CHECK(late.Snapshot().empty());
+}
+
+TEST(WriteReplayFeedsTheSinkAndFlushes) {
+    ReplayStage stage(ReplayOptions{});
+    CollectStage sink;
+    CHECK_THROWS(WriteReplay(stage.Snapshot(), sink));
+    Feed(stage, 0, 45, 30);
+    WriteReplay(stage.Snapshot(), sink);
+    CHECK_EQ(sink.timestamps.size(), 45u);
+    CHECK(sink.flushed);
+}
+
+int main() {
+    return check::RunTests();
+}
@@ -0,0 +1,442 @@
+#include <zlib.h>
+
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "check.h"
+#include "rfb_encodings.h"
+
+using namespace screen_recorder;
+using namespace screen_recorder::rfb;
+
+namespace {
+
+// An RGB24 test card: flat background, two-colour "text", a gradient and
+// noise, at a size that is no multiple of any tile size.
+struct Image {
+    int width = 150;
+    int height = 90;
+    std::vector<uint8_t> rgb;
+
+    Image() {
+        rgb.resize(static_cast<size_t>(width) * height * 3);
+        std::mt19937 random(7);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                uint8_t* p = &rgb[(static_cast<size_t>(y) * width + x) * 3];
+                if (y < 30) {
+                    const bool ink = x > 10 && x < 100 && ((x / 3 + y / 2) % 4 == 0);
+                    p[0] = ink ? 20 : 240;
+                    p[1] = ink ? 20 : 240;
+                    p[2] = ink ? 30 : 235;
+                } else if (y < 60) {
+                    p[0] = static_cast<uint8_t>(x);
+                    p[1] = static_cast<uint8_t>(y * 3);
+                    p[2] = static_cast<uint8_t>(x + y);
+                } else if (x < 75) {
+                    p[0] = static_cast<uint8_t>(random());
+                    p[1] = static_cast<uint8_t>(random());
+                    p[2] = static_cast<uint8_t>(random());
+                } else {
+                    p[0] = 0;
+                    p[1] = 90;
+                    p[2] = 200;
+                }
+            }
+        }
+    }
+
+    Surface AsSurface() const {
+        return {rgb.data(), width * 3, width, height};
+    }
+};
+
+class Reader {
+public:
+    explicit Reader(const std::vector<uint8_t>& data) : data_(data) {}
+
+    uint8_t U8() {
+        if (offset_ >= data_.size()) {
+            throw std::runtime_error("read past the end");
+        }
+        return data_[offset_++];
+    }
+
+    uint16_t U16() {
+        const uint16_t high = U8();
+        return static_cast<uint16_t>(high << 8 | U8());
+    }
+
+    uint32_t U32() {
+        const uint32_t high = U16();
+        return high << 16 | U16();
+    }
+
+    // Little-endian pixel of `bytes` bytes, as the default format sends.
+    uint32_t Pixel(int bytes) {
+        uint32_t value = 0;
+        for (int i = 0; i < bytes; i++) {
+            value |= static_cast<uint32_t>(U8()) << (8 * i);
+        }
+        return value;
+    }
+
+    std::vector<uint8_t> Bytes(size_t count) {
+        if (offset_ + count > data_.size()) {
+            throw std::runtime_error("read past the end");
+        }
+        std::vector<uint8_t> bytes(data_.begin() + offset_, data_.begin() + offset_ + count);
+        offset_ += count;
+        return bytes;
+    }
+
+    bool AtEnd() const {
+        return offset_ == data_.size();
+    }
+
+private:
+    const std::vector<uint8_t>& data_;
+    size_t offset_ = 0;
+};
+
+class Inflater {
+public:
+    Inflater() {
+        stream_ = {};
+        inflateInit(&stream_);
+    }
+
+    ~Inflater() {
+        inflateEnd(&stream_);
+    }
+
+    std::vector<uint8_t> Inflate(const std::vector<uint8_t>& input, size_t expected) {
+        std::vector<uint8_t> output(expected);
+        stream_.next_in = const_cast<Bytef*>(input.data());
+        stream_.avail_in = static_cast<uInt>(input.size());
+        stream_.next_out = output.data();
+        stream_.avail_out = static_cast<uInt>(output.size());
+        const int result = inflate(&stream_, Z_SYNC_FLUSH);
+        if ((result != Z_OK && result != Z_BUF_ERROR) || stream_.avail_out != 0) {
+            throw std::runtime_error("inflate failed");
+        }
+        return output;
+    }
+
+    // Everything the stream holds, for when the size is not known up front.
+    std::vector<uint8_t> InflateAll(const std::vector<uint8_t>& input) {
+        std::vector<uint8_t> output(1 << 20);
+        stream_.next_in = const_cast<Bytef*>(input.data());
+        stream_.avail_in = static_cast<uInt>(input.size());
+        stream_.next_out = output.data();
+        stream_.avail_out = static_cast<uInt>(output.size());
+        const int result = inflate(&stream_, Z_SYNC_FLUSH);
+        if ((result != Z_OK && result != Z_BUF_ERROR) || stream_.avail_in != 0) {
+            throw std::runtime_error("inflate failed");
+        }
+        output.resize(output.size() - stream_.avail_out);
+        return output;
+    }
+
+private:
+    z_stream stream_;
+};
+
+// Client pixel values of the whole image, row major.
+std::vector<uint32_t> Expected(const Image& image, const PixelWriter& writer) {
+    std::vector<uint32_t> pixels;
+    writer.Gather(image.AsSurface(), {0, 0, image.width, image.height}, pixels);
+    return pixels;
+}
+
+Rect ReadRectHeader(Reader& in, int32_t& encoding) {
+    Rect rect;
+    rect.x = in.U16();
+    rect.y = in.U16();
+    rect.width = in.U16();
+    rect.height = in.U16();
+    encoding = static_cast<int32_t>(in.U32());
+    return rect;
+}
+
+void Fill(std::vector<uint32_t>& frame, int stride, int x, int y, int width, int height, uint32_t pixel) {
+    for (int row = y; row < y + height; row++) {
+        for (int column = x; column < x + width; column++) {
+            frame[static_cast<size_t>(row) * stride + column] = pixel;
+        }
+    }
+}
+
+void DecodeHextile(Reader& in, const Rect& rect, int stride, std::vector<uint32_t>& frame) {
+    uint32_t background = 0;
+    uint32_t foreground = 0;
+    for (int ty = 0; ty < rect.height; ty += 16) {
+        for (int tx = 0; tx < rect.width; tx += 16) {
+            const int x = rect.x + tx;
+            const int y = rect.y + ty;
+            const int width = std::min(16, rect.width - tx);
+            const int height = std::min(16, rect.height - ty);
+            const uint8_t flags = in.U8();
+            if (flags & 1) {
+                for (int row = 0; row < height; row++) {
+                    for (int column = 0; column < width; column++) {
+                        frame[static_cast<size_t>(y + row) * stride + x + column] = in.Pixel(4);
+                    }
+                }
+                continue;
+            }
+            if (flags & 2) {
+                background = in.Pixel(4);
+            }
+            Fill(frame, stride, x, y, width, height, background);
+            if (flags & 4) {
+                foreground = in.Pixel(4);
+            }
+            if (!(flags & 8)) {
+                continue;
+            }
+            const int count = in.U8();
+            for (int i = 0; i < count; i++) {
+                const uint32_t pixel = (flags & 16) ? in.Pixel(4) : foreground;
+                const uint8_t position = in.U8();
+                const uint8_t size = in.U8();
+                Fill(frame, stride, x + (position >> 4), y + (position & 15), (size >> 4) + 1, (size & 15) + 1, pixel);
+            }
+        }
+    }
+}
+
+void DecodeZrle(Reader& in, const Rect& rect, int stride, Inflater& inflater, std::vector<uint32_t>& frame) {
+    const uint32_t length = in.U32();
+    std::vector<uint8_t> tiles = inflater.InflateAll(in.Bytes(length));
+    Reader data(tiles);
+    for (int ty = 0; ty < rect.height; ty += 64) {
+        for (int tx = 0; tx < rect.width; tx += 64) {
+            const int x = rect.x + tx;
+            const int y = rect.y + ty;
+            const int width = std::min(64, rect.width - tx);
+            const int height = std::min(64, rect.height - ty);
+            auto put = [&](int i, uint32_t pixel) {
+                frame[static_cast<size_t>(y + i / width) * stride + x + i % width] = pixel;
+            };
+            auto run_length = [&] {
+                int length = 1;
+                uint8_t byte;
+                do {
+                    byte = data.U8();
+                    length += byte;
+                } while (byte == 255);
+                return length;
+            };
+            const uint8_t type = data.U8();
+            std::vector<uint32_t> palette;
+            const int palette_size = type >= 130 ? type - 128 : (type >= 1 && type <= 16) ? type : 0;
+            for (int i = 0; i < palette_size; i++) {
+                palette.push_back(data.Pixel(3));
+            }
+            const int pixels = width * height;
+            if (type == 0) {
+                for (int i = 0; i < pixels; i++) {
+                    put(i, data.Pixel(3));
+                }
+            } else if (type == 1) {
+                for (int i = 0; i < pixels; i++) {
+                    put(i, palette[0]);
+                }
+            } else if (type <= 16) {
+                const int bits = type == 2 ? 1 : type <= 4 ? 2 : 4;
+                for (int row = 0; row < height; row++) {
+                    uint8_t byte = 0;
+                    int left = 0;
+                    for (int column = 0; column < width; column++) {
+                        if (left == 0) {
+                            byte = data.U8();
+                            left = 8;
+                        }
+                        left -= bits;
+                        put(row * width + column, palette[(byte >> left) & ((1 << bits) - 1)]);
+                    }
+                }
+            } else if (type == 128) {
+                for (int i = 0; i < pixels;) {
+                    const uint32_t pixel = data.Pixel(3);
+                    for (int n = run_length(); n > 0; n--) {
+                        put(i++, pixel);
+                    }
+                }
+            } else {
+                for (int i = 0; i < pixels;) {
+                    const uint8_t index = data.U8();
+                    const int count = (index & 128) ? run_length() : 1;
+                    for (int n = 0; n < count; n++) {
+                        put(i++, palette[index & 127]);
+                    }
+                }
+            }
+        }
+    }
+    CHECK(data.AtEnd());
+}
+
+size_t ReadCompactLength(Reader& in) {
+    size_t length = 0;
+    for (int shift = 0; shift < 21; shift += 7) {
+        const uint8_t byte = in.U8();
+        length |= static_cast<size_t>(shift == 14 ? byte : byte & 0x7f) << shift;
+        if (shift == 14 || !(byte & 0x80)) {
+            break;
+        }
+    }
+    return length;
+}
+
+void DecodeTight(Reader& in, const Rect& rect, int stride, Inflater (&streams)[4], std::vector<uint32_t>& frame) {
+    const uint8_t control = in.U8();
+    if ((control >> 4) == 8) {
+        Fill(frame, stride, rect.x, rect.y, rect.width, rect.height, in.Pixel(3));
+        return;
+    }
+    const int stream = (control >> 4) & 3;
+    std::vector<uint32_t> palette;
+    if (control & 0x40) {
+        CHECK_EQ(in.U8(), 1);
+        const int colours = in.U8() + 1;
+        for (int i = 0; i < colours; i++) {
+            palette.push_back(in.Pixel(3));
+        }
+    }
+    const size_t row_bytes = palette.empty() ? rect.width * 3u : palette.size() == 2 ? (rect.width + 7) / 8u
+                                                                                        : rect.width;
+    const size_t size = row_bytes * rect.height;
+    const std::vector<uint8_t> data =
+        size < 12 ? in.Bytes(size) : streams[stream].Inflate(in.Bytes(ReadCompactLength(in)), size);
+    for (int row = 0; row < rect.height; row++) {
+        const uint8_t* line = data.data() + row * row_bytes;
+        for (int column = 0; column < rect.width; column++) {
+            uint32_t pixel;
+            if (palette.empty()) {
+                pixel = line[column * 3] | line[column * 3 + 1] << 8 | line[column * 3 + 2] << 16;
+            } else if (palette.size() == 2) {
+                pixel = palette[(line[column / 8] >> (7 - column % 8)) & 1];
+            } else {
+                pixel = palette[line[column]];
+            }
+            frame[static_cast<size_t>(rect.y + row) * stride + rect.x + column] = pixel;
+        }
+    }
+}
+
+}  // namespace
+
+TEST(PixelWriterScalesToNarrowFormats) {
+    WireFormat format;
+    format.bits_per_pixel = 16;
+    format.depth = 16;
+    format.red_max = 31;
+    format.green_max = 63;
+    format.blue_max = 31;
+    format.red_shift = 11;
+    format.green_shift = 5;
+    format.blue_shift = 0;
+    PixelWriter writer(format);
+    const uint8_t white[3] = {255, 255, 255};
+    const uint8_t red[3] = {255, 0, 0};
+    CHECK_EQ(writer.Pixel(white), 0xFFFFu);
+    CHECK_EQ(writer.Pixel(red), 0xF800u);
+    CHECK_EQ(writer.Bytes(), 2);
+    CHECK_EQ(writer.CompactBytes(), 2);
+    CHECK_EQ(PixelWriter(WireFormat()).CompactBytes(), 3);
+}
+
+TEST(RawAndCopyRectLayout) {
+    Image image;
+    PixelWriter writer{WireFormat()};
+    std::vector<uint8_t> out;
+    EncodeRaw(image.AsSurface(), {4, 5, 2, 1}, writer, out);
+    CHECK_EQ(out.size(), 12u + 8u);
+    Reader in(out);
+    int32_t encoding;
+    Rect rect = ReadRectHeader(in, encoding);
+    CHECK_EQ(encoding, kRaw);
+    CHECK_EQ(rect.x, 4);
+    CHECK_EQ(rect.width, 2);
+    const std::vector<uint32_t> expected = Expected(image, writer);
+    CHECK_EQ(in.Pixel(4), expected[5 * image.width + 4]);
+
+    out.clear();
+    EncodeCopyRect({10, 20, 30, 40}, 1, 2, out);
+    const std::vector<uint8_t> copy = {0, 10, 0, 20, 0, 30, 0, 40, 0, 0, 0, 1, 0, 1, 0, 2};
+    CHECK(out == copy);
+}
+
+TEST(HextileRoundTrips) {
+    Image image;
+    PixelWriter writer{WireFormat()};
+    HextileEncoder encoder;
+    std::vector<uint8_t> out;
+    encoder.Encode(image.AsSurface(), {0, 0, image.width, image.height}, writer, out);
+
+    std::vector<uint32_t> decoded(static_cast<size_t>(image.width) * image.height, 0xDEADBEEF);
+    Reader in(out);
+    int32_t encoding;
+    Rect rect = ReadRectHeader(in, encoding);
+    CHECK_EQ(encoding, kHextile);
+    DecodeHextile(in, rect, image.width, decoded);
+    CHECK(in.AtEnd());
+    CHECK(decoded == Expected(image, writer));
+}
+
+TEST(ZrleRoundTripsAcrossUpdates) {
+    Image image;
+    PixelWriter writer{WireFormat()};
+    ZrleEncoder encoder;
+    Inflater inflater;
+    // The zlib stream carries over between updates, as it does on the wire.
+    for (const Rect& area : {Rect{0, 0, image.width, image.height}, Rect{7, 3, 100, 80}}) {
+        std::vector<uint8_t> out;
+        encoder.Encode(image.AsSurface(), area, writer, out);
+        std::vector<uint32_t> decoded = Expected(image, writer);
+        Fill(decoded, image.width, area.x, area.y, area.width, area.height, 0xDEADBEEF);
+        Reader in(out);
+        int32_t encoding;
+        Rect rect = ReadRectHeader(in, encoding);
+        CHECK_EQ(encoding, kZrle);
+        DecodeZrle(in, rect, image.width, inflater, decoded);
+        CHECK(in.AtEnd());
+        CHECK(decoded == Expected(image, writer));
+    }
+}
+
+TEST(TightRoundTripsInBlocks) {
+    Image image;
+    PixelWriter writer{WireFormat()};
+    TightEncoder encoder;
+    Inflater streams[4];
+    std::vector<uint8_t> out;
+    const int rects = encoder.Encode(image.AsSurface(), {0, 0, image.width, image.height}, writer, out);
+    CHECK_EQ(rects, 2);
+
+    std::vector<uint32_t> decoded(static_cast<size_t>(image.width) * image.height, 0xDEADBEEF);
+    Reader in(out);
+    for (int i = 0; i < rects; i++) {
+        int32_t encoding;
+        Rect rect = ReadRectHeader(in, encoding);
+        CHECK_EQ(encoding, kTight);
+        CHECK(rect.width <= TightEncoder::kBlockSize && rect.height <= TightEncoder::kBlockSize);
+        DecodeTight(in, rect, image.width, streams, decoded);
+    }
+    CHECK(in.AtEnd());
+    CHECK(decoded == Expected(image, writer));
+
+    // A flat rect is a single fill.
+    out.clear();
+    encoder.Encode(image.AsSurface(), {80, 65, 60, 20}, writer, out);
+    CHECK_EQ(out.size(), 12u + 1u + 3u);
+    CHECK_EQ(out[12], 0x80);
+}
+
+int main() {
+    return check::RunTests();
+}
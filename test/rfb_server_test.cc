@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <vector>
+
+#include "check.h"
+#include "rfb_server.h"
+
+using namespace screen_recorder;
+using namespace screen_recorder::rfb;
+
+namespace {
+
+SharedFrame Tiles(int columns, int rows) {
+    SharedFrame shared;
+    shared.columns = columns;
+    shared.rows = rows;
+    return shared;
+}
+
+std::vector<DamageRect> Damage(const SharedFrame& shared, const std::vector<uint8_t>& mask, int32_t encoding,
+                               bool jpeg = false) {
+    std::vector<DamageRect> damage;
+    for (const Rect& rect : MergeDamage(shared, mask, 0, shared.columns - 1, 0, shared.rows - 1)) {
+        damage.push_back({rect, encoding, jpeg});
+    }
+    return damage;
+}
+
+size_t Rects(const std::vector<DamageRect>& damage) {
+    size_t rects = 0;
+    for (const DamageRect& rect : damage) {
+        rects += UpdateRects(rect);
+    }
+    return rects;
+}
+
+}  // namespace
+
+TEST(TightBlocksAreCounted) {
+    CHECK_EQ(UpdateRects({{0, 0, 128, 128}, kTight, false}), 1u);
+    CHECK_EQ(UpdateRects({{0, 0, 129, 256}, kTight, false}), 4u);
+    CHECK_EQ(UpdateRects({{0, 0, 4096, 2049}, kTight, true}), 4u);
+    CHECK_EQ(UpdateRects({{0, 0, 4096, 4096}, kZrle, false}), 1u);
+}
+
+TEST(DamageWithinTheBudgetIsKept) {
+    // Isolated tiles, each its own rectangle, under MergeDamage's own cap.
+    const SharedFrame shared = Tiles(480, 270);
+    std::vector<uint8_t> mask(static_cast<size_t>(480) * 270, 0);
+    for (int i = 0; i < 4000; i++) {
+        mask[static_cast<size_t>(i / 200 * 2) * 480 + i % 200 * 2] = 1;
+    }
+    std::vector<DamageRect> damage = Damage(shared, mask, kHextile);
+    CHECK_EQ(damage.size(), 4000u);
+    FitDamage(damage, 4000);
+    CHECK_EQ(damage.size(), 4000u);
+
+    // With copies already using most of the update, the tiles are merged.
+    FitDamage(damage, 3999);
+    CHECK_EQ(damage.size(), 1u);
+    CHECK_EQ(damage[0].encoding, kHextile);
+    CHECK_EQ(damage[0].rect.x, 0);
+    CHECK_EQ(damage[0].rect.y, 0);
+    CHECK_EQ(damage[0].rect.width, 399 * kTileSize);
+    CHECK_EQ(damage[0].rect.height, 39 * kTileSize);
+}
+
+TEST(PathologicalMaskStaysWithinTheRectCount) {
+    // Every other tile row of the widest frame: 150 rectangles that Tight
+    // splits into 512 blocks each, more than an update can count.
+    const SharedFrame shared = Tiles(4095, 300);
+    std::vector<uint8_t> mask(static_cast<size_t>(4095) * 300, 0);
+    for (int row = 0; row < 300; row += 2) {
+        std::fill(mask.begin() + static_cast<size_t>(row) * 4095, mask.begin() + static_cast<size_t>(row + 1) * 4095,
+                  1);
+    }
+    std::vector<DamageRect> damage = Damage(shared, mask, kTight);
+    CHECK_EQ(damage.size(), 150u);
+    CHECK(Rects(damage) > kMaxUpdateRects);
+    FitDamage(damage, kMaxUpdateRects);
+    CHECK_EQ(damage.size(), 1u);
+    CHECK_EQ(damage[0].encoding, kTight);
+    CHECK_EQ(damage[0].rect.width, 4095 * kTileSize);
+    CHECK_EQ(damage[0].rect.height, 299 * kTileSize);
+    CHECK(Rects(damage) <= kMaxUpdateRects);
+
+    // Too many blocks even for the bounding rectangle: sent as one Raw.
+    damage = Damage(shared, mask, kTight);
+    FitDamage(damage, 100);
+    CHECK_EQ(damage.size(), 1u);
+    CHECK_EQ(damage[0].encoding, kRaw);
+    CHECK_EQ(Rects(damage), 1u);
+}
+
+TEST(MergedJpegDamageGoesLossless) {
+    const SharedFrame shared = Tiles(64, 64);
+    std::vector<uint8_t> natural(64 * 64, 0);
+    std::vector<uint8_t> lossless(64 * 64, 0);
+    natural[0] = 1;
+    lossless[63 * 64 + 63] = 1;
+    std::vector<DamageRect> damage = Damage(shared, natural, kTight, true);
+    for (const DamageRect& rect : Damage(shared, lossless, kTight)) {
+        damage.push_back(rect);
+    }
+    FitDamage(damage, 1);
+    CHECK_EQ(damage.size(), 1u);
+    CHECK(!damage[0].jpeg);
+    CHECK_EQ(damage[0].rect.width, 64 * kTileSize);
+    CHECK_EQ(damage[0].rect.height, 64 * kTileSize);
+    // 1024x1024 is 64 Tight blocks, more than the one rectangle left.
+    CHECK_EQ(damage[0].encoding, kRaw);
+}
+
+TEST(MergeDamageJoinsIdenticalRuns) {
+    const SharedFrame shared = Tiles(8, 4);
+    std::vector<uint8_t> mask(32, 0);
+    for (int row = 0; row < 3; row++) {
+        mask[row * 8 + 2] = mask[row * 8 + 3] = 1;
+    }
+    mask[3 * 8 + 7] = 1;
+    const std::vector<Rect> damage = MergeDamage(shared, mask, 0, 7, 0, 3);
+    CHECK_EQ(damage.size(), 2u);
+    CHECK_EQ(damage[0].x, 2 * kTileSize);
+    CHECK_EQ(damage[0].width, 2 * kTileSize);
+    CHECK_EQ(damage[0].height, 3 * kTileSize);
+    CHECK_EQ(damage[1].y, 3 * kTileSize);
+}
+
+int main() {
+    return check::RunTests();
+}
@@ -0,0 +1,155 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "segmenter.h"
+
+using namespace screen_recorder;
+
+namespace {
+
+Frame H264Packet(int64_t timestamp_us, bool keyframe) {
+    static const uint8_t kKeyframe[] = {0, 0, 0, 1, 0x67, 0x64, 0x00, 0x1f, 0xac,
+                                        0, 0, 0, 1, 0x68, 0xee, 0x3c, 0x80, 0, 0, 1, 0x65, 0x88};
+    static const uint8_t kSlice[] = {0, 0, 1, 0x41, 0x9a};
+    Frame packet;
+    packet.format = PixelFormat::kH264;
+    packet.width = 320;
+    packet.height = 240;
+    packet.timestamp_us = timestamp_us;
+    packet.decode_timestamp_us = timestamp_us;
+    packet.keyframe = keyframe;
+    if (keyframe) {
+        packet.data.assign(std::begin(kKeyframe), std::end(kKeyframe));
+    } else {
+        packet.data.assign(std::begin(kSlice), std::end(kSlice));
+    }
+    return packet;
+}
+
+std::string ReadText(const std::filesystem::path& path) {
+    std::ifstream file(path);
+    std::stringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+class TempDirectory {
+public:
+    explicit TempDirectory(const char* name) : path_(std::filesystem::temp_directory_path() / name) {
+        std::filesystem::remove_all(path_);
+    }
+
+    ~TempDirectory() {
+        std::filesystem::remove_all(path_);
+    }
+
+    const std::filesystem::path& Path() const {
+        return path_;
+    }
+
+private:
+    std::filesystem::path path_;
+};
+
+}  // namespace
+
+TEST(HlsTargetDurationIsFixedAndTheWindowRolls) {
+    TempDirectory directory("segmenter_test_hls");
+    const std::filesystem::path playlist = directory.Path() / "live.m3u8";
+    SegmenterOptions options;
+    options.segment_duration_us = 2000000;
+    options.playlist_size = 3;
+    SegmenterStage stage(playlist.string(), options);
+    const Stage::Emit emit = [](Frame&&) {};
+
+    // Keyframes every 2 s for 10 s, then none for 12 s, forcing cuts.
+    std::vector<std::string> targets;
+    for (int i = 0; i < 22 * 30; i++) {
+        stage.Process(H264Packet(i * 33333, i < 300 && i % 60 == 0), emit);
+        if (std::filesystem::exists(playlist)) {
+            const std::string text = ReadText(playlist);
+            const size_t at = text.find("#EXT-X-TARGETDURATION:");
+            targets.push_back(text.substr(at, text.find('\n', at) - at));
+        }
+    }
+    stage.Flush(emit);
+
+    CHECK(!targets.empty());
+    for (const std::string& target : targets) {
+        CHECK(target == "#EXT-X-TARGETDURATION:8");
+    }
+    const std::string text = ReadText(playlist);
+    CHECK(text.find("#EXT-X-ENDLIST") != std::string::npos);
+    CHECK(text.find("segment_0.m4s") == std::string::npos);
+    CHECK(std::filesystem::exists(directory.Path() / "init.mp4"));
+    CHECK(!std::filesystem::exists(directory.Path() / "segment_0.m4s"));
+}
+
+TEST(DashClaimsSapOnlyWhileEverySegmentStartsOnAKeyframe) {
+    TempDirectory directory("segmenter_test_dash");
+    const std::filesystem::path manifest = directory.Path() / "live.mpd";
+    SegmenterOptions options;
+    options.format = ManifestFormat::kDash;
+    options.segment_duration_us = 1000000;
+    options.playlist_size = 4;
+    SegmenterStage stage(manifest.string(), options);
+    const Stage::Emit emit = [](Frame&&) {};
+
+    int frame = 0;
+    for (; frame < 4 * 30; frame++) {
+        stage.Process(H264Packet(frame * 33333, frame % 30 == 0), emit);
+    }
+    std::string mpd = ReadText(manifest);
+    CHECK(mpd.find("type=\"dynamic\"") != std::string::npos);
+    CHECK(mpd.find("availabilityStartTime=") != std::string::npos);
+    CHECK(mpd.find("startWithSAP=\"1\"") != std::string::npos);
+
+    // Past the forced cut the window holds a segment without a keyframe.
+    for (; frame < 13 * 30; frame++) {
+        stage.Process(H264Packet(frame * 33333, false), emit);
+    }
+    mpd = ReadText(manifest);
+    CHECK(mpd.find("startWithSAP") == std::string::npos);
+}
+
+TEST(DashDoesNotClaimSapForSegmentsStartingOnRecoveryPoints) {
+    TempDirectory directory("segmenter_test_recovery");
+    const std::filesystem::path manifest = directory.Path() / "live.mpd";
+    SegmenterOptions options;
+    options.format = ManifestFormat::kDash;
+    options.segment_duration_us = 1000000;
+    options.playlist_size = 4;
+    SegmenterStage stage(manifest.string(), options);
+    const Stage::Emit emit = [](Frame&&) {};
+
+    // Intra refresh: one IDR frame, then a recovery point every second,
+    // flagged as a keyframe the way x264 reports them.
+    auto packet = [](int index) {
+        if (index == 0) {
+            return H264Packet(0, true);
+        }
+        Frame packet = H264Packet(index * 33333, false);
+        packet.keyframe = packet.recovery_point = index % 30 == 0;
+        return packet;
+    };
+    int frame = 0;
+    while (!std::filesystem::exists(manifest)) {
+        stage.Process(packet(frame++), emit);
+    }
+    CHECK(ReadText(manifest).find("startWithSAP=\"1\"") != std::string::npos);
+
+    // The forced cut after the first segment lands on a P-frame, recovery
+    // point or not.
+    while (!std::filesystem::exists(directory.Path() / "segment_2.m4s")) {
+        stage.Process(packet(frame++), emit);
+    }
+    CHECK(ReadText(manifest).find("startWithSAP") == std::string::npos);
+}
+
+int main() {
+    return check::RunTests();
+}
@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "check.h"
+#include "template_match.h"
+
+using namespace screen_recorder;
+
+namespace {
+
+Frame Noise(int width, int height, unsigned seed) {
+    Frame frame;
+    frame.format = PixelFormat::kBGRA;
+    frame.width = width;
+    frame.height = height;
+    frame.stride = width * 4;
+    frame.data.resize(static_cast<size_t>(frame.stride) * height);
+    std::mt19937 random(seed);
+    for (uint8_t& byte : frame.data) {
+        byte = static_cast<uint8_t>(random());
+    }
+    return frame;
+}
+
+Frame Crop(const Frame& frame, int x, int y, int width, int height) {
+    Frame crop;
+    crop.format = frame.format;
+    crop.width = width;
+    crop.height = height;
+    crop.stride = width * 4;
+    for (int row = 0; row < height; row++) {
+        const uint8_t* in = frame.data.data() + static_cast<size_t>(y + row) * frame.stride + x * 4;
+        crop.data.insert(crop.data.end(), in, in + crop.stride);
+    }
+    return crop;
+}
+
+void Paste(Frame& frame, const Frame& patch, int x, int y) {
+    for (int row = 0; row < patch.height; row++) {
+        std::copy(patch.data.begin() + static_cast<size_t>(row) * patch.stride,
+                  patch.data.begin() + static_cast<size_t>(row + 1) * patch.stride,
+                  frame.data.begin() + static_cast<size_t>(y + row) * frame.stride + x * 4);
+    }
+}
+
+}  // namespace
+
+TEST(RowSadMatchesTheScalarSum) {
+    std::mt19937 random(1);
+    std::vector<uint8_t> a(64);
+    std::vector<uint8_t> b(64);
+    for (size_t i = 0; i < a.size(); i++) {
+        a[i] = static_cast<uint8_t>(random());
+        b[i] = static_cast<uint8_t>(random());
+    }
+    for (int count = 0; count <= 64; count++) {
+        uint32_t expected = 0;
+        for (int i = 0; i < count; i++) {
+            expected += static_cast<uint32_t>(std::abs(a[i] - b[i]));
+        }
+        CHECK_EQ(detail::RowSad(a.data(), b.data(), count), expected);
+    }
+}
+
+TEST(BoxMeansAreRoundedBlockAverages) {
+    detail::GrayImage image;
+    image.width = 5;
+    image.height = 3;
+    image.data = {0, 1, 2, 3, 4, 10, 11, 12, 13, 14, 20, 21, 22, 23, 24};
+    detail::GrayImage means;
+    detail::BoxMeans(image, 2, means);
+    CHECK_EQ(means.width, 4);
+    CHECK_EQ(means.height, 2);
+    // (0 + 1 + 10 + 11) / 4 = 5.5 and (11 + 12 + 21 + 22) / 4 = 16.5, rounded.
+    CHECK_EQ(means.data[0], 6);
+    CHECK_EQ(means.Row(1)[1], 17);
+}
+
+TEST(FindsExactCopiesAtOddOffsets) {
+    Executor executor(2);
+    Frame haystack = Noise(160, 120, 2);
+    // 40x24 is reduced by 4 for the coarse pass; neither offset is on its grid.
+    const Frame needle = Crop(haystack, 37, 53, 40, 24);
+    Paste(haystack, needle, 101, 9);
+    const std::vector<TemplateMatch> matches = FindTemplate(haystack, needle, TemplateMatchOptions(), executor);
+    CHECK_EQ(matches.size(), 2u);
+    for (const TemplateMatch& match : matches) {
+        CHECK(match.score == 1);
+        CHECK((match.x == 37 && match.y == 53) || (match.x == 101 && match.y == 9));
+    }
+}
+
+TEST(ToleranceAdmitsSmallDifferences) {
+    Executor executor(2);
+    const Frame haystack = Noise(120, 90, 3);
+    Frame needle = Crop(haystack, 21, 30, 32, 32);
+    std::mt19937 random(4);
+    for (uint8_t& byte : needle.data) {
+        byte = static_cast<uint8_t>(std::clamp(byte + static_cast<int>(random() % 9) - 4, 0, 255));
+    }
+    TemplateMatchOptions options;
+    std::vector<TemplateMatch> matches = FindTemplate(haystack, needle, options, executor);
+    CHECK_EQ(matches.size(), 1u);
+    CHECK_EQ(matches[0].x, 21);
+    CHECK_EQ(matches[0].y, 30);
+    CHECK(matches[0].score > 0.98 && matches[0].score < 1);
+
+    options.tolerance = 0.001;
+    CHECK(FindTemplate(haystack, needle, options, executor).empty());
+}
+
+TEST(CoarsePassKeepsTheBestPosition) {
+    Executor executor(3);
+    // A smooth picture, where many positions come close, checked against an
+    // exhaustive full-size search.
+    Frame haystack = Noise(96, 80, 5);
+    for (int y = 0; y < haystack.height; y++) {
+        for (int x = 0; x < haystack.width; x++) {
+            uint8_t* pixel = haystack.data.data() + static_cast<size_t>(y) * haystack.stride + x * 4;
+            for (int c = 0; c < 3; c++) {
+                pixel[c] = static_cast<uint8_t>(2 * x + y + pixel[c] % 16);
+            }
+        }
+    }
+    Frame needle = Crop(haystack, 30, 22, 20, 20);
+    needle.data[0] ^= 0x40;
+    TemplateMatchOptions options;
+    options.tolerance = 0.2;
+    options.max_results = 1;
+    const std::vector<TemplateMatch> matches = FindTemplate(haystack, needle, options, executor);
+    CHECK_EQ(matches.size(), 1u);
+
+    detail::GrayImage hay;
+    detail::GrayImage pin;
+    detail::ToGray(haystack, hay);
+    detail::ToGray(needle, pin);
+    uint64_t best = UINT64_MAX;
+    int best_x = -1;
+    int best_y = -1;
+    for (int y = 0; y + pin.height <= hay.height; y++) {
+        for (int x = 0; x + pin.width <= hay.width; x++) {
+            const uint64_t sad = detail::PatchSad(hay, x, y, pin, UINT64_MAX);
+            if (sad < best) {
+                best = sad;
+                best_x = x;
+                best_y = y;
+            }
+        }
+    }
+    CHECK_EQ(matches[0].x, best_x);
+    CHECK_EQ(matches[0].y, best_y);
+}
+
+TEST(OverlappingMatchesAreSuppressed) {
+    Executor executor(2);
+    // A flat picture matches the needle everywhere.
+    Frame haystack = Noise(64, 64, 6);
+    std::fill(haystack.data.begin(), haystack.data.end(), 128);
+    const Frame needle = Crop(haystack, 0, 0, 16, 16);
+    TemplateMatchOptions options;
+    options.max_results = 100;
+    const std::vector<TemplateMatch> matches = FindTemplate(haystack, needle, options, executor);
+    CHECK(!matches.empty());
+    for (size_t i = 0; i < matches.size(); i++) {
+        for (size_t j = i + 1; j < matches.size(); j++) {
+            CHECK(std::abs(matches[i].x - matches[j].x) > 8 || std::abs(matches[i].y - matches[j].y) > 8);
+        }
+    }
+    options.max_results = 3;
+    CHECK_EQ(FindTemplate(haystack, needle, options, executor).size(), 3u);
+}
+
+TEST(NeedleLargerThanHaystackFindsNothing) {
+    Executor executor(1);
+    CHECK(FindTemplate(Noise(20, 20, 7), Noise(21, 10, 8), TemplateMatchOptions(), executor).empty());
+    CHECK(FindTemplate(Noise(20, 20, 7), Noise(0, 0, 8), TemplateMatchOptions(), executor).empty());
+}
+
+int main() {
+    return check::RunTests();
+}
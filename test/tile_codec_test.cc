@@ -0,0 +1,254 @@
+#include <zlib.h>
+
+#include <cstring>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "check.h"
+#include "tile_codec.h"
+
+using namespace screen_recorder;
+
+namespace {
+
+// Odd sizes so the last tile column and row are cropped in every plane.
+constexpr int kWidth = 70;
+constexpr int kHeight = 37;
+
+// A noisy background with one of a few windows on top.
+Frame Picture(int window, int64_t timestamp_us) {
+    Frame frame;
+    frame.format = PixelFormat::kI420;
+    frame.width = kWidth;
+    frame.height = kHeight;
+    frame.stride = kWidth;
+    frame.timestamp_us = timestamp_us;
+    frame.data.resize(I420Size(kWidth, kHeight));
+    std::mt19937 background(1);
+    for (uint8_t& byte : frame.data) {
+        byte = static_cast<uint8_t>(background());
+    }
+    std::mt19937 content(100 + window);
+    const I420Planes planes = GetI420Planes(frame.data.data(), kWidth, kHeight);
+    for (int y = 8; y < 30; y++) {
+        for (int x = 16; x < 60; x++) {
+            planes.y[y * planes.y_stride + x] = static_cast<uint8_t>(content());
+        }
+    }
+    return frame;
+}
+
+uint64_t Metric(const TileEncoder& encoder, const char* name) {
+    Metrics metrics;
+    encoder.AddMetrics(metrics);
+    for (const auto& [key, value] : metrics) {
+        if (key == name) {
+            return static_cast<uint64_t>(value);
+        }
+    }
+    throw std::runtime_error(std::string("no metric ") + name);
+}
+
+// Reference decoder following the packet layout documented in tile_codec.h.
+class TileDecoder {
+public:
+    TileDecoder() : picture_(I420Size(kWidth, kHeight)) {
+        stream_ = {};
+        inflateInit(&stream_);
+    }
+
+    ~TileDecoder() {
+        inflateEnd(&stream_);
+    }
+
+    uint8_t Decode(const Frame& packet) {
+        const FrameBuffer& data = packet.data;
+        const uint32_t size = data[0] | data[1] << 8 | data[2] << 16 | static_cast<uint32_t>(data[3]) << 24;
+        CHECK_EQ(size, data.size() - 4);
+        const uint8_t flags = data[4];
+        CHECK_EQ(data[5] | data[6] << 8, kWidth);
+        CHECK_EQ(data[7] | data[8] << 8, kHeight);
+        if (flags & 1) {
+            inflateReset(&stream_);
+            tiles_.clear();
+        }
+        Inflate(data.data() + 9, data.size() - 9);
+
+        const int columns = (kWidth + TileEncoder::kTileSize - 1) / TileEncoder::kTileSize;
+        const int rows = (kHeight + TileEncoder::kTileSize - 1) / TileEncoder::kTileSize;
+        size_t at = 0;
+        uint64_t skip = 0;
+        for (int tile = 0; tile < columns * rows; tile++) {
+            if (skip > 0) {
+                skip--;
+                continue;
+            }
+            const uint8_t op = ops_.at(at++);
+            if (op == 0x00) {
+                int shift = 0;
+                uint8_t byte;
+                do {
+                    byte = ops_.at(at++);
+                    skip |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                    shift += 7;
+                } while (byte & 0x80);
+                CHECK(skip > 0);
+                skip--;
+                continue;
+            }
+            std::vector<uint8_t> pixels;
+            if (op == 0x02) {
+                uint64_t hash = 0;
+                for (int i = 0; i < 8; i++) {
+                    hash |= static_cast<uint64_t>(ops_.at(at++)) << (8 * i);
+                }
+                CHECK(tiles_.count(hash) == 1);
+                pixels = tiles_[hash];
+            } else {
+                CHECK(op == 0x01 || op == 0x03);
+                pixels.assign(ops_.begin() + at, ops_.begin() + at + TileBytes(tile % columns, tile / columns));
+                at += pixels.size();
+                if (op == 0x01) {
+                    tiles_[HashBytes(pixels.data(), pixels.size())] = pixels;
+                }
+            }
+            Paint(tile % columns, tile / columns, pixels);
+        }
+        CHECK_EQ(skip, 0u);
+        CHECK_EQ(at, ops_.size());
+        return flags;
+    }
+
+    const FrameBuffer& Picture() const {
+        return picture_;
+    }
+
+private:
+    void Inflate(const uint8_t* input, size_t size) {
+        ops_.clear();
+        stream_.next_in = const_cast<Bytef*>(input);
+        stream_.avail_in = static_cast<uInt>(size);
+        do {
+            const size_t used = ops_.size();
+            ops_.resize(used + 4096);
+            stream_.next_out = ops_.data() + used;
+            stream_.avail_out = 4096;
+            const int result = inflate(&stream_, Z_SYNC_FLUSH);
+            if (result != Z_OK && result != Z_BUF_ERROR) {
+                throw std::runtime_error("inflate failed");
+            }
+            ops_.resize(ops_.size() - stream_.avail_out);
+        } while (stream_.avail_in > 0 || stream_.avail_out == 0);
+    }
+
+    // Visits the tile's rows in Y, U, V order with their offsets in picture_.
+    template <typename Visit>
+    void ForEachRow(int column, int row, Visit visit) {
+        const int size = TileEncoder::kTileSize;
+        const I420Planes planes = GetI420Planes(picture_.data(), kWidth, kHeight);
+        const int x = column * size;
+        const int y = row * size;
+        for (int line = y; line < std::min(y + size, kHeight); line++) {
+            visit(planes.y + static_cast<size_t>(line) * planes.y_stride + x, std::min(size, kWidth - x));
+        }
+        const int chroma_width = std::min(size / 2, ChromaWidth(kWidth) - x / 2);
+        for (uint8_t* plane : {planes.u, planes.v}) {
+            for (int line = y / 2; line < std::min(y / 2 + size / 2, ChromaHeight(kHeight)); line++) {
+                visit(plane + static_cast<size_t>(line) * planes.uv_stride + x / 2, chroma_width);
+            }
+        }
+    }
+
+    size_t TileBytes(int column, int row) {
+        size_t bytes = 0;
+        ForEachRow(column, row, [&](uint8_t*, int width) { bytes += width; });
+        return bytes;
+    }
+
+    void Paint(int column, int row, const std::vector<uint8_t>& pixels) {
+        CHECK_EQ(pixels.size(), TileBytes(column, row));
+        size_t at = 0;
+        ForEachRow(column, row, [&](uint8_t* destination, int width) {
+            std::memcpy(destination, pixels.data() + at, width);
+            at += width;
+        });
+    }
+
+    z_stream stream_;
+    std::vector<uint8_t> ops_;
+    std::map<uint64_t, std::vector<uint8_t>> tiles_;
+    FrameBuffer picture_;
+};
+
+EncoderOptions Options() {
+    EncoderOptions options;
+    options.keyframe_interval = 4;
+    options.cache_reset_interval = 12;
+    return options;
+}
+
+// Cycles through three windows, two frames each.
+Frame Sequence(int index) {
+    return Picture(index / 2 % 3, index * 33333);
+}
+
+}  // namespace
+
+TEST(PacketsDecodeToTheInputPicture) {
+    TileEncoder encoder(Options(), kWidth, kHeight);
+    TileDecoder decoder;
+    for (int i = 0; i < 30; i++) {
+        const Frame frame = Sequence(i);
+        std::vector<Frame> packets;
+        encoder.Encode(frame, packets);
+        CHECK_EQ(packets.size(), 1u);
+        CHECK_EQ(packets[0].keyframe, i % 12 == 0);
+        const uint8_t flags = decoder.Decode(packets[0]);
+        CHECK_EQ(flags & 1, i % 12 == 0 ? 1 : 0);
+        CHECK_EQ(flags & 2, i % 12 == 4 || i % 12 == 8 ? 2 : 0);
+        CHECK(decoder.Picture() == frame.data);
+    }
+}
+
+TEST(CacheSurvivesRefreshesAndResetsOnKeyframes) {
+    TileEncoder encoder(Options(), kWidth, kHeight);
+    for (int i = 0; i < 30; i++) {
+        std::vector<Frame> packets;
+        encoder.Encode(Sequence(i), packets);
+    }
+    // Keyframes at 0, 12 and 24.
+    CHECK_EQ(Metric(encoder, "cacheResets"), 3u);
+    CHECK(Metric(encoder, "cacheHits") > 0);
+    // Windows cached before the refreshes at 4 and 8 (and 16, 20) hit after them.
+    CHECK(Metric(encoder, "cacheHitsAcrossRefresh") > 0);
+}
+
+TEST(DecodingCanStartAtAnyKeyframe) {
+    TileEncoder encoder(Options(), kWidth, kHeight);
+    TileDecoder late;
+    for (int i = 0; i < 24; i++) {
+        const Frame frame = Sequence(i);
+        std::vector<Frame> packets;
+        encoder.Encode(frame, packets);
+        if (i >= 12) {
+            late.Decode(packets[0]);
+            CHECK(late.Picture() == frame.data);
+        }
+    }
+}
+
+TEST(RejectsUnsupportedInput) {
+    CHECK_THROWS(TileEncoder(Options(), 0, kHeight));
+    TileEncoder encoder(Options(), kWidth, kHeight);
+    std::vector<Frame> packets;
+    Frame frame = Picture(0, 0);
+    frame.format = PixelFormat::kBGRA;
+    CHECK_THROWS(encoder.Encode(frame, packets));
+    CHECK_THROWS(encoder.Encode(Frame(), packets));
+}
+
+int main() {
+    return check::RunTests();
+}
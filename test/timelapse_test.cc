@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <vector>
+
+#include "check.h"
+#include "timelapse.h"
+
+using namespace screen_recorder;
+
+namespace {
+
+constexpr int kWidth = 8;
+constexpr int kHeight = 10;
+
+Frame Gray(uint8_t value, int64_t timestamp_us) {
+    Frame frame;
+    frame.format = PixelFormat::kBGRA;
+    frame.width = kWidth;
+    frame.height = kHeight;
+    frame.stride = kWidth * 4;
+    frame.timestamp_us = timestamp_us;
+    frame.data.assign(static_cast<size_t>(frame.stride) * kHeight, value);
+    return frame;
+}
+
+// A gray frame with its first `rows` rows changed to `value`.
+Frame Rows(int rows, uint8_t value, int64_t timestamp_us) {
+    Frame frame = Gray(0, timestamp_us);
+    std::fill(frame.data.begin(), frame.data.begin() + rows * frame.stride, value);
+    return frame;
+}
+
+struct Output {
+    std::vector<Frame> frames;
+    Stage::Emit emit = [this](Frame&& frame) { frames.push_back(std::move(frame)); };
+};
+
+TimelapseOptions Options(TimelapseMode mode) {
+    TimelapseOptions options;
+    options.interval_us = 1000000;
+    options.output_fps = 25;
+    options.mode = mode;
+    return options;
+}
+
+}  // namespace
+
+TEST(SampleKeepsTheFirstFrameOfEachInterval) {
+    TimelapseStage stage(Options(TimelapseMode::kSample));
+    Output output;
+    // 3.5 s at 10 fps.
+    for (int i = 0; i < 35; i++) {
+        stage.Process(Gray(static_cast<uint8_t>(i), i * 100000), output.emit);
+    }
+    CHECK_EQ(output.frames.size(), 3u);
+    stage.Flush(output.emit);
+    CHECK_EQ(output.frames.size(), 4u);
+    for (size_t i = 0; i < output.frames.size(); i++) {
+        CHECK_EQ(output.frames[i].data[0], 10 * i);
+        // Retimed for playback at 25 fps.
+        CHECK_EQ(output.frames[i].timestamp_us, static_cast<int64_t>(i * 40000));
+        CHECK_EQ(output.frames[i].sequence, i);
+    }
+}
+
+TEST(BlendAveragesTheInterval) {
+    TimelapseStage stage(Options(TimelapseMode::kBlend));
+    Output output;
+    for (int i = 0; i < 4; i++) {
+        stage.Process(Gray(i % 2 ? 21 : 10, i * 100000), output.emit);
+    }
+    stage.Flush(output.emit);
+    CHECK_EQ(output.frames.size(), 1u);
+    const Frame& frame = output.frames[0];
+    CHECK_EQ(frame.width, kWidth);
+    CHECK_EQ(frame.stride, kWidth * 4);
+    CHECK_EQ(frame.data.size(), static_cast<size_t>(kWidth) * kHeight * 4);
+    // (10 + 21 + 10 + 21) / 4 = 15.5, rounded.
+    CHECK_EQ(frame.data[0], 16);
+    CHECK_EQ(frame.data.back(), 16);
+}
+
+TEST(BlendStopsBeforeItsSumsOverflow) {
+    TimelapseStage stage(Options(TimelapseMode::kBlend));
+    Output output;
+    for (int i = 0; i < 300; i++) {
+        stage.Process(Gray(i < 257 ? 255 : 0, i * 1000), output.emit);
+    }
+    stage.Flush(output.emit);
+    CHECK_EQ(output.frames.size(), 1u);
+    CHECK_EQ(output.frames[0].data[0], 255);
+}
+
+TEST(ChangedPicksTheFrameThatDiffersMost) {
+    TimelapseStage stage(Options(TimelapseMode::kChanged));
+    Output output;
+    stage.Process(Gray(0, 0), output.emit);
+    // Against the frame emitted for the first interval.
+    stage.Process(Rows(1, 50, 1000000), output.emit);
+    stage.Process(Rows(6, 60, 1100000), output.emit);
+    stage.Process(Rows(2, 70, 1200000), output.emit);
+    stage.Process(Gray(0, 1300000), output.emit);
+    stage.Flush(output.emit);
+    CHECK_EQ(output.frames.size(), 2u);
+    CHECK_EQ(output.frames[1].data[0], 60);
+}
+
+TEST(SizeChangeClosesTheInterval) {
+    TimelapseStage stage(Options(TimelapseMode::kBlend));
+    Output output;
+    stage.Process(Gray(10, 0), output.emit);
+    Frame larger = Gray(20, 100000);
+    larger.width *= 2;
+    larger.stride *= 2;
+    larger.data.resize(larger.data.size() * 2, 20);
+    stage.Process(std::move(larger), output.emit);
+    stage.Flush(output.emit);
+    CHECK_EQ(output.frames.size(), 2u);
+    CHECK_EQ(output.frames[0].data[0], 10);
+    CHECK_EQ(output.frames[1].width, 2 * kWidth);
+    CHECK_EQ(output.frames[1].data[0], 20);
+}
+
+TEST(EncodedFramesAreRejected) {
+    TimelapseStage stage(Options(TimelapseMode::kSample));
+    Output output;
+    Frame packet;
+    packet.format = PixelFormat::kH264;
+    CHECK_THROWS(stage.Process(std::move(packet), output.emit));
+}
+
+int main() {
+    return check::RunTests();
+}
@@ -0,0 +1,192 @@
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <vector>
+
+#include "check.h"
+#include "webm_muxer.h"
+
+using namespace screen_recorder;
+
+namespace {
+
+struct Element {
+    uint32_t id = 0;
+    size_t header = 0;
+    uint64_t size = 0;
+};
+
+int VintLength(uint8_t first) {
+    int length = 1;
+    while (length <= 8 && !(first & (0x80 >> (length - 1)))) {
+        length++;
+    }
+    return length;
+}
+
+// Reads the element header at `offset`.
+Element ReadElement(const std::vector<uint8_t>& data, size_t offset) {
+    Element element;
+    const int id_length = VintLength(data[offset]);
+    for (int i = 0; i < id_length; i++) {
+        element.id = element.id << 8 | data[offset + i];
+    }
+    const int size_length = VintLength(data[offset + id_length]);
+    element.size = data[offset + id_length] & (0xff >> size_length);
+    for (int i = 1; i < size_length; i++) {
+        element.size = element.size << 8 | data[offset + id_length + i];
+    }
+    element.header = id_length + size_length;
+    return element;
+}
+
+// Children of the master element whose payload spans [begin, end).
+std::vector<std::pair<size_t, Element>> Children(const std::vector<uint8_t>& data, size_t begin, size_t end) {
+    std::vector<std::pair<size_t, Element>> children;
+    for (size_t offset = begin; offset < end;) {
+        Element element = ReadElement(data, offset);
+        children.emplace_back(offset, element);
+        offset += element.header + element.size;
+    }
+    return children;
+}
+
+uint64_t ReadUint(const std::vector<uint8_t>& data, size_t offset, const Element& element) {
+    uint64_t value = 0;
+    for (uint64_t i = 0; i < element.size; i++) {
+        value = value << 8 | data[offset + element.header + i];
+    }
+    return value;
+}
+
+Frame Vp9Packet(int64_t timestamp_us, bool keyframe) {
+    Frame packet;
+    packet.format = PixelFormat::kVP9;
+    packet.width = 640;
+    packet.height = 360;
+    packet.timestamp_us = timestamp_us;
+    packet.keyframe = keyframe;
+    packet.data.assign(keyframe ? 300 : 40, keyframe ? 0xAA : 0x55);
+    return packet;
+}
+
+std::vector<uint8_t> ReadFile(const std::filesystem::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+}  // namespace
+
+TEST(SizesUseTheShortestValidWidth) {
+    ebml::Writer w;
+    w.Size(0);
+    w.Size(126);
+    // 127 in one byte would be the reserved all-ones value.
+    w.Size(127);
+    const std::vector<uint8_t> expected = {0x80, 0xFE, 0x40, 0x7F};
+    CHECK(w.Data() == expected);
+}
+
+TEST(VoidFillsExactlyItsSize) {
+    for (size_t total = 2; total <= 300; total++) {
+        ebml::Writer w;
+        w.Void(total);
+        CHECK_EQ(w.Size(), total);
+        Element element = ReadElement(w.Data(), 0);
+        CHECK_EQ(element.id, ebml::kVoid);
+        CHECK_EQ(element.header + element.size, total);
+    }
+    ebml::Writer w;
+    CHECK_THROWS(w.Void(1));
+}
+
+TEST(FinishedFileHasSeekHeadCuesAndDuration) {
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / "webm_muxer_test.webm";
+    {
+        WebmMuxer muxer(path.string());
+        // Leading delta frames are dropped; a keyframe every second.
+        muxer.AddPacket(Vp9Packet(0, false));
+        for (int i = 0; i < 90; i++) {
+            muxer.AddPacket(Vp9Packet(100000 + i * 33333, i % 30 == 0));
+        }
+        muxer.Finish();
+    }
+    const std::vector<uint8_t> data = ReadFile(path);
+    std::filesystem::remove(path);
+
+    auto top = Children(data, 0, data.size());
+    CHECK_EQ(top.size(), 2u);
+    CHECK_EQ(top[0].second.id, ebml::kEbml);
+    const auto& [segment_offset, segment] = top[1];
+    CHECK_EQ(segment.id, ebml::kSegment);
+    const size_t segment_start = segment_offset + segment.header;
+    CHECK_EQ(segment_start + segment.size, data.size());
+
+    std::map<uint32_t, size_t> positions;
+    int clusters = 0;
+    auto children = Children(data, segment_start, data.size());
+    CHECK_EQ(children[0].second.id, ebml::kSeekHead);
+    CHECK_EQ(children[1].second.id, ebml::kVoid);
+    for (const auto& [offset, element] : children) {
+        positions.emplace(element.id, offset - segment_start);
+        clusters += element.id == ebml::kCluster;
+    }
+    CHECK_EQ(clusters, 3);
+
+    // Every SeekHead entry points at the element it names.
+    const auto& [head_offset, head] = children[0];
+    int seeks = 0;
+    for (const auto& [seek_offset, seek] : Children(data, head_offset + head.header, head_offset + head.header + head.size)) {
+        auto fields = Children(data, seek_offset + seek.header, seek_offset + seek.header + seek.size);
+        CHECK_EQ(fields.size(), 2u);
+        const uint32_t target = static_cast<uint32_t>(ReadUint(data, fields[0].first, fields[0].second));
+        const uint64_t position = ReadUint(data, fields[1].first, fields[1].second);
+        CHECK(positions.count(target) == 1);
+        CHECK_EQ(position, positions[target]);
+        seeks++;
+    }
+    CHECK_EQ(seeks, 3);
+
+    // One cue per cluster, pointing at it.
+    const size_t cues_offset = segment_start + positions[ebml::kCues];
+    const Element cues = ReadElement(data, cues_offset);
+    auto points = Children(data, cues_offset + cues.header, cues_offset + cues.header + cues.size);
+    CHECK_EQ(points.size(), 3u);
+    for (const auto& [point_offset, point] : points) {
+        auto fields = Children(data, point_offset + point.header, point_offset + point.header + point.size);
+        const auto& [track_offset, track] = fields[1];
+        auto track_fields = Children(data, track_offset + track.header, track_offset + track.header + track.size);
+        const uint64_t cluster = ReadUint(data, track_fields[1].first, track_fields[1].second);
+        CHECK_EQ(ReadElement(data, segment_start + cluster).id, ebml::kCluster);
+    }
+
+    // Duration runs to the end of the last frame: 90 frames at 30 fps.
+    const size_t info_offset = segment_start + positions[ebml::kInfo];
+    const Element info = ReadElement(data, info_offset);
+    for (const auto& [offset, element] : Children(data, info_offset + info.header, info_offset + info.header + info.size)) {
+        if (element.id == ebml::kDuration) {
+            const uint64_t bits = ReadUint(data, offset, element);
+            double duration;
+            std::memcpy(&duration, &bits, sizeof(duration));
+            CHECK(duration > 2990 && duration < 3010);
+        }
+    }
+}
+
+TEST(OnlyVpxPacketsAreAccepted) {
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / "webm_muxer_reject.webm";
+    {
+        WebmMuxer muxer(path.string());
+        Frame packet = Vp9Packet(0, true);
+        packet.format = PixelFormat::kH264;
+        CHECK_THROWS(muxer.AddPacket(std::move(packet)));
+    }
+    std::filesystem::remove(path);
+}
+
+int main() {
+    return check::RunTests();
+}